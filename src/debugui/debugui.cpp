@@ -20,22 +20,38 @@
 
 #include <stdio.h>
 
-static bool show_window          = false;
-static bool show_palette_window  = false;
-static bool show_memory_window   = false;
-static bool show_segments_window = false;
-static struct game_state *gamestate;
-static MemoryEditor mem_edit;
+/* Debug UI state. There is only one debug UI per process, as ImGui keeps its
+ * own global state.
+ */
+struct debugui_state {
+    bool show_window;
+    bool show_palette_window;
+    bool show_memory_window;
+    bool show_segments_window;
+    struct game_state *gamestate;
+    MemoryEditor mem_edit;
+    /* Segment selected in segments window */
+    psys_word selected_erec;
+};
+static struct debugui_state ui;
+
+/* Memory editor write handler, so that dirty page tracking sees edits */
+static void mem_edit_write(unsigned char *data, size_t off, unsigned char d)
+{
+    data[off] = d;
+    psys_mark_dirty(ui.gamestate->psys, off, 1);
+}
 
 void debugui_init(SDL_Window *window, struct game_state *gs)
 {
     ImGui_ImplSdlGLES2_Init(window);
-    gamestate = gs;
+    ui.gamestate        = gs;
+    ui.mem_edit.WriteFn = mem_edit_write;
 }
 
 bool debugui_is_visible(void)
 {
-    return show_window || show_palette_window || show_memory_window || show_segments_window;
+    return ui.show_window || ui.show_palette_window || ui.show_memory_window || ui.show_segments_window;
 }
 
 static bool is_segment_resident(struct psys_state *s, psys_word erec)
@@ -48,7 +64,6 @@ static bool is_segment_resident(struct psys_state *s, psys_word erec)
 static void debugui_list_segments(struct psys_state *s)
 {
     psys_word erec = psys_debug_first_erec_ptr(s);
-    static psys_word selected;
     ImGui::Columns(6, NULL, false);
     ImGui::SetColumnWidth(0, 40);
     ImGui::SetColumnWidth(1, 40);
@@ -82,17 +97,19 @@ static void debugui_list_segments(struct psys_state *s)
         /* Print main segment */
         char buf[16];
         sprintf(buf, "%04x", erec);
-        if (ImGui::Selectable(buf, selected == erec, ImGuiSelectableFlags_SpanAllColumns)) {
-            selected = erec;
+        if (ImGui::Selectable(buf, ui.selected_erec == erec, ImGuiSelectableFlags_SpanAllColumns)) {
+            ui.selected_erec = erec;
             // jump and highlight segment's data in hex editor
-            mem_edit.GotoAddrAndHighlight(data_base, data_base + data_size);
+            ui.mem_edit.GotoAddrAndHighlight(data_base, data_base + data_size);
         }
         ImGui::NextColumn();
         ImGui::Text("%04x", sib);
         ImGui::NextColumn();
         ImGui::Text("%c", is_segment_resident(s, erec) ? 'R' : '-');
         ImGui::NextColumn();
-        ImGui::Text("%-8.8s", psys_bytes(s, sib + PSYS_SIB_Seg_Name));
+        struct psys_segment_id seg_id;
+        psys_read_segment_id(s, &seg_id, sib + PSYS_SIB_Seg_Name);
+        ImGui::Text("%-8.8s", seg_id.name);
         ImGui::NextColumn();
         ImGui::Text("%04x", data_base);
         ImGui::NextColumn();
@@ -114,17 +131,19 @@ static void debugui_list_segments(struct psys_state *s)
                 if (serec != erec && sevec == evec) {
                     char buf2[16];
                     sprintf(buf2, "%04x", serec);
-                    if (ImGui::Selectable(buf2, selected == serec, ImGuiSelectableFlags_SpanAllColumns)) {
-                        selected = serec;
+                    if (ImGui::Selectable(buf2, ui.selected_erec == serec, ImGuiSelectableFlags_SpanAllColumns)) {
+                        ui.selected_erec = serec;
                         // jump and highlight segment's data in hex editor
-                        mem_edit.GotoAddrAndHighlight(data_base, data_base + data_size);
+                        ui.mem_edit.GotoAddrAndHighlight(data_base, data_base + data_size);
                     }
                     ImGui::NextColumn();
                     ImGui::Text("%04x", ssib);
                     ImGui::NextColumn();
                     ImGui::Text("%c", is_segment_resident(s, serec) ? 'R' : '-');
                     ImGui::NextColumn();
-                    ImGui::Text(" %-8.8s", psys_bytes(s, ssib + PSYS_SIB_Seg_Name));
+                    struct psys_segment_id sseg_id;
+                    psys_read_segment_id(s, &sseg_id, ssib + PSYS_SIB_Seg_Name);
+                    ImGui::Text(" %-8.8s", sseg_id.name);
                     ImGui::NextColumn();
                     ImGui::NextColumn();
                     ImGui::NextColumn();
@@ -140,7 +159,7 @@ bool debugui_newframe(SDL_Window *window)
 {
     ImGui_ImplSdlGLES2_NewFrame(window);
 
-    if (show_window) {
+    if (ui.show_window) {
         ImGui::Begin("Debug");
         ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.5f, 0.0f, 1.0f));
         ImGui::TextUnformatted("Su");
@@ -155,24 +174,24 @@ bool debugui_newframe(SDL_Window *window)
         ImGui::PopStyleColor();
 
         if (ImGui::Button("Palette"))
-            show_palette_window ^= 1;
+            ui.show_palette_window ^= 1;
         ImGui::SameLine();
         if (ImGui::Button("Memory"))
-            show_memory_window ^= 1;
+            ui.show_memory_window ^= 1;
         ImGui::SameLine();
         if (ImGui::Button("Segments"))
-            show_segments_window ^= 1;
+            ui.show_segments_window ^= 1;
 
         ImGui::Text("%.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGui::End();
     }
 
 #if 0 /* XXX needs to be updated for new renderer system */
-    if (show_palette_window)
+    if (ui.show_palette_window)
     {
-        ImGui::Begin("Palette", &show_palette_window);
+        ImGui::Begin("Palette", &ui.show_palette_window);
         for (int x=0; x<16; ++x) {
-            ImGui::Image((ImTextureID)(intptr_t)gamestate->pal_tex, ImVec2(5,5), ImVec2(x/256.0,0.0), ImVec2((x+1)/256.0,1.0));
+            ImGui::Image((ImTextureID)(intptr_t)ui.gamestate->pal_tex, ImVec2(5,5), ImVec2(x/256.0,0.0), ImVec2((x+1)/256.0,1.0));
             if (x != 15) {
                 ImGui::SameLine(0, 2);
             }
@@ -181,21 +200,21 @@ bool debugui_newframe(SDL_Window *window)
     }
 #endif
 
-    if (show_memory_window) {
-        assert(gamestate->psys);
+    if (ui.show_memory_window) {
+        assert(ui.gamestate->psys);
         ImGui::PushStyleColor(ImGuiCol_WindowBg, ImVec4(0.0f, 0.0f, 0.0f, 0.95f)); // Less transparent
-        ImGui::Begin("Memory", &show_memory_window);
-        mem_edit.DrawContents(gamestate->psys->memory, gamestate->psys->mem_size, 0);
+        ImGui::Begin("Memory", &ui.show_memory_window);
+        ui.mem_edit.DrawContents(ui.gamestate->psys->memory, ui.gamestate->psys->mem_size, 0);
         ImGui::End();
         ImGui::PopStyleColor();
     }
 
-    if (show_segments_window) {
+    if (ui.show_segments_window) {
         ImGui::SetNextWindowSize(ImVec2(320, 280), ImGuiCond_FirstUseEver);
         ImGui::PushStyleColor(ImGuiCol_WindowBg, ImVec4(0.0f, 0.0f, 0.0f, 0.90f)); // Less transparent
-        ImGui::Begin("Segments", &show_segments_window);
-        assert(gamestate->psys);
-        debugui_list_segments(gamestate->psys);
+        ImGui::Begin("Segments", &ui.show_segments_window);
+        assert(ui.gamestate->psys);
+        debugui_list_segments(ui.gamestate->psys);
         ImGui::End();
         ImGui::PopStyleColor();
     }
@@ -214,7 +233,7 @@ bool debugui_processevent(SDL_Event *event)
     case SDL_KEYDOWN:
         switch (event->key.keysym.sym) {
         case SDLK_BACKQUOTE: /* Debug window */
-            show_window = !show_window;
+            ui.show_window = !ui.show_window;
             return true;
         }
         break;
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "game_clock.h"
+
+#include "psys/psys_state.h"
+#include "psys/psys_debug.h"
+#include "util/memutil.h"
+#include "util/util_save_state.h"
+#include "util/util_time.h"
+
+/* Header for savestates */
+#define GAME_CLOCK_STATE_ID 0x434c4b56
+
+/* If real time runs ahead of virtual time by more than this (slow host, or
+ * paused), pacing starts over instead of trying to catch up.
+ */
+#define MAX_LAG_MS 100
+
+struct game_clock {
+    struct psys_state *psys;
+    unsigned vblank_insns; /* instructions per vblank */
+    uint64_t offset;       /* time slept, in instructions */
+    uint64_t next_vblank;  /* time of next vblank, in instructions */
+    bool paced;
+    uint32_t pace_virt; /* virtual time at start of pacing */
+    uint32_t pace_real; /* real time at start of pacing */
+};
+
+/** Virtual time in instructions */
+static uint64_t virtual_now(struct game_clock *clock)
+{
+    return clock->psys->insn_count + clock->offset;
+}
+
+/** Wait until real time catches up with virtual time. */
+static void pace(struct game_clock *clock)
+{
+    uint32_t virt = game_clock_ms(clock) - clock->pace_virt;
+    uint32_t real = util_ticks_ms() - clock->pace_real;
+    if (virt > real) {
+        util_msleep(virt - real);
+    } else if (real - virt > MAX_LAG_MS) {
+        clock->pace_virt = game_clock_ms(clock);
+        clock->pace_real = util_ticks_ms();
+    }
+}
+
+struct game_clock *new_game_clock_virtual(struct psys_state *psys, unsigned vblank_insns, bool paced)
+{
+    struct game_clock *clock = CALLOC_STRUCT(game_clock);
+    clock->psys              = psys;
+    clock->vblank_insns      = vblank_insns;
+    clock->next_vblank       = virtual_now(clock) + vblank_insns;
+    clock->paced             = paced;
+    clock->pace_virt         = game_clock_ms(clock);
+    clock->pace_real         = util_ticks_ms();
+    return clock;
+}
+
+void game_clock_destroy(struct game_clock *clock)
+{
+    free(clock);
+}
+
+unsigned game_clock_vblank_insns(struct game_clock *clock)
+{
+    return clock->vblank_insns;
+}
+
+uint32_t game_clock_ms(struct game_clock *clock)
+{
+    if (!clock) {
+        return util_ticks_ms();
+    }
+    return virtual_now(clock) * GAME_CLOCK_VBLANK_MS / clock->vblank_insns;
+}
+
+void game_clock_sleep(struct game_clock *clock, unsigned ms)
+{
+    struct psys_state *psys;
+    if (!clock) {
+        util_msleep(ms);
+        return;
+    }
+    psys = clock->psys;
+    clock->offset += (uint64_t)ms * clock->vblank_insns / GAME_CLOCK_VBLANK_MS;
+    if (psys->insn_limit > psys->insn_count) { /* stop psys_run after the current instruction */
+        psys->insn_limit = psys->insn_count;
+    }
+    if (clock->paced) {
+        pace(clock);
+    }
+}
+
+uint64_t game_clock_until_vblank(struct game_clock *clock)
+{
+    uint64_t now = virtual_now(clock);
+    return clock->next_vblank > now ? clock->next_vblank - now : 0;
+}
+
+bool game_clock_vblank(struct game_clock *clock)
+{
+    if (virtual_now(clock) < clock->next_vblank) {
+        return false;
+    }
+    clock->next_vblank += clock->vblank_insns;
+    if (clock->paced) {
+        pace(clock);
+    }
+    return true;
+}
+
+int game_clock_save_state(struct game_clock *clock, FILE *fd)
+{
+    uint32_t id  = GAME_CLOCK_STATE_ID;
+    uint64_t now = virtual_now(clock);
+    if (FD_WRITE(fd, id)
+        || FD_WRITE(fd, now)
+        || FD_WRITE(fd, clock->next_vblank)) {
+        return -1;
+    }
+    return 0;
+}
+
+int game_clock_load_state(struct game_clock *clock, FILE *fd)
+{
+    uint32_t id;
+    uint64_t now;
+    if (FD_READ(fd, id)) {
+        return -1;
+    }
+    if (id != GAME_CLOCK_STATE_ID) {
+        psys_debug("Invalid clock state record %08x\n", id);
+        return -1;
+    }
+    if (FD_READ(fd, now)
+        || FD_READ(fd, clock->next_vblank)) {
+        return -1;
+    }
+    /* continue from saved virtual time at the current instruction count */
+    clock->offset    = now - clock->psys->insn_count;
+    clock->pace_virt = game_clock_ms(clock);
+    clock->pace_real = util_ticks_ms();
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Game timing: time for the RSP clock, vblanks and delays.
+ *
+ * By default time follows the wall clock. A virtual clock instead derives time
+ * from the number of p-machine instructions executed: a vblank (20 ms) is a
+ * configurable number of instructions, and delays advance time instead of
+ * waiting. Runs with a virtual clock are reproducible, and can go as fast as
+ * the host allows, or be paced to real time.
+ */
+#ifndef H_GAME_CLOCK
+#define H_GAME_CLOCK
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct psys_state;
+
+/* Time between vblanks in ms */
+#define GAME_CLOCK_VBLANK_MS (1000 / 50)
+/* Default number of instructions per vblank for virtual clock */
+#define GAME_CLOCK_DEFAULT_VBLANK_INSNS 20000
+
+struct game_clock;
+
+/** Create a virtual clock for a p-system, with a vblank every *vblank_insns*
+ * instructions. If *paced* is set, vblanks and delays also wait until real
+ * time catches up with virtual time.
+ */
+struct game_clock *new_game_clock_virtual(struct psys_state *psys, unsigned vblank_insns, bool paced);
+
+/** Destroy clock. Can be passed NULL. */
+void game_clock_destroy(struct game_clock *clock);
+
+/** Number of instructions per vblank (virtual clock only). */
+unsigned game_clock_vblank_insns(struct game_clock *clock);
+
+/** Current time in milliseconds. A NULL clock is the wall clock. */
+uint32_t game_clock_ms(struct game_clock *clock);
+
+/** Delay for *ms* milliseconds. With a virtual clock this advances time, and
+ * ends the current psys_run after the current instruction so that vblanks that
+ * became due are delivered.
+ */
+void game_clock_sleep(struct game_clock *clock, unsigned ms);
+
+/** Number of instructions to run before the next vblank is due, 0 if it is due
+ * now (virtual clock only).
+ */
+uint64_t game_clock_until_vblank(struct game_clock *clock);
+
+/** Consume a vblank, if one is due. Returns true if it was (virtual clock
+ * only).
+ */
+bool game_clock_vblank(struct game_clock *clock);
+
+/** Save virtual time (virtual clock only). */
+int game_clock_save_state(struct game_clock *clock, FILE *fd);
+
+/** Load virtual time (virtual clock only). The p-system instruction count is
+ * not part of the state, so this must be done after the p-system state has
+ * been loaded, if the instruction count changed.
+ */
+int game_clock_load_state(struct game_clock *clock, FILE *fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#ifndef H_GAME_COMPILED
+#define H_GAME_COMPILED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct psys_state;
+
+/** Register procedures compiled ahead of time from SYSTEM.STARTUP (generated
+ * by tools/pcode_to_c.py). Call this after the game bindings have been
+ * registered.
+ */
+extern void game_register_compiled(struct psys_state *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
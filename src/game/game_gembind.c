@@ -7,14 +7,14 @@
 
 #include "psys/psys_debug.h"
 #include "psys/psys_helpers.h"
+#include "psys/psys_serialize.h"
 #include "psys/psys_state.h"
 #include "util/memutil.h"
 #include "util/util_img.h"
 #include "util/util_minmax.h"
-#include "util/util_save_state.h"
-#include "util/util_time.h"
 #include "util/write_bmp.h"
 
+#include "game_clock.h"
 #include "game_screen.h"
 #include "game_sound.h"
 
@@ -32,6 +32,7 @@
 struct gembind_priv {
     struct game_screen *screen;
     struct game_sound *sound;
+    struct game_clock *clock;
     /* Pointer to p-system for vblank handler */
     struct psys_state *psys;
     /* Debug message level, 0 is no debugger output */
@@ -49,6 +50,12 @@ struct gembind_priv {
     /* Work space for image decompression.
      */
     uint8_t workspace[SCREEN_WIDTH * SCREEN_HEIGHT];
+#if PSYS_MEM_BYTE_XOR
+    /* Staging buffers for byte data in p-system memory, which is not
+     * contiguous in this memory layout.
+     */
+    uint8_t staging[2][GEMBIND_MEMSIZE];
+#endif
     /* State to do with moving on the screen */
     bool movement_enable1;
     bool movement_enable2;
@@ -67,11 +74,11 @@ struct gembind_priv {
  * Index 14 is 11, not a repeat of 4.
  * {black, white, dblue, dgreen, dred, brown, dcyan, orange, grey, dgrey, blue, green, red, yellow, cyan, magenta}
  */
-unsigned vdi_color_map[16] = { 0, 15, 1, 2, 4, 6, 3, 5, 7, 8, 9, 10, 12, 14, 11, 13 };
+static const unsigned vdi_color_map[16] = { 0, 15, 1, 2, 4, 6, 3, 5, 7, 8, 9, 10, 12, 14, 11, 13 };
 
 /* Sprite color map. Subtly different to the VDI color map.
  */
-unsigned sprite_color_map[16] = { 0, 15, 1, 2, 4, 6, 3, 5, 8, 7, 9, 10, 12, 14, 11, 13 };
+static const unsigned sprite_color_map[16] = { 0, 15, 1, 2, 4, 6, 3, 5, 8, 7, 9, 10, 12, 14, 11, 13 };
 
 /* Hardcoded sprite patterns for rendering */
 uint8_t sprite_patterns[10][7] = {
@@ -143,15 +150,44 @@ static inline void psys_sta(struct psys_state *s, psys_fulladdr addr, psys_fulla
     psys_stw(s, W(addr, 1), value & 0xffff);
 }
 
-static inline uint8_t *gem_bytes(struct psys_state *s, struct gembind_priv *priv, psys_fulladdr addr)
+/* Get access to *size* bytes of GEM data at addr. If the data is in p-system
+ * memory and the memory layout requires it, the data is copied to staging
+ * buffer *buf*, and gem_bytes_done must be called after changing it.
+ */
+static uint8_t *gem_bytes(struct psys_state *s, struct gembind_priv *priv, psys_fulladdr addr, size_t size, unsigned buf)
 {
     if (addr < 0x80000000) {
+#if PSYS_MEM_BYTE_XOR
+        size = umin(umin(size, GEMBIND_MEMSIZE), s->mem_size - addr);
+        psys_read_bytes(s, priv->staging[buf], addr, size);
+        return priv->staging[buf];
+#else
         return psys_bytes(s, addr);
+#endif
     } else {
         return &priv->memory[addr - GEMBIND_MEMBASE];
     }
 }
 
+/* Write back GEM data changed through gem_bytes */
+static void gem_bytes_done(struct psys_state *s, struct gembind_priv *priv, psys_fulladdr addr, size_t size, unsigned buf)
+{
+    if (addr < 0x80000000) {
+        size = umin(umin(size, GEMBIND_MEMSIZE), s->mem_size - addr);
+#if PSYS_MEM_BYTE_XOR
+        psys_write_bytes(s, addr, priv->staging[buf], size);
+#else
+        psys_mark_dirty(s, addr, size);
+#endif
+    }
+}
+
+/* Size in bytes of a planar (4 bitplane) image */
+static size_t planar_size(unsigned wdwidth, unsigned height)
+{
+    return wdwidth * 8 * height;
+}
+
 /* Swap if dimensions are the wrong way around, so that
  * x0 <= x1 and y0 <= y1.
  * XXX should we flip/mirror in this case?
@@ -291,8 +327,10 @@ static void gembind_VDI(struct psys_state *s, struct gembind_priv *priv, psys_fu
                 unsigned bytes_per_line;
                 int width  = sx1 - sx0 + 1;
                 int height = sy1 - sy0 + 1;
+                size_t dst_size = planar_size(dst_wdwidth, height);
                 priv->screen->get_image(priv->screen, sx0, sy0, width, height, &image_ptr, &bytes_per_line);
-                util_img_planarize(gem_bytes(s, priv, dst), dst_wdwidth, image_ptr, width, height, bytes_per_line);
+                util_img_planarize(gem_bytes(s, priv, dst, dst_size, 0), dst_wdwidth, image_ptr, width, height, bytes_per_line);
+                gem_bytes_done(s, priv, dst, dst_size, 0);
             } else { /* screen to screen (ignoring vr_mode) */
                 priv->screen->move(priv->screen, dx0, dy0, sx0, sy0, sx1 - sx0 + 1, dy1 - dy0 + 1);
             }
@@ -314,14 +352,16 @@ static void gembind_VDI(struct psys_state *s, struct gembind_priv *priv, psys_fu
                     psys_debug("vro_cpyfm: mem to mem: cannot handle destination x != 0\n");
                     return;
                 }
-                util_img_unplanarize(priv->workspace, width, gem_bytes(s, priv, src), sx0, sy0, width, height, src_wdwidth);
+                util_img_unplanarize(priv->workspace, width, gem_bytes(s, priv, src, planar_size(src_wdwidth, sy0 + height), 0),
+                    sx0, sy0, width, height, src_wdwidth);
                 /* planarize temporary buffer to destination */
-                util_img_planarize(gem_bytes(s, priv, dst) + dy0 * dst_wdwidth * 8,
+                util_img_planarize(gem_bytes(s, priv, dst, planar_size(dst_wdwidth, dy0 + height), 1) + dy0 * dst_wdwidth * 8,
                     dst_wdwidth, priv->workspace, width, height, width);
+                gem_bytes_done(s, priv, dst, planar_size(dst_wdwidth, dy0 + height), 1);
             } else { /* mem to screen */
                 priv->screen->vro_cpyfm(priv->screen,
                     vr_mode,
-                    gem_bytes(s, priv, src), src_width, src_height, src_wdwidth,
+                    gem_bytes(s, priv, src, planar_size(src_wdwidth, src_height), 0), src_width, src_height, src_wdwidth,
                     sx0, sy0, sx1, sy1, dx0, dy0, dx1, dy1);
             }
         }
@@ -372,7 +412,7 @@ static void gembind_VDI(struct psys_state *s, struct gembind_priv *priv, psys_fu
         }
         priv->screen->vrt_cpyfm(priv->screen,
             vr_mode, vdi_color_map[col0], vdi_color_map[col1],
-            gem_bytes(s, priv, src), src_width, src_height, src_wdwidth,
+            gem_bytes(s, priv, src, src_wdwidth * 2 * src_height, 0), src_width, src_height, src_wdwidth,
             sx0, sy0, sx1, sy1, dx0, dy0, dx1, dy1);
     } break;
     case 0x007a: /* v_show_c */
@@ -388,7 +428,7 @@ static void gembind_VDI(struct psys_state *s, struct gembind_priv *priv, psys_fu
         psys_stw(s, W(intout, 0), buttons); /* buttons */
         psys_stw(s, W(ptsout, 0), x);       /* x */
         psys_stw(s, W(ptsout, 1), y);       /* y */
-        util_msleep(10);
+        game_clock_sleep(priv->clock, 10);
         /* UI loop delay - ideally this would be a conditional wait on mouse state change or vsync,
          * but seems to work well enough.
          */
@@ -455,7 +495,8 @@ static void gembind_MemoryCopy(struct psys_state *s, struct gembind_priv *priv,
 #if 0
     psys_debug_hexdump(s, fromaddr, bytes);
 #endif
-    memcpy(gem_bytes(s, priv, toaddr), gem_bytes(s, priv, fromaddr), bytes);
+    memcpy(gem_bytes(s, priv, toaddr, bytes, 0), gem_bytes(s, priv, fromaddr, bytes, 1), bytes);
+    gem_bytes_done(s, priv, toaddr, bytes, 0);
 }
 
 /** GetAbsoluteAddress(addr,dst) */
@@ -503,14 +544,16 @@ static void gembind_DecompressImage(struct psys_state *s, struct gembind_priv *p
     }
 
     /* Decompress image into staging area */
-    util_img_decompress_image(priv->workspace, gem_bytes(s, priv, addr1l + 4), addr1w, addr1h, &srcsize);
+    util_img_decompress_image(priv->workspace, gem_bytes(s, priv, addr1l + 4, GEMBIND_MEMSIZE, 0), addr1w, addr1h, &srcsize);
 
     /* Perform copy */
     if (addr2l == 0) { /* if to screen */
         priv->screen->draw_image(priv->screen, priv->workspace, addr1w, addr1h, x, y);
     } else { /* if not to screen, planarize it at destination - ignore x and y */
-        uint8_t *dst_planar = gem_bytes(s, priv, addr2l);
+        size_t dst_size     = planar_size((addr1w + 15) >> 4, addr1h);
+        uint8_t *dst_planar = gem_bytes(s, priv, addr2l, dst_size, 0);
         util_img_planarize(dst_planar, (addr1w + 15) >> 4, priv->workspace, addr1w, addr1h, addr1w);
+        gem_bytes_done(s, priv, addr2l, dst_size, 0);
     }
 
     /* This call leaves the stack in a really weird state, probably a bug */
@@ -530,7 +573,7 @@ static void gembind_DecompressImage(struct psys_state *s, struct gembind_priv *p
 static void gembind_DoSound(struct psys_state *s, struct gembind_priv *priv, psys_fulladdr segment, psys_fulladdr env_priv)
 {
     psys_word a         = psys_pop(s);
-    const uint8_t *data = psys_bytes(s, a);
+    const uint8_t *data = gem_bytes(s, priv, a, 128, 0);
     if (priv->sound) {
         /* XXX this should be safe as we're always passed a buffer of 128 bytes,
          * but it would be better to do some kind of bounds checking.
@@ -628,7 +671,7 @@ static psys_word collision_detect_internal(struct psys_state *s, struct gembind_
 {
     const uint8_t *image_ptr;
     unsigned bytes_per_line;
-    const psys_byte *unpassable = psys_bytes(s, priv->env_priv + UNPASSABLE_OFS);
+    const psys_byte *unpassable = gem_bytes(s, priv, priv->env_priv + UNPASSABLE_OFS, 256, 0);
     int cx, cy;
 
     x -= 4;
@@ -664,7 +707,8 @@ static void draw_sprite_internal(struct psys_state *s, struct gembind_priv *priv
 #endif
         /* Save background */
         priv->screen->get_image(priv->screen, x, y, 7, 7, &image_ptr, &bytes_per_line);
-        util_img_planarize(psys_bytes(s, back_addr), 1, image_ptr, 7, 7, bytes_per_line);
+        util_img_planarize(gem_bytes(s, priv, back_addr, planar_size(1, 7), 0), 1, image_ptr, 7, 7, bytes_per_line);
+        gem_bytes_done(s, priv, back_addr, planar_size(1, 7), 0);
         /* Draw opaque-colored */
         memset(colors, sprite_color_map[color], 7 * 7);
     } else {
@@ -672,7 +716,7 @@ static void draw_sprite_internal(struct psys_state *s, struct gembind_priv *priv
         psys_debug("Undraw %d at %d,%d\n", pattern, x, y);
 #endif
         /* Load back background */
-        util_img_unplanarize(colors, 7, psys_bytes(s, back_addr), 0, 0, 7, 7, 1);
+        util_img_unplanarize(colors, 7, gem_bytes(s, priv, back_addr, planar_size(1, 7), 0), 0, 0, 7, 7, 1);
     }
     priv->screen->draw_sprite(priv->screen, x, y, sprite_patterns[pattern], colors, 7, 7, 7);
 }
@@ -692,7 +736,7 @@ static void gembind_CollisionDetect(struct psys_state *s, struct gembind_priv *p
     /* HACK: time delay to make combat playable, otherwise bullets are invisible
      * because they effectively move at light speed.
      */
-    util_msleep(3);
+    game_clock_sleep(priv->clock, 3);
 }
 
 /** DrawSprite(flag,back_addr,x,y,pattern,color) */
@@ -712,7 +756,7 @@ static void gembind_DrawSprite(struct psys_state *s, struct gembind_priv *priv,
     /* HACK: time delay to make combat playable, otherwise bullets are invisible
      * because they effectively move at light speed.
      */
-    util_msleep(3);
+    game_clock_sleep(priv->clock, 3);
 }
 
 /** SpriteMovementEnable(flag) */
@@ -885,32 +929,32 @@ static void gembind_vblank_cb(struct game_screen *screen, void *arg)
     }
 }
 
-static int gembind_save_state(struct psys_binding *b, FILE *fd)
+static int gembind_save_state(struct psys_binding *b, struct psys_writer *w)
 {
     struct gembind_priv *priv = (struct gembind_priv *)b->userdata;
     uint32_t id               = GAME_GEMBIND_STATE_ID;
     /* Save GEMBIND state */
-    if (FD_WRITE(fd, id)
-        || FD_WRITE(fd, priv->line_color)
-        || FD_WRITE(fd, priv->line_width)
-        || FD_WRITE(fd, priv->fill_color)
-        || FD_WRITE(fd, priv->vr_mode)
-        || FD_WRITE(fd, priv->memory)
-        || FD_WRITE(fd, priv->movement_enable1)
-        || FD_WRITE(fd, priv->movement_enable2)
-        || FD_WRITE(fd, priv->env_priv)
-        || FD_WRITE(fd, priv->movement_start)) {
+    if (PSYS_WRITE(w, id)
+        || PSYS_WRITE(w, priv->line_color)
+        || PSYS_WRITE(w, priv->line_width)
+        || PSYS_WRITE(w, priv->fill_color)
+        || PSYS_WRITE(w, priv->vr_mode)
+        || PSYS_WRITE(w, priv->memory)
+        || PSYS_WRITE(w, priv->movement_enable1)
+        || PSYS_WRITE(w, priv->movement_enable2)
+        || PSYS_WRITE(w, priv->env_priv)
+        || PSYS_WRITE(w, priv->movement_start)) {
         return -1;
     }
     return 0;
 }
 
-static int gembind_load_state(struct psys_binding *b, FILE *fd)
+static int gembind_load_state(struct psys_binding *b, struct psys_reader *r)
 {
     struct gembind_priv *priv = (struct gembind_priv *)b->userdata;
     uint32_t id;
     /* Load GEMBIND state */
-    if (FD_READ(fd, id)) {
+    if (PSYS_READ(r, id)) {
         return -1;
     }
     if (id != GAME_GEMBIND_STATE_ID) {
@@ -918,27 +962,28 @@ static int gembind_load_state(struct psys_binding *b, FILE *fd)
         return -1;
     }
 
-    if (FD_READ(fd, priv->line_color)
-        || FD_READ(fd, priv->line_width)
-        || FD_READ(fd, priv->fill_color)
-        || FD_READ(fd, priv->vr_mode)
-        || FD_READ(fd, priv->memory)
-        || FD_READ(fd, priv->movement_enable1)
-        || FD_READ(fd, priv->movement_enable2)
-        || FD_READ(fd, priv->env_priv)
-        || FD_READ(fd, priv->movement_start)) {
+    if (PSYS_READ(r, priv->line_color)
+        || PSYS_READ(r, priv->line_width)
+        || PSYS_READ(r, priv->fill_color)
+        || PSYS_READ(r, priv->vr_mode)
+        || PSYS_READ(r, priv->memory)
+        || PSYS_READ(r, priv->movement_enable1)
+        || PSYS_READ(r, priv->movement_enable2)
+        || PSYS_READ(r, priv->env_priv)
+        || PSYS_READ(r, priv->movement_start)) {
         return -1;
     }
     return 0;
 }
 
-struct psys_binding *new_gembind(struct psys_state *state, struct game_screen *screen, struct game_sound *sound)
+struct psys_binding *new_gembind(struct psys_state *state, struct game_screen *screen, struct game_sound *sound, struct game_clock *clock)
 {
     struct psys_binding *b    = CALLOC_STRUCT(psys_binding);
     struct gembind_priv *priv = CALLOC_STRUCT(gembind_priv);
 
     priv->screen = screen;
     priv->sound  = sound;
+    priv->clock  = clock;
     priv->psys   = state;
     /* Have screen call us for every vblank */
     screen->add_vblank_cb(screen, &gembind_vblank_cb, priv);
@@ -12,12 +12,13 @@
 extern "C" {
 #endif
 
+struct game_clock;
 struct game_screen;
 struct game_sound;
 struct psys_state;
 
 /** Construction */
-extern struct psys_binding *new_gembind(struct psys_state *state, struct game_screen *screen, struct game_sound *sound);
+extern struct psys_binding *new_gembind(struct psys_state *state, struct game_screen *screen, struct game_sound *sound, struct game_clock *clock);
 
 /** Destruction */
 extern void destroy_gembind(struct psys_binding *b);
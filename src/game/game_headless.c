@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L /* fmemopen */
+#define HAVE_FMEMOPEN
+#endif
+
+#include "game_headless.h"
+
+#include "game/game_clock.h"
+#include "game/game_replay.h"
+#include "game/game_setup.h"
+#include "game/game_sound.h"
+#include "psys/psys_bindings.h"
+#include "psys/psys_blockdev.h"
+#include "psys/psys_debug.h"
+#include "psys/psys_hooks.h"
+#include "psys/psys_rsp.h"
+#include "psys/psys_save_state.h"
+#include "psys/psys_state.h"
+#include "util/memutil.h"
+#include "util/util_cow.h"
+#include "util/util_save_state.h"
+#include "util/write_bmp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Header for savestates */
+#define GAME_HEADLESS_STATE_ID 0x48444c53
+
+struct game_headless_image {
+    unsigned vblank_insns;
+    /* Memory and disk, mapped by forked instances */
+    struct util_cow_image *memory;
+    struct util_cow_image *disk;
+    /* Saved state of the instance. This includes the memory again, but
+     * loading it over a mapping with the same contents doesn't write to it.
+     */
+    psys_byte *state;
+    size_t state_size;
+};
+
+struct game_script *game_script_load(const char *filename)
+{
+    struct game_script *script = CALLOC_STRUCT(game_script);
+    FILE *f                    = fopen(filename, "r");
+    char line[512];
+    unsigned lineno = 0;
+    size_t alloc    = 0;
+    if (!f) {
+        fprintf(stderr, "Could not open script %s\n", filename);
+        goto error;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        struct game_script_cmd cmd;
+        char op[16];
+        int ofs;
+        lineno += 1;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+        memset(&cmd, 0, sizeof(cmd));
+        if (sscanf(line, "%u %15s %n", &cmd.vblank, op, &ofs) < 2) {
+            goto parse_error;
+        }
+        if (strcmp(op, "mouse") == 0) {
+            cmd.op = GAME_SCRIPT_MOUSE;
+            if (sscanf(line + ofs, "%d %d %u", &cmd.x, &cmd.y, &cmd.buttons) != 3) {
+                goto parse_error;
+            }
+        } else if (strcmp(op, "screenshot") == 0) {
+            cmd.op = GAME_SCRIPT_SCREENSHOT;
+            if (sscanf(line + ofs, "%255s", cmd.filename) != 1) {
+                goto parse_error;
+            }
+        } else if (strcmp(op, "quit") == 0) {
+            cmd.op = GAME_SCRIPT_QUIT;
+        } else if (strcmp(op, "digest") == 0) {
+            unsigned long long digest;
+            cmd.op = GAME_SCRIPT_DIGEST;
+            if (sscanf(line + ofs, "%u %llx", &cmd.time, &digest) != 2) {
+                goto parse_error;
+            }
+            cmd.digest = digest;
+        } else {
+            goto parse_error;
+        }
+        if (script->len && cmd.vblank < script->cmds[script->len - 1].vblank) {
+            fprintf(stderr, "%s:%u: commands are not sorted by vblank\n", filename, lineno);
+            goto error;
+        }
+        if (script->len == alloc) {
+            alloc        = alloc ? alloc * 2 : 64;
+            script->cmds = realloc(script->cmds, alloc * sizeof(struct game_script_cmd));
+        }
+        script->cmds[script->len++] = cmd;
+    }
+    fclose(f);
+    return script;
+parse_error:
+    fprintf(stderr, "%s:%u: could not parse script command\n", filename, lineno);
+error:
+    if (f) {
+        fclose(f);
+    }
+    game_script_destroy(script);
+    return NULL;
+}
+
+void game_script_destroy(struct game_script *script)
+{
+    if (script) {
+        free(script->cmds);
+        free(script);
+    }
+}
+
+/** Print every instruction executed, see setup_trace */
+static void headless_trace(struct psys_state *s, void *dummy)
+{
+    psys_print_info(s);
+}
+
+/** Trace instructions if PSYS_DEBUG asks for it, for example to record an
+ * opcode profile with tools/opcode_ngrams.py.
+ */
+static void setup_trace(struct game_headless *hs)
+{
+    if (PDBG(hs->psys, TRACE)) {
+        psys_set_trace(hs->psys, headless_trace, NULL);
+    }
+}
+
+struct game_headless *new_game_headless(const psys_byte *image, unsigned vblank_insns)
+{
+    struct game_headless *hs = CALLOC_STRUCT(game_headless);
+    hs->screen               = new_game_screen(NULL);
+    hs->sound                = new_null_sound();
+    hs->psys                 = game_setup_state(image, hs->screen, hs->sound, vblank_insns, false, &hs->clock, &hs->rspb);
+    setup_trace(hs);
+    return hs;
+}
+
+void game_headless_destroy(struct game_headless *hs)
+{
+    hs->screen->destroy(hs->screen);
+    hs->sound->destroy(hs->sound);
+    psys_bindings_destroy(hs->psys);
+    psys_hooks_destroy(hs->psys);
+    psys_caches_destroy(hs->psys);
+    if (hs->image) {
+        util_cow_unmap(hs->image->memory, hs->psys->memory);
+        util_cow_unmap(hs->image->disk, hs->disk);
+    } else {
+        free(hs->psys->memory);
+    }
+    psys_destroy_rsp(hs->rspb);
+    free(hs->psys);
+    game_clock_destroy(hs->clock);
+    free(hs);
+}
+
+struct game_headless_image *game_headless_image_new(struct game_headless *hs)
+{
+    struct game_headless_image *img = CALLOC_STRUCT(game_headless_image);
+    struct psys_rsp_state *rsp      = (struct psys_rsp_state *)hs->rspb->userdata;
+    FILE *f                         = tmpfile();
+    psys_byte *disk                 = malloc(GAME_DISK_SIZE);
+    long size;
+
+    psys_blockdev_read_all(rsp->disk0, disk);
+    img->vblank_insns = game_clock_vblank_insns(hs->clock);
+    img->memory       = util_cow_image_new(hs->psys->memory, hs->psys->mem_size);
+    img->disk         = util_cow_image_new(disk, GAME_DISK_SIZE);
+    free(disk);
+    if (!img->memory || !img->disk || !f || game_headless_save_state(hs, f) < 0) {
+        goto error;
+    }
+    size = ftell(f);
+    if (size < 0) {
+        goto error;
+    }
+    img->state_size = size;
+    img->state      = malloc(img->state_size);
+    rewind(f);
+    if (fread(img->state, 1, img->state_size, f) < img->state_size) {
+        goto error;
+    }
+    fclose(f);
+    return img;
+error:
+    if (f) {
+        fclose(f);
+    }
+    game_headless_image_destroy(img);
+    return NULL;
+}
+
+void game_headless_image_destroy(struct game_headless_image *img)
+{
+    util_cow_image_destroy(img->memory);
+    util_cow_image_destroy(img->disk);
+    free(img->state);
+    free(img);
+}
+
+/** Open saved state of an image for reading */
+static FILE *open_image_state(const struct game_headless_image *img)
+{
+#ifdef HAVE_FMEMOPEN
+    return fmemopen(img->state, img->state_size, "rb");
+#else
+    FILE *f = tmpfile();
+    if (f && fwrite(img->state, 1, img->state_size, f) == img->state_size) {
+        rewind(f);
+        return f;
+    }
+    if (f) {
+        fclose(f);
+    }
+    return NULL;
+#endif
+}
+
+struct game_headless *game_headless_fork(const struct game_headless_image *img, const struct game_script *script)
+{
+    struct game_headless *hs = CALLOC_STRUCT(game_headless);
+    psys_byte *memory        = util_cow_map(img->memory);
+    psys_byte *disk          = util_cow_map(img->disk);
+    FILE *f;
+    if (!memory || !disk) {
+        if (memory) {
+            util_cow_unmap(img->memory, memory);
+        }
+        if (disk) {
+            util_cow_unmap(img->disk, disk);
+        }
+        free(hs);
+        return NULL;
+    }
+    hs->screen = new_game_screen(NULL);
+    hs->sound  = new_null_sound();
+    hs->psys   = game_setup_state_mapped(memory, disk, hs->screen, hs->sound, img->vblank_insns, false, &hs->clock, &hs->rspb);
+    hs->image  = img;
+    hs->disk   = disk;
+    hs->script = script;
+    setup_trace(hs);
+
+    f = open_image_state(img);
+    if (!f || game_headless_load_state(hs, f) < 0) {
+        psys_debug("Could not load state of image\n");
+        if (f) {
+            fclose(f);
+        }
+        game_headless_destroy(hs);
+        return NULL;
+    }
+    fclose(f);
+    return hs;
+}
+
+static void update_texture(void *data, const uint8_t *buffer)
+{
+    struct game_headless *hs = (struct game_headless *)data;
+    memcpy(hs->buffer, buffer, sizeof(hs->buffer));
+}
+
+static void update_palette(void *data, const uint16_t *palette)
+{
+    struct game_headless *hs = (struct game_headless *)data;
+    memcpy(hs->palette, palette, sizeof(hs->palette));
+}
+
+void game_headless_get_rgba(struct game_headless *hs, uint8_t *rgba)
+{
+    unsigned ptr;
+    game_screen_update_textures(hs->screen, hs, &update_texture, &update_palette);
+    for (ptr = 0; ptr < SCREEN_WIDTH * SCREEN_HEIGHT; ++ptr) {
+        /* atari ST palette color is 0x0rgb, convert to RGBA */
+        uint16_t color    = hs->palette[hs->buffer[ptr]];
+        unsigned red      = (color >> 8) & 7;
+        unsigned green    = (color >> 4) & 7;
+        unsigned blue     = (color >> 0) & 7;
+        rgba[ptr * 4 + 0] = (red << 5) | (red << 2) | (red >> 1);
+        rgba[ptr * 4 + 1] = (green << 5) | (green << 2) | (green >> 1);
+        rgba[ptr * 4 + 2] = (blue << 5) | (blue << 2) | (blue >> 1);
+        rgba[ptr * 4 + 3] = 255;
+    }
+}
+
+void game_headless_screenshot(struct game_headless *hs, const char *filename)
+{
+    uint8_t *rgba = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+    game_headless_get_rgba(hs, rgba);
+    bmp_dump32_ex((char *)rgba, SCREEN_WIDTH, SCREEN_HEIGHT, true, false, false, filename);
+    free(rgba);
+}
+
+/** Run script commands that are due. Returns false if the script asks to
+ * quit.
+ */
+static bool run_script(struct game_headless *hs)
+{
+    const struct game_script *script = hs->script;
+    while (script && hs->script_pos < script->len && script->cmds[hs->script_pos].vblank <= hs->vblank) {
+        const struct game_script_cmd *cmd = &script->cmds[hs->script_pos++];
+        switch (cmd->op) {
+        case GAME_SCRIPT_MOUSE:
+            game_screen_update_mouse(hs->screen, cmd->x, cmd->y, cmd->buttons);
+            break;
+        case GAME_SCRIPT_SCREENSHOT:
+            game_headless_screenshot(hs, cmd->filename);
+            printf("[%u] Wrote screenshot to %s\n", hs->vblank, cmd->filename);
+            break;
+        case GAME_SCRIPT_QUIT:
+            return false;
+        case GAME_SCRIPT_DIGEST: {
+            struct game_digest digest;
+            game_digest_compute(&digest, hs->psys, hs->rspb);
+            if (digest.time != cmd->time || digest.memory != cmd->digest) {
+                printf("[%u] Diverged from recording: time %u digest %016llx, expected time %u digest %016llx\n",
+                    hs->vblank, digest.time, (unsigned long long)digest.memory, cmd->time, (unsigned long long)cmd->digest);
+                hs->diverged = true;
+                return false;
+            }
+        } break;
+        }
+    }
+    return true;
+}
+
+/** Vblank interrupt, see do_vblank in sundog.c */
+static void do_vblank(struct game_headless *hs)
+{
+    hs->screen->vblank_interrupt(hs->screen);
+    hs->vblank_count += 1;
+    if (hs->vblank_count == 4) {
+        psys_rsp_event(hs->rspb, 0, true);
+        hs->vblank_count = 0;
+    }
+    psys_rsp_settime(hs->rspb, game_clock_ms(hs->clock) / 17);
+    hs->vblank += 1;
+}
+
+enum psys_stop_reason game_headless_run(struct game_headless *hs, unsigned max_vblanks)
+{
+    enum psys_stop_reason reason;
+    while (true) {
+        /* Stop before taking the vblank from the clock, so that a run that is
+         * continued later delivers it.
+         */
+        while (game_clock_until_vblank(hs->clock) == 0) {
+            if (!run_script(hs) || (max_vblanks && hs->vblank == max_vblanks)) {
+                return PSYS_STOP_NONE;
+            }
+            game_clock_vblank(hs->clock);
+            do_vblank(hs);
+        }
+        reason = psys_run(hs->psys, game_clock_until_vblank(hs->clock));
+        if (reason != PSYS_STOP_BUDGET) {
+            return reason;
+        }
+    }
+}
+
+int game_headless_save_state(struct game_headless *hs, FILE *fd)
+{
+    uint32_t id = GAME_HEADLESS_STATE_ID;
+    if (FD_WRITE(fd, id)
+        || FD_WRITE(fd, hs->vblank)
+        || FD_WRITE(fd, hs->vblank_count)) {
+        return -1;
+    }
+    if (psys_save_state(hs->psys, fd) < 0) {
+        psys_debug("Error saving p-system state\n");
+        return -1;
+    }
+    if (game_screen_save_state(hs->screen, fd) < 0) {
+        psys_debug("Error saving screen state\n");
+        return -1;
+    }
+    if (game_clock_save_state(hs->clock, fd) < 0) {
+        psys_debug("Error saving clock state\n");
+        return -1;
+    }
+    return 0;
+}
+
+int game_headless_load_state(struct game_headless *hs, FILE *fd)
+{
+    uint32_t id;
+    if (FD_READ(fd, id)) {
+        return -1;
+    }
+    if (id != GAME_HEADLESS_STATE_ID) {
+        psys_debug("Invalid headless state record %08x\n", id);
+        return -1;
+    }
+    if (FD_READ(fd, hs->vblank)
+        || FD_READ(fd, hs->vblank_count)) {
+        return -1;
+    }
+    if (psys_load_state(hs->psys, fd) < 0) {
+        psys_debug("Error loading p-system state\n");
+        return -1;
+    }
+    if (game_screen_load_state(hs->screen, fd) < 0) {
+        psys_debug("Error loading screen state\n");
+        return -1;
+    }
+    if (game_clock_load_state(hs->clock, fd) < 0) {
+        psys_debug("Error loading clock state\n");
+        return -1;
+    }
+    /* skip script commands for earlier vblanks */
+    hs->script_pos = 0;
+    while (hs->script && hs->script_pos < hs->script->len && hs->script->cmds[hs->script_pos].vblank < hs->vblank) {
+        hs->script_pos += 1;
+    }
+    return 0;
+}
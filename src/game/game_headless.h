@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Headless game instance: runs the game without display, audio or SDL input,
+ * on an unpaced virtual clock. Input comes from a script. Shared between the
+ * headless and batch frontends; instances are independent, so several can run
+ * on different threads.
+ *
+ * Many instances can be forked from the image of one booted instance. These
+ * map the memory and disk of the image copy-on-write, so that they only use
+ * memory for what they change.
+ */
+#ifndef H_GAME_HEADLESS
+#define H_GAME_HEADLESS
+
+#include "game/game_screen.h"
+#include "psys/psys_interpreter.h"
+#include "psys/psys_types.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct game_clock;
+struct game_headless_image;
+struct game_sound;
+struct psys_binding;
+struct psys_state;
+
+enum game_script_op {
+    GAME_SCRIPT_MOUSE,      /* set mouse position and buttons */
+    GAME_SCRIPT_SCREENSHOT, /* write screenshot */
+    GAME_SCRIPT_QUIT,       /* stop */
+    GAME_SCRIPT_DIGEST,     /* check state against recorded digest */
+};
+
+/** Script command, executed before the given vblank is delivered. */
+struct game_script_cmd {
+    unsigned vblank;
+    enum game_script_op op;
+    int x, y;
+    unsigned buttons;
+    char filename[256];
+    uint32_t time;
+    uint64_t digest;
+};
+
+/** Input script. Read-only after loading, so it can be shared between
+ * instances.
+ */
+struct game_script {
+    struct game_script_cmd *cmds;
+    size_t len;
+};
+
+struct game_headless {
+    struct psys_state *psys;
+    struct psys_binding *rspb;
+    struct game_screen *screen;
+    struct game_sound *sound;
+    struct game_clock *clock;
+    /* Image that memory and disk are mapped from, NULL if private */
+    const struct game_headless_image *image;
+    psys_byte *disk;
+
+    /* Number of vblanks delivered so far */
+    unsigned vblank;
+    unsigned vblank_count;
+
+    /* Script, and position of next command */
+    const struct game_script *script;
+    size_t script_pos;
+    /* Set if the state did not match a digest in the script */
+    bool diverged;
+
+    /* Copy of screen contents, for screenshots */
+    uint8_t buffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint16_t palette[SCREEN_COLORS];
+};
+
+/** Load script. Every line is "<vblank> <command> <args>", with commands
+ *   mouse <x> <y> <buttons>
+ *   screenshot <filename.bmp>
+ *   quit
+ *   digest <time> <hex memory digest>
+ * Digests are written by game_recorder, see game_replay.h. Empty lines and
+ * lines starting with # are ignored. Commands must be sorted by vblank.
+ * Returns NULL on error.
+ */
+extern struct game_script *game_script_load(const char *filename);
+
+/** Destroy script. Can be passed NULL. */
+extern void game_script_destroy(struct game_script *script);
+
+/** Boot a headless instance from a raw disk image (GAME_DISK_SIZE bytes), on
+ * a virtual clock with *vblank_insns* instructions per vblank.
+ */
+extern struct game_headless *new_game_headless(const psys_byte *image, unsigned vblank_insns);
+
+/** Destroy headless instance. */
+extern void game_headless_destroy(struct game_headless *hs);
+
+/** Create an image of the current state of an instance, that instances can be
+ * forked from. Returns NULL on failure.
+ */
+extern struct game_headless_image *game_headless_image_new(struct game_headless *hs);
+
+/** Destroy image. Instances forked from it must have been destroyed. */
+extern void game_headless_image_destroy(struct game_headless_image *img);
+
+/** Create an instance in the state of an image, with *script* (can be NULL).
+ * Can be called from any thread. Returns NULL on failure.
+ */
+extern struct game_headless *game_headless_fork(const struct game_headless_image *img, const struct game_script *script);
+
+/** Run until the script quits, vblank *max_vblanks* is reached (if non-zero),
+ * the state diverges from a digest in the script (which sets *diverged*), or
+ * the interpreter stops. Returns the reason the interpreter stopped, or
+ * PSYS_STOP_NONE if it was still running.
+ */
+extern enum psys_stop_reason game_headless_run(struct game_headless *hs, unsigned max_vblanks);
+
+/** Convert current screen contents to RGBA, SCREEN_WIDTH * SCREEN_HEIGHT * 4
+ * bytes.
+ */
+extern void game_headless_get_rgba(struct game_headless *hs, uint8_t *rgba);
+
+/** Write current screen contents to a BMP file. */
+extern void game_headless_screenshot(struct game_headless *hs, const char *filename);
+
+/** Save state of instance: p-system, screen, clock and vblank counters. The
+ * script position is not saved.
+ */
+extern int game_headless_save_state(struct game_headless *hs, FILE *fd);
+
+/** Load state of instance. Script commands for vblanks before the loaded
+ * vblank are skipped.
+ */
+extern int game_headless_load_state(struct game_headless *hs, FILE *fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "game_replay.h"
+
+#include "psys/psys_debug.h"
+#include "psys/psys_helpers.h"
+#include "psys/psys_rsp.h"
+#include "psys/psys_state.h"
+#include "util/memutil.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct game_recorder {
+    FILE *f;
+    unsigned digest_interval;
+    /* Last mouse state written */
+    bool have_mouse;
+    int x, y;
+    unsigned buttons;
+};
+
+void game_digest_compute(struct game_digest *digest, struct psys_state *psys, struct psys_binding *rspb)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    psys_byte buf[4096];
+    size_t ptr, n, i;
+    for (ptr = 0; ptr < psys->mem_size; ptr += n) {
+        n = psys->mem_size - ptr < sizeof(buf) ? psys->mem_size - ptr : sizeof(buf);
+        psys_read_bytes(psys, buf, ptr, n);
+        for (i = 0; i < n; ++i) {
+            hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+        }
+    }
+    digest->memory = hash;
+    digest->time   = rspb ? ((struct psys_rsp_state *)rspb->userdata)->time : 0;
+}
+
+struct game_recorder *new_game_recorder(const char *filename, unsigned vblank_insns, unsigned digest_interval)
+{
+    struct game_recorder *rec;
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        psys_debug("Error opening %s for writing\n", filename);
+        return NULL;
+    }
+    fprintf(f, "# Recorded with --virtual-clock %u, replay with the same setting\n", vblank_insns);
+    rec                  = CALLOC_STRUCT(game_recorder);
+    rec->f               = f;
+    rec->digest_interval = digest_interval;
+    return rec;
+}
+
+void game_recorder_mouse(struct game_recorder *rec, unsigned vblank, int x, int y, unsigned buttons)
+{
+    if (rec->have_mouse && x == rec->x && y == rec->y && buttons == rec->buttons) {
+        return;
+    }
+    fprintf(rec->f, "%u mouse %d %d %u\n", vblank, x, y, buttons);
+    rec->have_mouse = true;
+    rec->x          = x;
+    rec->y          = y;
+    rec->buttons    = buttons;
+}
+
+void game_recorder_vblank(struct game_recorder *rec, unsigned vblank, struct psys_state *psys, struct psys_binding *rspb)
+{
+    struct game_digest digest;
+    if (!rec->digest_interval || (vblank % rec->digest_interval) != 0) {
+        return;
+    }
+    game_digest_compute(&digest, psys, rspb);
+    fprintf(rec->f, "%u digest %u %016llx\n", vblank, digest.time, (unsigned long long)digest.memory);
+}
+
+int game_recorder_close(struct game_recorder *rec, unsigned vblank)
+{
+    int rv;
+    fprintf(rec->f, "%u quit\n", vblank);
+    rv = ferror(rec->f) ? -1 : 0;
+    if (fclose(rec->f) != 0) {
+        rv = -1;
+    }
+    free(rec);
+    return rv;
+}
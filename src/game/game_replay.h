@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Recording of input, for deterministic replay.
+ *
+ * On the virtual clock the game is a function of its input: RSP events and
+ * time are derived from the vblank number, and the game has no other source of
+ * randomness than the time. A recording holds the mouse state whenever it
+ * changes, stamped with the vblank it is applied at, in the script format of
+ * the headless frontend so that it can be replayed there. Digests of the
+ * p-system state are recorded periodically, so that the replay can detect the
+ * first vblank where it diverges from the recorded run.
+ */
+#ifndef H_GAME_REPLAY
+#define H_GAME_REPLAY
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct game_recorder;
+struct psys_binding;
+struct psys_state;
+
+/** Digest of the state of the p-system at a vblank */
+struct game_digest {
+    uint32_t time;   /* RSP time */
+    uint64_t memory; /* FNV-1a of memory, independent of memory layout */
+};
+
+/** Compute digest of current state. */
+extern void game_digest_compute(struct game_digest *digest, struct psys_state *psys, struct psys_binding *rspb);
+
+/** Start recording to *filename*, for a game on a virtual clock with
+ * *vblank_insns* instructions per vblank. A digest is recorded every
+ * *digest_interval* vblanks (0 records none). Returns NULL if the file cannot
+ * be created.
+ */
+extern struct game_recorder *new_game_recorder(const char *filename, unsigned vblank_insns, unsigned digest_interval);
+
+/** Record mouse state applied before *vblank* is delivered. Only changes are
+ * written.
+ */
+extern void game_recorder_mouse(struct game_recorder *rec, unsigned vblank, int x, int y, unsigned buttons);
+
+/** Record digest of state before *vblank* is delivered, if one is due. Call
+ * after game_recorder_mouse for the same vblank.
+ */
+extern void game_recorder_vblank(struct game_recorder *rec, unsigned vblank, struct psys_state *psys, struct psys_binding *rspb);
+
+/** Finish recording, ending it before *vblank*, and destroy recorder. Returns
+ * 0 if the recording was written succesfully.
+ */
+extern int game_recorder_close(struct game_recorder *rec, unsigned vblank);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "game_rewind.h"
+
+#include "game_screen.h"
+#include "psys/psys_debug.h"
+#include "psys/psys_helpers.h"
+#include "psys/psys_save_state.h"
+#include "psys/psys_serialize.h"
+#include "psys/psys_snapshot.h"
+#include "util/memutil.h"
+#include "util/util_minmax.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum number of frames, independent of the budget */
+#define REWIND_MAX_FRAMES 1024
+/* Size of pages that binding and screen state is stored in */
+#define CHUNK_SIZE 1024
+
+/* Page of binding and screen state, shared between frames */
+struct rewind_chunk {
+    unsigned refs;
+    size_t len;
+    uint8_t data[CHUNK_SIZE];
+};
+
+struct rewind_frame {
+    struct psys_snapshot *psys;
+    struct rewind_chunk **chunks;
+    size_t num_chunks;
+    size_t state_size; /* size of binding and screen state */
+    size_t size;       /* bytes copied for this frame, rest is shared */
+    uint32_t time;
+};
+
+struct game_rewind {
+    struct psys_state *psys;
+    struct game_screen *screen;
+    size_t budget;
+    /* Binding and screen state is serialized to this writer */
+    struct psys_writer writer;
+    uint8_t *buf; /* for restore */
+    size_t buf_size;
+    /* Ring of frames, oldest first */
+    struct rewind_frame frames[REWIND_MAX_FRAMES];
+    unsigned first;
+    unsigned count;
+    size_t size; /* sum of frame sizes */
+};
+
+static struct rewind_frame *get_frame(struct game_rewind *rw, unsigned idx)
+{
+    return &rw->frames[(rw->first + idx) % REWIND_MAX_FRAMES];
+}
+
+/* Size of frame if nothing was shared */
+static size_t full_size(const struct rewind_frame *frame)
+{
+    return psys_snapshot_num_pages(frame->psys) * PSYS_PAGE_SIZE + frame->state_size;
+}
+
+static void free_frame(struct game_rewind *rw, struct rewind_frame *frame)
+{
+    size_t x;
+    for (x = 0; x < frame->num_chunks; ++x) {
+        if (--frame->chunks[x]->refs == 0) {
+            free(frame->chunks[x]);
+        }
+    }
+    free(frame->chunks);
+    psys_snapshot_release(frame->psys);
+    rw->size -= frame->size;
+    memset(frame, 0, sizeof(*frame));
+}
+
+static void drop_oldest(struct game_rewind *rw)
+{
+    free_frame(rw, get_frame(rw, 0));
+    rw->first = (rw->first + 1) % REWIND_MAX_FRAMES;
+    rw->count -= 1;
+}
+
+static void drop_newest(struct game_rewind *rw)
+{
+    free_frame(rw, get_frame(rw, rw->count - 1));
+    rw->count -= 1;
+}
+
+/* Serialize binding and screen state to rw->writer */
+static int save_extra_state(struct game_rewind *rw)
+{
+    psys_writer_reset(&rw->writer);
+    if (psys_write_bindings_state(rw->psys, &rw->writer) < 0
+        || game_screen_write_state(rw->screen, &rw->writer) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Deserialize binding and screen state from rw->buf */
+static int load_extra_state(struct game_rewind *rw, size_t size)
+{
+    struct psys_reader r;
+    psys_reader_init(&r, rw->buf, size);
+    if (psys_read_bindings_state(rw->psys, &r) < 0
+        || game_screen_read_state(rw->screen, &r) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+struct game_rewind *new_game_rewind(struct psys_state *psys, struct game_screen *screen, size_t budget)
+{
+    struct game_rewind *rw = CALLOC_STRUCT(game_rewind);
+    rw->psys               = psys;
+    rw->screen             = screen;
+    rw->budget             = budget;
+    psys_writer_init(&rw->writer);
+    psys_dirty_enable(psys);
+    return rw;
+}
+
+void game_rewind_destroy(struct game_rewind *rw)
+{
+    while (rw->count) {
+        drop_newest(rw);
+    }
+    psys_dirty_disable(rw->psys);
+    psys_writer_free(&rw->writer);
+    free(rw->buf);
+    free(rw);
+}
+
+bool game_rewind_push(struct game_rewind *rw, uint32_t time)
+{
+    const struct rewind_frame *prev = rw->count ? get_frame(rw, rw->count - 1) : NULL;
+    struct rewind_frame frame;
+    const uint8_t *state;
+    size_t x;
+    if (save_extra_state(rw) < 0) {
+        psys_debug("Could not save state for rewind\n");
+        return false;
+    }
+    state = psys_writer_flatten(&rw->writer);
+    memset(&frame, 0, sizeof(frame));
+    frame.psys       = psys_snapshot_take(rw->psys);
+    frame.size       = psys_snapshot_copied_pages(frame.psys) * PSYS_PAGE_SIZE;
+    frame.state_size = psys_writer_size(&rw->writer);
+    frame.num_chunks = (frame.state_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    frame.chunks     = calloc(frame.num_chunks, sizeof(struct rewind_chunk *));
+    frame.time       = time;
+    for (x = 0; x < frame.num_chunks; ++x) {
+        const uint8_t *data = &state[x * CHUNK_SIZE];
+        size_t len          = umin(frame.state_size - x * CHUNK_SIZE, CHUNK_SIZE);
+        struct rewind_chunk *chunk;
+        if (prev && x < prev->num_chunks && prev->chunks[x]->len == len && !memcmp(prev->chunks[x]->data, data, len)) {
+            chunk = prev->chunks[x];
+            chunk->refs += 1;
+        } else {
+            chunk       = CALLOC_STRUCT(rewind_chunk);
+            chunk->refs = 1;
+            chunk->len  = len;
+            memcpy(chunk->data, data, len);
+            frame.size += len;
+        }
+        frame.chunks[x] = chunk;
+    }
+
+    if (rw->count == REWIND_MAX_FRAMES) {
+        drop_oldest(rw);
+    }
+    *get_frame(rw, rw->count) = frame;
+    rw->count += 1;
+    rw->size += frame.size;
+    while (rw->count > 1 && game_rewind_size(rw) > rw->budget) {
+        drop_oldest(rw);
+    }
+    return true;
+}
+
+bool game_rewind_restore(struct game_rewind *rw, unsigned steps, uint32_t *time)
+{
+    struct rewind_frame *frame;
+    size_t x;
+    if (steps == 0 || steps > rw->count) {
+        return false;
+    }
+    frame = get_frame(rw, rw->count - steps);
+    if (frame->state_size > rw->buf_size) {
+        rw->buf      = realloc(rw->buf, frame->state_size);
+        rw->buf_size = frame->state_size;
+    }
+    for (x = 0; x < frame->num_chunks; ++x) {
+        memcpy(&rw->buf[x * CHUNK_SIZE], frame->chunks[x]->data, frame->chunks[x]->len);
+    }
+    psys_snapshot_restore(rw->psys, frame->psys);
+    if (load_extra_state(rw, frame->state_size) < 0) {
+        psys_debug("Could not restore state for rewind\n");
+        return false;
+    }
+    *time = frame->time;
+    while (steps--) {
+        drop_newest(rw);
+    }
+    return true;
+}
+
+unsigned game_rewind_count(struct game_rewind *rw)
+{
+    return rw->count;
+}
+
+size_t game_rewind_size(struct game_rewind *rw)
+{
+    if (!rw->count) {
+        return 0;
+    }
+    /* The oldest frame is charged in full, as it keeps pages alive that it
+     * shared with frames that were dropped.
+     */
+    return rw->size - get_frame(rw, 0)->size + full_size(get_frame(rw, 0));
+}
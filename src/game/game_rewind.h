@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Rewind buffer: ring of recent snapshots of the game, bounded by a memory
+ * budget, that the game can be restored to instantly.
+ *
+ * A frame holds an incremental p-system snapshot (see psys_snapshot.h) plus
+ * the state of the bindings and screen. Both are stored in pages that are
+ * shared with the neighbouring frame where unchanged, so a frame costs about
+ * as much memory as what changed since the previous one.
+ *
+ * Frames are pushed and restored from the thread that runs the interpreter,
+ * at a point where the interpreter state is consistent (or while it is
+ * stopped).
+ */
+#ifndef H_GAME_REWIND
+#define H_GAME_REWIND
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct game_rewind;
+struct game_screen;
+struct psys_state;
+
+/** Create rewind buffer of at most *budget* bytes. This enables dirty page
+ * tracking on the p-system state.
+ */
+extern struct game_rewind *new_game_rewind(struct psys_state *psys, struct game_screen *screen, size_t budget);
+
+/** Destroy rewind buffer, and disable dirty page tracking. */
+extern void game_rewind_destroy(struct game_rewind *rw);
+
+/** Push a frame with the current state, and game time *time*. The oldest
+ * frames are dropped to stay within the budget. Returns false on failure.
+ */
+extern bool game_rewind_push(struct game_rewind *rw, uint32_t time);
+
+/** Restore the frame *steps* frames back (1 is the most recent frame). That
+ * frame and all newer ones are removed. The game time of the frame is
+ * returned in *time*. Returns false if there are not that many frames, or on
+ * failure.
+ */
+extern bool game_rewind_restore(struct game_rewind *rw, unsigned steps, uint32_t *time);
+
+/** Number of frames in buffer. */
+extern unsigned game_rewind_count(struct game_rewind *rw);
+
+/** Memory used by frames in buffer, in bytes. */
+extern size_t game_rewind_size(struct game_rewind *rw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "game_save_state.h"
+
+#include "game_screen.h"
+#include "psys/psys_bindings.h"
+#include "psys/psys_blockdev.h"
+#include "psys/psys_debug.h"
+#include "psys/psys_helpers.h"
+#include "psys/psys_rsp.h"
+#include "psys/psys_save_state.h"
+#include "psys/psys_serialize.h"
+#include "psys/psys_state.h"
+#include "util/memutil.h"
+#include "util/util_lz.h"
+#include "util/util_minmax.h"
+#include "util/util_save_state.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Header for savestates */
+#define GAME_SAVE_V2_ID 0x53554e32
+#define GAME_SAVE_VERSION 2
+
+/* Section tags */
+#define SECTION_GAME 0x47414d45   /* frontend data */
+#define SECTION_REGS 0x52454753   /* p-system registers */
+#define SECTION_MEM 0x4d454d20    /* memory, XOR delta against reference */
+#define SECTION_BIND 0x42494e44   /* segment name, binding state */
+#define SECTION_DISK 0x4449534b   /* disk, XOR delta against reference (only in old saves) */
+#define SECTION_SCREEN 0x5343524e /* screen state */
+
+/* Sanity limits for loading */
+#define MAX_SECTIONS 64
+#define MAX_SECTION_SIZE (16 * 1024 * 1024)
+
+struct game_save_ref {
+    psys_byte *memory; /* in big-endian layout, as saved */
+    size_t mem_size;
+    psys_byte *disk;
+    size_t disk_size;
+    uint64_t hash;
+};
+
+/* Section header, followed by compressed data */
+struct section_header {
+    uint32_t tag;
+    uint32_t size;      /* uncompressed */
+    uint32_t comp_size; /* compressed */
+};
+
+/* Section of captured state, in capture data */
+struct capture_section {
+    uint32_t tag;
+    size_t offset;
+    size_t size;
+};
+
+struct game_save_capture {
+    const struct game_save_ref *ref;
+    struct psys_writer data;
+    const psys_byte *flat; /* data, after flattening */
+    struct capture_section sections[MAX_SECTIONS];
+    unsigned num_sections;
+};
+
+/* Decompressed section */
+struct section {
+    uint32_t tag;
+    uint32_t size;
+    uint8_t *data;
+};
+
+/* Growable buffer */
+struct buffer {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+};
+
+static void buffer_reserve(struct buffer *b, size_t size)
+{
+    if (b->size + size > b->capacity) {
+        b->capacity = umax(b->size + size, b->capacity * 2);
+        b->data     = realloc(b->data, b->capacity);
+    }
+}
+
+/* 64-bit FNV-1a */
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *data, size_t size)
+{
+    size_t x;
+    for (x = 0; x < size; ++x) {
+        hash = (hash ^ data[x]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static size_t disk_size(struct psys_binding *rspb)
+{
+    return ((struct psys_rsp_state *)rspb->userdata)->disk0_size * PSYS_BLOCK_SIZE;
+}
+
+static struct psys_blockdev *disk_dev(struct psys_binding *rspb)
+{
+    return ((struct psys_rsp_state *)rspb->userdata)->disk0;
+}
+
+struct game_save_ref *game_save_ref_new(struct psys_state *psys, struct psys_binding *rspb)
+{
+    struct game_save_ref *ref = CALLOC_STRUCT(game_save_ref);
+    ref->mem_size             = psys->mem_size;
+    ref->memory               = malloc(ref->mem_size);
+    ref->disk_size            = disk_size(rspb);
+    ref->disk                 = malloc(ref->disk_size);
+    psys_read_bytes(psys, ref->memory, 0, ref->mem_size);
+    psys_blockdev_read_all(disk_dev(rspb), ref->disk);
+    ref->hash = hash_bytes(0xcbf29ce484222325ULL, ref->memory, ref->mem_size);
+    ref->hash = hash_bytes(ref->hash, ref->disk, ref->disk_size);
+    return ref;
+}
+
+void game_save_ref_destroy(struct game_save_ref *ref)
+{
+    free(ref->memory);
+    free(ref->disk);
+    free(ref);
+}
+
+/** out = a ^ b, a word at a time. *out* may be the same as *a*. */
+static void xor_bytes(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t x = 0;
+    for (; x + 8 <= size; x += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa, a + x, sizeof(wa));
+        memcpy(&wb, b + x, sizeof(wb));
+        wa ^= wb;
+        memcpy(out + x, &wa, sizeof(wa));
+    }
+    for (; x < size; ++x) {
+        out[x] = a[x] ^ b[x];
+    }
+}
+
+/** Compress and append section to body */
+static void add_section(struct buffer *body, uint32_t tag, const void *data, size_t size)
+{
+    struct section_header hdr;
+    buffer_reserve(body, sizeof(hdr) + util_lz_bound(size));
+    hdr.tag       = tag;
+    hdr.size      = size;
+    hdr.comp_size = util_lz_compress(data, size, body->data + body->size + sizeof(hdr));
+    memcpy(body->data + body->size, &hdr, sizeof(hdr));
+    body->size += sizeof(hdr) + hdr.comp_size;
+}
+
+/** Append section with XOR delta of *data* against *ref* */
+static void add_delta_section(struct buffer *body, uint32_t tag, const psys_byte *data, const psys_byte *ref, size_t size, struct buffer *tmp)
+{
+    tmp->size = 0;
+    buffer_reserve(tmp, size);
+    xor_bytes(tmp->data, data, ref, size);
+    add_section(body, tag, tmp->data, size);
+}
+
+bool game_save_is_v2(FILE *fd)
+{
+    long pos = ftell(fd);
+    uint32_t id;
+    bool rv = !FD_READ(fd, id) && id == GAME_SAVE_V2_ID;
+    fseek(fd, pos, SEEK_SET);
+    return rv;
+}
+
+static int begin_section(struct game_save_capture *cap, uint32_t tag)
+{
+    struct capture_section *section;
+    if (cap->num_sections == MAX_SECTIONS) {
+        psys_debug("Too many save state sections\n");
+        return -1;
+    }
+    section         = &cap->sections[cap->num_sections++];
+    section->tag    = tag;
+    section->offset = psys_writer_size(&cap->data);
+    return 0;
+}
+
+static void end_section(struct game_save_capture *cap)
+{
+    struct capture_section *section = &cap->sections[cap->num_sections - 1];
+    section->size                   = psys_writer_size(&cap->data) - section->offset;
+}
+
+/* Memory in big-endian layout, like the reference */
+static void write_memory(struct psys_state *psys, struct psys_writer *w)
+{
+#if PSYS_MEM_BYTE_XOR
+    psys_byte buf[4096];
+    size_t ptr, n;
+    for (ptr = 0; ptr < psys->mem_size; ptr += n) {
+        n = umin(psys->mem_size - ptr, sizeof(buf));
+        psys_read_bytes(psys, buf, ptr, n);
+        psys_write(w, buf, n);
+    }
+#else
+    psys_write_ref(w, psys->memory, psys->mem_size);
+#endif
+}
+
+struct game_save_capture *game_save_capture(const struct game_save_ref *ref, struct psys_state *psys, struct psys_binding *rspb,
+    struct game_screen *screen, const void *extra, size_t extra_size)
+{
+    struct game_save_capture *cap;
+    unsigned x;
+
+    if (psys->mem_size != ref->mem_size || disk_size(rspb) != ref->disk_size) {
+        psys_debug("Reference image does not match\n");
+        return NULL;
+    }
+    cap      = CALLOC_STRUCT(game_save_capture);
+    cap->ref = ref;
+    psys_writer_init(&cap->data);
+    begin_section(cap, SECTION_GAME);
+    psys_write(&cap->data, extra, extra_size);
+    end_section(cap);
+    begin_section(cap, SECTION_REGS);
+    if (psys_write_registers(psys, &cap->data) < 0) {
+        goto error;
+    }
+    end_section(cap);
+    begin_section(cap, SECTION_MEM);
+    write_memory(psys, &cap->data);
+    end_section(cap);
+    for (x = 0; x < psys->num_bindings; ++x) {
+        struct psys_binding *b = psys->bindings[x];
+        if (b->save_state) {
+            if (begin_section(cap, SECTION_BIND) < 0
+                || PSYS_WRITE(&cap->data, b->seg.name)
+                || b->save_state(b, &cap->data) < 0) {
+                goto error;
+            }
+            end_section(cap);
+        }
+    }
+    if (begin_section(cap, SECTION_SCREEN) < 0
+        || game_screen_write_state(screen, &cap->data) < 0) {
+        goto error;
+    }
+    end_section(cap);
+    /* Copy referenced data, so that the game can continue */
+    cap->flat = psys_writer_flatten(&cap->data);
+    return cap;
+error:
+    game_save_capture_free(cap);
+    return NULL;
+}
+
+int game_save_capture_write(FILE *fd, const struct game_save_capture *cap)
+{
+    const struct game_save_ref *ref = cap->ref;
+    const psys_byte *data           = cap->flat;
+    struct buffer body              = { NULL, 0, 0 };
+    struct buffer tmp               = { NULL, 0, 0 };
+    uint32_t id                     = GAME_SAVE_V2_ID;
+    uint32_t version                = GAME_SAVE_VERSION;
+    uint32_t num_sections           = cap->num_sections;
+    uint64_t body_size, hash;
+    unsigned x;
+    int rv = -1;
+
+    for (x = 0; x < cap->num_sections; ++x) {
+        const struct capture_section *section = &cap->sections[x];
+        switch (section->tag) {
+        case SECTION_MEM:
+            add_delta_section(&body, section->tag, &data[section->offset], ref->memory, ref->mem_size, &tmp);
+            break;
+        default:
+            add_section(&body, section->tag, &data[section->offset], section->size);
+        }
+    }
+    body_size = body.size;
+    hash      = hash_bytes(0xcbf29ce484222325ULL, body.data, body.size);
+    if (FD_WRITE(fd, id)
+        || FD_WRITE(fd, version)
+        || FD_WRITE(fd, num_sections)
+        || FD_WRITE(fd, ref->hash)
+        || FD_WRITE(fd, body_size)
+        || FD_WRITE(fd, hash)
+        || fwrite(body.data, 1, body.size, fd) < body.size) {
+        goto out;
+    }
+    rv = 0;
+out:
+    free(body.data);
+    free(tmp.data);
+    return rv;
+}
+
+void game_save_capture_free(struct game_save_capture *cap)
+{
+    psys_writer_free(&cap->data);
+    free(cap);
+}
+
+int game_save_state_v2(FILE *fd, const struct game_save_ref *ref, struct psys_state *psys, struct psys_binding *rspb,
+    struct game_screen *screen, const void *extra, size_t extra_size)
+{
+    struct game_save_capture *cap = game_save_capture(ref, psys, rspb, screen, extra, extra_size);
+    int rv;
+    if (!cap) {
+        return -1;
+    }
+    rv = game_save_capture_write(fd, cap);
+    game_save_capture_free(cap);
+    return rv;
+}
+
+/** Read and decompress sections. Returns number of sections, or -1 on error. */
+static int read_sections(FILE *fd, const struct game_save_ref *ref, struct section *sections)
+{
+    uint32_t id, version, num_sections;
+    uint64_t ref_hash, body_size, hash;
+    uint8_t *body = NULL;
+    const uint8_t *ptr;
+    size_t remaining;
+    unsigned x = 0;
+    int rv     = -1;
+
+    if (FD_READ(fd, id)
+        || FD_READ(fd, version)
+        || FD_READ(fd, num_sections)
+        || FD_READ(fd, ref_hash)
+        || FD_READ(fd, body_size)
+        || FD_READ(fd, hash)) {
+        return -1;
+    }
+    if (id != GAME_SAVE_V2_ID) {
+        psys_debug("Invalid save state record %08x\n", id);
+        return -1;
+    }
+    if (version != GAME_SAVE_VERSION) {
+        psys_debug("Unsupported save state version %d\n", version);
+        return -1;
+    }
+    if (ref_hash != ref->hash) {
+        psys_debug("Save state is for a different disk image\n");
+        return -1;
+    }
+    if (num_sections > MAX_SECTIONS || body_size > (uint64_t)MAX_SECTIONS * MAX_SECTION_SIZE) {
+        psys_debug("Save state header is corrupt\n");
+        return -1;
+    }
+    body = malloc(body_size);
+    if (fread(body, 1, body_size, fd) < body_size) {
+        goto out;
+    }
+    if (hash_bytes(0xcbf29ce484222325ULL, body, body_size) != hash) {
+        psys_debug("Save state is corrupt (hash mismatch)\n");
+        goto out;
+    }
+    ptr       = body;
+    remaining = body_size;
+    for (x = 0; x < num_sections; ++x) {
+        struct section_header hdr;
+        if (remaining < sizeof(hdr)) {
+            goto out;
+        }
+        memcpy(&hdr, ptr, sizeof(hdr));
+        ptr += sizeof(hdr);
+        remaining -= sizeof(hdr);
+        if (hdr.comp_size > remaining || hdr.size > MAX_SECTION_SIZE) {
+            goto out;
+        }
+        sections[x].tag  = hdr.tag;
+        sections[x].size = hdr.size;
+        sections[x].data = malloc(umax(hdr.size, 1));
+        if (util_lz_decompress(ptr, hdr.comp_size, sections[x].data, hdr.size) < 0) {
+            psys_debug("Save state section %08x is corrupt\n", hdr.tag);
+            free(sections[x].data);
+            goto out;
+        }
+        ptr += hdr.comp_size;
+        remaining -= hdr.comp_size;
+    }
+    rv = num_sections;
+out:
+    if (rv < 0) {
+        while (x--) {
+            free(sections[x].data);
+        }
+    }
+    free(body);
+    return rv;
+}
+
+/** Find first section with tag, or NULL */
+static struct section *find_section(struct section *sections, int num_sections, uint32_t tag)
+{
+    int x;
+    for (x = 0; x < num_sections; ++x) {
+        if (sections[x].tag == tag) {
+            return &sections[x];
+        }
+    }
+    return NULL;
+}
+
+/** Set up reader for section data, skipping *skip* bytes */
+static struct psys_reader *section_reader(struct psys_reader *r, const struct section *section, size_t skip)
+{
+    psys_reader_init(r, section->data + skip, section->size - skip);
+    return r;
+}
+
+int game_load_state_v2(FILE *fd, const struct game_save_ref *ref, struct psys_state *psys, struct psys_binding *rspb,
+    struct game_screen *screen, void *extra, size_t extra_size)
+{
+    struct section sections[MAX_SECTIONS];
+    struct section *game, *regs, *mem, *disk, *scr;
+    size_t mem_size   = psys->mem_size;
+    struct psys_reader r;
+    int num_sections  = read_sections(fd, ref, sections);
+    psys_byte cur[4096];
+    size_t ptr, n;
+    int i, rv = -1;
+
+    if (num_sections < 0) {
+        return -1;
+    }
+    game = find_section(sections, num_sections, SECTION_GAME);
+    regs = find_section(sections, num_sections, SECTION_REGS);
+    mem  = find_section(sections, num_sections, SECTION_MEM);
+    disk = find_section(sections, num_sections, SECTION_DISK);
+    scr  = find_section(sections, num_sections, SECTION_SCREEN);
+    if (!game || game->size != extra_size || !regs || !mem || mem->size != mem_size || mem_size != ref->mem_size
+        || (disk && disk->size != ref->disk_size) || disk_size(rspb) != ref->disk_size || !scr) {
+        psys_debug("Save state sections missing or of the wrong size\n");
+        goto out;
+    }
+
+    if (psys_read_registers(psys, section_reader(&r, regs, 0)) < 0
+        || psys->mem_size != mem_size) {
+        psys->mem_size = mem_size;
+        goto out;
+    }
+    /* Only memory that differs is written, as in psys_load_state */
+    for (ptr = 0; ptr < mem_size; ptr += n) {
+        n = umin(mem_size - ptr, sizeof(cur));
+        xor_bytes(&mem->data[ptr], &mem->data[ptr], &ref->memory[ptr], n);
+        psys_read_bytes(psys, cur, ptr, n);
+        if (memcmp(&mem->data[ptr], cur, n)) {
+            psys_write_bytes(psys, ptr, &mem->data[ptr], n);
+        }
+    }
+    psys_invalidate_code(psys, 0, mem_size);
+    psys_invalidate_display(psys);
+    for (i = 0; i < num_sections; ++i) {
+        struct psys_segment_id seg;
+        struct psys_binding *b;
+        if (sections[i].tag != SECTION_BIND) {
+            continue;
+        }
+        if (sections[i].size < sizeof(seg.name)) {
+            goto out;
+        }
+        memcpy(seg.name, sections[i].data, sizeof(seg.name));
+        b = psys_find_binding(psys, &seg);
+        if (!b || !b->load_state) {
+            psys_debug("Save state has state for unknown binding %.8s\n", seg.name);
+            goto out;
+        }
+        if (b->load_state(b, section_reader(&r, &sections[i], sizeof(seg.name))) < 0) {
+            goto out;
+        }
+    }
+    /* After the bindings, as the RSP state contains the disk blocks written */
+    if (disk) {
+        xor_bytes(disk->data, disk->data, ref->disk, ref->disk_size);
+        if (psys_blockdev_update(disk_dev(rspb), 0, disk->data, ref->disk_size) < 0) {
+            goto out;
+        }
+    }
+    if (game_screen_read_state(screen, section_reader(&r, scr, 0)) < 0) {
+        goto out;
+    }
+    memcpy(extra, game->data, extra_size);
+    rv = 0;
+out:
+    for (i = 0; i < num_sections; ++i) {
+        free(sections[i].data);
+    }
+    return rv;
+}
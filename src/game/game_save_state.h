@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Save state format version 2.
+ *
+ * A header with magic, version, a hash of the reference image and a hash of
+ * the contents, followed by sections: frontend data, registers, memory, one
+ * per binding and screen. Every section is compressed with util_lz. Memory is
+ * stored as XOR delta against the pristine image after boot, which is mostly
+ * zeros, so a save is a small fraction of the size of a version 1 save
+ * (psys_save_state). The disk blocks written to are part of the RSP binding
+ * state; older saves have a separate section with the whole disk as XOR delta,
+ * which can still be loaded.
+ *
+ * Loading requires the same reference image: states can only be loaded into
+ * a game booted from the same disk image.
+ */
+#ifndef H_GAME_SAVE_STATE
+#define H_GAME_SAVE_STATE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct game_save_capture;
+struct game_save_ref;
+struct game_screen;
+struct psys_binding;
+struct psys_state;
+
+/** Capture the reference image: current memory, and the disk of RSP binding
+ * *rspb*. Call this right after booting.
+ */
+extern struct game_save_ref *game_save_ref_new(struct psys_state *psys, struct psys_binding *rspb);
+
+/** Destroy reference image. */
+extern void game_save_ref_destroy(struct game_save_ref *ref);
+
+/** Returns true if fd contains a version 2 state at the current position. The
+ * position is not changed.
+ */
+extern bool game_save_is_v2(FILE *fd);
+
+/** Save state of p-system, bindings and screen, as well as *extra_size*
+ * bytes of frontend data, to fd (return 0 on success).
+ */
+extern int game_save_state_v2(FILE *fd, const struct game_save_ref *ref, struct psys_state *psys, struct psys_binding *rspb,
+    struct game_screen *screen, const void *extra, size_t extra_size);
+
+/** Capture state for saving later, as game_save_state_v2 would save it.
+ * This only copies: it is fast enough to do while the game is running, and
+ * the game can continue right after. Returns NULL on error.
+ */
+extern struct game_save_capture *game_save_capture(const struct game_save_ref *ref, struct psys_state *psys, struct psys_binding *rspb,
+    struct game_screen *screen, const void *extra, size_t extra_size);
+
+/** Compress captured state and write it to fd (return 0 on success). This
+ * does not touch the game, so can be done on another thread. The reference
+ * image must be kept alive until it finishes.
+ */
+extern int game_save_capture_write(FILE *fd, const struct game_save_capture *cap);
+
+/** Free captured state. */
+extern void game_save_capture_free(struct game_save_capture *cap);
+
+/** Load state saved with game_save_state_v2 from fd (return 0 on success).
+ * Nothing is changed if the file is corrupt or was saved with a different
+ * reference image.
+ */
+extern int game_load_state_v2(FILE *fd, const struct game_save_ref *ref, struct psys_state *psys, struct psys_binding *rspb,
+    struct game_screen *screen, void *extra, size_t extra_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "game_saver.h"
+
+#include "game_save_state.h"
+#include "psys/psys_debug.h"
+#include "util/memutil.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct game_saver {
+    SDL_Thread *thread;
+    SDL_atomic_t status;
+    /* Owned by the thread while busy */
+    struct game_save_capture *cap;
+    char *filename;
+    char *tmp_filename;
+    struct game_saver_result result;
+};
+
+/* Write to temporary file, then move it over the target */
+static int write_file(struct game_saver *sv)
+{
+    FILE *f = fopen(sv->tmp_filename, "wb");
+    long size;
+    if (f == NULL) {
+        psys_debug("Error opening %s for writing\n", sv->tmp_filename);
+        return -1;
+    }
+    if (game_save_capture_write(f, sv->cap) < 0 || (size = ftell(f)) < 0) {
+        psys_debug("Error writing %s\n", sv->tmp_filename);
+        fclose(f);
+        remove(sv->tmp_filename);
+        return -1;
+    }
+    if (fclose(f) != 0) {
+        psys_debug("Error closing %s\n", sv->tmp_filename);
+        remove(sv->tmp_filename);
+        return -1;
+    }
+#ifdef _WIN32
+    /* rename does not replace existing files on Windows */
+    remove(sv->filename);
+#endif
+    if (rename(sv->tmp_filename, sv->filename) != 0) {
+        psys_debug("Error renaming %s to %s\n", sv->tmp_filename, sv->filename);
+        remove(sv->tmp_filename);
+        return -1;
+    }
+    sv->result.size = size;
+    return 0;
+}
+
+static int saver_thread(void *sv_)
+{
+    struct game_saver *sv = (struct game_saver *)sv_;
+    uint32_t start        = SDL_GetTicks();
+    int rv                = write_file(sv);
+    sv->result.time_ms    = SDL_GetTicks() - start;
+    game_save_capture_free(sv->cap);
+    sv->cap = NULL;
+    SDL_AtomicSet(&sv->status, rv < 0 ? GAME_SAVER_FAILED : GAME_SAVER_DONE);
+    return rv;
+}
+
+struct game_saver *new_game_saver(void)
+{
+    struct game_saver *sv = CALLOC_STRUCT(game_saver);
+    SDL_AtomicSet(&sv->status, GAME_SAVER_IDLE);
+    return sv;
+}
+
+void game_saver_destroy(struct game_saver *sv)
+{
+    if (sv->thread) {
+        SDL_WaitThread(sv->thread, NULL);
+    }
+    free(sv->filename);
+    free(sv->tmp_filename);
+    free(sv);
+}
+
+bool game_saver_start(struct game_saver *sv, struct game_save_capture *cap, const char *filename)
+{
+    size_t len = strlen(filename);
+    if (SDL_AtomicGet(&sv->status) != GAME_SAVER_IDLE) {
+        game_save_capture_free(cap);
+        return false;
+    }
+    free(sv->filename);
+    free(sv->tmp_filename);
+    sv->filename     = malloc(len + 1);
+    sv->tmp_filename = malloc(len + 5);
+    memcpy(sv->filename, filename, len + 1);
+    sprintf(sv->tmp_filename, "%s.tmp", filename);
+    memset(&sv->result, 0, sizeof(sv->result));
+    sv->result.filename = sv->filename;
+    sv->cap             = cap;
+    SDL_AtomicSet(&sv->status, GAME_SAVER_BUSY);
+    sv->thread = SDL_CreateThread(saver_thread, "saver_thread", sv);
+    if (!sv->thread) {
+        psys_debug("Could not create saver thread: %s\n", SDL_GetError());
+        game_save_capture_free(cap);
+        sv->cap = NULL;
+        SDL_AtomicSet(&sv->status, GAME_SAVER_FAILED);
+    }
+    return true;
+}
+
+enum game_saver_status game_saver_poll(struct game_saver *sv, struct game_saver_result *result)
+{
+    enum game_saver_status status = SDL_AtomicGet(&sv->status);
+    if (status == GAME_SAVER_DONE || status == GAME_SAVER_FAILED) {
+        if (sv->thread) {
+            SDL_WaitThread(sv->thread, NULL);
+            sv->thread = NULL;
+        }
+        *result = sv->result;
+        SDL_AtomicSet(&sv->status, GAME_SAVER_IDLE);
+    }
+    return status;
+}
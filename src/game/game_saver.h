@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Background writing of save states.
+ *
+ * State captured with game_save_capture is compressed and written on a
+ * separate thread, to a temporary file that replaces the target file when
+ * complete, so that an existing save is never left half-written. One save is
+ * in progress at a time. The saver must be used from one thread, which polls
+ * it for the result.
+ */
+#ifndef H_GAME_SAVER
+#define H_GAME_SAVER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct game_save_capture;
+struct game_saver;
+
+enum game_saver_status {
+    GAME_SAVER_IDLE,   /* no save in progress */
+    GAME_SAVER_BUSY,   /* writing */
+    GAME_SAVER_DONE,   /* finished succesfully */
+    GAME_SAVER_FAILED, /* finished with an error */
+};
+
+/** Result of a finished save */
+struct game_saver_result {
+    const char *filename;
+    size_t size;      /* size of file written */
+    uint32_t time_ms; /* time taken to compress and write */
+};
+
+/** Create saver. */
+extern struct game_saver *new_game_saver(void);
+
+/** Destroy saver, waiting for the save in progress to finish. */
+extern void game_saver_destroy(struct game_saver *sv);
+
+/** Start writing captured state to *filename* in the background. The saver
+ * takes ownership of the capture. Returns false (and frees the capture) if the
+ * previous save is still in progress or its result has not been polled.
+ */
+extern bool game_saver_start(struct game_saver *sv, struct game_save_capture *cap, const char *filename);
+
+/** Poll status. GAME_SAVER_DONE or GAME_SAVER_FAILED is returned once when a
+ * save finishes, with details in *result* (valid until the next save is
+ * started). After that the saver is idle again.
+ */
+extern enum game_saver_status game_saver_poll(struct game_saver *sv, struct game_saver_result *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
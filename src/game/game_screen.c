@@ -6,12 +6,10 @@
 #include "game_screen.h"
 
 #include "psys/psys_debug.h"
+#include "psys/psys_serialize.h"
 #include "util/memutil.h"
 #include "util/util_img.h"
 #include "util/util_minmax.h"
-#include "util/util_save_state.h"
-
-#include "SDL.h"
 
 /* make sure M_PI is defined */
 #include <math.h>
@@ -19,8 +17,10 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+#include <string.h>
+
 /* Header for savestates */
-#define GAME_SDLSCREEN_STATE_ID 0x53444c53
+#define GAME_SCREEN_STATE_ID 0x53444c53
 
 /** Rectangle structure used for clipping rectangle.
  */
@@ -31,10 +31,10 @@ struct rect {
 static const struct rect fullscreen = { 0, 0, SCREEN_WIDTH - 1, SCREEN_HEIGHT - 1 };
 
 /** Cursor info */
-#define CURSOR_WIDTH 32
+#define CURSOR_WIDTH GAME_SCREEN_CURSOR_WIDTH
 #define CURSOR_SIZE (CURSOR_WIDTH * CURSOR_WIDTH / 8)
 
-/** SDL screen implementation. We implement our own line and arc drawing
+/** Software screen implementation. We implement our own line and arc drawing
  * functions instead of rendering to a texture using OpenGL because
  * - The number of draws is so low, that the overhead of doing it in software
  *   is minimal.
@@ -42,9 +42,11 @@ static const struct rect fullscreen = { 0, 0, SCREEN_WIDTH - 1, SCREEN_HEIGHT -
  * - The interpreter runs in its own thread, and synchronization is much easier
  *   if we don't have to take cross-thread OpenGL rendering into account.
  */
-struct sdl_screen {
+struct soft_screen {
     struct game_screen base;
-    SDL_mutex *mutex;
+    /* Locking, NULL if only used from one thread */
+    const struct game_screen_mutex_ops *mutex_ops;
+    void *mutex;
 
     /** The screen - represented as a simple grid of pixels, one byte per
      * pixel, with a pointer to every row for easy access. Only indexes 0-15
@@ -76,16 +78,30 @@ struct sdl_screen {
 
     /** Current mouse state. */
     struct {
-        SDL_mutex *mutex;
+        void *mutex;
         int x;
         int y;
         unsigned buttons;
     } mouse;
 };
 
-static inline struct sdl_screen *sdl_screen(struct game_screen *base)
+static inline struct soft_screen *soft_screen(struct game_screen *base)
+{
+    return (struct soft_screen *)base;
+}
+
+static inline void lock_mutex(struct soft_screen *screen, void *mutex)
 {
-    return (struct sdl_screen *)base;
+    if (screen->mutex_ops) {
+        screen->mutex_ops->lock(mutex);
+    }
+}
+
+static inline void unlock_mutex(struct soft_screen *screen, void *mutex)
+{
+    if (screen->mutex_ops) {
+        screen->mutex_ops->unlock(mutex);
+    }
 }
 
 /** Draw a pixel, taking vr_mode into account, the GEM drawing mode
@@ -180,54 +196,54 @@ static void draw_arc(uint8_t **rows,
     }
 }
 
-static void sdlscreen_v_pline(struct game_screen *screen_,
+static void softscreen_v_pline(struct game_screen *screen_,
     unsigned vr_mode, unsigned line_color, unsigned line_width,
     unsigned count,
     int *coordinates)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     unsigned i;
 #if 0
     psys_debug("screen v_pline vr=%d col=%d width=%d count=%d\n", vr_mode, line_color, line_width, count);
 #endif
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     for (i = 1; i < count; ++i) {
         draw_line(screen->rows, coordinates[i * 2 - 2], coordinates[i * 2 - 1], coordinates[i * 2 + 0], coordinates[i * 2 + 1],
             vr_mode, line_color, line_width, &screen->clip);
     }
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_v_ellarc(struct game_screen *screen_,
+static void softscreen_v_ellarc(struct game_screen *screen_,
     unsigned vr_mode, unsigned line_color, unsigned line_width,
     int x, int y, int xradius, int yradius,
     int begang, int endang)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
 #if 0
     psys_debug("screen v_ellarc vr=%d col=%d width=%d (%d,%d) (%d,%d) (%d,%d)\n",
         vr_mode, line_color, line_width,
         x, y, xradius, yradius,
         begang, endang);
 #endif
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     draw_arc(screen->rows, vr_mode, line_color, line_width, x, y, xradius, yradius, begang, endang, &screen->clip);
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_vr_recfl(struct game_screen *screen_,
+static void softscreen_vr_recfl(struct game_screen *screen_,
     unsigned vr_mode, unsigned fill_color,
     int dx0, int dy0, int dx1, int dy1)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     int dx, dy;
 #if 0
     psys_debug("screen vr_recfl vr=%d col=%d %d,%d %d,%d\n", vr_mode, fill_color, dx0, dy0, dx1, dy1);
 #endif
 
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     for (dy = dy0; dy <= dy1; ++dy) {
         if (dy < screen->clip.y0 || dy > screen->clip.y1) {
             continue;
@@ -241,13 +257,13 @@ static void sdlscreen_vr_recfl(struct game_screen *screen_,
         }
     }
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_v_show_c(struct game_screen *screen_,
+static void softscreen_v_show_c(struct game_screen *screen_,
     bool visible)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     (void)screen;
     /* Mouse hide/show is ignored. On Atari ST this is done before
      * and after every draw operation, but on modern hardware with hardware
@@ -255,10 +271,10 @@ static void sdlscreen_v_show_c(struct game_screen *screen_,
      */
 }
 
-static void sdlscreen_vs_clip(struct game_screen *screen_,
+static void softscreen_vs_clip(struct game_screen *screen_,
     bool enable, int x0, int y0, int x1, int y1)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
 #if 0
     psys_debug("screen vs_clip %d %d,%d %d,%d\n", enable, x0, y0, x1, y1);
 #endif
@@ -275,13 +291,13 @@ static void sdlscreen_vs_clip(struct game_screen *screen_,
     }
 }
 
-static void sdlscreen_vro_cpyfm(struct game_screen *screen_,
+static void softscreen_vro_cpyfm(struct game_screen *screen_,
     unsigned vr_mode,
     uint8_t *src, unsigned src_width, unsigned src_height, unsigned src_wdwidth,
     int sx0, int sy0, int sx1, int sy1,
     int dx0, int dy0, int dx1, int dy1)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     int dx, dy;
 #if 0
     psys_debug("screen vro_cpyfm vr=%d %p[%d %d %d] (%d,%d,%d,%d) -> (%d,%d,%d,%d)\n",
@@ -290,7 +306,7 @@ static void sdlscreen_vro_cpyfm(struct game_screen *screen_,
             sx0, sy0, sx1, sy1,
             dx0, dy0, dx1, dy1);
 #endif
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     /* If the sizes of both rasters don't match, then the size of the source raster
      * will be used.
      */
@@ -333,16 +349,16 @@ static void sdlscreen_vro_cpyfm(struct game_screen *screen_,
         }
     }
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_vrt_cpyfm(struct game_screen *screen_,
+static void softscreen_vrt_cpyfm(struct game_screen *screen_,
     unsigned vr_mode, unsigned col0, unsigned col1,
     const uint8_t *src, unsigned src_width, unsigned src_height, unsigned src_wdwidth,
     int sx0, int sy0, int sx1, int sy1,
     int dx0, int dy0, int dx1, int dy1)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     int dx, dy;
 #if 0
     psys_debug("screen vrt_cpyfm vr=%d %p[%d %d %d] (%d,%d,%d,%d), col0 %d col1 %d -> (%d,%d,%d,%d)\n",
@@ -359,7 +375,7 @@ static void sdlscreen_vrt_cpyfm(struct game_screen *screen_,
         dx1 = dx0 + (sx1 - sx0);
         dy1 = dy0 + (sy1 - sy0);
     }
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     /* Draw B/W image data.
      * Every byte in the source image will have 8 pixels, arranged MSB to LSB.
      * The 0/1 states are converted to color depending on col0 and col1 respectively.
@@ -383,19 +399,19 @@ static void sdlscreen_vrt_cpyfm(struct game_screen *screen_,
         }
     }
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_vsc_form(struct game_screen *screen_,
+static void softscreen_vsc_form(struct game_screen *screen_,
     uint16_t *mform)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     int y;
     psys_debug("screen vsc_form\n");
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     screen->cursor_hot_x = ((int16_t)mform[0]) * 2;
     screen->cursor_hot_y = ((int16_t)mform[1]) * 2;
-    /* Convert to SDL format, and blow up 16x16 cursor to 32x32 */
+    /* Convert to 1-bit data and mask, and blow up 16x16 cursor to 32x32 */
     for (y = 0; y < 16; ++y) {
         uint32_t data = double_bits16(~mform[21 + y] & mform[5 + y]);
         uint32_t mask = double_bits16(mform[5 + y]);
@@ -421,59 +437,61 @@ static void sdlscreen_vsc_form(struct game_screen *screen_,
             = screen->cursor_mask[y * 8 + 7] = mask & 0xff;
     }
     screen->cursor_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
     (void)screen;
 }
 
-static void sdlscreen_vq_mouse(struct game_screen *screen_,
+static void softscreen_vq_mouse(struct game_screen *screen_,
     unsigned *buttons, int *x, int *y)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
 
-    SDL_LockMutex(screen->mouse.mutex);
+    lock_mutex(screen, screen->mouse.mutex);
     *x       = screen->mouse.x;
     *y       = screen->mouse.y;
     *buttons = screen->mouse.buttons;
-    SDL_UnlockMutex(screen->mouse.mutex);
+    unlock_mutex(screen, screen->mouse.mutex);
 }
 
-static void sdlscreen_set_color(struct game_screen *screen_,
+static void softscreen_set_color(struct game_screen *screen_,
     unsigned index, unsigned color)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
-    SDL_LockMutex(screen->mutex);
+    struct soft_screen *screen = soft_screen(screen_);
+    lock_mutex(screen, screen->mutex);
     screen->palette[index] = color;
     screen->palette_dirty  = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_destroy(struct game_screen *screen_)
+static void softscreen_destroy(struct game_screen *screen_)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
-    SDL_DestroyMutex(screen->mutex);
-    SDL_DestroyMutex(screen->mouse.mutex);
+    struct soft_screen *screen = soft_screen(screen_);
+    if (screen->mutex_ops) {
+        screen->mutex_ops->destroy(screen->mutex);
+        screen->mutex_ops->destroy(screen->mouse.mutex);
+    }
     free(screen);
 }
 
-static void sdlscreen_draw_image(struct game_screen *screen_,
+static void softscreen_draw_image(struct game_screen *screen_,
     uint8_t *src, int src_width, int src_height,
     int x, int y)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     int sy;
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     for (sy = 0; sy < src_height; ++sy) {
         memcpy(screen->rows[sy + y] + x, &src[src_width * sy], src_width);
     }
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_get_image(struct game_screen *screen_,
+static void softscreen_get_image(struct game_screen *screen_,
     int sx, int sy, int width, int height,
     const uint8_t **image_ptr, unsigned *bytes_per_line)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     /* This does not need a mutex because we're the only ones writing
      * to the screen, and will always read back what we wrote. The mutex is for
      * synchronizing with the render thread, something we don't have to do here.
@@ -486,18 +504,18 @@ static void sdlscreen_get_image(struct game_screen *screen_,
     *bytes_per_line = SCREEN_WIDTH;
 }
 
-static void sdlscreen_draw_sprite(struct game_screen *screen_,
+static void softscreen_draw_sprite(struct game_screen *screen_,
     int x, int y, const uint8_t *pattern,
     const uint8_t *colors,
     int width, int height, unsigned bytes_per_line)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     int cx, cy;
     if (x < 0 || y < 0 || (x + width) > SCREEN_WIDTH || (y + height) > SCREEN_HEIGHT) {
         psys_debug("draw_sprite: out-of-screen access\n");
         return;
     }
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     for (cy = 0; cy < height; ++cy) {
         for (cx = 0; cx < width; ++cx) {
             if (pattern[cy] & (1 << (~cx & 7))) {
@@ -506,20 +524,20 @@ static void sdlscreen_draw_sprite(struct game_screen *screen_,
         }
     }
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_move(struct game_screen *screen_,
+static void softscreen_move(struct game_screen *screen_,
     int dx, int dy, int sx, int sy,
     int width, int height)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     int cx, cy;
     if (dx < 0 || dy < 0 || (dx + width) > SCREEN_WIDTH || (dy + height) > SCREEN_HEIGHT || sx < 0 || sy < 0 || (sx + width) > SCREEN_WIDTH || (sy + height) > SCREEN_HEIGHT) {
         psys_debug("move: out-of-screen access\n");
         return;
     }
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     /* [dest > src]
      * a[x+1] = a[x];
      * [forward]          [reverse]
@@ -558,32 +576,32 @@ static void sdlscreen_move(struct game_screen *screen_,
         }
     }
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-static void sdlscreen_vblank_interrupt(struct game_screen *screen_)
+static void softscreen_vblank_interrupt(struct game_screen *screen_)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     (void)screen;
     if (screen->vblank_cb) {
         screen->vblank_cb(screen_, screen->vblank_cb_arg);
     }
 }
 
-static void sdlscreen_add_vblank_cb(struct game_screen *screen_, game_screen_vblank_func *f, void *arg)
+static void softscreen_add_vblank_cb(struct game_screen *screen_, game_screen_vblank_func *f, void *arg)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
 
     screen->vblank_cb     = f;
     screen->vblank_cb_arg = arg;
 }
 
-static void sdlscreen_draw_points(struct game_screen *screen_, unsigned vr_mode, struct game_screen_point *points, unsigned npoints)
+static void softscreen_draw_points(struct game_screen *screen_, unsigned vr_mode, struct game_screen_point *points, unsigned npoints)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     unsigned i;
     const struct rect *clip = &fullscreen;
-    SDL_LockMutex(screen->mutex);
+    lock_mutex(screen, screen->mutex);
     for (i = 0; i < npoints; ++i) {
         if (points[i].y < clip->y0 || points[i].y > clip->y1
             || points[i].x < clip->x0 || points[i].x > clip->x1) {
@@ -592,34 +610,37 @@ static void sdlscreen_draw_points(struct game_screen *screen_, unsigned vr_mode,
         draw_pixel(vr_mode, screen->rows[points[i].y], points[i].x, 1, 0, points[i].color);
     }
     screen->buffer_dirty = true;
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
 }
 
-struct game_screen *new_game_screen(void)
+struct game_screen *new_game_screen(const struct game_screen_mutex_ops *mutex_ops)
 {
-    struct sdl_screen *screen = CALLOC_STRUCT(sdl_screen);
+    struct soft_screen *screen = CALLOC_STRUCT(soft_screen);
     int i;
-    screen->base.v_pline          = &sdlscreen_v_pline;
-    screen->base.v_ellarc         = &sdlscreen_v_ellarc;
-    screen->base.vr_recfl         = &sdlscreen_vr_recfl;
-    screen->base.v_show_c         = &sdlscreen_v_show_c;
-    screen->base.vs_clip          = &sdlscreen_vs_clip;
-    screen->base.vro_cpyfm        = &sdlscreen_vro_cpyfm;
-    screen->base.vrt_cpyfm        = &sdlscreen_vrt_cpyfm;
-    screen->base.vsc_form         = &sdlscreen_vsc_form;
-    screen->base.vq_mouse         = &sdlscreen_vq_mouse;
-    screen->base.set_color        = &sdlscreen_set_color;
-    screen->base.draw_image       = &sdlscreen_draw_image;
-    screen->base.get_image        = &sdlscreen_get_image;
-    screen->base.draw_sprite      = &sdlscreen_draw_sprite;
-    screen->base.move             = &sdlscreen_move;
-    screen->base.vblank_interrupt = &sdlscreen_vblank_interrupt;
-    screen->base.add_vblank_cb    = &sdlscreen_add_vblank_cb;
-    screen->base.draw_points      = &sdlscreen_draw_points;
-    screen->base.destroy          = &sdlscreen_destroy;
-
-    screen->mutex       = SDL_CreateMutex();
-    screen->mouse.mutex = SDL_CreateMutex();
+    screen->base.v_pline          = &softscreen_v_pline;
+    screen->base.v_ellarc         = &softscreen_v_ellarc;
+    screen->base.vr_recfl         = &softscreen_vr_recfl;
+    screen->base.v_show_c         = &softscreen_v_show_c;
+    screen->base.vs_clip          = &softscreen_vs_clip;
+    screen->base.vro_cpyfm        = &softscreen_vro_cpyfm;
+    screen->base.vrt_cpyfm        = &softscreen_vrt_cpyfm;
+    screen->base.vsc_form         = &softscreen_vsc_form;
+    screen->base.vq_mouse         = &softscreen_vq_mouse;
+    screen->base.set_color        = &softscreen_set_color;
+    screen->base.draw_image       = &softscreen_draw_image;
+    screen->base.get_image        = &softscreen_get_image;
+    screen->base.draw_sprite      = &softscreen_draw_sprite;
+    screen->base.move             = &softscreen_move;
+    screen->base.vblank_interrupt = &softscreen_vblank_interrupt;
+    screen->base.add_vblank_cb    = &softscreen_add_vblank_cb;
+    screen->base.draw_points      = &softscreen_draw_points;
+    screen->base.destroy          = &softscreen_destroy;
+
+    if (mutex_ops) {
+        screen->mutex_ops   = mutex_ops;
+        screen->mutex       = mutex_ops->create();
+        screen->mouse.mutex = mutex_ops->create();
+    }
 
     /* Set up row pointers for easy access */
     for (i = 0; i < SCREEN_HEIGHT; ++i) {
@@ -648,11 +669,11 @@ struct game_screen *new_game_screen(void)
     return &screen->base;
 }
 
-bool game_sdlscreen_update_textures(struct game_screen *screen_, void *data, update_texture_func *update_texture, update_palette_func *update_palette)
+bool game_screen_update_textures(struct game_screen *screen_, void *data, update_texture_func *update_texture, update_palette_func *update_palette)
 {
-    bool updated              = false;
-    struct sdl_screen *screen = sdl_screen(screen_);
-    SDL_LockMutex(screen->mutex);
+    bool updated               = false;
+    struct soft_screen *screen = soft_screen(screen_);
+    lock_mutex(screen, screen->mutex);
     if (screen->buffer_dirty) {
         update_texture(data, screen->buffer);
         screen->buffer_dirty = false;
@@ -664,17 +685,16 @@ bool game_sdlscreen_update_textures(struct game_screen *screen_, void *data, upd
         screen->palette_dirty = false;
         updated               = true;
     }
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
     return updated;
 }
 
-void game_sdlscreen_update_cursor(struct game_screen *screen_, void **cursor)
+bool game_screen_update_cursor(struct game_screen *screen_, void *data, update_cursor_func *update_cursor)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
-    SDL_Cursor *oldcursor     = (SDL_Cursor *)*cursor;
-    SDL_Cursor *newcursor;
-    SDL_LockMutex(screen->mutex);
-    if (screen->cursor_dirty) { /* Only create a new cursor if it was updated */
+    bool updated               = false;
+    struct soft_screen *screen = soft_screen(screen_);
+    lock_mutex(screen, screen->mutex);
+    if (screen->cursor_dirty) {
         bool cursor_set = false;
         int i;
         /* First, make sure a cursor is actually set */
@@ -684,77 +704,105 @@ void game_sdlscreen_update_cursor(struct game_screen *screen_, void **cursor)
             }
         }
         if (cursor_set) {
-            newcursor = SDL_CreateCursor(screen->cursor_data, screen->cursor_mask, CURSOR_WIDTH, CURSOR_WIDTH, screen->cursor_hot_x, screen->cursor_hot_y);
+            update_cursor(data, screen->cursor_data, screen->cursor_mask, screen->cursor_hot_x, screen->cursor_hot_y);
         } else { /* Back to system cursor */
-            newcursor = NULL;
-        }
-        SDL_SetCursor(newcursor);
-        *cursor = newcursor;
-        if (oldcursor) {
-            SDL_FreeCursor(oldcursor);
+            update_cursor(data, NULL, NULL, 0, 0);
         }
+        screen->cursor_dirty = false;
+        updated              = true;
     }
-    SDL_UnlockMutex(screen->mutex);
+    unlock_mutex(screen, screen->mutex);
+    return updated;
 }
 
-int game_sdlscreen_save_state(struct game_screen *screen_, FILE *fd)
+int game_screen_write_state(struct game_screen *screen_, struct psys_writer *w)
 {
     /* Must be called without the interpreter thread running,
      * so no locking is needed.
      */
-    struct sdl_screen *screen = sdl_screen(screen_);
-    uint32_t id               = GAME_SDLSCREEN_STATE_ID;
+    struct soft_screen *screen = soft_screen(screen_);
+    uint32_t id                = GAME_SCREEN_STATE_ID;
     /* Save screen state */
-    if (FD_WRITE(fd, id)
-        || FD_WRITE(fd, screen->buffer)
-        || FD_WRITE(fd, screen->palette)
-        || FD_WRITE(fd, screen->cursor_data)
-        || FD_WRITE(fd, screen->cursor_mask)
-        || FD_WRITE(fd, screen->cursor_hot_x)
-        || FD_WRITE(fd, screen->cursor_hot_y)
-        || FD_WRITE(fd, screen->clip)) {
+    if (PSYS_WRITE(w, id)
+        || psys_write_ref(w, screen->buffer, sizeof(screen->buffer))
+        || PSYS_WRITE(w, screen->palette)
+        || PSYS_WRITE(w, screen->cursor_data)
+        || PSYS_WRITE(w, screen->cursor_mask)
+        || PSYS_WRITE(w, screen->cursor_hot_x)
+        || PSYS_WRITE(w, screen->cursor_hot_y)
+        || PSYS_WRITE(w, screen->clip)) {
         return -1;
     }
     return 0;
 }
 
-int game_sdlscreen_load_state(struct game_screen *screen_, FILE *fd)
+int game_screen_read_state(struct game_screen *screen_, struct psys_reader *r)
 {
-    /* Must be called without the interpreter thread running,
-     * so no locking is needed.
+    /* Can be called from the interpreter thread (e.g. for rewinding), so
+     * take the lock against concurrent texture updates.
      */
-    struct sdl_screen *screen = sdl_screen(screen_);
+    struct soft_screen *screen = soft_screen(screen_);
     uint32_t id;
+    int rv = -1;
     /* Load screen state */
-    if (FD_READ(fd, id)) {
+    if (PSYS_READ(r, id)) {
         return -1;
     }
-    if (id != GAME_SDLSCREEN_STATE_ID) {
+    if (id != GAME_SCREEN_STATE_ID) {
         psys_debug("Invalid game screen state record %08x\n", id);
         return -1;
     }
-    if (FD_READ(fd, screen->buffer)
-        || FD_READ(fd, screen->palette)
-        || FD_READ(fd, screen->cursor_data)
-        || FD_READ(fd, screen->cursor_mask)
-        || FD_READ(fd, screen->cursor_hot_x)
-        || FD_READ(fd, screen->cursor_hot_y)
-        || FD_READ(fd, screen->clip)) {
-        return -1;
+    lock_mutex(screen, screen->mutex);
+    if (!(PSYS_READ(r, screen->buffer)
+            || PSYS_READ(r, screen->palette)
+            || PSYS_READ(r, screen->cursor_data)
+            || PSYS_READ(r, screen->cursor_mask)
+            || PSYS_READ(r, screen->cursor_hot_x)
+            || PSYS_READ(r, screen->cursor_hot_y)
+            || PSYS_READ(r, screen->clip))) {
+        rv = 0;
     }
     /* Mark everything as dirty after load */
     screen->buffer_dirty  = true;
     screen->palette_dirty = true;
     screen->cursor_dirty  = true;
-    return 0;
+    unlock_mutex(screen, screen->mutex);
+    return rv;
+}
+
+int game_screen_save_state(struct game_screen *screen, FILE *fd)
+{
+    struct psys_writer w;
+    int rv;
+    psys_writer_init(&w);
+    rv = game_screen_write_state(screen, &w);
+    if (rv == 0) {
+        rv = psys_writer_fwrite(&w, fd);
+    }
+    psys_writer_free(&w);
+    return rv;
+}
+
+int game_screen_load_state(struct game_screen *screen, FILE *fd)
+{
+    struct psys_reader r;
+    int rv;
+    if (psys_reader_fopen(&r, fd) < 0) {
+        return -1;
+    }
+    rv = game_screen_read_state(screen, &r);
+    if (psys_reader_fclose(&r, fd) < 0) {
+        rv = -1;
+    }
+    return rv;
 }
 
-void game_sdlscreen_update_mouse(struct game_screen *screen_, int x, int y, unsigned buttons)
+void game_screen_update_mouse(struct game_screen *screen_, int x, int y, unsigned buttons)
 {
-    struct sdl_screen *screen = sdl_screen(screen_);
-    SDL_LockMutex(screen->mouse.mutex);
+    struct soft_screen *screen = soft_screen(screen_);
+    lock_mutex(screen, screen->mouse.mutex);
     screen->mouse.x       = x;
     screen->mouse.y       = y;
     screen->mouse.buttons = buttons;
-    SDL_UnlockMutex(screen->mouse.mutex);
+    unlock_mutex(screen, screen->mouse.mutex);
 }
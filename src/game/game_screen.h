@@ -19,7 +19,12 @@ extern "C" {
 #define SCREEN_HEIGHT 200
 #define SCREEN_COLORS 16
 
+/* Width and height of (1-bit) mouse cursor image */
+#define GAME_SCREEN_CURSOR_WIDTH 32
+
 struct game_screen;
+struct psys_reader;
+struct psys_writer;
 
 typedef void(game_screen_vblank_func)(struct game_screen *screen, void *arg);
 
@@ -105,7 +110,21 @@ struct game_screen {
     void (*destroy)(struct game_screen *screen);
 };
 
-struct game_screen *new_game_screen(void);
+/* Mutex operations, for a screen that is drawn to by the interpreter thread
+ * while another thread reads it or updates the mouse state.
+ */
+struct game_screen_mutex_ops {
+    void *(*create)(void);
+    void (*destroy)(void *mutex);
+    void (*lock)(void *mutex);
+    void (*unlock)(void *mutex);
+};
+
+/** Create software-rendered screen. The screen is kept in memory, one byte
+ * per pixel. If mutex_ops is NULL, no locking is done and the screen must only
+ * be used from one thread.
+ */
+struct game_screen *new_game_screen(const struct game_screen_mutex_ops *mutex_ops);
 
 /* internal - communication between render/input thread
  * and interpreter thread
@@ -114,18 +133,28 @@ struct game_screen *new_game_screen(void);
 /** This gets passed the buffer and palette respectively, when dirty. */
 typedef void(update_texture_func)(void *data, const uint8_t *buffer);
 typedef void(update_palette_func)(void *data, const uint16_t *palette);
+/** This gets passed the cursor image and mask (GAME_SCREEN_CURSOR_WIDTH
+ * square, 1 bit per pixel) when changed, or NULL for the default cursor.
+ */
+typedef void(update_cursor_func)(void *data, const uint8_t *cursor_data, const uint8_t *cursor_mask, int hot_x, int hot_y);
+
+bool game_screen_update_textures(struct game_screen *screen, void *data, update_texture_func *update_texture, update_palette_func *update_palette);
+bool game_screen_update_cursor(struct game_screen *screen, void *data, update_cursor_func *update_cursor);
+
+/** Save screen state to writer (return 0 on success) */
+extern int game_screen_write_state(struct game_screen *b, struct psys_writer *w);
 
-bool game_sdlscreen_update_textures(struct game_screen *screen, void *data, update_texture_func *update_texture, update_palette_func *update_palette);
-void game_sdlscreen_update_cursor(struct game_screen *screen, void **cursor);
+/** Load screen state from reader (return 0 on success) */
+extern int game_screen_read_state(struct game_screen *b, struct psys_reader *r);
 
 /** Save screen state to fd (return 0 on success) */
-extern int game_sdlscreen_save_state(struct game_screen *b, FILE *fd);
+extern int game_screen_save_state(struct game_screen *b, FILE *fd);
 
 /** Load screen state from fd (return 0 on success) */
-extern int game_sdlscreen_load_state(struct game_screen *b, FILE *fd);
+extern int game_screen_load_state(struct game_screen *b, FILE *fd);
 
 /** Update mouse state */
-extern void game_sdlscreen_update_mouse(struct game_screen *b, int x, int y, unsigned buttons);
+extern void game_screen_update_mouse(struct game_screen *b, int x, int y, unsigned buttons);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "game_screen_sdl.h"
+
+#include "SDL.h"
+
+static void *sdl_mutex_create(void)
+{
+    return SDL_CreateMutex();
+}
+
+static void sdl_mutex_destroy(void *mutex)
+{
+    SDL_DestroyMutex((SDL_mutex *)mutex);
+}
+
+static void sdl_mutex_lock(void *mutex)
+{
+    SDL_LockMutex((SDL_mutex *)mutex);
+}
+
+static void sdl_mutex_unlock(void *mutex)
+{
+    SDL_UnlockMutex((SDL_mutex *)mutex);
+}
+
+static const struct game_screen_mutex_ops sdl_mutex_ops = {
+    sdl_mutex_create,
+    sdl_mutex_destroy,
+    sdl_mutex_lock,
+    sdl_mutex_unlock,
+};
+
+struct game_screen *new_game_sdlscreen(void)
+{
+    return new_game_screen(&sdl_mutex_ops);
+}
+
+static void sdlscreen_update_cursor(void *data, const uint8_t *cursor_data, const uint8_t *cursor_mask, int hot_x, int hot_y)
+{
+    SDL_Cursor **cursor   = (SDL_Cursor **)data;
+    SDL_Cursor *oldcursor = *cursor;
+    SDL_Cursor *newcursor = NULL; /* Back to system cursor */
+    if (cursor_data) {
+        newcursor = SDL_CreateCursor(cursor_data, cursor_mask, GAME_SCREEN_CURSOR_WIDTH, GAME_SCREEN_CURSOR_WIDTH, hot_x, hot_y);
+    }
+    SDL_SetCursor(newcursor);
+    *cursor = newcursor;
+    if (oldcursor) {
+        SDL_FreeCursor(oldcursor);
+    }
+}
+
+void game_sdlscreen_update_cursor(struct game_screen *screen, void **cursor)
+{
+    game_screen_update_cursor(screen, cursor, &sdlscreen_update_cursor);
+}
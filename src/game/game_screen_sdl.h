@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* SDL glue for the software-rendered game screen. */
+#ifndef H_GAME_SCREEN_SDL
+#define H_GAME_SCREEN_SDL
+
+#include "game_screen.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Create a screen that is shared between the interpreter thread and the
+ * render thread, using SDL mutexes.
+ */
+struct game_screen *new_game_sdlscreen(void);
+
+/** Set the SDL mouse cursor if it changed. *cursor is the current SDL_Cursor,
+ * or NULL for the system cursor.
+ */
+void game_sdlscreen_update_cursor(struct game_screen *screen, void **cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
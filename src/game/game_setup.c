@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "game_setup.h"
+
+#ifdef GAME_COMPILED
+#include "game/game_compiled.h"
+#endif
+#include "game/game_clock.h"
+#include "game/game_gembind.h"
+#include "game/game_shiplib.h"
+#include "psys/psys_bindings.h"
+#include "psys/psys_blockdev.h"
+#include "psys/psys_bootstrap.h"
+#include "psys/psys_constants.h"
+#include "psys/psys_debug.h"
+#include "psys/psys_helpers.h"
+#include "psys/psys_rsp.h"
+#include "psys/psys_state.h"
+#include "util/memutil.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static void special_disk_handler(void *data, int disk, unsigned srcblk, bool wr)
+{
+    /*
+     * Patch for copy protection:
+     * > I've done some reverse engineering to figure out a bit more about the copy
+     * > protection mechanism used by Atart ST Sundog.  Part of the trick is that
+     * > track 3 of the floppy disk has 10 sectors rather than the standard 9 sectors.
+     * > The additional sector is a duplicate of sector 5 (that is, there are two
+     * > sectors that both identify as sector 5.)  The contents of these two sectors
+     * > is identical except that the byte at offset 0x113 (275) is set to 0xBC in one
+     * > sector and to 0xA2 in the other.  In addition, the sectors on track 3 are
+     * > written in this order (1, 4, 7, 5, 2, 5, 8, 3, 6, 9).  This means that the
+     * > code can control which version of sector 5 it reads by varying which sector
+     * > it reads before it tries to read sector 5.
+     * - Wayne Holder
+     */
+    struct psys_blockdev *disk0 = (struct psys_blockdev *)data;
+    if (srcblk < 9) {
+        const int secret_offset = (5 - 1) * 512 + 0x113;
+        psys_byte value;
+        if (srcblk == (5 - 1)) {
+#ifdef DEBUG_INTEGRITY_CHECK
+            printf("Reading track 3 sector 5: %02x\n", psys_blockdev_read(disk0, 5 - 1)[0x113]);
+#endif
+            return;
+        } else if (srcblk == (2 - 1) || srcblk == (8 - 1)) { /* Visited sector 2 or 8 first, special value. */
+#ifdef DEBUG_INTEGRITY_CHECK
+            printf("Reading track 3 sector %d -> setting 0xa2\n", srcblk + 1);
+#endif
+            value = 0xa2;
+        } else { /* Visited any other sector first, normal value. */
+#ifdef DEBUG_INTEGRITY_CHECK
+            printf("Reading track 3 sector %d -> setting 0xbc\n", srcblk + 1);
+#endif
+            value = 0xbc;
+        }
+        psys_blockdev_update(disk0, secret_offset, &value, 1);
+    }
+}
+
+bool game_load_disk_image(const char *filename, psys_byte *image)
+{
+    FILE *f = fopen(filename, "rb");
+    bool ok;
+    if (!f) {
+        fprintf(stderr, "Could not open disk image %s\n", filename);
+        return false;
+    }
+    ok = fread(image, 1, GAME_DISK_SIZE, f) == GAME_DISK_SIZE;
+    if (!ok) {
+        fprintf(stderr, "Could not read disk image\n");
+    }
+    fclose(f);
+    return ok;
+}
+
+struct psys_blockdev *game_open_disk_image(const char *filename)
+{
+    struct psys_blockdev *disk = psys_blockdev_open_file(filename, GAME_DISK_SIZE / PSYS_BLOCK_SIZE, GAME_DISK_FIRST_BLOCK);
+    if (!disk) {
+        fprintf(stderr, "Could not open disk image %s\n", filename);
+    }
+    return disk;
+}
+
+/** Set up RSP, clock and game bindings for a p-system */
+static void setup_bindings(struct psys_state *state, struct psys_blockdev *disk, struct game_screen *screen, struct game_sound *sound, unsigned vblank_insns, bool paced, struct game_clock **clock_out, struct psys_binding **rspb_out)
+{
+    struct psys_binding *rspb;
+    struct game_clock *clock = NULL;
+
+    /* Debug setting */
+    state->debug = PSYS_DBG_WARNING;
+    {
+        const char *x = getenv("PSYS_DEBUG");
+        if (x) {
+            state->debug = strtol(x, NULL, 0);
+        }
+    }
+
+    /* set up RSP and disk */
+    rspb = psys_new_rsp(state);
+    psys_rsp_set_blockdev(rspb, 0, disk, GAME_DISK_TRACK_SIZE, true);
+    psys_rsp_set_pre_access_hook(rspb, special_disk_handler, disk);
+    if (rspb_out) {
+        *rspb_out = rspb;
+    }
+
+    /* Set up clock */
+    if (vblank_insns) {
+        clock = new_game_clock_virtual(state, vblank_insns, paced);
+    }
+    if (clock_out) {
+        *clock_out = clock;
+    }
+
+    /* Set up bindings */
+    psys_register_binding(state, rspb);
+    psys_register_binding(state, new_shiplib(state, screen, sound, clock));
+    psys_register_binding(state, new_gembind(state, screen, sound, clock));
+#ifdef GAME_COMPILED
+    game_register_compiled(state);
+#endif
+}
+
+struct psys_state *game_setup_state(const psys_byte *image, struct game_screen *screen, struct game_sound *sound, unsigned vblank_insns, bool paced, struct game_clock **clock_out, struct psys_binding **rspb_out)
+{
+    psys_byte *disk_data = malloc(GAME_DISK_SIZE);
+    memcpy(disk_data, image, GAME_DISK_SIZE);
+    return game_setup_state_blockdev(psys_blockdev_new_mem(disk_data, GAME_DISK_SIZE, GAME_DISK_FIRST_BLOCK, true),
+        screen, sound, vblank_insns, paced, clock_out, rspb_out);
+}
+
+struct psys_state *game_setup_state_blockdev(struct psys_blockdev *image, struct game_screen *screen, struct game_sound *sound, unsigned vblank_insns, bool paced, struct game_clock **clock_out, struct psys_binding **rspb_out)
+{
+    struct psys_state *state = CALLOC_STRUCT(psys_state);
+    struct psys_blockdev *disk;
+    struct psys_bootstrap_info boot;
+    psys_word ext_memsize     = GAME_EXT_MEM_SIZE / 1024;
+    psys_fulladdr ext_membase = 0x000337ac;
+    psys_word miscinfo[3];
+
+    /* allocate memory */
+    state->mem_size = GAME_MEM_SIZE;
+    state->memory   = malloc(state->mem_size);
+    memset(state->memory, 0, state->mem_size);
+
+    /* writes go to an overlay, leaving the image unchanged */
+    disk = psys_blockdev_new_overlay(image);
+
+    /* override memory size and offset in SYSTEM.MISCINFO */
+    /* This is sneaky: at boot, SUNDOG writes amount of memory and memory
+     * offset to SYSTEM.MISCINFO, which is read later by the p-machine.
+     * Emulate this.
+     */
+    miscinfo[0] = F(ext_memsize);
+    miscinfo[1] = F(ext_membase >> 16);
+    miscinfo[2] = F(ext_membase & 0xffff);
+    psys_blockdev_update(disk, 0x1e00 + 0x22, (const psys_byte *)miscinfo, sizeof(miscinfo));
+
+    /* Bootstrap */
+    boot.boot_unit_id  = PSYS_UNIT_DISK0;
+    boot.isp           = 0xfdec; /* initial stack pointer - top of p-system base memory */
+    boot.real_size     = 0;
+    boot.mem_fake_base = ext_membase - 0x10000; /* this is where (virtually) 0x10000 bytes of p-system base memory start */
+    /* was: 0x000237ac in hatari emulation */
+    /* so we have:
+     *
+     * psys addr    "atari" addr    size     description
+     * -----------------------------------------------------------------------
+     * 0xffff0000                   64 kB    GEMBIND memory (game specific)
+     *   0xffff0000                  21 kB    (unused, contains OS/68000 code on atari)
+     *   0xffff5400
+     *     =-0xac00 data_pool        31 kB    "data pool" area used by game (offset queried using psys_rsp_unitstatus 128, size fixed)
+     *   0xffffd000                  12 kB    (unused, contains 68000 code on atari)
+     * 0x00000000   mem_fake_base   64 kB    p-system base memory (16-bit addressable: globals, heap)
+     * 0x00010000   ext_membase     768 kB   p-system ext memory (offset/size passed in SYSTEM.MISCINFO)
+     *                                         used for code segments storage
+     *
+     * where psys_addr is the address from the viewpoint of the p-system,
+     * and "atari" addr the address from more low-level kind of code (like GEM calls)
+     * we've made all these relative to ext_membase which is more or less an arbitrary number to match a certain run of hatari
+     *
+     * XXX theoretically the p-system can address 128kB of memory directly starting from mem_fake_base, because addresses are word-based,
+     * i'm not sure how this matches the 64kB here, but in any case maybe it's because a lot of internal bookkeeping (like the stack pointer)
+     * does use byte addresses?
+     */
+
+    /** These two are dummy (legacy?) values and not used on Atari ST: */
+    boot.ext_mem_base = boot.mem_fake_base + boot.isp;
+    boot.ext_mem_size = 0;
+
+    psys_bootstrap_blockdev(state, &boot, disk, GAME_DISK_TRACK_SIZE / PSYS_BLOCK_SIZE);
+
+    setup_bindings(state, disk, screen, sound, vblank_insns, paced, clock_out, rspb_out);
+    return state;
+}
+
+struct psys_state *game_setup_state_mapped(psys_byte *memory, psys_byte *disk, struct game_screen *screen, struct game_sound *sound, unsigned vblank_insns, bool paced, struct game_clock **clock_out, struct psys_binding **rspb_out)
+{
+    struct psys_state *state = CALLOC_STRUCT(psys_state);
+    state->mem_size          = GAME_MEM_SIZE;
+    state->memory            = memory;
+    setup_bindings(state, psys_blockdev_new_mem(disk, GAME_DISK_SIZE, 0, false), screen, sound, vblank_insns, paced, clock_out, rspb_out);
+    return state;
+}
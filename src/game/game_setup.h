@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Boot the game from a disk image, shared between frontends. */
+#ifndef H_GAME_SETUP
+#define H_GAME_SETUP
+
+#include "psys/psys_types.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct game_clock;
+struct game_screen;
+struct game_sound;
+struct psys_binding;
+struct psys_blockdev;
+struct psys_state;
+
+/* Atari ST disk image: 80 tracks of 9 sectors */
+#define GAME_DISK_TRACK_SIZE (9 * 512)
+#define GAME_DISK_SIZE (80 * GAME_DISK_TRACK_SIZE)
+/* Block of the image that is the start of the disk as the RSP sees it: the
+ * first three tracks of the image go at the end.
+ */
+#define GAME_DISK_FIRST_BLOCK (3 * 9)
+/* P-system memory: 64 kB base memory plus ext memory. Note that this is way
+ * more than the game needs.
+ */
+#define GAME_EXT_MEM_SIZE (786 * 1024)
+#define GAME_MEM_SIZE (64 * 1024 + GAME_EXT_MEM_SIZE)
+
+/** Read a raw disk image (GAME_DISK_SIZE bytes) from a file. Returns false,
+ * after printing an error, if it cannot be read.
+ */
+extern bool game_load_disk_image(const char *filename, psys_byte *image);
+
+/** Open a raw disk image file as a read-only block device, as the RSP sees it.
+ * Returns NULL, after printing an error, if it cannot be opened.
+ */
+extern struct psys_blockdev *game_open_disk_image(const char *filename);
+
+/** Bootstrap the p-system from a raw disk image (GAME_DISK_SIZE bytes, in
+ * file order; the image is copied) and register the game bindings for
+ * *screen* and *sound*. If *vblank_insns* is non-zero, a virtual clock with
+ * that many instructions per vblank is created, optionally *paced* to real
+ * time, and returned in *clock_out*. The RSP binding is returned in
+ * *rspb_out*.
+ */
+extern struct psys_state *game_setup_state(const psys_byte *image, struct game_screen *screen, struct game_sound *sound, unsigned vblank_insns, bool paced, struct game_clock **clock_out, struct psys_binding **rspb_out);
+
+/** Like game_setup_state, but from a block device with the disk as the RSP
+ * sees it (see GAME_DISK_FIRST_BLOCK), which is taken ownership of. It is not
+ * written to: writes go to a copy-on-write overlay.
+ */
+extern struct psys_state *game_setup_state_blockdev(struct psys_blockdev *image, struct game_screen *screen, struct game_sound *sound, unsigned vblank_insns, bool paced, struct game_clock **clock_out, struct psys_binding **rspb_out);
+
+/** Like game_setup_state, but without bootstrapping: use existing *memory*
+ * (GAME_MEM_SIZE bytes) and *disk* (GAME_DISK_SIZE bytes, as the RSP sees it),
+ * for example mappings of a booted instance. A state must be loaded before
+ * running. The caller keeps ownership of both. Disk writes modify *disk* in
+ * place.
+ */
+extern struct psys_state *game_setup_state_mapped(psys_byte *memory, psys_byte *disk, struct game_screen *screen, struct game_sound *sound, unsigned vblank_insns, bool paced, struct game_clock **clock_out, struct psys_binding **rspb_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
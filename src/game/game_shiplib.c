@@ -5,15 +5,15 @@
  */
 #include "game_shiplib.h"
 
+#include "game/game_clock.h"
 #include "game/game_screen.h"
 #include "game/wowzo.h"
 #include "psys/psys_constants.h"
 #include "psys/psys_debug.h"
 #include "psys/psys_helpers.h"
+#include "psys/psys_serialize.h"
 #include "psys/psys_state.h"
 #include "util/memutil.h"
-#include "util/util_save_state.h"
-#include "util/util_time.h"
 
 #include <string.h>
 
@@ -25,6 +25,9 @@
 struct shiplib_priv {
     struct game_screen *screen;
     struct game_sound *sound;
+    struct game_clock *clock;
+    /* Current object color index for shiplib_18 */
+    int obj_color_idx;
 };
 
 /* VDI 1,2,6,4 */
@@ -43,8 +46,8 @@ static void shiplib_16(struct psys_state *s, struct shiplib_priv *priv, psys_ful
     psys_sword startx  = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0x11));
     psys_sword numrows = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0x12));
     psys_word bufofs   = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0x6));
-    psys_byte *xbuf    = psys_bytes(s, bufofs);
-    psys_byte *rows    = xbuf + 0x100;
+    psys_fulladdr xbuf = bufofs;
+    psys_fulladdr rows = xbuf + 0x100;
     unsigned xbufofs;
     struct game_screen_point point[SCREEN_HEIGHT * 2];
     int ptn = 0;
@@ -54,22 +57,22 @@ static void shiplib_16(struct psys_state *s, struct shiplib_priv *priv, psys_ful
         return;
     }
     for (y = 0; y < numrows; ++y) {
-        if (rows[y]) { /* if set for row, clear pixel first */
-            point[ptn].x     = rows[y];
+        if (psys_ldb(s, rows, y)) { /* if set for row, clear pixel first */
+            point[ptn].x     = psys_ldb(s, rows, y);
             point[ptn].y     = 6 + y;
             point[ptn].color = 0;
             ptn += 1;
         }
         xbufofs = (startofs + 6 + y) & 0xff;
-        x       = (startx + xbuf[xbufofs]) & 0xff;
+        x       = (startx + psys_ldb(s, xbuf, xbufofs)) & 0xff;
         if (x >= 0x60) { /* beyond left edge of viewscreen */
             point[ptn].x     = x;
             point[ptn].y     = y + 6;
             point[ptn].color = star_colors[xbufofs & 3];
             ptn += 1;
-            rows[y] = x;
+            psys_stb(s, rows, y, x);
         } else { /* set to 0 which means entry unused */
-            rows[y] = 0;
+            psys_stb(s, rows, y, 0);
         }
     }
     /* Draw queued pixels */
@@ -80,16 +83,15 @@ static void shiplib_16(struct psys_state *s, struct shiplib_priv *priv, psys_ful
 static void shiplib_18(struct psys_state *s, struct shiplib_priv *priv, psys_fulladdr segment, psys_fulladdr env_priv)
 {
     psys_debug("shiplib_18\n");
-    psys_sword count     = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0xc));
-    psys_sword ship_dx   = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0xe));
-    psys_sword ship_dy   = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0xd));
-    psys_byte *points_x  = psys_bytes(s, W(env_priv + PSYS_MSCW_VAROFS, 0x13));
-    psys_byte *points_y  = points_x + 0x10;
-    psys_byte *points_dx = psys_bytes(s, W(env_priv + PSYS_MSCW_VAROFS, 0x23));
-    psys_byte *points_dy = points_dx + 0x10;
+    psys_sword count        = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0xc));
+    psys_sword ship_dx      = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0xe));
+    psys_sword ship_dy      = psys_ldsw(s, W(env_priv + PSYS_MSCW_VAROFS, 0xd));
+    psys_fulladdr points_x  = W(env_priv + PSYS_MSCW_VAROFS, 0x13);
+    psys_fulladdr points_y  = points_x + 0x10;
+    psys_fulladdr points_dx = W(env_priv + PSYS_MSCW_VAROFS, 0x23);
+    psys_fulladdr points_dy = points_dx + 0x10;
     struct game_screen_point point[16 * 4 * 2];
-    int ptn                  = 0, i, xx, yy;
-    static int obj_color_idx = 0; /* keep track of current color index */
+    int ptn                 = 0, i, xx, yy;
     unsigned color;
     /* Decrease count and store new value in global */
     count -= 1;
@@ -100,13 +102,13 @@ static void shiplib_18(struct psys_state *s, struct shiplib_priv *priv, psys_ful
     ship_dy >>= 2;
     /* Pick the next color from the object color array. This is done globally,
      * not per object, causing them to all change color at the same time. */
-    color = obj_colors[obj_color_idx++];
-    if (obj_color_idx == 8) {
-        obj_color_idx = 0;
+    color = obj_colors[priv->obj_color_idx++];
+    if (priv->obj_color_idx == 8) {
+        priv->obj_color_idx = 0;
     }
     for (i = 0; i < 16; ++i) {
-        uint8_t x = points_x[i];
-        uint8_t y = points_y[i];
+        uint8_t x = psys_ldb(s, points_x, i);
+        uint8_t y = psys_ldb(s, points_y, i);
         if (x) { /* Only process if x coordinate is non-zero */
             /* Clear 2x2 block first */
             for (yy = 0; yy < 2; ++yy) {
@@ -118,19 +120,19 @@ static void shiplib_18(struct psys_state *s, struct shiplib_priv *priv, psys_ful
                 }
             }
 #if 0
-            psys_debug("%d pre xy: %d %d dx dy: %d %d ship dx dy %d %d\n", i, x, y, points_dx[i], points_dy[i], ship_dx, ship_dy);
+            psys_debug("%d pre xy: %d %d dx dy: %d %d ship dx dy %d %d\n", i, x, y, psys_ldb(s, points_dx, i), psys_ldb(s, points_dy, i), ship_dx, ship_dy);
 #endif
-            x += points_dx[i] - ship_dx;
-            y += points_dy[i] + ship_dy;
+            x += psys_ldb(s, points_dx, i) - ship_dx;
+            y += psys_ldb(s, points_dy, i) + ship_dy;
 #if 0
             psys_debug("%d post xy: %d %d\n", i, x, y);
 #endif
 
             if (count == 0 || x <= 96 || y <= 7 || y >= 116) { /* if counter expired or out of viewscreen, nuke it */
-                points_x[i] = 0;
+                psys_stb(s, points_x, i, 0);
             } else { /* store new position and redraw */
-                points_x[i] = x;
-                points_y[i] = y;
+                psys_stb(s, points_x, i, x);
+                psys_stb(s, points_y, i, y);
                 for (yy = 0; yy < 2; ++yy) {
                     for (xx = 0; xx < 2; ++xx) {
                         point[ptn].x     = x + xx;
@@ -150,17 +152,17 @@ static void shiplib_18(struct psys_state *s, struct shiplib_priv *priv, psys_ful
 static void shiplib_19(struct psys_state *s, struct shiplib_priv *priv, psys_fulladdr segment, psys_fulladdr env_priv)
 {
     psys_word x = psys_pop(s);
-    const psys_byte *src;
+    psys_byte src[10 * 2 * 63];
     unsigned color;
     int i, f, y;
 
     psys_debug("shiplib_19 0x%04x\n", x);
     /* Draw weapon fire */
     if (x) {
-        src   = psys_bytes(s, segment + 0x1646);
+        psys_read_bytes(s, src, segment + 0x1646, sizeof(src));
         color = 0xc;
     } else {
-        src   = psys_bytes(s, segment + 0x1b32);
+        psys_read_bytes(s, src, segment + 0x1b32, sizeof(src));
         color = 0xe;
     }
 
@@ -177,7 +179,7 @@ static void shiplib_19(struct psys_state *s, struct shiplib_priv *priv, psys_ful
         }
 
         /* Wait two frames */
-        util_msleep(2000 / 50);
+        game_clock_sleep(priv->clock, 2000 / 50);
     }
 }
 
@@ -190,24 +192,24 @@ static void shiplib_1A(struct psys_state *s, struct shiplib_priv *priv, psys_ful
     psys_word a = psys_pop(s); /* Warp-failed flag */
     psys_debug("shiplib_1A 0x%04x 0x%04x 0x%04x 0x%04x\n", a, b, c, d);
     (void)d;
-    wowzo(priv->screen, priv->sound, a, b, c);
+    wowzo(priv->screen, priv->sound, priv->clock, a, b, c);
 }
 
-static int shiplib_save_state(struct psys_binding *b, FILE *fd)
+static int shiplib_save_state(struct psys_binding *b, struct psys_writer *w)
 {
     uint32_t id = GAME_SHIPLIB_STATE_ID;
     /* Save shiplib state (dummy) */
-    if (FD_WRITE(fd, id)) {
+    if (PSYS_WRITE(w, id)) {
         return -1;
     }
     return 0;
 }
 
-static int shiplib_load_state(struct psys_binding *b, FILE *fd)
+static int shiplib_load_state(struct psys_binding *b, struct psys_reader *r)
 {
     uint32_t id;
     /* Load shiplib state (dummy) */
-    if (FD_READ(fd, id)) {
+    if (PSYS_READ(r, id)) {
         return -1;
     }
     if (id != GAME_SHIPLIB_STATE_ID) {
@@ -217,13 +219,14 @@ static int shiplib_load_state(struct psys_binding *b, FILE *fd)
     return 0;
 }
 
-struct psys_binding *new_shiplib(struct psys_state *state, struct game_screen *screen, struct game_sound *sound)
+struct psys_binding *new_shiplib(struct psys_state *state, struct game_screen *screen, struct game_sound *sound, struct game_clock *clock)
 {
     struct psys_binding *b    = CALLOC_STRUCT(psys_binding);
     struct shiplib_priv *priv = CALLOC_STRUCT(shiplib_priv);
 
     priv->screen = screen;
     priv->sound  = sound;
+    priv->clock  = clock;
     (void)state;
     b->userdata     = priv;
     b->num_handlers = SHIPLIB_NUM_PROC;
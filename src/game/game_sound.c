@@ -20,6 +20,7 @@
 struct sdl_sound {
     struct game_sound base;
 
+    SDL_AudioDeviceID device;
     int samples_per_tick;
     PSG *psg;
 
@@ -131,7 +132,7 @@ static void sdlsound_play_sound(struct game_sound *sound_, const uint8_t *data,
         printf("sdlsound: Command buffer overflow (%d>%d)\n", (int)len, (int)CMDBUFSIZE);
         return;
     }
-    SDL_LockAudioDevice(1);
+    SDL_LockAudioDevice(sound->device);
     /* Completely replace the previous sound and reset state. */
     memcpy(sound->cmd, data, len);
     sound->cmd_ptr   = 0;
@@ -139,14 +140,14 @@ static void sdlsound_play_sound(struct game_sound *sound_, const uint8_t *data,
     sound->tmp       = 0;
     sound->gen_count = 0;
     PSG_reset(sound->psg);
-    SDL_UnlockAudioDevice(1);
+    SDL_UnlockAudioDevice(sound->device);
 }
 
 static void sdlsound_destroy(struct game_sound *sound_)
 {
     struct sdl_sound *sound = sdl_sound(sound_);
 
-    SDL_CloseAudio();
+    SDL_CloseAudioDevice(sound->device);
     PSG_delete(sound->psg);
 
     free(sound);
@@ -172,7 +173,8 @@ struct game_sound *new_sdl_sound(void)
     wanted.callback = sdlsound_callback;
     wanted.userdata = sound;
 
-    if (SDL_OpenAudio(&wanted, NULL) < 0) {
+    sound->device = SDL_OpenAudioDevice(NULL, 0, &wanted, NULL, 0);
+    if (sound->device == 0) {
         free(sound);
         return NULL;
     }
@@ -182,7 +184,7 @@ struct game_sound *new_sdl_sound(void)
     PSG_set_quality(sound->psg, 1); // high quality (i guess)
     PSG_reset(sound->psg);
 
-    SDL_PauseAudio(0); /* start processing */
+    SDL_PauseAudioDevice(sound->device, 0); /* start processing */
 
     return &sound->base;
 }
@@ -30,6 +30,10 @@ struct game_sound {
  */
 struct game_sound *new_sdl_sound(void);
 
+/** Create a new game_sound instance that discards all sound.
+ */
+struct game_sound *new_null_sound(void);
+
 #ifdef __cplusplus
 }
 #endif
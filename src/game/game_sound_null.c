@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2022 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "game_sound.h"
+
+#include "util/memutil.h"
+
+static void nullsound_play_sound(struct game_sound *sound, const uint8_t *data, size_t len)
+{
+    (void)sound;
+    (void)data;
+    (void)len;
+}
+
+static void nullsound_destroy(struct game_sound *sound)
+{
+    free(sound);
+}
+
+struct game_sound *new_null_sound(void)
+{
+    struct game_sound *sound = CALLOC_STRUCT(game_sound);
+
+    sound->play_sound = &nullsound_play_sound;
+    sound->destroy    = &nullsound_destroy;
+
+    return sound;
+}
@@ -11,10 +11,10 @@
  */
 #include "wowzo.h"
 
+#include "game/game_clock.h"
 #include "game/game_screen.h"
 #include "game/game_sound.h"
 #include "util/memutil.h"
-#include "util/util_time.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -108,6 +108,7 @@ struct wowzo {
     /* OS handles */
     struct game_screen *screen;
     struct game_sound *sound;
+    struct game_clock *clock;
 
     /* arrays for stars */
     uint8_t xdelta[MAXSTARS]; /* xDirection */
@@ -142,7 +143,7 @@ static void wowzo_wait(struct wowzo *data, unsigned int delay)
     /* accumulate delays until we reach tick granularity, then wait a tick */
     while (data->delay_acc > (tick_ms * 1000)) {
         data->delay_acc -= tick_ms * 1000;
-        util_msleep(tick_ms);
+        game_clock_sleep(data->clock, tick_ms);
     }
 }
 
@@ -271,7 +272,7 @@ static void wowzo_stage4_new_star(struct wowzo *data, int idx)
  * distance: warp distance (1-12?)
  * seed: universe seed
  * */
-void wowzo(struct game_screen *screen, struct game_sound *sound, bool warp_failed, uint16_t distance, uint16_t seed)
+void wowzo(struct game_screen *screen, struct game_sound *sound, struct game_clock *clock, bool warp_failed, uint16_t distance, uint16_t seed)
 {
     struct wowzo data_;
     struct wowzo *data = &data_;
@@ -279,6 +280,7 @@ void wowzo(struct game_screen *screen, struct game_sound *sound, bool warp_faile
     memset(data, 0, sizeof(struct wowzo));
     data->screen = screen;
     data->sound  = sound;
+    data->clock  = clock;
     data->seed   = 0x03000000 | seed;
 
     wowzo_dosound(data, sound_warp1, sizeof(sound_warp1), 2);
@@ -14,10 +14,11 @@
 extern "C" {
 #endif
 
+struct game_clock;
 struct game_screen;
 struct game_sound;
 
-void wowzo(struct game_screen *screen, struct game_sound *sound, bool warp_failed, uint16_t distance, uint16_t seed);
+void wowzo(struct game_screen *screen, struct game_sound *sound, struct game_clock *clock, bool warp_failed, uint16_t distance, uint16_t seed);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "psys_bindings.h"
+
+#include "psys_constants.h"
+#include "psys_debug.h"
+#include "psys_helpers.h"
+#include "util/memutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Number of segment bases to cache the binding for, must be a power of two */
+#define SEGCACHE_SIZE 64
+/* Number of segment bases to remember the result of checking code against
+ * compiled procedures for, must be a power of two
+ */
+#define CODECHECK_SIZE 16
+
+struct segcache_entry {
+    psys_fulladdr segment; /* segment base, or PSYS_ADDR_ERROR if unused */
+    unsigned epoch;        /* segment epoch at time of lookup */
+    struct psys_binding *binding;
+};
+
+struct codecheck_entry {
+    psys_fulladdr segment; /* segment base, or PSYS_ADDR_ERROR if unused */
+    const struct psys_compiled_segment *compiled;
+    bool match; /* code in memory matches compiled code */
+};
+
+struct psys_binding_index {
+    unsigned hash_bits;          /* log2 of number of hash slots */
+    struct psys_binding **hash;  /* open addressing hash table on segment name */
+    struct segcache_entry segcache[SEGCACHE_SIZE];
+    unsigned num_compiled;       /* number of bindings with compiled procedures */
+    struct codecheck_entry codecheck[CODECHECK_SIZE];
+};
+
+static unsigned hash_slot(const struct psys_binding_index *idx, uint64_t num)
+{
+    return (num * 0x9e3779b97f4a7c15ULL) >> (64 - idx->hash_bits);
+}
+
+/** Rebuild the index after the set of bindings changed. */
+static void rebuild_index(struct psys_state *s)
+{
+    struct psys_binding_index *idx = s->binding_index;
+    unsigned x, slot, mask;
+    if (!idx) {
+        idx = s->binding_index = CALLOC_STRUCT(psys_binding_index);
+    }
+    free(idx->hash);
+    idx->hash_bits = 3;
+    while ((1U << idx->hash_bits) < s->num_bindings * 2) { /* keep load factor under 0.5 */
+        idx->hash_bits += 1;
+    }
+    mask      = (1U << idx->hash_bits) - 1;
+    idx->hash = calloc(1U << idx->hash_bits, sizeof(struct psys_binding *));
+    for (x = 0; x < s->num_bindings; ++x) {
+        slot = hash_slot(idx, s->bindings[x]->seg.num);
+        while (idx->hash[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        idx->hash[slot] = s->bindings[x];
+    }
+    for (x = 0; x < SEGCACHE_SIZE; ++x) {
+        idx->segcache[x].segment = PSYS_ADDR_ERROR;
+    }
+    idx->num_compiled = 0;
+    for (x = 0; x < s->num_bindings; ++x) {
+        if (s->bindings[x]->compiled) {
+            idx->num_compiled += 1;
+        }
+    }
+    for (x = 0; x < CODECHECK_SIZE; ++x) {
+        idx->codecheck[x].segment = PSYS_ADDR_ERROR;
+    }
+}
+
+int psys_register_binding(struct psys_state *s, struct psys_binding *b)
+{
+    struct psys_binding **bindings;
+    if (psys_find_binding(s, &b->seg)) {
+        return -1;
+    }
+    bindings = realloc(s->bindings, (s->num_bindings + 1) * sizeof(struct psys_binding *));
+    if (!bindings) {
+        return -1;
+    }
+    s->bindings                    = bindings;
+    s->bindings[s->num_bindings++] = b;
+    rebuild_index(s);
+    return 0;
+}
+
+int psys_unregister_binding(struct psys_state *s, struct psys_binding *b)
+{
+    unsigned x;
+    for (x = 0; x < s->num_bindings; ++x) {
+        if (s->bindings[x] == b) {
+            memmove(&s->bindings[x], &s->bindings[x + 1], (s->num_bindings - x - 1) * sizeof(struct psys_binding *));
+            s->num_bindings -= 1;
+            rebuild_index(s);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+struct psys_binding *psys_find_binding(struct psys_state *s, const struct psys_segment_id *seg)
+{
+    struct psys_binding_index *idx = s->binding_index;
+    unsigned slot, mask;
+    if (!idx) {
+        return NULL;
+    }
+    mask = (1U << idx->hash_bits) - 1;
+    for (slot = hash_slot(idx, seg->num); idx->hash[slot]; slot = (slot + 1) & mask) {
+        if (idx->hash[slot]->seg.num == seg->num) {
+            return idx->hash[slot];
+        }
+    }
+    return NULL;
+}
+
+struct psys_binding *psys_segment_binding(struct psys_state *s, psys_fulladdr segment)
+{
+    struct psys_binding_index *idx = s->binding_index;
+    struct segcache_entry *e;
+    struct psys_segment_id id;
+    if (!idx) {
+        return NULL;
+    }
+    e = &idx->segcache[(segment >> 1) & (SEGCACHE_SIZE - 1)];
+    if (e->segment != segment || e->epoch != s->seg_epoch) {
+        psys_read_segment_id(s, &id, segment + PSYS_SEG_NAME);
+        e->segment = segment;
+        e->epoch   = s->seg_epoch;
+        e->binding = psys_find_binding(s, &id);
+    }
+    return e->binding;
+}
+
+int psys_register_compiled(struct psys_state *s, const struct psys_compiled_segment *compiled)
+{
+    struct psys_segment_id seg;
+    struct psys_binding *b;
+    memcpy(seg.name, compiled->name, 8);
+    b = psys_find_binding(s, &seg);
+    if (!b) {
+        b      = CALLOC_STRUCT(psys_binding);
+        b->seg = seg;
+        if (psys_register_binding(s, b) < 0) {
+            free(b);
+            return -1;
+        }
+    } else if (b->compiled) {
+        return -1;
+    }
+    b->compiled = compiled;
+    rebuild_index(s);
+    return 0;
+}
+
+uint32_t psys_compiled_code_hash(struct psys_state *s, psys_fulladdr segment, psys_word size)
+{
+    uint32_t hash = 0x811c9dc5; /* FNV-1a */
+    psys_word x;
+    for (x = 0; x < size; ++x) {
+        hash = (hash ^ psys_ldb(s, segment + PSYS_SEG_CODESTART, x)) * 0x01000193;
+    }
+    return hash;
+}
+
+psys_compiledfunc *psys_compiled_procedure(struct psys_state *s, psys_fulladdr segment, unsigned procedure)
+{
+    struct psys_binding_index *idx = s->binding_index;
+    const struct psys_compiled_segment *compiled;
+    struct psys_binding *b;
+    struct codecheck_entry *e;
+    if (!idx || !idx->num_compiled) {
+        return NULL;
+    }
+    b = psys_segment_binding(s, segment);
+    if (!b || !b->compiled) {
+        return NULL;
+    }
+    compiled = b->compiled;
+    if (procedure >= (unsigned)compiled->num_procedures || !compiled->procedures[procedure]) {
+        return NULL;
+    }
+    e = &idx->codecheck[(segment >> 1) & (CODECHECK_SIZE - 1)];
+    if (e->segment != segment || e->compiled != compiled) {
+        e->segment  = segment;
+        e->compiled = compiled;
+        e->match    = psys_compiled_code_hash(s, segment, compiled->code_size) == compiled->code_hash;
+        if (!e->match && PDBG(s, WARNING)) {
+            psys_debug("Code of segment %.8s at 0x%05x does not match compiled code\n", compiled->name, segment);
+        }
+    }
+    return e->match ? compiled->procedures[procedure] : NULL;
+}
+
+bool psys_bindings_invalidate_code(struct psys_state *s, psys_fulladdr addr, psys_fulladdr size)
+{
+    struct psys_binding_index *idx = s->binding_index;
+    struct codecheck_entry *e;
+    psys_fulladdr start;
+    bool rv = false;
+    unsigned x;
+    if (!idx || !idx->num_compiled) {
+        return false;
+    }
+    for (x = 0; x < CODECHECK_SIZE; ++x) {
+        e = &idx->codecheck[x];
+        if (e->segment == PSYS_ADDR_ERROR) {
+            continue;
+        }
+        start = e->segment + PSYS_SEG_CODESTART;
+        if (addr < start + e->compiled->code_size && start < addr + size) {
+            e->segment = PSYS_ADDR_ERROR;
+            rv         = true;
+        }
+    }
+    return rv;
+}
+
+void psys_bindings_destroy(struct psys_state *s)
+{
+    if (s->binding_index) {
+        free(s->binding_index->hash);
+        free(s->binding_index);
+        s->binding_index = NULL;
+    }
+    free(s->bindings);
+    s->bindings     = NULL;
+    s->num_bindings = 0;
+}
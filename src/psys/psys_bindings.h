@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Registry of native bindings.
+ * Bindings are kept in registration order in psys_state.bindings (this is the
+ * order in which their state is saved), and indexed by segment name for
+ * lookups from the interpreter. The first binding registered must be the RSP.
+ */
+#ifndef H_PSYS_BINDINGS
+#define H_PSYS_BINDINGS
+
+#include "psys_state.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Register a binding. Returns 0 on success, or -1 if another binding for the
+ * same segment is already registered.
+ */
+extern int psys_register_binding(struct psys_state *s, struct psys_binding *b);
+
+/** Unregister a binding. Returns 0 on success, or -1 if it was not registered. */
+extern int psys_unregister_binding(struct psys_state *s, struct psys_binding *b);
+
+/** Look up binding for a segment name. Returns NULL if there is none. */
+extern struct psys_binding *psys_find_binding(struct psys_state *s, const struct psys_segment_id *seg);
+
+/** Look up binding for the segment at a segment base address. Returns NULL if
+ * there is none. The result is cached per segment base until the segment epoch
+ * changes.
+ */
+extern struct psys_binding *psys_segment_binding(struct psys_state *s, psys_fulladdr segment);
+
+/** Register compiled procedures for a segment. They are attached to the
+ * binding for the segment, and if there is none, a new binding without native
+ * handlers is registered. Returns 0 on success, or -1 if the segment already
+ * has compiled procedures.
+ */
+extern int psys_register_compiled(struct psys_state *s, const struct psys_compiled_segment *compiled);
+
+/** Look up compiled code for a procedure of the segment at a segment base
+ * address. Returns NULL if there is none, or if the code in memory does not
+ * match the code it was compiled from. The result of this check is cached
+ * per segment base until the code is invalidated.
+ */
+extern psys_compiledfunc *psys_compiled_procedure(struct psys_state *s, psys_fulladdr segment, unsigned procedure);
+
+/** Compute hash of the first *size* bytes of code of the segment at a segment
+ * base address. This must match the hash computed by tools/pcode_to_c.py.
+ */
+extern uint32_t psys_compiled_code_hash(struct psys_state *s, psys_fulladdr segment, psys_word size);
+
+/* Internal: called by the interpreter when code may have changed. Returns
+ * true if this affected checked compiled code.
+ */
+extern bool psys_bindings_invalidate_code(struct psys_state *s, psys_fulladdr addr, psys_fulladdr size);
+
+/** Free binding registry. This does not destroy the bindings themselves. */
+extern void psys_bindings_destroy(struct psys_state *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
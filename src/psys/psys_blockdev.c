@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define PSYS_BLOCKDEV_MMAP
+#endif
+
+#include "psys_blockdev.h"
+
+#include "psys_debug.h"
+#include "psys_rsp.h"
+#include "psys_serialize.h"
+#include "util/memutil.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef PSYS_BLOCKDEV_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/** Device on contiguous storage: memory, or a mapped file */
+struct blockdev_mem {
+    struct psys_blockdev base;
+    psys_byte *data;
+    unsigned first_block;
+    bool owned;    /* free data on destroy */
+    bool readonly; /* reject writes */
+    bool mapped;   /* data is a mapping of num_blocks blocks */
+};
+
+/** Copy-on-write overlay */
+struct blockdev_overlay {
+    struct psys_blockdev base;
+    struct psys_blockdev *lower;
+    psys_byte **blocks; /* written blocks, NULL if unchanged */
+};
+
+static psys_byte *mem_block(struct psys_blockdev *dev_, unsigned blk)
+{
+    struct blockdev_mem *dev = (struct blockdev_mem *)dev_;
+    return &dev->data[((blk + dev->first_block) % dev->base.num_blocks) * PSYS_BLOCK_SIZE];
+}
+
+static const psys_byte *mem_read_block(struct psys_blockdev *dev, unsigned blk)
+{
+    return mem_block(dev, blk);
+}
+
+static psys_byte *mem_write_block(struct psys_blockdev *dev, unsigned blk)
+{
+    return ((struct blockdev_mem *)dev)->readonly ? NULL : mem_block(dev, blk);
+}
+
+static void mem_destroy(struct psys_blockdev *dev_)
+{
+    struct blockdev_mem *dev = (struct blockdev_mem *)dev_;
+#ifdef PSYS_BLOCKDEV_MMAP
+    if (dev->mapped) {
+        munmap(dev->data, dev->base.num_blocks * PSYS_BLOCK_SIZE);
+    }
+#endif
+    if (dev->owned) {
+        free(dev->data);
+    }
+    free(dev);
+}
+
+static struct blockdev_mem *new_mem(psys_byte *data, unsigned num_blocks, unsigned first_block)
+{
+    struct blockdev_mem *dev = CALLOC_STRUCT(blockdev_mem);
+    dev->base.num_blocks     = num_blocks;
+    dev->base.read_block     = mem_read_block;
+    dev->base.write_block    = mem_write_block;
+    dev->base.destroy        = mem_destroy;
+    dev->data                = data;
+    dev->first_block         = first_block;
+    return dev;
+}
+
+struct psys_blockdev *psys_blockdev_new_mem(psys_byte *data, size_t size, unsigned first_block, bool owned)
+{
+    struct blockdev_mem *dev;
+    if ((size % PSYS_BLOCK_SIZE) != 0) {
+        psys_panic("Disk size must be multiple of block size %d\n", PSYS_BLOCK_SIZE);
+    }
+    dev        = new_mem(data, size / PSYS_BLOCK_SIZE, first_block);
+    dev->owned = owned;
+    return &dev->base;
+}
+
+struct psys_blockdev *psys_blockdev_open_file(const char *filename, unsigned num_blocks, unsigned first_block)
+{
+    size_t size = (size_t)num_blocks * PSYS_BLOCK_SIZE;
+    struct blockdev_mem *dev;
+    psys_byte *data;
+#ifdef PSYS_BLOCKDEV_MMAP
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < size) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file open */
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    dev         = new_mem(data, num_blocks, first_block);
+    dev->mapped = true;
+#else
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        return NULL;
+    }
+    data = malloc(size);
+    if (fread(data, 1, size, f) < size) {
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    dev        = new_mem(data, num_blocks, first_block);
+    dev->owned = true;
+#endif
+    dev->readonly = true;
+    return &dev->base;
+}
+
+static const psys_byte *overlay_read_block(struct psys_blockdev *dev_, unsigned blk)
+{
+    struct blockdev_overlay *dev = (struct blockdev_overlay *)dev_;
+    if (dev->blocks[blk]) {
+        return dev->blocks[blk];
+    }
+    return psys_blockdev_read(dev->lower, blk);
+}
+
+static psys_byte *overlay_write_block(struct psys_blockdev *dev_, unsigned blk)
+{
+    struct blockdev_overlay *dev = (struct blockdev_overlay *)dev_;
+    if (!dev->blocks[blk]) {
+        dev->blocks[blk] = malloc(PSYS_BLOCK_SIZE);
+        memcpy(dev->blocks[blk], psys_blockdev_read(dev->lower, blk), PSYS_BLOCK_SIZE);
+    }
+    return dev->blocks[blk];
+}
+
+static bool overlay_is_written(struct psys_blockdev *dev_, unsigned blk)
+{
+    struct blockdev_overlay *dev = (struct blockdev_overlay *)dev_;
+    return dev->blocks[blk] != NULL;
+}
+
+static void overlay_revert(struct psys_blockdev *dev_)
+{
+    struct blockdev_overlay *dev = (struct blockdev_overlay *)dev_;
+    unsigned blk;
+    for (blk = 0; blk < dev->base.num_blocks; ++blk) {
+        free(dev->blocks[blk]);
+        dev->blocks[blk] = NULL;
+    }
+}
+
+static void overlay_destroy(struct psys_blockdev *dev_)
+{
+    struct blockdev_overlay *dev = (struct blockdev_overlay *)dev_;
+    overlay_revert(dev_);
+    psys_blockdev_destroy(dev->lower);
+    free(dev->blocks);
+    free(dev);
+}
+
+struct psys_blockdev *psys_blockdev_new_overlay(struct psys_blockdev *lower)
+{
+    struct blockdev_overlay *dev = CALLOC_STRUCT(blockdev_overlay);
+    dev->base.num_blocks         = lower->num_blocks;
+    dev->base.read_block         = overlay_read_block;
+    dev->base.write_block        = overlay_write_block;
+    dev->base.is_written         = overlay_is_written;
+    dev->base.revert             = overlay_revert;
+    dev->base.destroy            = overlay_destroy;
+    dev->lower                   = lower;
+    dev->blocks                  = calloc(lower->num_blocks, sizeof(psys_byte *));
+    return &dev->base;
+}
+
+void psys_blockdev_read_all(struct psys_blockdev *dev, psys_byte *out)
+{
+    unsigned blk;
+    for (blk = 0; blk < dev->num_blocks; ++blk) {
+        memcpy(&out[blk * PSYS_BLOCK_SIZE], psys_blockdev_read(dev, blk), PSYS_BLOCK_SIZE);
+    }
+}
+
+int psys_blockdev_update(struct psys_blockdev *dev, size_t ofs, const psys_byte *data, size_t size)
+{
+    if (ofs > (size_t)dev->num_blocks * PSYS_BLOCK_SIZE || size > (size_t)dev->num_blocks * PSYS_BLOCK_SIZE - ofs) {
+        return -1;
+    }
+    while (size) {
+        unsigned blk    = ofs / PSYS_BLOCK_SIZE;
+        unsigned blkofs = ofs % PSYS_BLOCK_SIZE;
+        size_t n        = PSYS_BLOCK_SIZE - blkofs < size ? PSYS_BLOCK_SIZE - blkofs : size;
+        if (memcmp(&psys_blockdev_read(dev, blk)[blkofs], data, n)) {
+            psys_byte *dst = psys_blockdev_write(dev, blk);
+            if (!dst) {
+                return -1;
+            }
+            memcpy(&dst[blkofs], data, n);
+        }
+        ofs += n;
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/* State: number of blocks, then for every block its number and contents */
+int psys_blockdev_save_state(struct psys_blockdev *dev, struct psys_writer *w)
+{
+    uint32_t count = 0;
+    uint32_t blk;
+    if (dev->is_written) {
+        for (blk = 0; blk < dev->num_blocks; ++blk) {
+            count += dev->is_written(dev, blk);
+        }
+    }
+    if (PSYS_WRITE(w, count)) {
+        return -1;
+    }
+    for (blk = 0; count && blk < dev->num_blocks; ++blk) {
+        if (dev->is_written(dev, blk)) {
+            if (PSYS_WRITE(w, blk) || psys_write_ref(w, psys_blockdev_read(dev, blk), PSYS_BLOCK_SIZE) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int psys_blockdev_load_state(struct psys_blockdev *dev, struct psys_reader *r)
+{
+    struct psys_reader check = *r;
+    uint32_t count, blk, x;
+    /* Validate before changing anything */
+    if (PSYS_READ(&check, count) || count > dev->num_blocks) {
+        return -1;
+    }
+    for (x = 0; x < count; ++x) {
+        if (PSYS_READ(&check, blk) || blk >= dev->num_blocks || !psys_read_ref(&check, PSYS_BLOCK_SIZE)) {
+            return -1;
+        }
+    }
+
+    if (dev->revert) {
+        dev->revert(dev);
+    }
+    PSYS_READ(r, count);
+    for (x = 0; x < count; ++x) {
+        psys_byte *dst;
+        PSYS_READ(r, blk);
+        dst = psys_blockdev_write(dev, blk);
+        if (!dst) {
+            psys_debug("Cannot restore block %u on read-only device\n", blk);
+            return -1;
+        }
+        memcpy(dst, psys_read_ref(r, PSYS_BLOCK_SIZE), PSYS_BLOCK_SIZE);
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Block devices backing the disk units of the RSP.
+ *
+ * Blocks are accessed in place through pointers, so a read from a device is a
+ * single copy from the backing storage into p-system memory. Base devices can
+ * rotate the block order of their storage: block 0 of the device is block
+ * *first_block* of the storage, and the storage wraps around after its last
+ * block.
+ *
+ * A copy-on-write overlay over a base device keeps written blocks separately,
+ * so that the base can be read-only (for example mapped from a file), and so
+ * that the saved state of the device is only the blocks written to.
+ */
+#ifndef H_PSYS_BLOCKDEV
+#define H_PSYS_BLOCKDEV
+
+#include "psys_types.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct psys_reader;
+struct psys_writer;
+
+struct psys_blockdev {
+    unsigned num_blocks;
+
+    /** Return pointer to block *blk* for reading. It stays valid until the
+     * block is written or the device is destroyed.
+     */
+    const psys_byte *(*read_block)(struct psys_blockdev *dev, unsigned blk);
+
+    /** Return pointer to block *blk* for modifying in place, or NULL if the
+     * device is read-only.
+     */
+    psys_byte *(*write_block)(struct psys_blockdev *dev, unsigned blk);
+
+    /** Return whether block *blk* was written since the device was created
+     * (optional: devices without it save no state).
+     */
+    bool (*is_written)(struct psys_blockdev *dev, unsigned blk);
+
+    /** Discard all writes (optional). */
+    void (*revert)(struct psys_blockdev *dev);
+
+    /** Destroy device. */
+    void (*destroy)(struct psys_blockdev *dev);
+};
+
+/** Create device for *size* bytes of *data* (a multiple of PSYS_BLOCK_SIZE).
+ * Writes modify the data in place. If *owned*, the data is freed with the
+ * device.
+ */
+extern struct psys_blockdev *psys_blockdev_new_mem(psys_byte *data, size_t size, unsigned first_block, bool owned);
+
+/** Open read-only device for the first *num_blocks* blocks of a file. On
+ * POSIX systems the file is mapped, so blocks are only loaded when accessed.
+ * Returns NULL if the file cannot be opened or is too small.
+ */
+extern struct psys_blockdev *psys_blockdev_open_file(const char *filename, unsigned num_blocks, unsigned first_block);
+
+/** Create copy-on-write overlay over *base*, which is destroyed with the
+ * overlay.
+ */
+extern struct psys_blockdev *psys_blockdev_new_overlay(struct psys_blockdev *base);
+
+/** Copy the contents of the whole device to *out* (num_blocks blocks). */
+extern void psys_blockdev_read_all(struct psys_blockdev *dev, psys_byte *out);
+
+/** Write *size* bytes of *data* at byte offset *ofs*, skipping blocks that
+ * already have the same contents (return 0 on success, < 0 if the device is
+ * read-only or the range is out of bounds).
+ */
+extern int psys_blockdev_update(struct psys_blockdev *dev, size_t ofs, const psys_byte *data, size_t size);
+
+/** Save the blocks written to (return 0 on success). */
+extern int psys_blockdev_save_state(struct psys_blockdev *dev, struct psys_writer *w);
+
+/** Discard writes, then restore the written blocks from a saved state (return
+ * 0 on success). Devices without an overlay get the blocks written in place,
+ * which fails if they are read-only. The device is left unchanged if the
+ * state is invalid.
+ */
+extern int psys_blockdev_load_state(struct psys_blockdev *dev, struct psys_reader *r);
+
+static inline const psys_byte *psys_blockdev_read(struct psys_blockdev *dev, unsigned blk)
+{
+    return dev->read_block(dev, blk);
+}
+
+static inline psys_byte *psys_blockdev_write(struct psys_blockdev *dev, unsigned blk)
+{
+    return dev->write_block(dev, blk);
+}
+
+static inline void psys_blockdev_destroy(struct psys_blockdev *dev)
+{
+    dev->destroy(dev);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
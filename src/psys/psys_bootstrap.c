@@ -5,11 +5,13 @@
  */
 #include "psys_bootstrap.h"
 
+#include "psys_blockdev.h"
 #include "psys_constants.h"
 #include "psys_debug.h"
 #include "psys_helpers.h"
 #include "psys_rsp.h"
 #include "psys_state.h"
+#include "util/util_minmax.h"
 
 #include <string.h>
 
@@ -20,7 +22,32 @@ static void psys_flipw(struct psys_state *s, psys_fulladdr ptr)
     psys_stw(s, ptr, psys_flip_endian(psys_ldw(s, ptr)));
 }
 
-void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot, const psys_byte *disk)
+/* Boot disk: a buffer, or a block device starting at a block */
+struct boot_disk {
+    const psys_byte *data;
+    struct psys_blockdev *dev;
+    unsigned first_block;
+};
+
+/** Copy *size* bytes at offset *ofs* of the boot disk to p-system memory */
+static void read_disk(struct psys_state *s, psys_fulladdr dest, const struct boot_disk *disk, unsigned ofs, unsigned size)
+{
+    if (disk->data) {
+        psys_write_bytes(s, dest, &disk->data[ofs], size);
+        return;
+    }
+    while (size) {
+        unsigned blk    = (disk->first_block + ofs / PSYS_BLOCK_SIZE) % disk->dev->num_blocks;
+        unsigned blkofs = ofs % PSYS_BLOCK_SIZE;
+        unsigned n      = umin(PSYS_BLOCK_SIZE - blkofs, size);
+        psys_write_bytes(s, dest, &psys_blockdev_read(disk->dev, blk)[blkofs], n);
+        dest += n;
+        ofs += n;
+        size -= n;
+    }
+}
+
+static void bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot, const struct boot_disk *disk)
 {
     psys_word global_directory_ptr, segment_dict_ptr, userprog_ptr, procdict_ptr;
     psys_word membase_ptr, sib_ptr, evec_ptr, erec_ptr, lmscw_ptr, gmscw_ptr, tib_ptr;
@@ -37,7 +64,7 @@ void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot
     s->sp -= GDIR_SIZE;
     global_directory_ptr = s->sp;
     /* Copy global directory to stack */
-    memcpy(psys_bytes(s, global_directory_ptr), &disk[global_directory_ofs], GDIR_SIZE);
+    read_disk(s, global_directory_ptr, disk, global_directory_ofs, GDIR_SIZE);
     /* TODO: byte-swap global directory if necessary */
     /* endian = psys_ldw(s, global_directory_ptr + 0x02); */
     /* Look for SYSTEM.PASCAL */
@@ -45,7 +72,9 @@ void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot
     psys_debug("psys_bootstrap: %d entries in global directory\n", num_entries);
     ptr = global_directory_ptr + GDIR_ENTRY_SIZE;
     for (i = 0; i < num_entries; ++i) {
-        if (!memcmp(psys_bytes(s, ptr + GDIR_ENTRY_NAME), system_pascal, sizeof(system_pascal))) {
+        psys_byte name[sizeof(system_pascal)];
+        psys_read_bytes(s, name, ptr + GDIR_ENTRY_NAME, sizeof(name));
+        if (!memcmp(name, system_pascal, sizeof(system_pascal))) {
             break;
         }
         ptr += GDIR_ENTRY_SIZE;
@@ -59,7 +88,7 @@ void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot
     /* Read segment dictionary */
     s->sp -= PSYS_BLOCK_SIZE;
     segment_dict_ptr = s->sp;
-    memcpy(psys_bytes(s, segment_dict_ptr), &disk[sys_pascal_ofs], PSYS_BLOCK_SIZE);
+    read_disk(s, segment_dict_ptr, disk, sys_pascal_ofs, PSYS_BLOCK_SIZE);
     /* TODO: byte-swap segment dictionary if necessary */
     /* endian = psys_ldw(s, segment_dict_ptr + 0x1fe); */
     userprog_ofs          = sys_pascal_ofs + psys_ldw(s, segment_dict_ptr + 0x3c) * PSYS_BLOCK_SIZE;
@@ -70,7 +99,7 @@ void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot
     /* Read USERPROG */
     s->sp -= userprog_codesize;
     userprog_ptr = s->sp;
-    memcpy(psys_bytes(s, userprog_ptr), &disk[userprog_ofs], userprog_codesize);
+    read_disk(s, userprog_ptr, disk, userprog_ofs, userprog_codesize);
     /* byte-swap USERPROG if necessary */
     endian = psys_ldw(s, userprog_ptr + PSYS_SEG_ENDIAN);
     if (endian != 1) {
@@ -161,7 +190,7 @@ void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot
     psys_stw(s, sib_ptr + PSYS_SIB_Time_Stamp, 0);
     psys_stw(s, sib_ptr + PSYS_SIB_Link_Count, 0);
     psys_stw(s, sib_ptr + PSYS_SIB_Residency, 0);
-    memset(psys_bytes(s, sib_ptr + PSYS_SIB_Seg_Name), 0, 8);
+    psys_fill_bytes(s, sib_ptr + PSYS_SIB_Seg_Name, 0, 8);
     psys_stw(s, sib_ptr + PSYS_SIB_Seg_Leng, userprog_codesize / 2);
     psys_stw(s, sib_ptr + PSYS_SIB_Seg_Addr, userprog_ofs / PSYS_BLOCK_SIZE);
     psys_stw(s, sib_ptr + PSYS_SIB_Vol_Info, 0);
@@ -189,7 +218,7 @@ void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot
 
     /* Initialize syscom */
     psys_debug("  SYSCOM at 0x%04x\n", syscom_ptr);
-    memset(psys_bytes(s, syscom_ptr), 0, PSYS_SYSCOM_SIZE);
+    psys_fill_bytes(s, syscom_ptr, 0, PSYS_SYSCOM_SIZE);
     psys_stw(s, syscom_ptr + PSYS_SYSCOM_IORSLT, PSYS_IO_NOERROR);
     psys_stw(s, syscom_ptr + PSYS_SYSCOM_BOOT_UNIT, boot->boot_unit_id);
     psys_stw(s, syscom_ptr + PSYS_SYSCOM_GLOBALDIR, global_directory_ptr);
@@ -216,8 +245,21 @@ void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot
     s->curtask = tib_ptr;
     s->erec    = erec_ptr;
     s->curproc = proc_num;
+    psys_invalidate_display(s);
 
     /* Other offsets and state */
     s->syscom        = syscom_ptr;
     s->mem_fake_base = boot->mem_fake_base;
 }
+
+void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot, const psys_byte *disk)
+{
+    struct boot_disk bd = { disk, NULL, 0 };
+    bootstrap(s, boot, &bd);
+}
+
+void psys_bootstrap_blockdev(struct psys_state *s, const struct psys_bootstrap_info *boot, struct psys_blockdev *dev, unsigned first_block)
+{
+    struct boot_disk bd = { NULL, dev, first_block };
+    bootstrap(s, boot, &bd);
+}
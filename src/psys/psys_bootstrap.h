@@ -12,6 +12,8 @@
 extern "C" {
 #endif
 
+struct psys_blockdev;
+
 struct psys_bootstrap_info {
     psys_word boot_unit_id;      /* Boot disk unit number */
     psys_word isp;               /* Initial stack pointer */
@@ -31,6 +33,11 @@ struct psys_bootstrap_info {
  */
 extern void psys_bootstrap(struct psys_state *s, const struct psys_bootstrap_info *boot, const psys_byte *disk);
 
+/**
+ * Bootstrap from a block device, with the boot volume starting at *first_block*.
+ */
+extern void psys_bootstrap_blockdev(struct psys_state *s, const struct psys_bootstrap_info *boot, struct psys_blockdev *dev, unsigned first_block);
+
 #ifdef __cplusplus
 }
 #endif
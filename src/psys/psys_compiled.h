@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Support definitions for p-code compiled to C by tools/pcode_to_c.py.
+ *
+ * A compiled procedure is a function that is called with the offset of the
+ * current instruction in the segment. If there is an entry point at that
+ * offset it executes instructions until it reaches one that it does not
+ * implement, and returns with ipc pointing at that instruction so that the
+ * interpreter can continue from there. Only instructions that cannot raise an
+ * execution error or fault, call out or switch tasks are compiled, so the
+ * p-machine state is the same as after interpreting the same instructions.
+ *
+ * The instruction handlers are the same as those for superinstructions (see
+ * gen_interpreter.py), with the macros below standing in for those of the
+ * interpreter loop. The stack pointer is kept in a local variable, and written
+ * back on exit.
+ *
+ * This header is only meant to be included from generated code.
+ */
+#ifndef H_PSYS_COMPILED
+#define H_PSYS_COMPILED
+
+#include "psys_constants.h"
+#include "psys_helpers.h"
+#include "psys_state.h"
+
+/* Boolean test, see interpreter */
+#define BOOL(x) ((x) & 1)
+
+#define PUSH(x)                     \
+    do {                            \
+        psys_word push_val_ = (x);  \
+        sp -= 2;                    \
+        psys_stw(s, sp, push_val_); \
+    } while (0)
+#define POP() (sp += 2, psys_ldw(s, (psys_word)(sp - 2)))
+#define SPOP() signext_word(POP())
+#define TOP() psys_ldw(s, sp)
+#define SET_TOP(x) psys_stw(s, sp, (x))
+
+/* Leave compiled code, continuing in the interpreter at offset *ofs* */
+#define EXIT(ofs)                   \
+    do {                            \
+        s->sp  = sp;                \
+        s->ipc = s->curseg + (ofs); \
+        return;                     \
+    } while (0)
+
+/* Start of basic block of *n* instructions at offset *ofs*. Leave to the
+ * interpreter if the instruction budget would run out in it, or if an
+ * asynchronous event is pending.
+ */
+#define BLOCK(ofs, n)                                                                    \
+    do {                                                                                 \
+        if (s->insn_limit - s->insn_count < (n) || util_atomic_get(&s->async_pending)) { \
+            EXIT(ofs);                                                                   \
+        }                                                                                \
+        s->insn_count += (n);                                                            \
+    } while (0)
+
+/** Get address of local variable */
+static inline psys_fulladdr local_addr(struct psys_state *state, unsigned n)
+{
+    return W(state->mp + PSYS_MSCW_VAROFS, n);
+}
+
+/** Get address of global variable */
+static inline psys_fulladdr global_addr(struct psys_state *state, unsigned n)
+{
+    return W(state->base + PSYS_MSCW_VAROFS, n);
+}
+
+/** Get address of intermediate variable. This walks the static chain instead
+ * of using the display, which is private to the interpreter.
+ */
+static inline psys_fulladdr intermd_addr(struct psys_state *state, unsigned lexlevel, unsigned n)
+{
+    psys_fulladdr mscw = state->mp;
+    unsigned l;
+    for (l = 0; l < lexlevel; ++l) {
+        mscw = psys_ldw(state, mscw + PSYS_MSCW_MSSTAT);
+    }
+    return W(mscw + PSYS_MSCW_VAROFS, n);
+}
+
+#endif
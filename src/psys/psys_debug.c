@@ -17,9 +17,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-/** HACK: state used for print_info */
-static int prev_opcode = -1;
-
 /** U+2192 RIGHT ARROW */
 #define U_RIGHT_ARROW "\xe2\x86\x92"
 
@@ -47,16 +44,14 @@ int psys_debug_proc_num_arguments(struct psys_state *s, psys_fulladdr erec, psys
     psys_fulladdr segment;
     psys_word end_pointer;
     psys_fulladdr addr = lookup_procedure(s, erec, procedure, false, &num_locals, &end_pointer, &segment);
-    psys_byte *data;
     if (addr == PSYS_ADDR_ERROR || num_locals == 0xffff) { /* Not resident or native */
         return -1;
     }
-    data = psys_bytes(s, segment);
-    if (data[end_pointer] != PSOP_RPU) { /* End pointer does not point to return */
+    if (psys_ldb(s, segment, end_pointer) != PSOP_RPU) { /* End pointer does not point to return */
         return -1;
     }
     /* Subtract return argument */
-    return data[end_pointer + 1] - num_locals;
+    return psys_ldb(s, segment, end_pointer + 1) - num_locals;
 }
 
 void psys_print_traceback(struct psys_state *s)
@@ -72,10 +67,12 @@ void psys_print_traceback(struct psys_state *s)
     erec    = s->erec;
 
     while (true) {
+        struct psys_segment_id id;
         sib = psys_ldw(s, erec + PSYS_EREC_Env_SIB);
+        psys_read_segment_id(s, &id, sib + PSYS_SIB_Seg_Name);
 
         psys_debug("  %-8.8s:0x%02x:%04x mp=0x%04x base=0x%04x erec=0x%04x\n",
-            psys_bytes(s, sib + PSYS_SIB_Seg_Name), curproc, ipc,
+            id.name, curproc, ipc,
             mp, base, erec);
 
         /* Advance to caller frame */
@@ -126,11 +123,14 @@ static bool is_call(psys_byte opcode)
 
 static bool get_call_destination(struct psys_state *s, psys_fulladdr *erec_out, psys_byte *procedure_out)
 {
-    psys_byte *instr   = psys_bytes(s, s->ipc);
-    psys_byte opcode   = instr[0];
     psys_fulladdr erec = s->erec;
+    psys_byte instr[4];
+    psys_byte opcode;
     psys_byte procedure;
 
+    psys_read_bytes(s, instr, s->ipc, sizeof(instr));
+    opcode = instr[0];
+
     if (opcode == PSOP_CLP || opcode == PSOP_CGP || opcode == PSOP_SCIP1 || opcode == PSOP_SCIP2) {
         procedure = instr[1];
     } else if (opcode == PSOP_CIP) {
@@ -167,10 +167,11 @@ void psys_print_info(struct psys_state *s)
     unsigned ptr;
     psys_byte opcode;
     struct psys_opcode_desc *op;
+    struct psys_segment_id id;
     int num_in;
 
-    if (prev_opcode != -1) {
-        op = &psys_opcode_descriptions[prev_opcode];
+    if (s->print_info_pending) {
+        op = &psys_opcode_descriptions[s->print_info_opcode];
         /* print result of previous instruction */
         if (op->num_out > 0) {
             psys_debug("    -> (");
@@ -182,15 +183,16 @@ void psys_print_info(struct psys_state *s)
             psys_debug(")");
             psys_debug("\n");
         }
-        prev_opcode = -1;
+        s->print_info_pending = false;
     }
 
     ptr    = s->ipc;
     opcode = psys_ldb(s, ptr++, 0);
     op     = &psys_opcode_descriptions[opcode];
 
+    psys_read_segment_id(s, &id, s->curseg + PSYS_SEG_NAME);
     psys_debug("%.8s:0x%02x:%04x ipc=0x%05x tib=%04x sp=%04x ",
-        psys_bytes(s, s->curseg + PSYS_SEG_NAME), s->curproc, s->ipc - s->curseg, s->ipc,
+        id.name, s->curproc, s->ipc - s->curseg, s->ipc,
         s->curtask, s->sp);
     /* print instruction */
     psys_debug("%s", op->name);
@@ -241,7 +243,8 @@ void psys_print_info(struct psys_state *s)
     psys_debug(")");
 
     psys_debug("\n");
-    prev_opcode = opcode;
+    s->print_info_pending = true;
+    s->print_info_opcode  = opcode;
 }
 
 static int psys_function_id_compare(const void *key_, const void *entry_)
@@ -261,9 +264,10 @@ void psys_print_call_info(struct psys_state *s, const struct psys_function_id *i
     psys_byte opcode;
     int num_in = -1;
     psys_fulladdr erec;
-    const psys_byte *segname = NULL;
+    bool have_dest = false;
     int depth, i;
     struct psys_function_id key;
+    struct psys_segment_id id;
 
     opcode = psys_ldb(s, s->ipc, 0);
 
@@ -277,8 +281,8 @@ void psys_print_call_info(struct psys_state *s, const struct psys_function_id *i
     if (get_call_destination(s, &erec, &key.proc_num)) {
         struct psys_function_id key_wild; /* wildcard key */
         psys_word sib = psys_ldw(s, erec + PSYS_EREC_Env_SIB);
-        segname       = psys_bytes(s, sib + PSYS_SIB_Seg_Name);
-        memcpy(&key.seg, segname, 8);
+        psys_read_segment_id(s, &key.seg, sib + PSYS_SIB_Seg_Name);
+        have_dest = true;
 
         /* It is possible to ignore certain segment-procedure pairs,
          * which cause a lot of noise.
@@ -307,10 +311,11 @@ void psys_print_call_info(struct psys_state *s, const struct psys_function_id *i
         psys_debug(" ");
     }
 
+    psys_read_segment_id(s, &id, s->curseg + PSYS_SEG_NAME);
     psys_debug("%.8s:0x%02x:%04x " U_RIGHT_ARROW " ",
-        psys_bytes(s, s->curseg + PSYS_SEG_NAME), s->curproc, s->ipc - s->curseg);
+        id.name, s->curproc, s->ipc - s->curseg);
 
-    if (segname) {
+    if (have_dest) {
         const struct util_debuginfo_entry *entry;
 
         psys_debug("%-8.8s:0x%02x ", key.seg.name, key.proc_num);
@@ -407,7 +412,10 @@ void psys_debug_hexdump_ofs(const psys_byte *data, psys_fulladdr offset, unsigne
 
 void psys_debug_hexdump(struct psys_state *s, psys_fulladdr offset, unsigned size)
 {
-    psys_debug_hexdump_ofs(psys_bytes(s, offset), offset, size);
+    psys_byte *data = malloc(size);
+    psys_read_bytes(s, data, offset, size);
+    psys_debug_hexdump_ofs(data, offset, size);
+    free(data);
 }
 
 psys_fulladdr psys_debug_first_erec_ptr(struct psys_state *s)
@@ -435,7 +443,9 @@ psys_fulladdr psys_debug_get_erec_for_segment(struct psys_state *s, const char *
     /* Traverse linked list of erecs */
     while (erec) {
         psys_word sib = psys_ldw(s, erec + PSYS_EREC_Env_SIB);
-        if (!memcmp(id.name, psys_bytes(s, sib + PSYS_SIB_Seg_Name), 8)) {
+        struct psys_segment_id sib_id;
+        psys_read_segment_id(s, &sib_id, sib + PSYS_SIB_Seg_Name);
+        if (sib_id.num == id.num) {
             return erec;
         }
         erec = psys_ldw(s, erec + PSYS_EREC_Next_Rec);
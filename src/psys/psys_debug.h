@@ -19,12 +19,14 @@ struct psys_state;
 
 #define PDBG(s, flag) ((s)->debug & PSYS_DBG_##flag)
 enum {
-    PSYS_DBG_CALL    = 0x1,  /* Extra debugging for calls and returns */
-    PSYS_DBG_WARNING = 0x2,  /* Weirdnesses */
-    PSYS_DBG_STRINGS = 0x4,  /* Strings and arrays */
-    PSYS_DBG_TASK    = 0x10, /* Tasks and synchonization */
-    PSYS_DBG_RSP     = 0x20, /* RSP calls */
-    PSYS_DBG_REG     = 0x40, /* Register writes and reads */
+    PSYS_DBG_CALL     = 0x1,   /* Extra debugging for calls and returns */
+    PSYS_DBG_WARNING  = 0x2,   /* Weirdnesses */
+    PSYS_DBG_STRINGS  = 0x4,   /* Strings and arrays */
+    PSYS_DBG_TASK     = 0x10,  /* Tasks and synchonization */
+    PSYS_DBG_RSP      = 0x20,  /* RSP calls */
+    PSYS_DBG_REG      = 0x40,  /* Register writes and reads */
+    PSYS_DBG_DISPLAY  = 0x100, /* Check display against static chain (debug builds only) */
+    PSYS_DBG_JIT_DIFF = 0x200, /* Compare every JIT block against the interpreter (PSYS_JIT builds only) */
     /* These are not used by the interpreter itself,
      * but are free for use by the application.
      */
@@ -32,6 +34,11 @@ enum {
     PSYS_DBG_TRACE_CALLS = 0x80, /* Trace all procedure calls */
 };
 
+/* Debug flags that are checked in the interpreter loop. The interpreter runs
+ * an instrumented variant of the loop while any of these is set.
+ */
+#define PSYS_DBG_INTERPRETER (PSYS_DBG_CALL | PSYS_DBG_STRINGS | PSYS_DBG_DISPLAY)
+
 /** Debug info entry for one procedure */
 struct util_debuginfo_entry {
     struct psys_function_id proc;
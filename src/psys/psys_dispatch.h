@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#ifndef H_PSYS_DISPATCH
+#define H_PSYS_DISPATCH
+
+// clang-format off
+/* auto-generated by gen_interpreter.py */
+/* Handler label for every opcode, for use by the threaded interpreter.
+ * Every label named here must be defined exactly once in psys_interpreter().
+ */
+#define PSYS_DISPATCH_LABELS(X) \
+    X(do_sldc     ) /* 0x00 sldc0    */ \
+    X(do_sldc     ) /* 0x01 sldc1    */ \
+    X(do_sldc     ) /* 0x02 sldc2    */ \
+    X(do_sldc     ) /* 0x03 sldc3    */ \
+    X(do_sldc     ) /* 0x04 sldc4    */ \
+    X(do_sldc     ) /* 0x05 sldc5    */ \
+    X(do_sldc     ) /* 0x06 sldc6    */ \
+    X(do_sldc     ) /* 0x07 sldc7    */ \
+    X(do_sldc     ) /* 0x08 sldc8    */ \
+    X(do_sldc     ) /* 0x09 sldc9    */ \
+    X(do_sldc     ) /* 0x0a sldc10   */ \
+    X(do_sldc     ) /* 0x0b sldc11   */ \
+    X(do_sldc     ) /* 0x0c sldc12   */ \
+    X(do_sldc     ) /* 0x0d sldc13   */ \
+    X(do_sldc     ) /* 0x0e sldc14   */ \
+    X(do_sldc     ) /* 0x0f sldc15   */ \
+    X(do_sldc     ) /* 0x10 sldc16   */ \
+    X(do_sldc     ) /* 0x11 sldc17   */ \
+    X(do_sldc     ) /* 0x12 sldc18   */ \
+    X(do_sldc     ) /* 0x13 sldc19   */ \
+    X(do_sldc     ) /* 0x14 sldc20   */ \
+    X(do_sldc     ) /* 0x15 sldc21   */ \
+    X(do_sldc     ) /* 0x16 sldc22   */ \
+    X(do_sldc     ) /* 0x17 sldc23   */ \
+    X(do_sldc     ) /* 0x18 sldc24   */ \
+    X(do_sldc     ) /* 0x19 sldc25   */ \
+    X(do_sldc     ) /* 0x1a sldc26   */ \
+    X(do_sldc     ) /* 0x1b sldc27   */ \
+    X(do_sldc     ) /* 0x1c sldc28   */ \
+    X(do_sldc     ) /* 0x1d sldc29   */ \
+    X(do_sldc     ) /* 0x1e sldc30   */ \
+    X(do_sldc     ) /* 0x1f sldc31   */ \
+    X(do_sldl     ) /* 0x20 sldl1    */ \
+    X(do_sldl     ) /* 0x21 sldl2    */ \
+    X(do_sldl     ) /* 0x22 sldl3    */ \
+    X(do_sldl     ) /* 0x23 sldl4    */ \
+    X(do_sldl     ) /* 0x24 sldl5    */ \
+    X(do_sldl     ) /* 0x25 sldl6    */ \
+    X(do_sldl     ) /* 0x26 sldl7    */ \
+    X(do_sldl     ) /* 0x27 sldl8    */ \
+    X(do_sldl     ) /* 0x28 sldl9    */ \
+    X(do_sldl     ) /* 0x29 sldl10   */ \
+    X(do_sldl     ) /* 0x2a sldl11   */ \
+    X(do_sldl     ) /* 0x2b sldl12   */ \
+    X(do_sldl     ) /* 0x2c sldl13   */ \
+    X(do_sldl     ) /* 0x2d sldl14   */ \
+    X(do_sldl     ) /* 0x2e sldl15   */ \
+    X(do_sldl     ) /* 0x2f sldl16   */ \
+    X(do_sldo     ) /* 0x30 sldo1    */ \
+    X(do_sldo     ) /* 0x31 sldo2    */ \
+    X(do_sldo     ) /* 0x32 sldo3    */ \
+    X(do_sldo     ) /* 0x33 sldo4    */ \
+    X(do_sldo     ) /* 0x34 sldo5    */ \
+    X(do_sldo     ) /* 0x35 sldo6    */ \
+    X(do_sldo     ) /* 0x36 sldo7    */ \
+    X(do_sldo     ) /* 0x37 sldo8    */ \
+    X(do_sldo     ) /* 0x38 sldo9    */ \
+    X(do_sldo     ) /* 0x39 sldo10   */ \
+    X(do_sldo     ) /* 0x3a sldo11   */ \
+    X(do_sldo     ) /* 0x3b sldo12   */ \
+    X(do_sldo     ) /* 0x3c sldo13   */ \
+    X(do_sldo     ) /* 0x3d sldo14   */ \
+    X(do_sldo     ) /* 0x3e sldo15   */ \
+    X(do_sldo     ) /* 0x3f sldo16   */ \
+    X(do_invalid  ) /* 0x40 und40    */ \
+    X(do_invalid  ) /* 0x41 und41    */ \
+    X(do_invalid  ) /* 0x42 und42    */ \
+    X(do_invalid  ) /* 0x43 und43    */ \
+    X(do_invalid  ) /* 0x44 und44    */ \
+    X(do_invalid  ) /* 0x45 und45    */ \
+    X(do_invalid  ) /* 0x46 und46    */ \
+    X(do_invalid  ) /* 0x47 und47    */ \
+    X(do_invalid  ) /* 0x48 und48    */ \
+    X(do_invalid  ) /* 0x49 und49    */ \
+    X(do_invalid  ) /* 0x4a und4a    */ \
+    X(do_invalid  ) /* 0x4b und4b    */ \
+    X(do_invalid  ) /* 0x4c und4c    */ \
+    X(do_invalid  ) /* 0x4d und4d    */ \
+    X(do_invalid  ) /* 0x4e und4e    */ \
+    X(do_invalid  ) /* 0x4f und4f    */ \
+    X(do_invalid  ) /* 0x50 und50    */ \
+    X(do_invalid  ) /* 0x51 und51    */ \
+    X(do_invalid  ) /* 0x52 und52    */ \
+    X(do_invalid  ) /* 0x53 und53    */ \
+    X(do_invalid  ) /* 0x54 und54    */ \
+    X(do_invalid  ) /* 0x55 und55    */ \
+    X(do_invalid  ) /* 0x56 und56    */ \
+    X(do_invalid  ) /* 0x57 und57    */ \
+    X(do_invalid  ) /* 0x58 und58    */ \
+    X(do_invalid  ) /* 0x59 und59    */ \
+    X(do_invalid  ) /* 0x5a und5a    */ \
+    X(do_invalid  ) /* 0x5b und5b    */ \
+    X(do_invalid  ) /* 0x5c und5c    */ \
+    X(do_invalid  ) /* 0x5d und5d    */ \
+    X(do_invalid  ) /* 0x5e und5e    */ \
+    X(do_invalid  ) /* 0x5f und5f    */ \
+    X(do_slla     ) /* 0x60 slla1    */ \
+    X(do_slla     ) /* 0x61 slla2    */ \
+    X(do_slla     ) /* 0x62 slla3    */ \
+    X(do_slla     ) /* 0x63 slla4    */ \
+    X(do_slla     ) /* 0x64 slla5    */ \
+    X(do_slla     ) /* 0x65 slla6    */ \
+    X(do_slla     ) /* 0x66 slla7    */ \
+    X(do_slla     ) /* 0x67 slla8    */ \
+    X(do_sstl     ) /* 0x68 sstl1    */ \
+    X(do_sstl     ) /* 0x69 sstl2    */ \
+    X(do_sstl     ) /* 0x6a sstl3    */ \
+    X(do_sstl     ) /* 0x6b sstl4    */ \
+    X(do_sstl     ) /* 0x6c sstl5    */ \
+    X(do_sstl     ) /* 0x6d sstl6    */ \
+    X(do_sstl     ) /* 0x6e sstl7    */ \
+    X(do_sstl     ) /* 0x6f sstl8    */ \
+    X(do_scxg     ) /* 0x70 scxg1    */ \
+    X(do_scxg     ) /* 0x71 scxg2    */ \
+    X(do_scxg     ) /* 0x72 scxg3    */ \
+    X(do_scxg     ) /* 0x73 scxg4    */ \
+    X(do_scxg     ) /* 0x74 scxg5    */ \
+    X(do_scxg     ) /* 0x75 scxg6    */ \
+    X(do_scxg     ) /* 0x76 scxg7    */ \
+    X(do_scxg     ) /* 0x77 scxg8    */ \
+    X(do_sind     ) /* 0x78 sind0    */ \
+    X(do_sind     ) /* 0x79 sind1    */ \
+    X(do_sind     ) /* 0x7a sind2    */ \
+    X(do_sind     ) /* 0x7b sind3    */ \
+    X(do_sind     ) /* 0x7c sind4    */ \
+    X(do_sind     ) /* 0x7d sind5    */ \
+    X(do_sind     ) /* 0x7e sind6    */ \
+    X(do_sind     ) /* 0x7f sind7    */ \
+    X(do_ldcb     ) /* 0x80 ldcb     */ \
+    X(do_ldci     ) /* 0x81 ldci     */ \
+    X(do_lco      ) /* 0x82 lco      */ \
+    X(do_ldc      ) /* 0x83 ldc      */ \
+    X(do_lla      ) /* 0x84 lla      */ \
+    X(do_ldo      ) /* 0x85 ldo      */ \
+    X(do_lao      ) /* 0x86 lao      */ \
+    X(do_ldl      ) /* 0x87 ldl      */ \
+    X(do_lda      ) /* 0x88 lda      */ \
+    X(do_lod      ) /* 0x89 lod      */ \
+    X(do_ujp      ) /* 0x8a ujp      */ \
+    X(do_ujpl     ) /* 0x8b ujpl     */ \
+    X(do_mpi      ) /* 0x8c mpi      */ \
+    X(do_dvi      ) /* 0x8d dvi      */ \
+    X(do_stm      ) /* 0x8e stm      */ \
+    X(do_modi     ) /* 0x8f modi     */ \
+    X(do_clp      ) /* 0x90 clp      */ \
+    X(do_cgp      ) /* 0x91 cgp      */ \
+    X(do_cip      ) /* 0x92 cip      */ \
+    X(do_cxl      ) /* 0x93 cxl      */ \
+    X(do_cxg      ) /* 0x94 cxg      */ \
+    X(do_cxi      ) /* 0x95 cxi      */ \
+    X(do_rpu      ) /* 0x96 rpu      */ \
+    X(do_cfp      ) /* 0x97 cfp      */ \
+    X(do_ldcn     ) /* 0x98 ldcn     */ \
+    X(do_lsl      ) /* 0x99 lsl      */ \
+    X(do_lde      ) /* 0x9a lde      */ \
+    X(do_lae      ) /* 0x9b lae      */ \
+    X(do_nop      ) /* 0x9c nop      */ \
+    X(do_lpr      ) /* 0x9d lpr      */ \
+    X(do_bpt      ) /* 0x9e bpt      */ \
+    X(do_bnot     ) /* 0x9f bnot     */ \
+    X(do_lor      ) /* 0xa0 lor      */ \
+    X(do_land     ) /* 0xa1 land     */ \
+    X(do_adi      ) /* 0xa2 adi      */ \
+    X(do_sbi      ) /* 0xa3 sbi      */ \
+    X(do_stl      ) /* 0xa4 stl      */ \
+    X(do_sro      ) /* 0xa5 sro      */ \
+    X(do_str      ) /* 0xa6 str      */ \
+    X(do_ldb      ) /* 0xa7 ldb      */ \
+    X(do_native   ) /* 0xa8 native   */ \
+    X(do_nat_info ) /* 0xa9 nat-info */ \
+    X(do_invalid  ) /* 0xaa undaa    */ \
+    X(do_cap      ) /* 0xab cap      */ \
+    X(do_csp      ) /* 0xac csp      */ \
+    X(do_slod     ) /* 0xad slod1    */ \
+    X(do_slod     ) /* 0xae slod2    */ \
+    X(do_invalid  ) /* 0xaf undaf    */ \
+    X(do_equi     ) /* 0xb0 equi     */ \
+    X(do_neqi     ) /* 0xb1 neqi     */ \
+    X(do_leqi     ) /* 0xb2 leqi     */ \
+    X(do_geqi     ) /* 0xb3 geqi     */ \
+    X(do_leusw    ) /* 0xb4 leusw    */ \
+    X(do_geusw    ) /* 0xb5 geusw    */ \
+    X(do_eqpwr    ) /* 0xb6 eqpwr    */ \
+    X(do_lepwr    ) /* 0xb7 lepwr    */ \
+    X(do_gepwr    ) /* 0xb8 gepwr    */ \
+    X(do_eqbyte   ) /* 0xb9 eqbyte   */ \
+    X(do_lebyte   ) /* 0xba lebyte   */ \
+    X(do_gebyte   ) /* 0xbb gebyte   */ \
+    X(do_srs      ) /* 0xbc srs      */ \
+    X(do_swap     ) /* 0xbd swap     */ \
+    X(do_invalid  ) /* 0xbe undbe    */ \
+    X(do_invalid  ) /* 0xbf undbf    */ \
+    X(do_invalid  ) /* 0xc0 undc0    */ \
+    X(do_invalid  ) /* 0xc1 undc1    */ \
+    X(do_invalid  ) /* 0xc2 undc2    */ \
+    X(do_invalid  ) /* 0xc3 undc3    */ \
+    X(do_sto      ) /* 0xc4 sto      */ \
+    X(do_mov      ) /* 0xc5 mov      */ \
+    X(do_dup2     ) /* 0xc6 dup2     */ \
+    X(do_adj      ) /* 0xc7 adj      */ \
+    X(do_stb      ) /* 0xc8 stb      */ \
+    X(do_ldp      ) /* 0xc9 ldp      */ \
+    X(do_stp      ) /* 0xca stp      */ \
+    X(do_chk      ) /* 0xcb chk      */ \
+    X(do_flt      ) /* 0xcc flt      */ \
+    X(do_eqreal   ) /* 0xcd eqreal   */ \
+    X(do_lereal   ) /* 0xce lereal   */ \
+    X(do_gereal   ) /* 0xcf gereal   */ \
+    X(do_ldm      ) /* 0xd0 ldm      */ \
+    X(do_spr      ) /* 0xd1 spr      */ \
+    X(do_efj      ) /* 0xd2 efj      */ \
+    X(do_nfj      ) /* 0xd3 nfj      */ \
+    X(do_fjp      ) /* 0xd4 fjp      */ \
+    X(do_fjpl     ) /* 0xd5 fjpl     */ \
+    X(do_xjp      ) /* 0xd6 xjp      */ \
+    X(do_ixa      ) /* 0xd7 ixa      */ \
+    X(do_ixp      ) /* 0xd8 ixp      */ \
+    X(do_ste      ) /* 0xd9 ste      */ \
+    X(do_inn      ) /* 0xda inn      */ \
+    X(do_uni      ) /* 0xdb uni      */ \
+    X(do_int      ) /* 0xdc int      */ \
+    X(do_dif      ) /* 0xdd dif      */ \
+    X(do_signal   ) /* 0xde signal   */ \
+    X(do_wait     ) /* 0xdf wait     */ \
+    X(do_abi      ) /* 0xe0 abi      */ \
+    X(do_ngi      ) /* 0xe1 ngi      */ \
+    X(do_dup1     ) /* 0xe2 dup1     */ \
+    X(do_abr      ) /* 0xe3 abr      */ \
+    X(do_ngr      ) /* 0xe4 ngr      */ \
+    X(do_lnot     ) /* 0xe5 lnot     */ \
+    X(do_ind      ) /* 0xe6 ind      */ \
+    X(do_inc      ) /* 0xe7 inc      */ \
+    X(do_eqstr    ) /* 0xe8 eqstr    */ \
+    X(do_lestr    ) /* 0xe9 lestr    */ \
+    X(do_gestr    ) /* 0xea gestr    */ \
+    X(do_astr     ) /* 0xeb astr     */ \
+    X(do_cstr     ) /* 0xec cstr     */ \
+    X(do_inci     ) /* 0xed inci     */ \
+    X(do_deci     ) /* 0xee deci     */ \
+    X(do_scip     ) /* 0xef scip1    */ \
+    X(do_scip     ) /* 0xf0 scip2    */ \
+    X(do_tjp      ) /* 0xf1 tjp      */ \
+    X(do_ldcrl    ) /* 0xf2 ldcrl    */ \
+    X(do_ldrl     ) /* 0xf3 ldrl     */ \
+    X(do_strl     ) /* 0xf4 strl     */ \
+    X(do_invalid  ) /* 0xf5 undf5    */ \
+    X(do_invalid  ) /* 0xf6 undf6    */ \
+    X(do_invalid  ) /* 0xf7 undf7    */ \
+    X(do_invalid  ) /* 0xf8 undf8    */ \
+    X(do_invalid  ) /* 0xf9 undf9    */ \
+    X(do_invalid  ) /* 0xfa undfa    */ \
+    X(do_invalid  ) /* 0xfb undfb    */ \
+    X(do_invalid  ) /* 0xfc undfc    */ \
+    X(do_invalid  ) /* 0xfd undfd    */ \
+    X(do_invalid  ) /* 0xfe undfe    */ \
+    X(do_invalid  ) /* 0xff undff    */
+// clang-format on
+
+#endif
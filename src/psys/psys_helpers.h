@@ -10,6 +10,8 @@
 #include "psys_interpreter.h"
 #include "psys_types.h"
 
+#include <string.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -30,6 +32,27 @@ extern "C" {
 /* Flip endian */
 #define F(x) psys_flip_endian(x)
 #endif
+/* P-machine memory layout. By default memory is kept in the 68000's
+ * big-endian byte order, so that byte data is contiguous and words are
+ * flipped on every load and store on little-endian hosts. With
+ * PSYS_NATIVE_ENDIAN words are kept in host order instead, and byte addresses
+ * are mapped to their location within the word (PSYS_MEM_BYTE_XOR). Byte
+ * data in memory is then only contiguous per byte, so code that treats
+ * memory as bytes must go through psys_ldb/psys_stb or the byte copy helpers
+ * below.
+ */
+#if defined(PSYS_NATIVE_ENDIAN) && !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define PSYS_MEM_BYTE_XOR 1
+/* Words in memory are in host order */
+#define FM(x) (x)
+#else
+#define PSYS_MEM_BYTE_XOR 0
+/* Words in memory are big-endian */
+#define FM(x) F(x)
+#endif
+/* Granularity of dirty page tracking */
+#define PSYS_PAGE_SHIFT 10
+#define PSYS_PAGE_SIZE (1 << PSYS_PAGE_SHIFT)
 
 /* Sign extend byte */
 static inline int signext_byte(psys_byte x)
@@ -57,12 +80,12 @@ static inline psys_word psys_flip_endian(psys_word x)
  */
 static inline psys_byte psys_ldb(const struct psys_state *state, psys_fulladdr addr, psys_fulladdr offset)
 {
-    return state->memory[addr + offset];
+    return state->memory[(addr + offset) ^ PSYS_MEM_BYTE_XOR];
 }
 /* Load unsigned word from word addr */
 static inline psys_word psys_ldw(const struct psys_state *state, psys_fulladdr addr)
 {
-    return F(*((psys_word *)&state->memory[addr]));
+    return FM(*((psys_word *)&state->memory[addr]));
 }
 /* Loads signed word from word addr */
 static inline psys_sword psys_ldsw(const struct psys_state *state, psys_fulladdr addr)
@@ -92,26 +115,130 @@ static inline psys_sword psys_ldsw_flip(const struct psys_state *state, psys_ful
         return signext_word(rv);
     }
 }
+/* Mark memory range as changed, for dirty page tracking.
+ * Writes through the store and copy helpers below do this automatically, code
+ * that writes through psys_bytes or psys_words must call it.
+ */
+static inline void psys_mark_dirty(struct psys_state *state, psys_fulladdr addr, size_t n)
+{
+    if (state->dirty_pages && n) {
+        psys_fulladdr page;
+        for (page = addr >> PSYS_PAGE_SHIFT; page <= (addr + n - 1) >> PSYS_PAGE_SHIFT; ++page) {
+            state->dirty_pages[page] = 1;
+        }
+    }
+}
 /* Store byte to (word addr, offset) */
 static inline void psys_stb(struct psys_state *state, psys_fulladdr addr, psys_word offset, psys_byte value)
 {
-    state->memory[addr + offset] = value;
+    psys_fulladdr ptr = (addr + offset) ^ PSYS_MEM_BYTE_XOR;
+    state->memory[ptr] = value;
+    if (state->dirty_pages) {
+        state->dirty_pages[ptr >> PSYS_PAGE_SHIFT] = 1;
+    }
 }
 /* Store word to word addr */
 static inline void psys_stw(struct psys_state *state, psys_fulladdr addr, psys_word value)
 {
-    *((psys_word *)&state->memory[addr]) = F(value);
+    *((psys_word *)&state->memory[addr]) = FM(value);
+    if (state->dirty_pages) {
+        state->dirty_pages[addr >> PSYS_PAGE_SHIFT] = 1;
+    }
 }
-/* Get direct access to bytes in memory */
+/* Get direct access to bytes in memory.
+ * Byte data is only contiguous if PSYS_MEM_BYTE_XOR is 0, otherwise use the
+ * byte copy helpers.
+ */
 static inline psys_byte *psys_bytes(struct psys_state *state, psys_fulladdr addr)
 {
     return (psys_byte *)&state->memory[addr];
 }
-/* Get direct access to words in memory */
+/* Get direct access to words in memory, words are converted with FM() */
 static inline psys_word *psys_words(struct psys_state *state, psys_fulladdr addr)
 {
     return (psys_word *)&state->memory[addr];
 }
+/* Copy bytes from memory to host buffer */
+static inline void psys_read_bytes(const struct psys_state *state, void *dst, psys_fulladdr addr, size_t n)
+{
+#if PSYS_MEM_BYTE_XOR
+    psys_byte *out = (psys_byte *)dst;
+    size_t x;
+    for (x = 0; x < n; ++x) {
+        out[x] = psys_ldb(state, addr, x);
+    }
+#else
+    memcpy(dst, &state->memory[addr], n);
+#endif
+}
+/* Copy bytes from host buffer to memory */
+static inline void psys_write_bytes(struct psys_state *state, psys_fulladdr addr, const void *src, size_t n)
+{
+#if PSYS_MEM_BYTE_XOR
+    const psys_byte *in = (const psys_byte *)src;
+    size_t x;
+    for (x = 0; x < n; ++x) {
+        psys_stb(state, addr, x, in[x]);
+    }
+#else
+    memcpy(&state->memory[addr], src, n);
+    psys_mark_dirty(state, addr, n);
+#endif
+}
+/* Fill bytes in memory */
+static inline void psys_fill_bytes(struct psys_state *state, psys_fulladdr addr, psys_byte value, size_t n)
+{
+#if PSYS_MEM_BYTE_XOR
+    size_t x;
+    for (x = 0; x < n; ++x) {
+        psys_stb(state, addr, x, value);
+    }
+#else
+    memset(&state->memory[addr], value, n);
+    psys_mark_dirty(state, addr, n);
+#endif
+}
+/* Move bytes within memory, like memmove */
+static inline void psys_move_bytes(struct psys_state *state, psys_fulladdr dst, psys_fulladdr src, size_t n)
+{
+#if PSYS_MEM_BYTE_XOR
+    size_t x;
+    if (dst < src) {
+        for (x = 0; x < n; ++x) {
+            psys_stb(state, dst, x, psys_ldb(state, src, x));
+        }
+    } else {
+        for (x = n; x > 0; --x) {
+            psys_stb(state, dst, x - 1, psys_ldb(state, src, x - 1));
+        }
+    }
+#else
+    memmove(&state->memory[dst], &state->memory[src], n);
+    psys_mark_dirty(state, dst, n);
+#endif
+}
+/* Compare bytes in memory, like memcmp */
+static inline int psys_compare_bytes(const struct psys_state *state, psys_fulladdr addr1, psys_fulladdr addr2, size_t n)
+{
+#if PSYS_MEM_BYTE_XOR
+    size_t x;
+    for (x = 0; x < n; ++x) {
+        psys_byte a = psys_ldb(state, addr1, x);
+        psys_byte b = psys_ldb(state, addr2, x);
+        if (a != b) {
+            return (int)a - (int)b;
+        }
+    }
+    return 0;
+#else
+    return memcmp(&state->memory[addr1], &state->memory[addr2], n);
+#endif
+}
+/* Read segment name at addr */
+static inline void psys_read_segment_id(const struct psys_state *state, struct psys_segment_id *id, psys_fulladdr addr)
+{
+    psys_read_bytes(state, id->name, addr, 8);
+}
 
 /* push a word to the stack */
 static inline void psys_push(struct psys_state *state, psys_word x)
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "psys_hooks.h"
+
+#include "psys_constants.h"
+#include "psys_helpers.h"
+#include "psys_interpreter.h"
+#include "util/memutil.h"
+
+#include <stdlib.h>
+
+/* Segment offsets cannot exceed 64k */
+#define MAX_OFS 0x10000
+
+enum hook_kind {
+    HK_INSN,
+    HK_ADDR,
+    HK_CALL,
+    HK_RETURN,
+    HK_MAX
+};
+
+struct psys_hook {
+    enum hook_kind kind;
+    psys_hookfunc *func;
+    void *userdata;
+    struct psys_segment_id seg; /* address hooks only */
+    psys_word offset;           /* address hooks only */
+    bool removed;               /* removed while hooks were running */
+    struct psys_hook *next;
+};
+
+/** Bitmap of hooked offsets in one segment */
+struct addr_map {
+    struct psys_segment_id seg;
+    psys_byte bits[MAX_OFS / 8];
+    struct addr_map *next;
+};
+
+struct psys_hooks {
+    struct psys_hook *hooks[HK_MAX];
+    /* Address hook bitmaps, and map for the current segment */
+    struct addr_map *maps;
+    psys_fulladdr map_seg;  /* segment base that *map* was looked up for */
+    unsigned map_epoch;     /* segment epoch that *map* was looked up in */
+    struct addr_map *map;   /* NULL if no hooks in segment */
+    /* Instruction budget */
+    unsigned budget;
+    psys_hookfunc *budget_func;
+    void *budget_userdata;
+    /* Asynchronous events */
+    psys_hookfunc *async_func;
+    void *async_userdata;
+    /* Deferred removal */
+    unsigned running;
+    bool need_cleanup;
+};
+
+static const unsigned kind_flags[HK_MAX] = {
+    PSYS_HOOK_INSN,
+    PSYS_HOOK_ADDR | PSYS_HOOK_ADDR_ARMED,
+    PSYS_HOOK_CALL,
+    PSYS_HOOK_RETURN,
+};
+
+static struct psys_hooks *get_hooks(struct psys_state *s)
+{
+    if (!s->hooks) {
+        s->hooks          = CALLOC_STRUCT(psys_hooks);
+        s->hooks->map_seg = PSYS_ADDR_ERROR;
+    }
+    return s->hooks;
+}
+
+/** Recompute armed hook kinds. */
+static void update_flags(struct psys_state *s)
+{
+    struct psys_hooks *h = s->hooks;
+    unsigned flags       = s->hook_flags & (PSYS_HOOK_TRACE | PSYS_HOOK_BUDGET);
+    unsigned kind;
+    for (kind = 0; kind < HK_MAX; ++kind) {
+        if (h->hooks[kind]) {
+            flags |= kind_flags[kind];
+        }
+    }
+    s->hook_flags = flags;
+}
+
+/** Rebuild address hook bitmaps. */
+static void rebuild_maps(struct psys_hooks *h)
+{
+    struct psys_hook *hook;
+    struct addr_map *map;
+    while (h->maps) {
+        map     = h->maps;
+        h->maps = map->next;
+        free(map);
+    }
+    for (hook = h->hooks[HK_ADDR]; hook; hook = hook->next) {
+        for (map = h->maps; map && map->seg.num != hook->seg.num; map = map->next) {
+        }
+        if (!map) {
+            map       = CALLOC_STRUCT(addr_map);
+            map->seg  = hook->seg;
+            map->next = h->maps;
+            h->maps   = map;
+        }
+        map->bits[hook->offset >> 3] |= 1 << (hook->offset & 7);
+    }
+    h->map_seg = PSYS_ADDR_ERROR;
+    h->map     = NULL;
+}
+
+/** Unlink and free removed hooks. */
+static void cleanup(struct psys_state *s)
+{
+    struct psys_hooks *h = s->hooks;
+    struct psys_hook **p, *hook;
+    unsigned kind;
+    for (kind = 0; kind < HK_MAX; ++kind) {
+        p = &h->hooks[kind];
+        while (*p) {
+            hook = *p;
+            if (hook->removed) {
+                *p = hook->next;
+                free(hook);
+            } else {
+                p = &hook->next;
+            }
+        }
+    }
+    h->need_cleanup = false;
+    rebuild_maps(h);
+    update_flags(s);
+}
+
+static struct psys_hook *add_hook(struct psys_state *s, enum hook_kind kind, psys_hookfunc *func, void *userdata)
+{
+    struct psys_hooks *h   = get_hooks(s);
+    struct psys_hook *hook = CALLOC_STRUCT(psys_hook);
+    hook->kind             = kind;
+    hook->func             = func;
+    hook->userdata         = userdata;
+    hook->next             = h->hooks[kind];
+    h->hooks[kind]         = hook;
+    update_flags(s);
+    return hook;
+}
+
+struct psys_hook *psys_add_insn_hook(struct psys_state *s, psys_hookfunc *func, void *userdata)
+{
+    return add_hook(s, HK_INSN, func, userdata);
+}
+
+struct psys_hook *psys_add_address_hook(struct psys_state *s, const struct psys_segment_id *seg, psys_word offset,
+    psys_hookfunc *func, void *userdata)
+{
+    struct psys_hook *hook = add_hook(s, HK_ADDR, func, userdata);
+    hook->seg              = *seg;
+    hook->offset           = offset;
+    rebuild_maps(s->hooks);
+    return hook;
+}
+
+struct psys_hook *psys_add_call_hook(struct psys_state *s, psys_hookfunc *func, void *userdata)
+{
+    return add_hook(s, HK_CALL, func, userdata);
+}
+
+struct psys_hook *psys_add_return_hook(struct psys_state *s, psys_hookfunc *func, void *userdata)
+{
+    return add_hook(s, HK_RETURN, func, userdata);
+}
+
+void psys_remove_hook(struct psys_state *s, struct psys_hook *hook)
+{
+    struct psys_hooks *h = s->hooks;
+    hook->removed        = true;
+    h->need_cleanup      = true;
+    if (!h->running) {
+        cleanup(s);
+    }
+}
+
+void psys_set_trace(struct psys_state *s, psys_tracefunc *func, void *userdata)
+{
+    s->trace          = func;
+    s->trace_userdata = userdata;
+    if (func) {
+        s->hook_flags |= PSYS_HOOK_TRACE;
+    } else {
+        s->hook_flags &= ~PSYS_HOOK_TRACE;
+    }
+}
+
+void psys_set_budget(struct psys_state *s, unsigned count, psys_hookfunc *func, void *userdata)
+{
+    struct psys_hooks *h = get_hooks(s);
+    h->budget            = count;
+    h->budget_func       = func;
+    h->budget_userdata   = userdata;
+    if (count || func) {
+        s->hook_flags |= PSYS_HOOK_BUDGET;
+    } else {
+        s->hook_flags &= ~PSYS_HOOK_BUDGET;
+    }
+}
+
+unsigned psys_get_budget(struct psys_state *s)
+{
+    return s->hooks ? s->hooks->budget : 0;
+}
+
+void psys_set_async_handler(struct psys_state *s, psys_hookfunc *func, void *userdata)
+{
+    struct psys_hooks *h = get_hooks(s);
+    h->async_func        = func;
+    h->async_userdata    = userdata;
+}
+
+void psys_raise_async(struct psys_state *s)
+{
+    util_atomic_set(&s->async_pending, 1);
+}
+
+void psys_hooks_destroy(struct psys_state *s)
+{
+    struct psys_hooks *h = s->hooks;
+    struct psys_hook *hook;
+    unsigned kind;
+    if (!h) {
+        return;
+    }
+    for (kind = 0; kind < HK_MAX; ++kind) {
+        while (h->hooks[kind]) {
+            hook           = h->hooks[kind];
+            h->hooks[kind] = hook->next;
+            free(hook);
+        }
+    }
+    rebuild_maps(h);
+    free(h);
+    s->hooks      = NULL;
+    s->hook_flags = s->hook_flags & PSYS_HOOK_TRACE;
+}
+
+/** Run all hooks in a list. */
+static void run_hooks(struct psys_state *s, struct psys_hook *hook)
+{
+    for (; hook; hook = hook->next) {
+        if (!hook->removed) {
+            hook->func(s, hook->userdata);
+        }
+    }
+}
+
+/** Run address hooks for current instruction, if any. If the current segment
+ * has no address hooks, stop checking until the segment changes.
+ */
+static void run_address_hooks(struct psys_state *s, struct psys_hooks *h)
+{
+    psys_fulladdr ofs = s->ipc - s->curseg;
+    struct psys_hook *hook;
+    if (h->map_seg != s->curseg || h->map_epoch != s->seg_epoch) { /* segment changed */
+        struct psys_segment_id id;
+        psys_read_segment_id(s, &id, s->curseg + PSYS_SEG_NAME);
+        for (h->map = h->maps; h->map && h->map->seg.num != id.num; h->map = h->map->next) {
+        }
+        h->map_seg   = s->curseg;
+        h->map_epoch = s->seg_epoch;
+    }
+    if (!h->map) {
+        s->hook_flags &= ~PSYS_HOOK_ADDR;
+        return;
+    }
+    if (ofs >= MAX_OFS || !(h->map->bits[ofs >> 3] & (1 << (ofs & 7)))) {
+        return;
+    }
+    for (hook = h->hooks[HK_ADDR]; hook; hook = hook->next) {
+        if (!hook->removed && hook->offset == ofs && hook->seg.num == h->map->seg.num) {
+            hook->func(s, hook->userdata);
+        }
+    }
+}
+
+void psys_hooks_insn(struct psys_state *s)
+{
+    struct psys_hooks *h = s->hooks;
+    if ((s->hook_flags & PSYS_HOOK_TRACE) && s->trace) {
+        s->trace(s, s->trace_userdata);
+    }
+    if (!h) {
+        return;
+    }
+    h->running += 1;
+    if (s->hook_flags & PSYS_HOOK_INSN) {
+        run_hooks(s, h->hooks[HK_INSN]);
+    }
+    if (s->hook_flags & PSYS_HOOK_ADDR) {
+        run_address_hooks(s, h);
+    }
+    if (s->hook_flags & PSYS_HOOK_BUDGET) {
+        if (h->budget == 0) { /* budget exhausted */
+            s->hook_flags &= ~PSYS_HOOK_BUDGET;
+            if (h->budget_func) {
+                h->budget_func(s, h->budget_userdata);
+            } else {
+                psys_stop(s);
+            }
+        } else {
+            h->budget -= 1;
+        }
+    }
+    h->running -= 1;
+    if (!h->running && h->need_cleanup) {
+        cleanup(s);
+    }
+}
+
+void psys_hooks_call(struct psys_state *s)
+{
+    struct psys_hooks *h = s->hooks;
+    h->running += 1;
+    run_hooks(s, h->hooks[HK_CALL]);
+    h->running -= 1;
+    if (!h->running && h->need_cleanup) {
+        cleanup(s);
+    }
+}
+
+void psys_hooks_return(struct psys_state *s)
+{
+    struct psys_hooks *h = s->hooks;
+    h->running += 1;
+    run_hooks(s, h->hooks[HK_RETURN]);
+    h->running -= 1;
+    if (!h->running && h->need_cleanup) {
+        cleanup(s);
+    }
+}
+
+void psys_hooks_async(struct psys_state *s)
+{
+    struct psys_hooks *h = s->hooks;
+    /* Clear before handling, so that events raised meanwhile are not lost */
+    util_atomic_exchange(&s->async_pending, 0);
+    if (h && h->async_func) {
+        h->async_func(s, h->async_userdata);
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Interpreter hooks.
+ * There are different kinds of hooks, and each kind only costs time while
+ * at least one hook of that kind is armed:
+ *
+ * - instruction hooks run before every instruction (this includes the trace
+ *   function in psys_state)
+ * - address hooks run before the instruction at a given offset in a named
+ *   segment; only instructions in segments that have address hooks pay for
+ *   them
+ * - call hooks run after a p-code procedure has been entered, return hooks
+ *   after returning from one
+ * - the asynchronous event handler runs at the first backward branch or
+ *   procedure call after psys_raise_async
+ * - the instruction budget runs a handler (or stops the interpreter) after a
+ *   given number of instructions
+ *
+ * Hooks can be added and removed from within hook functions.
+ */
+#ifndef H_PSYS_HOOKS
+#define H_PSYS_HOOKS
+
+#include "psys_state.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void(psys_hookfunc)(struct psys_state *state, void *userdata);
+
+struct psys_hook;
+
+/** Armed hook kinds, bits in psys_state.hook_flags */
+enum psys_hook_flags {
+    PSYS_HOOK_TRACE      = 0x01, /* trace function */
+    PSYS_HOOK_INSN       = 0x02, /* instruction hooks */
+    PSYS_HOOK_ADDR       = 0x04, /* address hooks, current segment may have some */
+    PSYS_HOOK_BUDGET     = 0x08, /* instruction budget */
+    PSYS_HOOK_CALL       = 0x10, /* call hooks */
+    PSYS_HOOK_RETURN     = 0x20, /* return hooks */
+    PSYS_HOOK_ADDR_ARMED = 0x40, /* address hooks, in any segment */
+};
+
+/* Hook kinds that need to be checked before every instruction */
+#define PSYS_HOOK_PER_INSN (PSYS_HOOK_TRACE | PSYS_HOOK_INSN | PSYS_HOOK_ADDR | PSYS_HOOK_BUDGET)
+
+/** Add a hook that runs before every instruction. */
+extern struct psys_hook *psys_add_insn_hook(struct psys_state *s, psys_hookfunc *func, void *userdata);
+
+/** Add a hook that runs before the instruction at *offset* in segment *seg*. */
+extern struct psys_hook *psys_add_address_hook(struct psys_state *s, const struct psys_segment_id *seg, psys_word offset,
+    psys_hookfunc *func, void *userdata);
+
+/** Add a hook that runs after entering a p-code procedure. */
+extern struct psys_hook *psys_add_call_hook(struct psys_state *s, psys_hookfunc *func, void *userdata);
+
+/** Add a hook that runs after returning from a p-code procedure. */
+extern struct psys_hook *psys_add_return_hook(struct psys_state *s, psys_hookfunc *func, void *userdata);
+
+/** Remove a hook. */
+extern void psys_remove_hook(struct psys_state *s, struct psys_hook *hook);
+
+/** Set trace function, called before every instruction. Pass NULL to disable. */
+extern void psys_set_trace(struct psys_state *s, psys_tracefunc *func, void *userdata);
+
+/** Arm instruction budget: after *count* instructions, call *func* or, if it
+ * is NULL, stop the interpreter before the next instruction. A count of 0
+ * with a NULL function disarms the budget.
+ */
+extern void psys_set_budget(struct psys_state *s, unsigned count, psys_hookfunc *func, void *userdata);
+
+/** Return remaining instruction budget. */
+extern unsigned psys_get_budget(struct psys_state *s);
+
+/** Set handler for asynchronous events. */
+extern void psys_set_async_handler(struct psys_state *s, psys_hookfunc *func, void *userdata);
+
+/** Request the asynchronous event handler to be called at the next safe
+ * point. This can be called from any thread.
+ */
+extern void psys_raise_async(struct psys_state *s);
+
+/** Remove all hooks and free hook state. */
+extern void psys_hooks_destroy(struct psys_state *s);
+
+/* Internal: called by interpreter when the current segment changed */
+static inline void psys_hooks_segment_changed(struct psys_state *s)
+{
+    if (s->hook_flags & PSYS_HOOK_ADDR_ARMED) {
+        s->hook_flags |= PSYS_HOOK_ADDR;
+    }
+}
+
+/* Internal: called by interpreter when any PSYS_HOOK_PER_INSN hooks are armed */
+extern void psys_hooks_insn(struct psys_state *s);
+
+/* Internal: called by interpreter when PSYS_HOOK_CALL hooks are armed */
+extern void psys_hooks_call(struct psys_state *s);
+
+/* Internal: called by interpreter when PSYS_HOOK_RETURN hooks are armed */
+extern void psys_hooks_return(struct psys_state *s);
+
+/* Internal: called by interpreter at safe points when async_pending is set */
+extern void psys_hooks_async(struct psys_state *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
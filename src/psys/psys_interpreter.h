@@ -12,20 +12,53 @@
 extern "C" {
 #endif
 
-/* Interpreter loop, runs until a binding (or the trace function)
- * sets running=false by calling psys_stop.
+/* Interpreter loop, runs until a binding (or a hook) sets running=false by
+ * calling psys_stop.
  */
 extern void psys_interpreter(struct psys_state *state);
 
+/* Run at most *max_instructions* instructions, or until the interpreter is
+ * stopped for another reason. Returns the reason for stopping. Execution
+ * can be continued by calling psys_run again.
+ */
+extern enum psys_stop_reason psys_run(struct psys_state *state, uint64_t max_instructions);
+
 /* Stop interpreter loop */
 extern void psys_stop(struct psys_state *state);
 
+/* Stop interpreter loop due to a breakpoint (for debuggers) */
+extern void psys_break(struct psys_state *state);
+
+/* Stop interpreter loop after the current instruction, so that the host
+ * can do other work (for native procedures).
+ */
+extern void psys_yield(struct psys_state *state);
+
 /* Raise execution error */
 extern void psys_execerror(struct psys_state *s, psys_word err);
 
 /* Raise fault */
 extern void psys_fault(struct psys_state *s, psys_fulladdr tib, psys_fulladdr erec, psys_fulladdr words, psys_word type);
 
+/* Notify the interpreter that code memory may have been changed, from
+ * outside the normal store instructions (segment reads and moves, or by
+ * the host). This drops any cached information about the instructions in
+ * this range, and all procedure call inline caches.
+ */
+extern void psys_invalidate_code(struct psys_state *s, psys_fulladdr addr, psys_fulladdr size);
+
+/* Notify the interpreter that the current frame or static chain has changed
+ * from outside of procedure calls (task switch, state load, or by the host).
+ */
+extern void psys_invalidate_display(struct psys_state *s);
+
+/* Free everything the interpreter allocated for a state: the predecoded
+ * instruction cache, compiled code, procedure call inline caches and dirty page
+ * tracking. Call this before freeing the state; memory, bindings and hooks are
+ * freed separately.
+ */
+extern void psys_caches_destroy(struct psys_state *s);
+
 /* Internal helper: Go from pool structure pointer to code pool base address
  * in memory.
  */
@@ -0,0 +1,1404 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Interpreter loop and procedure calls and returns. This is included twice by
+ * psys_interpreter.c, to build an instrumented and a lean variant (see there).
+ * INSTRUMENTED is 1 or 0, TOS_CACHE is 1 to cache the top of the stack in
+ * locals, and VARIANT(name) gives the name of a function in this variant. No
+ * include guard, on purpose.
+ */
+#define intermd_mscw VARIANT(intermd_mscw)
+#define intermd_addr VARIANT(intermd_addr)
+#define enter_procedure VARIANT(enter_procedure)
+#define handle_call_formal VARIANT(handle_call_formal)
+#define handle_call VARIANT(handle_call)
+#define handle_return VARIANT(handle_return)
+#define interpreter_loop VARIANT(interpreter_loop)
+
+/* Debug flag test, compiled out in the lean variant */
+#define IDBG(s, flag) (INSTRUMENTED && PDBG(s, flag))
+
+/* Expression stack access from instruction handlers. With TOS_CACHE, the
+ * instruction pointer, the stack pointer and up to two words from the top of
+ * the stack are kept in locals, so that simple instructions do not have to go
+ * through memory for them. *ncached* is the number of valid cached words: tos
+ * is the word at sp and nos the one below it, their copies in memory are stale.
+ * Pushes only write to memory when both registers are in use, pops only read
+ * from memory when none are. Handlers that call out of the interpreter loop,
+ * or access the stack in memory in any other way, spill the cache with
+ * SPILL_STACK after fetching their operands (as it also writes back the
+ * instruction pointer) and reload it with RELOAD_STACK before dispatching the
+ * next instruction. Reloading does not read memory: the words are loaded
+ * when they are popped.
+ */
+#if TOS_CACHE
+#define PUSH(x)                         \
+    do {                                \
+        psys_word push_val_ = (x);      \
+        if (ncached == 2) {             \
+            psys_stw(s, W(sp, 1), nos); \
+        } else {                        \
+            ncached += 1;               \
+        }                               \
+        nos = tos;                      \
+        tos = push_val_;                \
+        sp -= 2;                        \
+    } while (0)
+#define POP() cached_pop(s, &sp, &tos, &nos, &ncached)
+#define SPOP() signext_word(cached_pop(s, &sp, &tos, &nos, &ncached))
+#define TOP() (ncached ? tos : psys_ldw(s, sp))
+#define SET_TOP(x) ((void)(tos = (x)), ncached = ncached ? ncached : 1)
+#define STACK_PTR sp
+#define INSN_PTR ipc
+#define SPILL_STACK()                   \
+    do {                                \
+        if (ncached >= 1) {             \
+            psys_stw(s, sp, tos);       \
+        }                               \
+        if (ncached == 2) {             \
+            psys_stw(s, W(sp, 1), nos); \
+        }                               \
+        ncached = 0;                    \
+        s->sp   = sp;                   \
+        s->ipc  = ipc;                  \
+    } while (0)
+#define RELOAD_STACK()    \
+    do {                  \
+        sp      = s->sp;  \
+        ipc     = s->ipc; \
+        ncached = 0;      \
+    } while (0)
+#else
+#define PUSH(x) psys_push(s, (x))
+#define POP() psys_pop(s)
+#define SPOP() psys_spop(s)
+#define TOP() psys_ldw(s, s->sp)
+#define SET_TOP(x) psys_stw(s, s->sp, (x))
+#define STACK_PTR s->sp
+#define INSN_PTR s->ipc
+#define SPILL_STACK() \
+    do {              \
+    } while (0)
+#define RELOAD_STACK() \
+    do {               \
+    } while (0)
+#endif
+
+/** Look up intermediate MSCW offset, *lexlevel* lexical levels
+ * above the current one (0=local). This is used for intermediate (e.g. nested
+ * scope) variable accesses.
+ */
+static inline psys_fulladdr intermd_mscw(struct psys_state *state, unsigned lexlevel)
+{
+    psys_fulladdr mscw;
+    if (lexlevel < state->display_len && state->display[0] == state->mp) {
+        mscw = state->display[lexlevel];
+    } else {
+        mscw = extend_display(state, lexlevel);
+    }
+#ifndef NDEBUG
+    if (IDBG(state, DISPLAY) && mscw != walk_static_chain(state, lexlevel)) {
+        psys_panic("Display mismatch at lexical level %d: 0x%04x instead of 0x%04x\n",
+            lexlevel, mscw, walk_static_chain(state, lexlevel));
+    }
+#endif
+    return mscw;
+}
+
+/** Get address of intermediate variable */
+static inline psys_fulladdr intermd_addr(struct psys_state *state, unsigned lexlevel, unsigned n)
+{
+    return W(intermd_mscw(state, lexlevel) + PSYS_MSCW_VAROFS, n);
+}
+
+/** Set up stack frame and registers for a p-code procedure call, after the
+ * procedure has been looked up.
+ */
+static void enter_procedure(struct psys_state *s, psys_fulladdr msstat, psys_fulladdr erec, psys_word procedure, bool nonlocal,
+    psys_fulladdr newseg, psys_fulladdr funcaddr, psys_word num_locals)
+{
+    if (nonlocal) { /* increase timestamp for intersegment call */
+        psys_increase_timestamp(s, s->erec);
+        psys_segment_refcount(s, s->erec, 1);
+    }
+    /* Push locals */
+    if (INSTRUMENTED) { /* only needed for trace comparison */
+        s->local_init_base  = 5;
+        s->local_init_count = num_locals;
+    }
+    s->sp = W(s->sp, -num_locals);
+    /* Push MSCW */
+    psys_push(s, s->curproc);         /* MPROC */
+    psys_push(s, s->erec);            /* MSENV */
+    psys_push(s, s->ipc - s->curseg); /* IPC */
+    psys_push(s, s->mp);              /* MSDYN */
+    psys_push(s, msstat);             /* MSSTAT */
+    enter_display(s, msstat, s->sp);
+    /* Set up registers for new procedure */
+    s->mp      = s->sp;
+    s->base    = psys_ldw(s, erec + PSYS_EREC_Env_Data);
+    s->curseg  = newseg;
+    s->ipc     = W(funcaddr, 1);
+    s->erec    = erec;
+    s->curproc = procedure;
+    if (IDBG(s, CALL)) {
+        psys_debug("after call: mp=0x%04x ipc=0x%05x erec=0x%04x curproc=0x%02x\n",
+            s->mp, s->ipc, s->erec, s->curproc);
+    }
+    psys_hooks_segment_changed(s);
+    if (s->hook_flags & PSYS_HOOK_CALL) {
+        psys_hooks_call(s);
+    }
+    if (util_atomic_get(&s->async_pending)) {
+        psys_hooks_async(s);
+    }
+    s->compiled = psys_compiled_procedure(s, s->curseg, s->curproc);
+    run_compiled(s);
+#ifdef PSYS_JIT
+    psys_jit_run(s);
+#endif
+}
+
+/** Procedure call after context lookups (except of the procedure address itself).
+ * msstat can be 0, in which case the current base pointer will be used.
+ * If *cache* is not NULL, the result of the lookup is stored there.
+ */
+static void handle_call_formal(struct psys_state *s, psys_fulladdr msstat, psys_fulladdr erec, psys_word procedure, bool nonlocal,
+    struct psys_callcache_entry *cache)
+{
+    psys_fulladdr funcaddr, newseg;
+    psys_word num_locals;
+    const struct psys_binding *binding = NULL;
+    if (IDBG(s, CALL)) {
+        psys_debug("call msstat=0x%04x erec=0x%04x proc=0x%02x\n", msstat, erec, procedure);
+    }
+    funcaddr = lookup_procedure(s, erec, procedure, true, &num_locals, NULL, &newseg);
+    if (funcaddr == PSYS_ADDR_ERROR) { /* function out of range or not resident */
+        return;
+    }
+    if (num_locals == 0xffff) { /* native */
+        binding = psys_segment_binding(s, newseg);
+        if (!binding || procedure >= binding->num_handlers || !binding->handlers[procedure]) {
+            struct psys_segment_id id;
+            psys_read_segment_id(s, &id, newseg + PSYS_SEG_NAME);
+            psys_panic("NATIVE call to %.8s:0x%02x not handled\n", id.name, procedure);
+        }
+    }
+    if (cache) {
+        psys_fulladdr sib  = psys_ldw(s, erec + PSYS_EREC_Env_SIB);
+        cache->site        = s->stored_ipc;
+        cache->caller_erec = s->erec;
+        cache->epoch       = s->seg_epoch;
+        cache->erec        = erec;
+        cache->sib         = sib;
+        cache->seg_base    = psys_ldw(s, sib + PSYS_SIB_Seg_Base);
+        cache->seg_pool    = psys_ldw(s, sib + PSYS_SIB_Seg_Pool);
+        cache->segment     = newseg;
+        cache->procaddr    = funcaddr;
+        cache->num_locals  = num_locals;
+        cache->binding     = binding;
+    }
+    if (binding) {
+        binding->handlers[procedure](s, binding->userdata, newseg, psys_ldw(s, erec + PSYS_EREC_Env_Data));
+        return;
+    }
+    enter_procedure(s, msstat, erec, procedure, nonlocal, newseg, funcaddr, num_locals);
+}
+
+/* Handle any kind of procedure call instruction except CFP.
+ * This can fail for various reasons:
+ *   - segment not found in segment table (PSYS_ERR_NOPROC)
+ *   - segment not resident (PSYS_FAULT_SEG)
+ */
+static void handle_call(struct psys_state *s, psys_word seg, psys_word lexlevel, psys_word procedure)
+{
+    /* Determine target erec */
+    psys_fulladdr erec, msstat;
+    struct psys_callcache_entry *cache = NULL;
+    bool nonlocal                      = false;
+    if (seg == 1 && lexlevel == CALL_GLOBAL) { /* RSP */
+        struct psys_binding *rsp = (s->num_bindings > 0) ? s->bindings[0] : NULL;
+        if (rsp != NULL && procedure < rsp->num_handlers && rsp->handlers[procedure]) {
+            rsp->handlers[procedure](s, rsp->userdata, 0, 0);
+            return;
+        }
+        /* just fall through if not found so that KERNEL can handle it */
+    }
+    /* Determine static link (closure) */
+    if (lexlevel != CALL_GLOBAL) {
+        msstat = intermd_mscw(s, lexlevel);
+    } else {
+        msstat = s->base;
+    }
+    if (!IDBG(s, CALL)) { /* bypass cache when debugging calls, to log every lookup */
+        cache = callcache_entry(s);
+        if (callcache_hit(s, cache)) {
+            if (cache->binding) {
+                cache->binding->handlers[procedure](s, cache->binding->userdata, cache->segment,
+                    psys_ldw(s, cache->erec + PSYS_EREC_Env_Data));
+            } else {
+                enter_procedure(s, msstat, cache->erec, procedure, seg != CALL_CURSEG,
+                    cache->segment, cache->procaddr, cache->num_locals);
+            }
+            return;
+        }
+    }
+    if (seg != CALL_CURSEG) { /* lookup segment */
+        erec     = psys_lookup_ref_segment(s, seg, true);
+        nonlocal = true;
+    } else { /* current segment */
+        erec = s->erec;
+    }
+    if (erec == PSYS_ADDR_ERROR) /* lookup error - don't continue */
+        return;
+    handle_call_formal(s, msstat, erec, procedure, nonlocal, cache);
+}
+
+/* Handle RPU (return) instruction. This can generate a segment fault if the
+ * segment returned to is not resident.
+ */
+static void handle_return(struct psys_state *s, psys_word count)
+{
+    /* Store original mp as registers will be changed */
+    psys_fulladdr mp          = s->mp;
+    psys_fulladdr caller_erec = psys_ldw(s, mp + PSYS_MSCW_MSENV);
+    psys_fulladdr caller_seg;
+    psys_sword caller_proc;
+
+    /* Bail out early if segment not resident, to make it possible
+     * to re-execute the instruction. */
+    caller_seg = psys_segment_from_erec(s, caller_erec, true);
+    if (caller_seg == PSYS_ADDR_ERROR) {
+        return;
+    }
+
+    if (caller_erec != s->erec) { /* increase timestamp for intersegment return */
+        psys_increase_timestamp(s, s->erec);
+        psys_segment_refcount(s, s->erec, -1);
+    }
+
+    /* Restore register state from MSCW, display is rebuilt on demand */
+    s->display_len = 0;
+    s->mp       = psys_ldw(s, mp + PSYS_MSCW_MSDYN);
+    s->base     = psys_ldw(s, caller_erec + PSYS_EREC_Env_Data);
+    s->erec     = caller_erec;
+    s->curseg   = caller_seg;
+    caller_proc = psys_ldsw(s, mp + PSYS_MSCW_MPROC);
+    if (caller_proc >= 0) {
+        s->curproc = caller_proc;
+        s->ipc     = caller_seg + psys_ldw(s, mp + PSYS_MSCW_IPC);
+        if (IDBG(s, CALL)) {
+            psys_debug("return to %05x (erec %05x procedure %02x)\n", s->ipc, s->erec, s->curproc);
+        }
+    } else { /* Returning to a negative procedure number means we need to jump to the end pointer of that procedure */
+        psys_word end_addr;
+        if (lookup_procedure(s, caller_erec, -caller_proc, true, NULL, &end_addr, NULL) == PSYS_ADDR_ERROR) {
+            /* TODO: handle this properly. This should raise a fault and make sure the p-machine
+             * state is restored to that of before the return.
+             */
+            psys_panic("Segment not resident during error return\n");
+        }
+        s->curproc = -caller_proc;
+        s->ipc     = caller_seg + end_addr;
+        if (IDBG(s, CALL)) {
+            psys_debug("return (to end) to %05x (erec %05x procedure %02x)\n", s->ipc, s->erec, s->curproc);
+        }
+    }
+
+    /* Restore SP, add 'count' words to remove locals + parameters */
+    s->sp = W(mp + PSYS_MSCW_SIZE, count);
+
+    if (IDBG(s, CALL)) {
+        psys_debug("after return: mp=0x%04x ipc=0x%05x erec=0x%04x curproc=0x%02x\n",
+            s->mp, s->ipc, s->erec, s->curproc);
+    }
+    psys_hooks_segment_changed(s);
+    if (s->hook_flags & PSYS_HOOK_RETURN) {
+        psys_hooks_return(s);
+    }
+    s->compiled = psys_compiled_procedure(s, s->curseg, s->curproc);
+    run_compiled(s);
+#ifdef PSYS_JIT
+    psys_jit_run(s);
+#endif
+}
+
+/* Returns true if it stopped to switch to the other variant. In that case,
+ * the per-instruction hooks for the next instruction have already run, and
+ * should not run again.
+ */
+static bool interpreter_loop(struct psys_state *s, bool hooks_ran)
+{
+    /* check:
+     * - word/sword usage for ops
+     * - do stack checks for ADJ etc
+     * - Importent: properly generate segment faults for the following instructions:
+     *   CAP, CSP, CXL, SCXGn, CXG, CXI, CFP, RPU, SIGNAL (if a task switch occurs), WAIT (if a task switch occurs)
+     *   These have bene marked *segf*
+     * - Less important: generate stack fault for:
+     *   LDC, LDM, ADJ, SRS, CLP, CGP, SCIPn, CIP, CXL, SCXGn, CXG, CXI, CFP
+     *   This does not seem to be implemented in the Atari ST version.
+     */
+    int op;                     /* Stored opcode */
+    int arg0, arg1, arg2;       /* Instruction arguments */
+    int tos0, tos1, tos2, tos3; /* Top Of Stack,-1, -2, -3, ... */
+    int x;                      /* Loop variable */
+#if TOS_CACHE
+    psys_fulladdr ipc; /* Cached instruction pointer */
+    psys_word sp;      /* Cached stack pointer */
+    psys_word tos = 0; /* Cached top of stack */
+    psys_word nos = 0; /* Cached word below top of stack */
+    unsigned ncached;  /* Number of valid cached words (0-2) */
+#endif
+#ifdef PSYS_DISPATCH_THREADED
+#define HANDLER_ADDR(name) &&name,
+#ifdef PSYS_PREDECODE
+    static const void *const dispatch_table[256 + PSYS_SUPERINST_COUNT] = { PSYS_DISPATCH_LABELS(HANDLER_ADDR) PSYS_SUPERINST_LABELS(HANDLER_ADDR) };
+#else
+    static const void *const dispatch_table[256] = { PSYS_DISPATCH_LABELS(HANDLER_ADDR) };
+#endif
+#undef HANDLER_ADDR
+#endif
+#ifdef PSYS_PREDECODE
+    struct psys_predecode *pd;   /* Predecode cache */
+    struct psys_insn *insn;      /* Current instruction */
+    const psys_sword *insn_args; /* Next operand of current instruction */
+    if (!s->predecode) {
+        s->predecode = psys_predecode_new();
+    }
+    pd = s->predecode;
+    if (pd->handlers != HANDLERS) { /* decoded by the other variant, handler addresses are not valid here */
+        psys_predecode_invalidate(pd, 0, s->mem_size);
+        pd->handlers = HANDLERS;
+    }
+#endif
+    psys_hooks_segment_changed(s);
+    s->running  = true;
+    s->compiled = psys_compiled_procedure(s, s->curseg, s->curproc);
+    RELOAD_STACK();
+    while (1) {
+        INSN_PROLOGUE();
+#ifdef PSYS_PREDECODE
+    redispatch:
+#endif
+#ifdef PSYS_DISPATCH_THREADED
+        goto *HANDLER_TARGET;
+#endif
+        switch (op) {
+        HANDLER(do_sldc)
+        case PSOP_SLDC0: /* Short load constant */
+        case PSOP_SLDC1:
+        case PSOP_SLDC2:
+        case PSOP_SLDC3:
+        case PSOP_SLDC4:
+        case PSOP_SLDC5:
+        case PSOP_SLDC6:
+        case PSOP_SLDC7:
+        case PSOP_SLDC8:
+        case PSOP_SLDC9:
+        case PSOP_SLDC10:
+        case PSOP_SLDC11:
+        case PSOP_SLDC12:
+        case PSOP_SLDC13:
+        case PSOP_SLDC14:
+        case PSOP_SLDC15:
+        case PSOP_SLDC16:
+        case PSOP_SLDC17:
+        case PSOP_SLDC18:
+        case PSOP_SLDC19:
+        case PSOP_SLDC20:
+        case PSOP_SLDC21:
+        case PSOP_SLDC22:
+        case PSOP_SLDC23:
+        case PSOP_SLDC24:
+        case PSOP_SLDC25:
+        case PSOP_SLDC26:
+        case PSOP_SLDC27:
+        case PSOP_SLDC28:
+        case PSOP_SLDC29:
+        case PSOP_SLDC30:
+        case PSOP_SLDC31:
+            PUSH(op - PSOP_SLDC0);
+            DISPATCH();
+        HANDLER(do_sldl)
+        case PSOP_SLDL1: /* Short load local */
+        case PSOP_SLDL2:
+        case PSOP_SLDL3:
+        case PSOP_SLDL4:
+        case PSOP_SLDL5:
+        case PSOP_SLDL6:
+        case PSOP_SLDL7:
+        case PSOP_SLDL8:
+        case PSOP_SLDL9:
+        case PSOP_SLDL10:
+        case PSOP_SLDL11:
+        case PSOP_SLDL12:
+        case PSOP_SLDL13:
+        case PSOP_SLDL14:
+        case PSOP_SLDL15:
+        case PSOP_SLDL16:
+            PUSH(psys_ldw(s, local_addr(s, op - PSOP_SLDL1 + 1)));
+            DISPATCH();
+        HANDLER(do_sldo)
+        case PSOP_SLDO1: /* Short local global */
+        case PSOP_SLDO2:
+        case PSOP_SLDO3:
+        case PSOP_SLDO4:
+        case PSOP_SLDO5:
+        case PSOP_SLDO6:
+        case PSOP_SLDO7:
+        case PSOP_SLDO8:
+        case PSOP_SLDO9:
+        case PSOP_SLDO10:
+        case PSOP_SLDO11:
+        case PSOP_SLDO12:
+        case PSOP_SLDO13:
+        case PSOP_SLDO14:
+        case PSOP_SLDO15:
+        case PSOP_SLDO16:
+            PUSH(psys_ldw(s, global_addr(s, op - PSOP_SLDO1 + 1)));
+            DISPATCH();
+        HANDLER(do_slla)
+        case PSOP_SLLA1: /* Short load local address */
+        case PSOP_SLLA2:
+        case PSOP_SLLA3:
+        case PSOP_SLLA4:
+        case PSOP_SLLA5:
+        case PSOP_SLLA6:
+        case PSOP_SLLA7:
+        case PSOP_SLLA8:
+            PUSH(local_addr(s, op - PSOP_SLLA1 + 1));
+            DISPATCH();
+        HANDLER(do_sstl)
+        case PSOP_SSTL1: /* Short store local */
+        case PSOP_SSTL2:
+        case PSOP_SSTL3:
+        case PSOP_SSTL4:
+        case PSOP_SSTL5:
+        case PSOP_SSTL6:
+        case PSOP_SSTL7:
+        case PSOP_SSTL8:
+            tos0 = POP();
+            psys_stw(s, local_addr(s, op - PSOP_SSTL1 + 1), tos0);
+            DISPATCH();
+        HANDLER(do_scxg)
+        case PSOP_SCXG1: /* Short call intersegment */ /* segf */
+        case PSOP_SCXG2:
+        case PSOP_SCXG3:
+        case PSOP_SCXG4:
+        case PSOP_SCXG5:
+        case PSOP_SCXG6:
+        case PSOP_SCXG7:
+        case PSOP_SCXG8:
+            arg0 = FETCH_UB();
+            SPILL_STACK();
+            handle_call(s, op - PSOP_SCXG1 + 1, CALL_GLOBAL, arg0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_sind)
+        case PSOP_SIND0: /* Short index */
+        case PSOP_SIND1:
+        case PSOP_SIND2:
+        case PSOP_SIND3:
+        case PSOP_SIND4:
+        case PSOP_SIND5:
+        case PSOP_SIND6:
+        case PSOP_SIND7:
+            tos0 = TOP();
+#if 0
+            psys_debug("SIND %05x\n", W(tos0, op - PSOP_SIND0));
+            psys_debug_hexdump(s, tos0, 32);
+#endif
+            SET_TOP(psys_ldw(s, W(tos0, op - PSOP_SIND0)));
+            DISPATCH();
+        HANDLER(do_ldcb)
+        case PSOP_LDCB: /* Load constant (unsigned) byte */
+            arg0 = FETCH_UB();
+            PUSH(arg0);
+            DISPATCH();
+        HANDLER(do_ldci)
+        case PSOP_LDCI: /* Load constant integer */
+            arg0 = FETCH_W();
+            PUSH(arg0);
+            DISPATCH();
+        HANDLER(do_lco)
+        case PSOP_LCO: /* Load constant offset */
+            arg0 = FETCH_V();
+            PUSH(seg_cpool_ofs(s, s->curseg, arg0));
+            DISPATCH();
+        HANDLER(do_ldc)
+        case PSOP_LDC: { /* Load constant (words) */
+            psys_fulladdr src;
+            arg0 = FETCH_UB(); /* flag: 0 keep as is, 2 flip endian if necessary */
+            arg1 = FETCH_V();  /* word offset into current segment */
+            arg2 = FETCH_UB(); /* number of words */
+            src  = s->curseg + seg_cpool_ofs(s, s->curseg, arg1);
+
+            /* perform endian swap if requested and necessary.
+             * push in reversed order because the words should appear in the same order.
+             */
+            if (arg0 == 2 && seg_needs_endian_flip(s, s->curseg)) {
+                for (x = arg2 - 1; x >= 0; --x) {
+                    PUSH(psys_flip_endian(psys_ldw(s, W(src, x))));
+                }
+            } else {
+                for (x = arg2 - 1; x >= 0; --x) {
+                    PUSH(psys_ldw(s, W(src, x)));
+                }
+            }
+        } DISPATCH();
+        HANDLER(do_lla)
+        case PSOP_LLA: /* Load local address */
+            arg0 = FETCH_V();
+            PUSH(local_addr(s, arg0));
+            DISPATCH();
+        HANDLER(do_ldo)
+        case PSOP_LDO: /* Load global */
+            arg0 = FETCH_V();
+            PUSH(psys_ldw(s, global_addr(s, arg0)));
+            DISPATCH();
+        HANDLER(do_lao)
+        case PSOP_LAO: /* Load global address */
+            arg0 = FETCH_V();
+            PUSH(global_addr(s, arg0));
+            DISPATCH();
+        HANDLER(do_ldl)
+        case PSOP_LDL: /* Load local */
+            arg0 = FETCH_V();
+            PUSH(psys_ldw(s, local_addr(s, arg0)));
+            DISPATCH();
+        HANDLER(do_lda)
+        case PSOP_LDA: /* Load intermediate address */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_V();
+            PUSH(intermd_addr(s, arg0, arg1));
+            DISPATCH();
+        HANDLER(do_lod)
+        case PSOP_LOD: /* Load intermediate */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_V();
+            PUSH(psys_ldw(s, intermd_addr(s, arg0, arg1)));
+            DISPATCH();
+        HANDLER(do_ujp)
+        case PSOP_UJP: /* Unconditional jump */
+            JUMP(FETCH_SB());
+            DISPATCH();
+        HANDLER(do_ujpl)
+        case PSOP_UJPL: /* Unconditional jump long */
+            JUMP(FETCH_W());
+            DISPATCH();
+        HANDLER(do_mpi)
+        case PSOP_MPI: /* Multiply (unsigned) integer */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 * tos0);
+            DISPATCH();
+        HANDLER(do_dvi)
+        case PSOP_DVI: /* Divide (signed) integer */
+            SPILL_STACK();
+            tos0 = psys_spop(s);
+            tos1 = psys_spop(s);
+            if (tos0 == 0) {
+                psys_execerror(s, PSYS_ERR_DIVZER);
+            } else {
+                psys_push(s, tos1 / tos0);
+            }
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_stm)
+        case PSOP_STM: { /* Store multiple */
+            psys_fulladdr dst;
+            arg0 = FETCH_UB();
+            SPILL_STACK();
+            dst  = psys_ldw(s, W(s->sp, arg0));
+            for (x = 0; x < arg0; ++x) {
+                psys_stw(s, W(dst, x), psys_pop(s));
+            }
+            psys_pop(s); /* pop dst */
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_modi)
+        case PSOP_MODI: /* Modulo integers */
+            SPILL_STACK();
+            tos0 = psys_spop(s);
+            tos1 = psys_spop(s);
+            if (tos0 == 0) {
+                psys_execerror(s, PSYS_ERR_DIVZER);
+            } else {
+                psys_sword r = tos1 % tos0;
+                /* p-systems interpretation of MOD always returns positive numbers */
+                psys_push(s, (r < 0) ? (r + tos0) : r);
+            }
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_clp)
+        case PSOP_CLP: /* Call local procedure */
+            arg0 = FETCH_UB();
+            SPILL_STACK();
+            handle_call(s, CALL_CURSEG, CALL_LOCAL, arg0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_cgp)
+        case PSOP_CGP: /* Call global procedure */
+            arg0 = FETCH_UB();
+            SPILL_STACK();
+            handle_call(s, CALL_CURSEG, CALL_GLOBAL, arg0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_cip)
+        case PSOP_CIP: /* Call intermediate procedure */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            SPILL_STACK();
+            handle_call(s, CALL_CURSEG, arg0, arg1);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_cxl)
+        case PSOP_CXL: /* Call intersegment local procedure */ /* segf */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            SPILL_STACK();
+            handle_call(s, arg0, CALL_LOCAL, arg1);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_cxg)
+        case PSOP_CXG: /* Call intersegment global procedure */ /* segf */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            SPILL_STACK();
+            handle_call(s, arg0, CALL_GLOBAL, arg1);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_cxi)
+        case PSOP_CXI: /* Call intersegment intermediate procedure */ /* segf */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            arg2 = FETCH_UB();
+            SPILL_STACK();
+            handle_call(s, arg0, arg1, arg2);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_rpu)
+        case PSOP_RPU: /* Return from procedure */ /* segf */
+            arg0 = FETCH_V();
+            SPILL_STACK();
+            handle_return(s, arg0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_cfp)
+        case PSOP_CFP: /* Call formal procedure */ /* segf */
+            SPILL_STACK();
+            /* In contrast to what the p-systems internal reference manual says, this has no argument */
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            tos2 = psys_pop(s);
+            handle_call_formal(s, tos0, tos1, tos2, true, NULL);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_ldcn)
+        case PSOP_LDCN: /* Load constant NIL */
+            PUSH(PSYS_NIL);
+            DISPATCH();
+        HANDLER(do_lsl)
+        case PSOP_LSL: /* Load static link */
+            arg0 = FETCH_UB();
+            PUSH(intermd_mscw(s, arg0));
+            DISPATCH();
+        HANDLER(do_lde)
+        case PSOP_LDE: { /* Load extended */
+            psys_fulladdr addr;
+            arg0 = FETCH_UB();
+            arg1 = FETCH_V();
+            SPILL_STACK();
+            addr = extended_addr(s, arg0, arg1);
+            if (addr != PSYS_ADDR_ERROR) { /* continue only if segment could be found - if not, error will already have been set */
+                psys_push(s, psys_ldw(s, addr));
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_lae)
+        case PSOP_LAE: { /* Load address extended */
+            psys_fulladdr addr;
+            arg0 = FETCH_UB();
+            arg1 = FETCH_V();
+            SPILL_STACK();
+            addr = extended_addr(s, arg0, arg1);
+            if (addr != PSYS_ADDR_ERROR) { /* continue only if segment could be found - if not, error will already have been set */
+                psys_push(s, addr);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_lpr)
+        case PSOP_LPR: /* Load processor register */
+            SPILL_STACK();
+            tos0 = psys_spop(s);
+            psys_push(s, psys_lpr(s, tos0));
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_bpt)
+        case PSOP_BPT: /* Breakpoint */
+            SPILL_STACK();
+            psys_execerror(s, PSYS_ERR_BRKPNT);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_bnot)
+        case PSOP_BNOT: /* Boolean NOT */
+            tos0 = TOP();
+            SET_TOP(!BOOL(tos0));
+            DISPATCH();
+        HANDLER(do_lor)
+        case PSOP_LOR: /* Logical OR */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 | tos0);
+            DISPATCH();
+        HANDLER(do_land)
+        case PSOP_LAND: /* Logical AND */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 & tos0);
+            DISPATCH();
+        HANDLER(do_adi)
+        case PSOP_ADI: /* Add integers */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 + tos0);
+            DISPATCH();
+        HANDLER(do_sbi)
+        case PSOP_SBI: /* Subtract integers */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 - tos0);
+            DISPATCH();
+        HANDLER(do_stl)
+        case PSOP_STL: /* Store local */
+            arg0 = FETCH_V();
+            tos0 = POP();
+            psys_stw(s, local_addr(s, arg0), tos0);
+            DISPATCH();
+        HANDLER(do_sro)
+        case PSOP_SRO: /* Store global */
+            arg0 = FETCH_V();
+            tos0 = POP();
+            psys_stw(s, global_addr(s, arg0), tos0);
+            DISPATCH();
+        HANDLER(do_str)
+        case PSOP_STR: /* Store Intermediate */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_V();
+            tos0 = POP();
+            psys_stw(s, intermd_addr(s, arg0, arg1), tos0);
+            DISPATCH();
+        HANDLER(do_ldb)
+        case PSOP_LDB: /* Load byte */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(psys_ldb(s, tos1, tos0));
+            DISPATCH();
+        HANDLER(do_native)
+        case PSOP_NATIVE: /* Enter native code */
+            SPILL_STACK();
+            psys_panic("NATIVE not supported");
+            return false;
+        HANDLER(do_nat_info)
+        case PSOP_NAT_INFO: /* Native code information (skip PC forward over metadata) */
+            arg0 = FETCH_V();
+            INSN_PTR += arg0;
+            DISPATCH();
+        HANDLER(do_cap)
+        case PSOP_CAP: { /* Copy array parameter */ /* segf */
+            psys_fulladdr addr;
+            arg0 = FETCH_V(); /* size of array in words */
+            SPILL_STACK();
+            tos0 = psys_pop(s); /* address of a parameter descriptor for a packed array of characters */
+            tos1 = psys_pop(s); /* destination for the array */
+            addr = array_descriptor_to_addr(s, tos0);
+            if (addr != PSYS_ADDR_ERROR) {
+                memcpy(psys_words(s, tos1), psys_words(s, addr), arg0 * 2);
+                psys_mark_dirty(s, tos1, arg0 * 2);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_csp)
+        case PSOP_CSP: { /* Copy string parameter */ /* segf */
+            psys_fulladdr addr;
+            arg0 = FETCH_UB(); /* maximum size of string in bytes */
+            SPILL_STACK();
+            tos0 = psys_pop(s); /* address of a parameter descriptor for a packed array of characters */
+            tos1 = psys_pop(s); /* destination of string */
+            addr = array_descriptor_to_addr(s, tos0);
+            if (addr != PSYS_ADDR_ERROR) {
+                psys_word length = psys_ldb(s, addr, 0);
+                if (length > arg0) { /* string doesn't fit */
+                    psys_execerror(s, PSYS_ERR_S2LONG);
+                } else {
+                    if (IDBG(s, STRINGS)) {
+                        char str[256];
+                        psys_read_bytes(s, str, addr + 1, length);
+                        psys_debug("string: %05x '%.*s' (len %d of %d)\n", addr, length, str, length, arg0);
+                        psys_debug_hexdump(s, addr, length + 1);
+                    }
+                    memcpy(psys_words(s, tos1), psys_words(s, addr), (length / 2 + 1) * 2);
+                    psys_mark_dirty(s, tos1, (length / 2 + 1) * 2);
+                }
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_slod)
+        case PSOP_SLOD1: /* Short load intermediate */
+        case PSOP_SLOD2:
+            arg0 = FETCH_V();
+            PUSH(psys_ldw(s, intermd_addr(s, op - PSOP_SLOD1 + 1, arg0)));
+            DISPATCH();
+        HANDLER(do_equi)
+        case PSOP_EQUI: /* Equal Integer */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 == tos0);
+            DISPATCH();
+        HANDLER(do_neqi)
+        case PSOP_NEQI: /* Not Equal Integer */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 != tos0);
+            DISPATCH();
+        HANDLER(do_leqi)
+        case PSOP_LEQI: /* Less Than or Equal Integer */
+            tos0 = SPOP();
+            tos1 = signext_word(TOP());
+            SET_TOP(tos1 <= tos0);
+            DISPATCH();
+        HANDLER(do_geqi)
+        case PSOP_GEQI: /* Greater Than or Equal Integer */
+            tos0 = SPOP();
+            tos1 = signext_word(TOP());
+            SET_TOP(tos1 >= tos0);
+            DISPATCH();
+        HANDLER(do_leusw)
+        case PSOP_LEUSW: /* Less Than or Equal Unsigned */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 <= tos0);
+            DISPATCH();
+        HANDLER(do_geusw)
+        case PSOP_GEUSW: /* Greater Than or Equal Unsigned */
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(tos1 >= tos0);
+            DISPATCH();
+        HANDLER(do_eqpwr)
+        case PSOP_EQPWR: { /* Equal Set (TRUE if all elements match) */
+            SPILL_STACK();
+            psys_word *stos0 = psys_stack_words(s, 0);
+            psys_word *stos1 = psys_stack_words(s, psys_set_words(stos0));
+            psys_pop_n(s, psys_set_words(stos0) + psys_set_words(stos1)); /* drop both sets from stack */
+            psys_push(s, psys_set_is_equal(stos1, stos0));
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_lepwr)
+        case PSOP_LEPWR: { /* Less Than or Equal Set (TRUE if TOS-1 is a subset of TOS) */
+            SPILL_STACK();
+            psys_word *stos0 = psys_stack_words(s, 0);
+            psys_word *stos1 = psys_stack_words(s, psys_set_words(stos0));
+            psys_pop_n(s, psys_set_words(stos0) + psys_set_words(stos1)); /* drop both sets from stack */
+            psys_push(s, psys_set_is_subset(stos1, stos0));
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_gepwr)
+        case PSOP_GEPWR: { /* Greater Than or Equal Set (TRUE if TOS-l is a superset of TOS) */
+            SPILL_STACK();
+            psys_word *stos0 = psys_stack_words(s, 0);
+            psys_word *stos1 = psys_stack_words(s, psys_set_words(stos0));
+            psys_pop_n(s, psys_set_words(stos0) + psys_set_words(stos1)); /* drop both sets from stack */
+            psys_push(s, psys_set_is_superset(stos1, stos0));
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_eqbyte)
+        case PSOP_EQBYTE: /* Equal Byte Array */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            arg2 = FETCH_V();
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            psys_push(s, compare_bytearrays(s, arg1, tos1, arg0, tos0, arg2) == 0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_lebyte)
+        case PSOP_LEBYTE: /* Less Than or Equal Byte Array */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            arg2 = FETCH_V();
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            psys_push(s, compare_bytearrays(s, arg1, tos1, arg0, tos0, arg2) <= 0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_gebyte)
+        case PSOP_GEBYTE: /* Greater Than or Equal Byte Array */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            arg2 = FETCH_V();
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            psys_push(s, compare_bytearrays(s, arg1, tos1, arg0, tos0, arg2) >= 0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_srs)
+        case PSOP_SRS: { /* Subrange set */
+            psys_set result;
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            if (psys_set_from_subrange(result, tos1, tos0)) {
+                psys_set_push(s, result);
+            } else {
+                psys_execerror(s, PSYS_ERR_SET2LG);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_swap)
+        case PSOP_SWAP: /* Swap */
+            tos0 = POP();
+            tos1 = POP();
+            PUSH(tos0);
+            PUSH(tos1);
+            DISPATCH();
+        HANDLER(do_sto)
+        case PSOP_STO: /* Store - TOS is stored in the word pointed to by TOS-1 */
+            tos0 = POP();
+            tos1 = POP();
+            psys_stw(s, tos1, tos0);
+            DISPATCH();
+        HANDLER(do_mov)
+        case PSOP_MOV: { /* Move */
+            const psys_word *src;
+            psys_word *dst;
+            arg0 = FETCH_UB(); /* flag: src from 0) memory or 1)segment 2)segment byteswapped */
+            arg1 = FETCH_V();  /* number of words to copy */
+            SPILL_STACK();
+            tos0 = psys_pop(s); /* src addr|ofs */
+            tos1 = psys_pop(s); /* dst addr */
+            src  = psys_words(s, memory_or_segment_addr(s, arg0, tos0));
+            dst  = psys_words(s, tos1);
+#if 0
+            psys_debug("MOV: copying 0x%04x words from %05x to %05x\n", arg1, memory_or_segment_addr(s, arg0, tos0), tos1);
+#endif
+            if (arg0 == 2 && seg_needs_endian_flip(s, s->curseg)) { /* flip bytes if requested and necessary */
+                for (x = 0; x < arg1; ++x) {
+#if 0
+                    psys_debug("  %04x\n", psys_flip_endian(src[x]));
+#endif
+                    dst[x] = psys_flip_endian(src[x]);
+                }
+            } else {
+                for (x = 0; x < arg1; ++x) {
+#if 0
+                    psys_debug("  %04x\n", src[x]);
+#endif
+                    dst[x] = src[x];
+                }
+            }
+            psys_mark_dirty(s, tos1, arg1 * 2);
+            psys_invalidate_code(s, tos1, arg1 * 2);
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_adj)
+        case PSOP_ADJ: { /* Adjust set */
+            psys_set a;
+            arg0 = FETCH_UB();
+            SPILL_STACK();
+            psys_set_pop(s, a);
+            if (psys_set_adj(a, arg0)) {                         /* push set without length word */
+                psys_push_n(s, arg0);                            /* make room for enough words on stack */
+                memcpy(psys_stack_words(s, 0), &a[1], arg0 * 2); /* copy entire structure */
+                psys_mark_dirty(s, s->sp, arg0 * 2);
+            } else {
+                psys_execerror(s, PSYS_ERR_SET2LG);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_stb)
+        case PSOP_STB:          /* Store byte */
+            tos0 = POP(); /* Value to write */
+            tos1 = POP(); /* Offset */
+            tos2 = POP(); /* Word address of target */
+            psys_stb(s, tos2, tos1, tos0);
+            DISPATCH();
+        HANDLER(do_ldp)
+        case PSOP_LDP:          /* Load packed */
+            tos0 = POP(); /* Number of rightmost bit of the field */
+            tos1 = POP(); /* Number of bits in field */
+            tos2 = POP(); /* Address of the word */
+            PUSH((psys_ldw(s, tos2) >> tos0) & (BIT(tos1) - 1));
+            DISPATCH();
+        HANDLER(do_stp)
+        case PSOP_STP: { /* Store packed */
+            unsigned mask;
+            tos0 = POP(); /* Value to store */
+            tos1 = POP(); /* Number of rightmost bit of the field */
+            tos2 = POP(); /* Number of bits in field */
+            tos3 = POP(); /* Address of the word */
+            mask = (BIT(tos2) - 1) << tos1;
+            psys_stw(s, tos3, (psys_ldw(s, tos3) & ~mask) | ((tos0 << tos1) & mask));
+        } DISPATCH();
+        HANDLER(do_chk)
+        case PSOP_CHK: /* Check subrange bounds */
+            SPILL_STACK();
+            tos0 = psys_spop(s);
+            tos1 = psys_spop(s);
+            tos2 = psys_spop(s);
+            if (tos2 < tos1 || tos2 > tos0) {
+                psys_execerror(s, PSYS_ERR_INVNDX);
+            } else {
+                psys_push(s, tos2);
+            }
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_ldm)
+        case PSOP_LDM: /* Load multiple */
+            arg0 = FETCH_UB();
+            tos0 = POP();
+            /* push in reversed order because the words should appear in the same order
+             * on the stack as in memory.
+             */
+            for (x = arg0 - 1; x >= 0; --x) {
+                PUSH(psys_ldw(s, W(tos0, x)));
+            }
+            DISPATCH();
+        HANDLER(do_spr)
+        case PSOP_SPR: /* Store processor register */
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            psys_spr(s, tos1, tos0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_efj)
+        case PSOP_EFJ: /* Equal false jump */
+            arg0 = FETCH_SB();
+            tos0 = POP();
+            tos1 = POP();
+            if (tos1 != tos0) {
+                JUMP(arg0);
+            }
+            DISPATCH();
+        HANDLER(do_nfj)
+        case PSOP_NFJ: /* Not equal false jump */
+            arg0 = FETCH_SB();
+            tos0 = POP();
+            tos1 = POP();
+            if (tos1 == tos0) {
+                JUMP(arg0);
+            }
+            DISPATCH();
+        HANDLER(do_fjp)
+        case PSOP_FJP: /* False jump */
+            arg0 = FETCH_SB();
+            tos0 = POP();
+            if (!BOOL(tos0)) {
+                JUMP(arg0);
+            }
+            DISPATCH();
+        HANDLER(do_fjpl)
+        case PSOP_FJPL: /* False jump long */
+            arg0 = FETCH_W();
+            tos0 = POP();
+            if (!BOOL(tos0)) {
+                JUMP(arg0);
+            }
+            DISPATCH();
+        HANDLER(do_xjp)
+        case PSOP_XJP: { /* Case jump */
+            int addr, b, e;
+            bool flip = seg_needs_endian_flip(s, s->curseg);
+            arg0      = FETCH_V();
+            tos0      = SPOP();
+            addr      = s->curseg + seg_cpool_ofs(s, s->curseg, arg0);
+            b         = psys_ldsw_flip(s, W(addr, 0), flip);
+            e         = psys_ldsw_flip(s, W(addr, 1), flip);
+            if (tos0 >= b && tos0 <= e) {
+                INSN_PTR += psys_ldsw_flip(s, W(addr, 2 + tos0 - b), flip);
+            }
+        } DISPATCH();
+        HANDLER(do_ixa)
+        case PSOP_IXA: /* Index array */
+            arg0 = FETCH_V();
+            tos0 = POP();
+            tos1 = TOP();
+            SET_TOP(W(tos1, arg0 * tos0));
+            DISPATCH();
+        HANDLER(do_ixp)
+        case PSOP_IXP: /* Index packed array */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            tos0 = POP();
+            tos1 = POP();
+            PUSH(W(tos1, tos0 / arg0)); /* Address of the word */
+            PUSH(arg1);                 /* Number of bits in field */
+            PUSH((tos0 % arg0) * arg1); /* Number of rightmost bit of the field */
+            DISPATCH();
+        HANDLER(do_ste)
+        case PSOP_STE: { /* Store extended */
+            psys_fulladdr addr;
+            arg0 = FETCH_UB();
+            arg1 = FETCH_V();
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            addr = extended_addr(s, arg0, arg1);
+            if (addr) { /* continue only if segment could be found */
+                psys_stw(s, addr, tos0);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_inn)
+        case PSOP_INN: { /* Set membership */
+            SPILL_STACK();
+            /* Note: arguments order is reversed compared to p-system reference:
+             * set is on the top of the stack, the element to check membership of is below that.
+             */
+            psys_word *data = psys_stack_words(s, 0); /* set length|set|tos1 */
+            psys_word ofs   = psys_set_words(data);
+            /* overwrite input word on stack */
+            psys_stw(s, W(s->sp, ofs), psys_set_in(data, psys_ldw(s, W(s->sp, ofs))));
+            psys_pop_n(s, ofs); /* drop set size and set */
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_uni)
+        case PSOP_UNI: { /* Set union (bitwise OR) */
+            psys_set result;
+            SPILL_STACK();
+            psys_word *stos0 = psys_stack_words(s, 0);
+            psys_word *stos1 = psys_stack_words(s, psys_set_words(stos0));
+            if (psys_set_union(result, stos1, stos0)) {
+                psys_pop_n(s, psys_set_words(stos0) + psys_set_words(stos1)); /* drop both sets from stack */
+                psys_set_push(s, result);                                     /* push result */
+            } else {
+                psys_execerror(s, PSYS_ERR_SET2LG);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_int)
+        case PSOP_INT: { /* Set intersection (bitwise AND) */
+            psys_set result;
+            SPILL_STACK();
+            psys_word *stos0 = psys_stack_words(s, 0);
+            psys_word *stos1 = psys_stack_words(s, psys_set_words(stos0));
+            if (psys_set_intersection(result, stos1, stos0)) {
+                psys_pop_n(s, psys_set_words(stos0) + psys_set_words(stos1)); /* drop both sets from stack */
+                psys_set_push(s, result);                                     /* push result */
+            } else {
+                psys_execerror(s, PSYS_ERR_SET2LG);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_dif)
+        case PSOP_DIF: { /* Set difference (TOS-1 AND NOT TOS) */
+            psys_set result;
+            SPILL_STACK();
+            psys_word *stos0 = psys_stack_words(s, 0);
+            psys_word *stos1 = psys_stack_words(s, psys_set_words(stos0));
+            if (psys_set_difference(result, stos1, stos0)) {
+                psys_pop_n(s, psys_set_words(stos0) + psys_set_words(stos1)); /* drop both sets from stack */
+                psys_set_push(s, result);                                     /* push result */
+            } else {
+                psys_execerror(s, PSYS_ERR_SET2LG);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_signal)
+        case PSOP_SIGNAL: /* Signal */ /* segf */
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            psys_signal(s, tos0, true);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_wait)
+        case PSOP_WAIT: /* Wait */ /* segf */
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            psys_wait(s, tos0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_abi)
+        case PSOP_ABI: /* Absolute value integer */
+            tos0 = signext_word(TOP());
+            SET_TOP(abs(tos0));
+            DISPATCH();
+        HANDLER(do_ngi)
+        case PSOP_NGI: /* Negate integer */
+            tos0 = signext_word(TOP());
+            SET_TOP(-tos0);
+            DISPATCH();
+        HANDLER(do_dup1)
+        case PSOP_DUP1: /* Duplicate one word */
+            tos0 = POP();
+            PUSH(tos0);
+            PUSH(tos0);
+            DISPATCH();
+        HANDLER(do_lnot)
+        case PSOP_LNOT: /* Logical NOT */
+            tos0 = TOP();
+            SET_TOP(~tos0);
+            DISPATCH();
+        HANDLER(do_ind)
+        case PSOP_IND: /* Index */
+            arg0 = FETCH_V();
+            tos0 = TOP();
+            SET_TOP(psys_ldw(s, W(tos0, arg0)));
+            DISPATCH();
+        HANDLER(do_inc)
+        case PSOP_INC: /* Increment */
+            arg0 = FETCH_V();
+            tos0 = TOP();
+            SET_TOP(W(tos0, arg0));
+            DISPATCH();
+        HANDLER(do_eqstr)
+        case PSOP_EQSTR: /* Equal string */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            psys_push(s, compare_strings(s, arg1, tos1, arg0, tos0) == 0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_lestr)
+        case PSOP_LESTR: /* Less or equal string */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            psys_push(s, compare_strings(s, arg1, tos1, arg0, tos0) <= 0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_gestr)
+        case PSOP_GESTR: /* Greater or equal string */
+            arg0 = FETCH_UB();
+            arg1 = FETCH_UB();
+            SPILL_STACK();
+            tos0 = psys_pop(s);
+            tos1 = psys_pop(s);
+            psys_push(s, compare_strings(s, arg1, tos1, arg0, tos0) >= 0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_astr)
+        case PSOP_ASTR: { /* Assign string */
+            psys_fulladdr src;
+            psys_byte length;
+            arg0   = FETCH_UB(); /* flag: src from memory or segment */
+            arg1   = FETCH_UB(); /* decared size of destination */
+            SPILL_STACK();
+            tos0   = psys_pop(s); /* src addr|ofs */
+            tos1   = psys_pop(s); /* dst addr */
+            src    = memory_or_segment_addr(s, arg0, tos0);
+            length = psys_ldb(s, src, 0);
+            if (length > arg1) { /* source is larger than destination */
+                psys_execerror(s, PSYS_ERR_S2LONG);
+            } else { /* copy string and length byte */
+                psys_move_bytes(s, tos1, src, length + 1);
+            }
+            RELOAD_STACK();
+        } DISPATCH();
+        HANDLER(do_cstr)
+        case PSOP_CSTR:         /* Check string index */
+            SPILL_STACK();
+            tos0 = psys_pop(s); /* index into variable */
+            tos1 = psys_pop(s); /* address of string variable */
+            if (tos0 < 1 || tos0 > psys_ldb(s, tos1, 0)) {
+                psys_execerror(s, PSYS_ERR_INVNDX);
+            } else {
+                psys_push(s, tos1);
+                psys_push(s, tos0);
+            }
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_inci)
+        case PSOP_INCI: /* Increase integer */
+            tos0 = TOP();
+            SET_TOP(tos0 + 1);
+            DISPATCH();
+        HANDLER(do_deci)
+        case PSOP_DECI: /* Decrease integer */
+            tos0 = TOP();
+            SET_TOP(tos0 - 1);
+            DISPATCH();
+        HANDLER(do_scip)
+        case PSOP_SCIP1: /* Short call intermediate procedure */
+        case PSOP_SCIP2:
+            arg0 = FETCH_UB();
+            SPILL_STACK();
+            handle_call(s, CALL_CURSEG, op - PSOP_SCIP1 + 1, arg0);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_tjp)
+        case PSOP_TJP: /* True jump */
+            arg0 = FETCH_SB();
+            tos0 = POP();
+            if (BOOL(tos0)) {
+                JUMP(arg0);
+            }
+            DISPATCH();
+        /* Floating point ops - not implemented */
+        HANDLER(do_flt)
+        case PSOP_FLT:    /* Float */
+        HANDLER(do_eqreal)
+        case PSOP_EQREAL: /* Equal Real */
+        HANDLER(do_lereal)
+        case PSOP_LEREAL: /* Less Than or Equal Real */
+        HANDLER(do_gereal)
+        case PSOP_GEREAL: /* Greater Than or Equal Real */
+        HANDLER(do_dup2)
+        case PSOP_DUP2:   /* Duplicate Real */
+        HANDLER(do_abr)
+        case PSOP_ABR:    /* Absolute Real */
+        HANDLER(do_ngr)
+        case PSOP_NGR:    /* Negate Real */
+        HANDLER(do_ldcrl)
+        case PSOP_LDCRL:  /* Load Constant Real */
+        HANDLER(do_ldrl)
+        case PSOP_LDRL:   /* Load Real */
+        HANDLER(do_strl)
+        case PSOP_STRL:   /* Store Real */
+            SPILL_STACK();
+            psys_execerror(s, PSYS_ERR_FPIERR);
+            RELOAD_STACK();
+            DISPATCH();
+        HANDLER(do_nop)
+        case PSOP_NOP: /* No operation */
+            DISPATCH();
+#ifdef PSYS_PREDECODE
+#include "psys_superinst_cases.h"
+#endif
+        HANDLER(do_invalid)
+        default:
+            SPILL_STACK();
+            psys_execerror(s, PSYS_ERR_NOTIMP);
+            RELOAD_STACK();
+            DISPATCH();
+        }
+    }
+}
+
+#undef intermd_mscw
+#undef intermd_addr
+#undef enter_procedure
+#undef handle_call_formal
+#undef handle_call
+#undef handle_return
+#undef interpreter_loop
+#undef IDBG
+#undef PUSH
+#undef POP
+#undef SPOP
+#undef TOP
+#undef SET_TOP
+#undef STACK_PTR
+#undef INSN_PTR
+#undef SPILL_STACK
+#undef RELOAD_STACK
@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* for MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
+
+#include "psys_jit.h"
+
+#include "psys_jit_templates.h"
+
+#include "psys_debug.h"
+#include "psys_helpers.h"
+#include "psys_hooks.h"
+#include "psys_predecode.h"
+#include "util/memutil.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if !defined(__linux__) || !(defined(__x86_64__) || defined(__aarch64__))
+#error "The JIT is only supported on x86-64 and AArch64 Linux"
+#endif
+
+/* Size of native code buffer. When it is full, all compiled code is dropped. */
+#define JIT_CODE_SIZE (4 * 1024 * 1024)
+/* Maximum amount of native code for one block */
+#define JIT_MAX_BLOCK_CODE 4096
+/* Maximum number of blocks, and number of hash slots (twice as many) */
+#define JIT_MAX_BLOCKS 16384
+#define JIT_HASH_BITS 15
+/* Minimum and maximum number of instructions in a block */
+#define JIT_MIN_INSNS 2
+#define JIT_MAX_INSNS 64
+/* Granularity of remembering which memory code was compiled from */
+#define JIT_PAGE_BITS 8
+
+typedef void(jit_entryfunc)(struct psys_state *s);
+
+/** Exit from a block to a block that was not compiled yet */
+struct jit_exit {
+    psys_byte *stub;      /* exit stub, NULL if it has been chained */
+    psys_fulladdr target; /* p-code address */
+};
+
+struct jit_block {
+    psys_fulladdr start;   /* address of first instruction */
+    jit_entryfunc *entry;  /* entry point, NULL if no code could be compiled at start */
+    psys_byte *chain;      /* entry point for jumps from other blocks */
+    struct jit_exit exits[2];
+    unsigned num_exits;
+};
+
+/** Registers compared in differential mode */
+struct jit_regs {
+    psys_fulladdr ipc, curseg, base, mp;
+    psys_word sp;
+    uint64_t insn_count;
+};
+
+struct psys_jit {
+    psys_byte *code;  /* native code buffer */
+    size_t code_used; /* bytes used in code buffer */
+    struct jit_block blocks[JIT_MAX_BLOCKS];
+    unsigned num_blocks;
+    struct jit_block *hash[1 << JIT_HASH_BITS]; /* open addressing hash table on start address */
+    psys_byte *pages;                           /* memory pages that code was compiled from */
+    size_t num_pages;
+    unsigned blocks_left; /* number of blocks that may still be entered before returning */
+    /* Differential mode */
+    bool diff_pending;       /* interpreter is executing the last block */
+    psys_fulladdr diff_addr; /* start address of that block */
+    uint64_t diff_start;     /* instruction count at start of that block */
+    uint64_t diff_limit;     /* instruction limit to restore afterwards */
+    struct jit_regs diff_regs;
+    psys_byte *diff_before; /* memory before executing block */
+    psys_byte *diff_after;  /* memory after executing block in compiled code */
+};
+
+/** Native code generation ***/
+
+static psys_byte *put32(psys_byte *p, uint32_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+    return p + 4;
+}
+
+#if defined(__x86_64__)
+/* rbx holds the state pointer; it is pushed in the prologue, which also aligns
+ * the stack for calls.
+ */
+static psys_byte *emit_prologue(psys_byte *p)
+{
+    *p++ = 0x53; /* push rbx */
+    *p++ = 0x48; /* mov rbx, rdi */
+    *p++ = 0x89;
+    *p++ = 0xfb;
+    return p;
+}
+
+/** Call func(state, arg), result in eax */
+static psys_byte *emit_call(psys_byte *p, psys_jit_func *func, uint32_t arg)
+{
+    uint64_t addr = (uintptr_t)func;
+    *p++          = 0x48; /* mov rdi, rbx */
+    *p++          = 0x89;
+    *p++          = 0xdf;
+    *p++          = 0xbe; /* mov esi, imm32 */
+    p             = put32(p, arg);
+    *p++          = 0x48; /* mov rax, imm64 */
+    *p++          = 0xb8;
+    p             = put32(p, addr);
+    p             = put32(p, addr >> 32);
+    *p++          = 0xff; /* call rax */
+    *p++          = 0xd0;
+    return p;
+}
+
+/** Branch on result of call being (non)zero. Target is set with patch_branch. */
+static psys_byte *emit_branch(psys_byte *p, bool nonzero)
+{
+    *p++ = 0x85; /* test eax, eax */
+    *p++ = 0xc0;
+    *p++ = 0x0f; /* jnz/jz rel32 */
+    *p++ = nonzero ? 0x85 : 0x84;
+    return put32(p, 0);
+}
+
+static void patch_branch(psys_byte *branch, psys_byte *target)
+{
+    put32(branch + 4, target - (branch + 8));
+}
+
+static psys_byte *emit_jump(psys_byte *p, psys_byte *target)
+{
+    *p++ = 0xe9; /* jmp rel32 */
+    return put32(p, target - (p + 4));
+}
+
+static psys_byte *emit_return(psys_byte *p)
+{
+    *p++ = 0x5b; /* pop rbx */
+    *p++ = 0xc3; /* ret */
+    return p;
+}
+#elif defined(__aarch64__)
+/* x19 holds the state pointer */
+static psys_byte *emit_prologue(psys_byte *p)
+{
+    p = put32(p, 0xa9be7bfd); /* stp x29, x30, [sp, #-32]! */
+    p = put32(p, 0x910003fd); /* mov x29, sp */
+    p = put32(p, 0xf9000bf3); /* str x19, [sp, #16] */
+    p = put32(p, 0xaa0003f3); /* mov x19, x0 */
+    return p;
+}
+
+/** Call func(state, arg), result in w0 */
+static psys_byte *emit_call(psys_byte *p, psys_jit_func *func, uint32_t arg)
+{
+    uint64_t addr = (uintptr_t)func;
+    unsigned i;
+    p = put32(p, 0xaa1303e0);                          /* mov x0, x19 */
+    p = put32(p, 0x52800001 | ((arg & 0xffff) << 5));  /* movz w1, #lo */
+    p = put32(p, 0x72a00001 | ((arg >> 16) << 5));     /* movk w1, #hi, lsl #16 */
+    p = put32(p, 0xd2800010 | ((addr & 0xffff) << 5)); /* movz x16, #addr0 */
+    for (i = 1; i < 4; ++i) { /* movk x16, #addrN, lsl #N*16 */
+        p = put32(p, 0xf2800010 | (i << 21) | (((addr >> (i * 16)) & 0xffff) << 5));
+    }
+    p = put32(p, 0xd63f0200); /* blr x16 */
+    return p;
+}
+
+/** Branch on result of call being (non)zero. Target is set with patch_branch. */
+static psys_byte *emit_branch(psys_byte *p, bool nonzero)
+{
+    return put32(p, nonzero ? 0x35000000 : 0x34000000); /* cbnz/cbz w0 */
+}
+
+static void patch_branch(psys_byte *branch, psys_byte *target)
+{
+    uint32_t insn = branch[0] | (branch[1] << 8) | (branch[2] << 16) | ((uint32_t)branch[3] << 24);
+    put32(branch, insn | ((((target - branch) / 4) & 0x7ffff) << 5));
+}
+
+static psys_byte *emit_jump(psys_byte *p, psys_byte *target)
+{
+    return put32(p, 0x14000000 | (((target - p) / 4) & 0x3ffffff)); /* b */
+}
+
+static psys_byte *emit_return(psys_byte *p)
+{
+    p = put32(p, 0xf9400bf3); /* ldr x19, [sp, #16] */
+    p = put32(p, 0xa8c27bfd); /* ldp x29, x30, [sp], #32 */
+    p = put32(p, 0xd65f03c0); /* ret */
+    return p;
+}
+#endif
+
+static void set_writable(struct psys_jit *jit, bool writable)
+{
+    if (mprotect(jit->code, JIT_CODE_SIZE, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC)) < 0) {
+        psys_panic("JIT: could not change protection of code buffer\n");
+    }
+}
+
+/** Runtime support called from compiled code ***/
+
+/** Enter a block of *n* instructions. Returns 0 if the block cannot be
+ * executed now, for the same reasons that the interpreter would stop or
+ * divert before the next instruction.
+ */
+static int jit_enter(struct psys_state *s, int n)
+{
+    struct psys_jit *jit = s->jit;
+    if (!jit->blocks_left || !s->running || util_atomic_get(&s->async_pending) || (s->hook_flags & PSYS_HOOK_PER_INSN)
+        || s->insn_limit - s->insn_count < (unsigned)n) {
+        return 0;
+    }
+    jit->blocks_left -= 1;
+    s->insn_count += n;
+    return 1;
+}
+
+/** Leave compiled code, continuing in the interpreter at *ipc*. */
+static int jit_exit(struct psys_state *s, int ipc)
+{
+    s->ipc = (psys_fulladdr)ipc;
+    return 0;
+}
+
+/** Block management ***/
+
+static unsigned hash_slot(psys_fulladdr addr)
+{
+    return (addr * 0x9e3779b1U) >> (32 - JIT_HASH_BITS);
+}
+
+static struct jit_block *lookup(struct psys_jit *jit, psys_fulladdr addr)
+{
+    unsigned slot;
+    for (slot = hash_slot(addr); jit->hash[slot]; slot = (slot + 1) & ((1 << JIT_HASH_BITS) - 1)) {
+        if (jit->hash[slot]->start == addr) {
+            return jit->hash[slot];
+        }
+    }
+    return NULL;
+}
+
+/** Drop all compiled code. */
+static void flush(struct psys_jit *jit)
+{
+    jit->code_used  = 0;
+    jit->num_blocks = 0;
+    memset(jit->hash, 0, sizeof(jit->hash));
+    memset(jit->pages, 0, jit->num_pages);
+}
+
+static void mark_pages(struct psys_jit *jit, psys_fulladdr start, psys_fulladdr end)
+{
+    size_t page;
+    for (page = start >> JIT_PAGE_BITS; page <= (end - 1) >> JIT_PAGE_BITS && page < jit->num_pages; ++page) {
+        jit->pages[page] = 1;
+    }
+}
+
+/** Emit exit from block to p-code address *target*: a direct jump if there is
+ * a compiled block there, otherwise a stub that returns to the interpreter,
+ * which will be patched when a block is compiled at *target*.
+ */
+static psys_byte *emit_exit(struct psys_jit *jit, struct jit_block *b, psys_byte *p, psys_fulladdr target)
+{
+    struct jit_block *tb = lookup(jit, target);
+    if (tb && tb->entry) {
+        return emit_jump(p, tb->chain);
+    }
+    b->exits[b->num_exits].stub   = p;
+    b->exits[b->num_exits].target = target;
+    b->num_exits += 1;
+    p = emit_call(p, &jit_exit, target);
+    return emit_return(p);
+}
+
+/** Patch exits of other blocks that go to block *b*. */
+static void chain_exits(struct psys_jit *jit, struct jit_block *b)
+{
+    unsigned i, j;
+    for (i = 0; i < jit->num_blocks; ++i) {
+        struct jit_block *ob = &jit->blocks[i];
+        for (j = 0; j < ob->num_exits; ++j) {
+            struct jit_exit *e = &ob->exits[j];
+            if (e->stub && e->target == b->start) {
+                psys_byte *end = emit_jump(e->stub, b->chain);
+                __builtin___clear_cache((char *)e->stub, (char *)end);
+                e->stub = NULL;
+            }
+        }
+    }
+}
+
+/** Compile block starting at *start*. If there are not enough simple
+ * instructions there, the block is remembered as not compilable.
+ */
+static struct jit_block *compile_block(struct psys_state *s, struct psys_jit *jit, psys_fulladdr start)
+{
+    struct psys_insn insns[JIT_MAX_INSNS];
+    const struct psys_jit_template *t;
+    psys_fulladdr addr = start, target;
+    psys_byte *p, *fail, *taken = NULL;
+    struct jit_block *b;
+    unsigned n = 0, i, slot;
+    uintptr_t entry;
+
+    if (jit->num_blocks == JIT_MAX_BLOCKS || JIT_CODE_SIZE - jit->code_used < JIT_MAX_BLOCK_CODE) {
+        flush(jit);
+    }
+    while (n < JIT_MAX_INSNS && addr + 1 + PSYS_OP_MAX_ARGS * 2 <= s->mem_size) {
+        psys_predecode_unfuse(s, &insns[n], addr, NULL);
+        t = &psys_jit_templates[insns[n].op];
+        if (!t->func) {
+            break;
+        }
+        addr += insns[n].len;
+        n += 1;
+        if (t->flags & PSYS_JIT_JUMP) {
+            break;
+        }
+    }
+
+    b            = &jit->blocks[jit->num_blocks++];
+    b->start     = start;
+    b->entry     = NULL;
+    b->chain     = NULL;
+    b->num_exits = 0;
+    for (slot = hash_slot(start); jit->hash[slot]; slot = (slot + 1) & ((1 << JIT_HASH_BITS) - 1)) {
+    }
+    jit->hash[slot] = b;
+    mark_pages(jit, start, addr > start ? addr : start + 1);
+    if (n < JIT_MIN_INSNS) {
+        return b;
+    }
+
+    set_writable(jit, true);
+    p        = jit->code + jit->code_used;
+    entry    = (uintptr_t)p;
+    b->entry = (jit_entryfunc *)entry;
+    p        = emit_prologue(p);
+    b->chain = p;
+    p        = emit_call(p, &jit_enter, n);
+    fail     = p;
+    p        = emit_branch(p, false);
+    addr     = start;
+    target   = 0;
+    for (i = 0; i < n; ++i) {
+        t = &psys_jit_templates[insns[i].op];
+        addr += insns[i].len;
+        if (t->flags & PSYS_JIT_JUMP) {
+            target = addr + insns[i].args[0];
+            if (t->flags & PSYS_JIT_COND) {
+                p     = emit_call(p, t->func, 0);
+                taken = p;
+                p     = emit_branch(p, true);
+            }
+        } else {
+            p = emit_call(p, t->func, t->operand >= 0 ? t->operand : t->operand == -1 ? insns[i].args[0] : 0);
+        }
+    }
+    t = &psys_jit_templates[insns[n - 1].op];
+    if (!(t->flags & PSYS_JIT_JUMP)) {
+        p = emit_exit(jit, b, p, addr); /* fall through to next instruction */
+    } else if (!(t->flags & PSYS_JIT_COND)) {
+        p = emit_exit(jit, b, p, target);
+    } else {
+        p = emit_exit(jit, b, p, addr);
+        patch_branch(taken, p);
+        p = emit_exit(jit, b, p, target);
+    }
+    patch_branch(fail, p); /* leave at start of block, nothing was executed */
+    p = emit_call(p, &jit_exit, start);
+    p = emit_return(p);
+    __builtin___clear_cache((char *)jit->code + jit->code_used, (char *)p);
+    jit->code_used = p - jit->code;
+    chain_exits(jit, b);
+    set_writable(jit, false);
+    return b;
+}
+
+/** Differential mode ***/
+
+static void save_regs(struct psys_state *s, struct jit_regs *regs)
+{
+    memset(regs, 0, sizeof(*regs));
+    regs->ipc        = s->ipc;
+    regs->curseg     = s->curseg;
+    regs->base       = s->base;
+    regs->mp         = s->mp;
+    regs->sp         = s->sp;
+    regs->insn_count = s->insn_count;
+}
+
+/** Run one block in compiled code, then go back to the state before it, and
+ * let the interpreter execute it for comparison in psys_jit_diff_check.
+ */
+static void diff_run(struct psys_state *s, struct psys_jit *jit, struct jit_block *b)
+{
+    struct jit_regs before;
+    if (!jit->diff_before) {
+        jit->diff_before = malloc(s->mem_size);
+        jit->diff_after  = malloc(s->mem_size);
+    }
+    save_regs(s, &before);
+    memcpy(jit->diff_before, s->memory, s->mem_size);
+    jit->blocks_left = 1;
+    b->entry(s);
+    if (s->insn_count == before.insn_count) { /* block was not entered */
+        return;
+    }
+    save_regs(s, &jit->diff_regs);
+    memcpy(jit->diff_after, s->memory, s->mem_size);
+    memcpy(s->memory, jit->diff_before, s->mem_size);
+    s->ipc            = before.ipc;
+    s->sp             = before.sp;
+    s->insn_count     = before.insn_count;
+    jit->diff_pending = true;
+    jit->diff_addr    = b->start;
+    jit->diff_start   = before.insn_count;
+    jit->diff_limit   = s->insn_limit;
+    s->insn_limit     = jit->diff_regs.insn_count;
+}
+
+bool psys_jit_diff_check(struct psys_state *s)
+{
+    struct psys_jit *jit = s->jit;
+    struct jit_regs regs;
+    size_t x, dead_start, dead_end;
+    if (!jit || !jit->diff_pending) {
+        return false;
+    }
+    jit->diff_pending = false;
+    s->insn_limit     = jit->diff_limit;
+    if (s->stop_reason != PSYS_STOP_BUDGET || s->insn_count != jit->diff_regs.insn_count) {
+        return false; /* interpreter stopped for a different reason */
+    }
+    save_regs(s, &regs);
+    if (memcmp(&regs, &jit->diff_regs, sizeof(regs))) {
+        psys_panic("JIT: block at 0x%05x: registers differ: ipc 0x%05x/0x%05x sp 0x%04x/0x%04x mp 0x%05x/0x%05x base 0x%05x/0x%05x curseg 0x%05x/0x%05x (interpreter/JIT)\n",
+            jit->diff_addr,
+            regs.ipc, jit->diff_regs.ipc,
+            regs.sp, jit->diff_regs.sp,
+            regs.mp, jit->diff_regs.mp,
+            regs.base, jit->diff_regs.base,
+            regs.curseg, jit->diff_regs.curseg);
+    }
+    /* Words popped by the block are dead, and may not have been written
+     * by the interpreter (e.g. with PSYS_TOS_CACHE). Every instruction pushes
+     * at most one word, so these are within n words below the final sp.
+     */
+    dead_end   = regs.sp;
+    dead_start = regs.sp - 2 * (regs.insn_count - jit->diff_start);
+    for (x = 0; x < s->mem_size; ++x) {
+        if (x >= dead_start && x < dead_end) {
+            continue;
+        }
+        if (s->memory[x] != jit->diff_after[x]) {
+            psys_panic("JIT: block at 0x%05x: memory differs at 0x%05x: 0x%02x/0x%02x (interpreter/JIT)\n",
+                jit->diff_addr, (unsigned)x, s->memory[x], jit->diff_after[x]);
+        }
+    }
+    return true;
+}
+
+/** Public interface ***/
+
+struct psys_jit *psys_jit_new(void)
+{
+    struct psys_jit *jit = CALLOC_STRUCT(psys_jit);
+    jit->code            = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        psys_panic("JIT: could not allocate code buffer\n");
+    }
+    return jit;
+}
+
+void psys_jit_destroy(struct psys_jit *jit)
+{
+    if (!jit) {
+        return;
+    }
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit->pages);
+    free(jit->diff_before);
+    free(jit->diff_after);
+    free(jit);
+}
+
+void psys_jit_invalidate(struct psys_jit *jit, psys_fulladdr addr, psys_fulladdr size)
+{
+    size_t page;
+    if (!jit->num_blocks || !size) {
+        return;
+    }
+    for (page = addr >> JIT_PAGE_BITS; page <= (addr + size - 1) >> JIT_PAGE_BITS && page < jit->num_pages; ++page) {
+        if (jit->pages[page]) {
+            flush(jit);
+            return;
+        }
+    }
+}
+
+void psys_jit_run(struct psys_state *s)
+{
+    struct psys_jit *jit = s->jit;
+    struct jit_block *b;
+    uint64_t insn_count;
+    if (!s->running || util_atomic_get(&s->async_pending) || (s->hook_flags & PSYS_HOOK_PER_INSN)) {
+        return;
+    }
+    if (!jit) {
+        jit = s->jit = psys_jit_new();
+    }
+    if (!jit->pages) {
+        jit->num_pages = (s->mem_size >> JIT_PAGE_BITS) + 1;
+        jit->pages     = calloc(jit->num_pages, 1);
+    }
+    if (jit->diff_pending) { /* interpreter is executing block for comparison */
+        return;
+    }
+    /* Blocks that were not compiled yet are left through a stub, so continue
+     * there to compile them and chain them up.
+     */
+    do {
+        b = lookup(jit, s->ipc);
+        if (!b) {
+            b = compile_block(s, jit, s->ipc);
+        }
+        if (!b->entry) {
+            return;
+        }
+        if (PDBG(s, JIT_DIFF)) {
+            diff_run(s, jit, b);
+            return;
+        }
+        insn_count       = s->insn_count;
+        jit->blocks_left = UINT_MAX;
+        b->entry(s);
+    } while (s->insn_count != insn_count);
+}
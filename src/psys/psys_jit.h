@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Basic-block template JIT (PSYS_JIT builds only, x86-64 and AArch64 Linux).
+ *
+ * Runs of simple instructions (the ones that can be fused into
+ * superinstructions, see gen_interpreter.py) are translated to native code
+ * that calls a C template per instruction, with operands as immediates.
+ * Blocks end at a jump or at the first instruction that cannot be compiled;
+ * exits to blocks that have been compiled are patched into direct jumps.
+ *
+ * The p-machine state is kept in psys_state at block boundaries, and the
+ * instruction count and budget are exact, so everything else (faults,
+ * native procedures, task switches, hooks) stays in the interpreter. All
+ * compiled code is dropped when code in memory changes (psys_invalidate_code).
+ *
+ * With PSYS_DBG_JIT_DIFF set, every block is also executed by the interpreter,
+ * and the resulting registers and memory are compared.
+ */
+#ifndef H_PSYS_JIT
+#define H_PSYS_JIT
+
+#include "psys_state.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct psys_jit;
+
+/** Create JIT state */
+extern struct psys_jit *psys_jit_new(void);
+
+/** Destroy JIT state. Can be passed NULL. */
+extern void psys_jit_destroy(struct psys_jit *jit);
+
+/** Drop compiled code if any of it was compiled from a range of memory. */
+extern void psys_jit_invalidate(struct psys_jit *jit, psys_fulladdr addr, psys_fulladdr size);
+
+/* Internal: called by the interpreter at jumps, calls and returns. Continue
+ * execution in compiled code at ipc, if possible.
+ */
+extern void psys_jit_run(struct psys_state *s);
+
+/* Internal: called by psys_run after the interpreter loop stopped. Returns
+ * true if it stopped to compare a block against the interpreter and should
+ * continue.
+ */
+extern bool psys_jit_diff_check(struct psys_state *s);
+
+/* Internal: instruction template, see psys_jit_templates.h */
+typedef int(psys_jit_func)(struct psys_state *s, int a);
+
+enum psys_jit_template_flags {
+    PSYS_JIT_JUMP = 0x1, /* jump, operand is relative target */
+    PSYS_JIT_COND = 0x2, /* conditional jump, template returns whether it is taken */
+};
+
+struct psys_jit_template {
+    psys_jit_func *func;
+    signed char operand;
+    unsigned char flags;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Instruction templates for the JIT (see psys_jit.c). */
+#ifndef H_PSYS_JIT_TEMPLATES
+#define H_PSYS_JIT_TEMPLATES
+
+#include "psys_compiled.h"
+#include "psys_jit.h"
+
+// clang-format off
+/* auto-generated by gen_interpreter.py */
+static int jit_do_sldc(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(a);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_sldl(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(psys_ldw(s, local_addr(s, a)));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_sldo(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(psys_ldw(s, global_addr(s, a)));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_slla(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(local_addr(s, a));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_sstl(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = POP(); psys_stw(s, local_addr(s, a), tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_sind(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = TOP(); SET_TOP(psys_ldw(s, W(tos0, a)));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ldcb(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(a);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ldci(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(a);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ldcn(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(PSYS_NIL);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_lla(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(local_addr(s, a));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ldo(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(psys_ldw(s, global_addr(s, a)));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_lao(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(global_addr(s, a));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ldl(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    PUSH(psys_ldw(s, local_addr(s, a)));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_stl(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = POP(); psys_stw(s, local_addr(s, a), tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_sro(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = POP(); psys_stw(s, global_addr(s, a), tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ind(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = TOP(); SET_TOP(psys_ldw(s, W(tos0, a)));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_inc(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = TOP(); SET_TOP(W(tos0, a));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ixa(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(W(tos1, a * tos0));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_sto(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = POP(); psys_stw(s, tos1, tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ldb(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(psys_ldb(s, tos1, tos0));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_adi(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 + tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_sbi(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 - tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_mpi(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 * tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_land(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 & tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_lor(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 | tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_equi(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 == tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_neqi(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 != tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_leqi(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = SPOP(); tos1 = signext_word(TOP()); SET_TOP(tos1 <= tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_geqi(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = SPOP(); tos1 = signext_word(TOP()); SET_TOP(tos1 >= tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_leusw(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 <= tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_geusw(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 >= tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_bnot(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = TOP(); SET_TOP(!BOOL(tos0));
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_lnot(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = TOP(); SET_TOP(~tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_inci(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = TOP(); SET_TOP(tos0 + 1);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_deci(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = TOP(); SET_TOP(tos0 - 1);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_dup1(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    tos0 = POP(); PUSH(tos0); PUSH(tos0);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_swap(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos0); PUSH(tos1);
+    s->sp = sp;
+    return 0;
+}
+static int jit_do_ujp(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int taken = 0;
+    taken = 1;
+    s->sp = sp;
+    return taken;
+}
+static int jit_do_fjp(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    int taken = 0;
+    tos0 = POP(); if (!BOOL(tos0)) { taken = 1; }
+    s->sp = sp;
+    return taken;
+}
+static int jit_do_tjp(struct psys_state *s, int a)
+{
+    psys_word sp = s->sp;
+    int tos0;
+    int taken = 0;
+    tos0 = POP(); if (BOOL(tos0)) { taken = 1; }
+    s->sp = sp;
+    return taken;
+}
+
+/* Template for every opcode, and its operand: value for operand encoded in
+ * opcode, -1 if it is the first argument, -2 if none.
+ */
+static const struct psys_jit_template psys_jit_templates[256] = {
+    {&jit_do_sldc, 0, 0}, /* 0x00 sldc0 */
+    {&jit_do_sldc, 1, 0}, /* 0x01 sldc1 */
+    {&jit_do_sldc, 2, 0}, /* 0x02 sldc2 */
+    {&jit_do_sldc, 3, 0}, /* 0x03 sldc3 */
+    {&jit_do_sldc, 4, 0}, /* 0x04 sldc4 */
+    {&jit_do_sldc, 5, 0}, /* 0x05 sldc5 */
+    {&jit_do_sldc, 6, 0}, /* 0x06 sldc6 */
+    {&jit_do_sldc, 7, 0}, /* 0x07 sldc7 */
+    {&jit_do_sldc, 8, 0}, /* 0x08 sldc8 */
+    {&jit_do_sldc, 9, 0}, /* 0x09 sldc9 */
+    {&jit_do_sldc, 10, 0}, /* 0x0a sldc10 */
+    {&jit_do_sldc, 11, 0}, /* 0x0b sldc11 */
+    {&jit_do_sldc, 12, 0}, /* 0x0c sldc12 */
+    {&jit_do_sldc, 13, 0}, /* 0x0d sldc13 */
+    {&jit_do_sldc, 14, 0}, /* 0x0e sldc14 */
+    {&jit_do_sldc, 15, 0}, /* 0x0f sldc15 */
+    {&jit_do_sldc, 16, 0}, /* 0x10 sldc16 */
+    {&jit_do_sldc, 17, 0}, /* 0x11 sldc17 */
+    {&jit_do_sldc, 18, 0}, /* 0x12 sldc18 */
+    {&jit_do_sldc, 19, 0}, /* 0x13 sldc19 */
+    {&jit_do_sldc, 20, 0}, /* 0x14 sldc20 */
+    {&jit_do_sldc, 21, 0}, /* 0x15 sldc21 */
+    {&jit_do_sldc, 22, 0}, /* 0x16 sldc22 */
+    {&jit_do_sldc, 23, 0}, /* 0x17 sldc23 */
+    {&jit_do_sldc, 24, 0}, /* 0x18 sldc24 */
+    {&jit_do_sldc, 25, 0}, /* 0x19 sldc25 */
+    {&jit_do_sldc, 26, 0}, /* 0x1a sldc26 */
+    {&jit_do_sldc, 27, 0}, /* 0x1b sldc27 */
+    {&jit_do_sldc, 28, 0}, /* 0x1c sldc28 */
+    {&jit_do_sldc, 29, 0}, /* 0x1d sldc29 */
+    {&jit_do_sldc, 30, 0}, /* 0x1e sldc30 */
+    {&jit_do_sldc, 31, 0}, /* 0x1f sldc31 */
+    {&jit_do_sldl, 1, 0}, /* 0x20 sldl1 */
+    {&jit_do_sldl, 2, 0}, /* 0x21 sldl2 */
+    {&jit_do_sldl, 3, 0}, /* 0x22 sldl3 */
+    {&jit_do_sldl, 4, 0}, /* 0x23 sldl4 */
+    {&jit_do_sldl, 5, 0}, /* 0x24 sldl5 */
+    {&jit_do_sldl, 6, 0}, /* 0x25 sldl6 */
+    {&jit_do_sldl, 7, 0}, /* 0x26 sldl7 */
+    {&jit_do_sldl, 8, 0}, /* 0x27 sldl8 */
+    {&jit_do_sldl, 9, 0}, /* 0x28 sldl9 */
+    {&jit_do_sldl, 10, 0}, /* 0x29 sldl10 */
+    {&jit_do_sldl, 11, 0}, /* 0x2a sldl11 */
+    {&jit_do_sldl, 12, 0}, /* 0x2b sldl12 */
+    {&jit_do_sldl, 13, 0}, /* 0x2c sldl13 */
+    {&jit_do_sldl, 14, 0}, /* 0x2d sldl14 */
+    {&jit_do_sldl, 15, 0}, /* 0x2e sldl15 */
+    {&jit_do_sldl, 16, 0}, /* 0x2f sldl16 */
+    {&jit_do_sldo, 1, 0}, /* 0x30 sldo1 */
+    {&jit_do_sldo, 2, 0}, /* 0x31 sldo2 */
+    {&jit_do_sldo, 3, 0}, /* 0x32 sldo3 */
+    {&jit_do_sldo, 4, 0}, /* 0x33 sldo4 */
+    {&jit_do_sldo, 5, 0}, /* 0x34 sldo5 */
+    {&jit_do_sldo, 6, 0}, /* 0x35 sldo6 */
+    {&jit_do_sldo, 7, 0}, /* 0x36 sldo7 */
+    {&jit_do_sldo, 8, 0}, /* 0x37 sldo8 */
+    {&jit_do_sldo, 9, 0}, /* 0x38 sldo9 */
+    {&jit_do_sldo, 10, 0}, /* 0x39 sldo10 */
+    {&jit_do_sldo, 11, 0}, /* 0x3a sldo11 */
+    {&jit_do_sldo, 12, 0}, /* 0x3b sldo12 */
+    {&jit_do_sldo, 13, 0}, /* 0x3c sldo13 */
+    {&jit_do_sldo, 14, 0}, /* 0x3d sldo14 */
+    {&jit_do_sldo, 15, 0}, /* 0x3e sldo15 */
+    {&jit_do_sldo, 16, 0}, /* 0x3f sldo16 */
+    {NULL, 0, 0}, /* 0x40 und40 */
+    {NULL, 0, 0}, /* 0x41 und41 */
+    {NULL, 0, 0}, /* 0x42 und42 */
+    {NULL, 0, 0}, /* 0x43 und43 */
+    {NULL, 0, 0}, /* 0x44 und44 */
+    {NULL, 0, 0}, /* 0x45 und45 */
+    {NULL, 0, 0}, /* 0x46 und46 */
+    {NULL, 0, 0}, /* 0x47 und47 */
+    {NULL, 0, 0}, /* 0x48 und48 */
+    {NULL, 0, 0}, /* 0x49 und49 */
+    {NULL, 0, 0}, /* 0x4a und4a */
+    {NULL, 0, 0}, /* 0x4b und4b */
+    {NULL, 0, 0}, /* 0x4c und4c */
+    {NULL, 0, 0}, /* 0x4d und4d */
+    {NULL, 0, 0}, /* 0x4e und4e */
+    {NULL, 0, 0}, /* 0x4f und4f */
+    {NULL, 0, 0}, /* 0x50 und50 */
+    {NULL, 0, 0}, /* 0x51 und51 */
+    {NULL, 0, 0}, /* 0x52 und52 */
+    {NULL, 0, 0}, /* 0x53 und53 */
+    {NULL, 0, 0}, /* 0x54 und54 */
+    {NULL, 0, 0}, /* 0x55 und55 */
+    {NULL, 0, 0}, /* 0x56 und56 */
+    {NULL, 0, 0}, /* 0x57 und57 */
+    {NULL, 0, 0}, /* 0x58 und58 */
+    {NULL, 0, 0}, /* 0x59 und59 */
+    {NULL, 0, 0}, /* 0x5a und5a */
+    {NULL, 0, 0}, /* 0x5b und5b */
+    {NULL, 0, 0}, /* 0x5c und5c */
+    {NULL, 0, 0}, /* 0x5d und5d */
+    {NULL, 0, 0}, /* 0x5e und5e */
+    {NULL, 0, 0}, /* 0x5f und5f */
+    {&jit_do_slla, 1, 0}, /* 0x60 slla1 */
+    {&jit_do_slla, 2, 0}, /* 0x61 slla2 */
+    {&jit_do_slla, 3, 0}, /* 0x62 slla3 */
+    {&jit_do_slla, 4, 0}, /* 0x63 slla4 */
+    {&jit_do_slla, 5, 0}, /* 0x64 slla5 */
+    {&jit_do_slla, 6, 0}, /* 0x65 slla6 */
+    {&jit_do_slla, 7, 0}, /* 0x66 slla7 */
+    {&jit_do_slla, 8, 0}, /* 0x67 slla8 */
+    {&jit_do_sstl, 1, 0}, /* 0x68 sstl1 */
+    {&jit_do_sstl, 2, 0}, /* 0x69 sstl2 */
+    {&jit_do_sstl, 3, 0}, /* 0x6a sstl3 */
+    {&jit_do_sstl, 4, 0}, /* 0x6b sstl4 */
+    {&jit_do_sstl, 5, 0}, /* 0x6c sstl5 */
+    {&jit_do_sstl, 6, 0}, /* 0x6d sstl6 */
+    {&jit_do_sstl, 7, 0}, /* 0x6e sstl7 */
+    {&jit_do_sstl, 8, 0}, /* 0x6f sstl8 */
+    {NULL, 0, 0}, /* 0x70 scxg1 */
+    {NULL, 0, 0}, /* 0x71 scxg2 */
+    {NULL, 0, 0}, /* 0x72 scxg3 */
+    {NULL, 0, 0}, /* 0x73 scxg4 */
+    {NULL, 0, 0}, /* 0x74 scxg5 */
+    {NULL, 0, 0}, /* 0x75 scxg6 */
+    {NULL, 0, 0}, /* 0x76 scxg7 */
+    {NULL, 0, 0}, /* 0x77 scxg8 */
+    {&jit_do_sind, 0, 0}, /* 0x78 sind0 */
+    {&jit_do_sind, 1, 0}, /* 0x79 sind1 */
+    {&jit_do_sind, 2, 0}, /* 0x7a sind2 */
+    {&jit_do_sind, 3, 0}, /* 0x7b sind3 */
+    {&jit_do_sind, 4, 0}, /* 0x7c sind4 */
+    {&jit_do_sind, 5, 0}, /* 0x7d sind5 */
+    {&jit_do_sind, 6, 0}, /* 0x7e sind6 */
+    {&jit_do_sind, 7, 0}, /* 0x7f sind7 */
+    {&jit_do_ldcb, -1, 0}, /* 0x80 ldcb */
+    {&jit_do_ldci, -1, 0}, /* 0x81 ldci */
+    {NULL, 0, 0}, /* 0x82 lco */
+    {NULL, 0, 0}, /* 0x83 ldc */
+    {&jit_do_lla, -1, 0}, /* 0x84 lla */
+    {&jit_do_ldo, -1, 0}, /* 0x85 ldo */
+    {&jit_do_lao, -1, 0}, /* 0x86 lao */
+    {&jit_do_ldl, -1, 0}, /* 0x87 ldl */
+    {NULL, 0, 0}, /* 0x88 lda */
+    {NULL, 0, 0}, /* 0x89 lod */
+    {&jit_do_ujp, -1, PSYS_JIT_JUMP}, /* 0x8a ujp */
+    {NULL, 0, 0}, /* 0x8b ujpl */
+    {&jit_do_mpi, -2, 0}, /* 0x8c mpi */
+    {NULL, 0, 0}, /* 0x8d dvi */
+    {NULL, 0, 0}, /* 0x8e stm */
+    {NULL, 0, 0}, /* 0x8f modi */
+    {NULL, 0, 0}, /* 0x90 clp */
+    {NULL, 0, 0}, /* 0x91 cgp */
+    {NULL, 0, 0}, /* 0x92 cip */
+    {NULL, 0, 0}, /* 0x93 cxl */
+    {NULL, 0, 0}, /* 0x94 cxg */
+    {NULL, 0, 0}, /* 0x95 cxi */
+    {NULL, 0, 0}, /* 0x96 rpu */
+    {NULL, 0, 0}, /* 0x97 cfp */
+    {&jit_do_ldcn, -2, 0}, /* 0x98 ldcn */
+    {NULL, 0, 0}, /* 0x99 lsl */
+    {NULL, 0, 0}, /* 0x9a lde */
+    {NULL, 0, 0}, /* 0x9b lae */
+    {NULL, 0, 0}, /* 0x9c nop */
+    {NULL, 0, 0}, /* 0x9d lpr */
+    {NULL, 0, 0}, /* 0x9e bpt */
+    {&jit_do_bnot, -2, 0}, /* 0x9f bnot */
+    {&jit_do_lor, -2, 0}, /* 0xa0 lor */
+    {&jit_do_land, -2, 0}, /* 0xa1 land */
+    {&jit_do_adi, -2, 0}, /* 0xa2 adi */
+    {&jit_do_sbi, -2, 0}, /* 0xa3 sbi */
+    {&jit_do_stl, -1, 0}, /* 0xa4 stl */
+    {&jit_do_sro, -1, 0}, /* 0xa5 sro */
+    {NULL, 0, 0}, /* 0xa6 str */
+    {&jit_do_ldb, -2, 0}, /* 0xa7 ldb */
+    {NULL, 0, 0}, /* 0xa8 native */
+    {NULL, 0, 0}, /* 0xa9 nat-info */
+    {NULL, 0, 0}, /* 0xaa undaa */
+    {NULL, 0, 0}, /* 0xab cap */
+    {NULL, 0, 0}, /* 0xac csp */
+    {NULL, 0, 0}, /* 0xad slod1 */
+    {NULL, 0, 0}, /* 0xae slod2 */
+    {NULL, 0, 0}, /* 0xaf undaf */
+    {&jit_do_equi, -2, 0}, /* 0xb0 equi */
+    {&jit_do_neqi, -2, 0}, /* 0xb1 neqi */
+    {&jit_do_leqi, -2, 0}, /* 0xb2 leqi */
+    {&jit_do_geqi, -2, 0}, /* 0xb3 geqi */
+    {&jit_do_leusw, -2, 0}, /* 0xb4 leusw */
+    {&jit_do_geusw, -2, 0}, /* 0xb5 geusw */
+    {NULL, 0, 0}, /* 0xb6 eqpwr */
+    {NULL, 0, 0}, /* 0xb7 lepwr */
+    {NULL, 0, 0}, /* 0xb8 gepwr */
+    {NULL, 0, 0}, /* 0xb9 eqbyte */
+    {NULL, 0, 0}, /* 0xba lebyte */
+    {NULL, 0, 0}, /* 0xbb gebyte */
+    {NULL, 0, 0}, /* 0xbc srs */
+    {&jit_do_swap, -2, 0}, /* 0xbd swap */
+    {NULL, 0, 0}, /* 0xbe undbe */
+    {NULL, 0, 0}, /* 0xbf undbf */
+    {NULL, 0, 0}, /* 0xc0 undc0 */
+    {NULL, 0, 0}, /* 0xc1 undc1 */
+    {NULL, 0, 0}, /* 0xc2 undc2 */
+    {NULL, 0, 0}, /* 0xc3 undc3 */
+    {&jit_do_sto, -2, 0}, /* 0xc4 sto */
+    {NULL, 0, 0}, /* 0xc5 mov */
+    {NULL, 0, 0}, /* 0xc6 dup2 */
+    {NULL, 0, 0}, /* 0xc7 adj */
+    {NULL, 0, 0}, /* 0xc8 stb */
+    {NULL, 0, 0}, /* 0xc9 ldp */
+    {NULL, 0, 0}, /* 0xca stp */
+    {NULL, 0, 0}, /* 0xcb chk */
+    {NULL, 0, 0}, /* 0xcc flt */
+    {NULL, 0, 0}, /* 0xcd eqreal */
+    {NULL, 0, 0}, /* 0xce lereal */
+    {NULL, 0, 0}, /* 0xcf gereal */
+    {NULL, 0, 0}, /* 0xd0 ldm */
+    {NULL, 0, 0}, /* 0xd1 spr */
+    {NULL, 0, 0}, /* 0xd2 efj */
+    {NULL, 0, 0}, /* 0xd3 nfj */
+    {&jit_do_fjp, -1, PSYS_JIT_JUMP | PSYS_JIT_COND}, /* 0xd4 fjp */
+    {NULL, 0, 0}, /* 0xd5 fjpl */
+    {NULL, 0, 0}, /* 0xd6 xjp */
+    {&jit_do_ixa, -1, 0}, /* 0xd7 ixa */
+    {NULL, 0, 0}, /* 0xd8 ixp */
+    {NULL, 0, 0}, /* 0xd9 ste */
+    {NULL, 0, 0}, /* 0xda inn */
+    {NULL, 0, 0}, /* 0xdb uni */
+    {NULL, 0, 0}, /* 0xdc int */
+    {NULL, 0, 0}, /* 0xdd dif */
+    {NULL, 0, 0}, /* 0xde signal */
+    {NULL, 0, 0}, /* 0xdf wait */
+    {NULL, 0, 0}, /* 0xe0 abi */
+    {NULL, 0, 0}, /* 0xe1 ngi */
+    {&jit_do_dup1, -2, 0}, /* 0xe2 dup1 */
+    {NULL, 0, 0}, /* 0xe3 abr */
+    {NULL, 0, 0}, /* 0xe4 ngr */
+    {&jit_do_lnot, -2, 0}, /* 0xe5 lnot */
+    {&jit_do_ind, -1, 0}, /* 0xe6 ind */
+    {&jit_do_inc, -1, 0}, /* 0xe7 inc */
+    {NULL, 0, 0}, /* 0xe8 eqstr */
+    {NULL, 0, 0}, /* 0xe9 lestr */
+    {NULL, 0, 0}, /* 0xea gestr */
+    {NULL, 0, 0}, /* 0xeb astr */
+    {NULL, 0, 0}, /* 0xec cstr */
+    {&jit_do_inci, -2, 0}, /* 0xed inci */
+    {&jit_do_deci, -2, 0}, /* 0xee deci */
+    {NULL, 0, 0}, /* 0xef scip1 */
+    {NULL, 0, 0}, /* 0xf0 scip2 */
+    {&jit_do_tjp, -1, PSYS_JIT_JUMP | PSYS_JIT_COND}, /* 0xf1 tjp */
+    {NULL, 0, 0}, /* 0xf2 ldcrl */
+    {NULL, 0, 0}, /* 0xf3 ldrl */
+    {NULL, 0, 0}, /* 0xf4 strl */
+    {NULL, 0, 0}, /* 0xf5 undf5 */
+    {NULL, 0, 0}, /* 0xf6 undf6 */
+    {NULL, 0, 0}, /* 0xf7 undf7 */
+    {NULL, 0, 0}, /* 0xf8 undf8 */
+    {NULL, 0, 0}, /* 0xf9 undf9 */
+    {NULL, 0, 0}, /* 0xfa undfa */
+    {NULL, 0, 0}, /* 0xfb undfb */
+    {NULL, 0, 0}, /* 0xfc undfc */
+    {NULL, 0, 0}, /* 0xfd undfd */
+    {NULL, 0, 0}, /* 0xfe undfe */
+    {NULL, 0, 0}, /* 0xff undff */
+};
+// clang-format on
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "psys_predecode.h"
+
+#include "psys_superinst.h"
+
+#include "psys_debug.h"
+#include "psys_helpers.h"
+#include "psys_hooks.h"
+#include "util/memutil.h"
+
+#include <string.h>
+
+/** Release all decoded instructions of a segment entry, and mark it unused. */
+static void seg_clear(struct psys_predecode_seg *seg)
+{
+    unsigned i;
+    for (i = 0; i < PSYS_PREDECODE_CHUNKS; ++i) {
+        free(seg->chunks[i]);
+        seg->chunks[i] = NULL;
+    }
+    seg->base = PSYS_ADDR_ERROR;
+    seg->end  = 0;
+}
+
+/** Recompute the range covered by all segment entries. */
+static void update_range(struct psys_predecode *pd)
+{
+    unsigned i;
+    pd->lo = PSYS_ADDR_ERROR;
+    pd->hi = 0;
+    for (i = 0; i < PSYS_PREDECODE_SEGS; ++i) {
+        struct psys_predecode_seg *seg = &pd->segs[i];
+        if (seg->base != PSYS_ADDR_ERROR) {
+            if (seg->base < pd->lo) {
+                pd->lo = seg->base;
+            }
+            if (seg->end > pd->hi) {
+                pd->hi = seg->end;
+            }
+        }
+    }
+}
+
+/** Decode a single instruction at addr into *insn. */
+static void decode_insn(struct psys_state *s, struct psys_insn *insn, psys_fulladdr addr, const void *const *handlers)
+{
+    psys_fulladdr ptr                   = addr;
+    psys_byte op                        = psys_ldb(s, 0, ptr++);
+    const struct psys_opcode_desc *desc = &psys_opcode_descriptions[op];
+    int i;
+    for (i = 0; i < desc->num_args; ++i) {
+        psys_word a, b;
+        switch (desc->args[i] & PSYS_OPARG_ARGTMASK) {
+        case PSYS_OPARG_VAR: /* B (1/2 byte varlen) */
+            a = psys_ldb(s, 0, ptr++);
+            if (a >= 0x80) {
+                a = ((a & 0x7f) << 8) | psys_ldb(s, 0, ptr++);
+            }
+            insn->args[i] = a;
+            break;
+        case PSYS_OPARG_BYTE: /* UB or SB */
+            a = psys_ldb(s, 0, ptr++);
+            if (desc->args[i] & PSYS_OPARG_SIGNED) {
+                insn->args[i] = signext_byte(a);
+            } else {
+                insn->args[i] = a;
+            }
+            break;
+        case PSYS_OPARG_WORD: /* W (signed LE word) */
+            a             = psys_ldb(s, 0, ptr++);
+            b             = psys_ldb(s, 0, ptr++);
+            insn->args[i] = signext_word(a | (b << 8));
+            break;
+        default:
+            psys_panic("Unknown argument type %d for opcode %02x\n", desc->args[i], op);
+        }
+    }
+    insn->handler = handlers ? handlers[op] : NULL;
+    insn->op      = op;
+    insn->len     = ptr - addr;
+}
+
+/** Try to fuse the instructions starting with *insn* (already decoded at
+ * addr) into a superinstruction.
+ */
+static void fuse_insn(struct psys_state *s, struct psys_insn *insn, psys_fulladdr addr, const void *const *handlers)
+{
+    struct psys_insn seq[PSYS_SUPERINST_MAX_LEN];
+    psys_fulladdr ptr;
+    int num_decoded = 1;
+    int i, j;
+
+    seq[0] = *insn;
+    for (i = 0; i < PSYS_SUPERINST_COUNT; ++i) {
+        const struct psys_superinst_desc *desc = &psys_superinst_descriptions[i];
+        psys_sword args[PSYS_OP_MAX_ARGS];
+        int num_args = 0;
+        ptr          = addr;
+        for (j = 0; j < desc->num; ++j) {
+            if (j == num_decoded) { /* decode following instructions on demand */
+                if (ptr + PSYS_OP_MAX_ARGS * 2 >= s->mem_size) {
+                    break;
+                }
+                decode_insn(s, &seq[j], ptr, NULL);
+                num_decoded += 1;
+            }
+            if (seq[j].op < desc->insns[j].first || seq[j].op > desc->insns[j].last) {
+                break;
+            }
+            if (desc->insns[j].operand >= 0) {
+                args[num_args++] = seq[j].op - desc->insns[j].first + desc->insns[j].operand;
+            } else if (desc->insns[j].operand == -1) {
+                args[num_args++] = seq[j].args[0];
+            }
+            ptr += seq[j].len;
+        }
+        if (j == desc->num) {
+            memcpy(insn->args, args, num_args * sizeof(psys_sword));
+            insn->handler = handlers ? handlers[PSOP_SUPER_0 + i] : NULL;
+            insn->op      = PSOP_SUPER_0 + i;
+            insn->len     = ptr - addr;
+            return;
+        }
+    }
+}
+
+struct psys_predecode *psys_predecode_new(void)
+{
+    struct psys_predecode *pd = CALLOC_STRUCT(psys_predecode);
+    unsigned i;
+    for (i = 0; i < PSYS_PREDECODE_SEGS; ++i) {
+        pd->segs[i].base = PSYS_ADDR_ERROR;
+    }
+    pd->cur = &pd->segs[0];
+    update_range(pd);
+    return pd;
+}
+
+void psys_predecode_destroy(struct psys_predecode *pd)
+{
+    unsigned i;
+    if (!pd) {
+        return;
+    }
+    for (i = 0; i < PSYS_PREDECODE_SEGS; ++i) {
+        seg_clear(&pd->segs[i]);
+    }
+    free(pd);
+}
+
+void psys_predecode_invalidate(struct psys_predecode *pd, psys_fulladdr addr, psys_fulladdr size)
+{
+    unsigned i;
+    bool changed = false;
+    if (addr >= pd->hi || addr + size <= pd->lo) { /* quick reject */
+        return;
+    }
+    for (i = 0; i < PSYS_PREDECODE_SEGS; ++i) {
+        struct psys_predecode_seg *seg = &pd->segs[i];
+        if (seg->base != PSYS_ADDR_ERROR && addr < seg->end && addr + size > seg->base) {
+            seg_clear(seg);
+            changed = true;
+        }
+    }
+    if (changed) {
+        update_range(pd);
+    }
+}
+
+void psys_predecode_unfuse(struct psys_state *s, struct psys_insn *insn, psys_fulladdr addr, const void *const *handlers)
+{
+    decode_insn(s, insn, addr, handlers);
+}
+
+struct psys_insn *psys_predecode_slow(struct psys_state *s, struct psys_predecode *pd, psys_fulladdr ipc, const void *const *handlers)
+{
+    struct psys_predecode_seg *seg = pd->cur;
+    psys_fulladdr ofs              = ipc - s->curseg;
+    struct psys_insn *chunk, *insn;
+    unsigned i;
+
+    if (ofs >= PSYS_PREDECODE_MAX_OFS) { /* not within segment, don't cache */
+        decode_insn(s, &pd->scratch, ipc, handlers);
+        return &pd->scratch;
+    }
+    if (seg->base != s->curseg) { /* segment switch */
+        seg = NULL;
+        for (i = 0; i < PSYS_PREDECODE_SEGS; ++i) {
+            if (pd->segs[i].base == s->curseg) {
+                seg = &pd->segs[i];
+                break;
+            }
+        }
+        if (!seg) { /* not found, prefer an unused entry, otherwise evict one */
+            for (i = 0; i < PSYS_PREDECODE_SEGS; ++i) {
+                if (pd->segs[i].base == PSYS_ADDR_ERROR) {
+                    seg = &pd->segs[i];
+                    break;
+                }
+            }
+            if (!seg) {
+                seg            = &pd->segs[pd->next_evict];
+                pd->next_evict = (pd->next_evict + 1) % PSYS_PREDECODE_SEGS;
+                seg_clear(seg);
+            }
+            seg->base = s->curseg;
+            seg->end  = s->curseg;
+        }
+        pd->cur = seg;
+    }
+    chunk = seg->chunks[ofs >> PSYS_PREDECODE_CHUNK_BITS];
+    if (!chunk) {
+        chunk = calloc(PSYS_PREDECODE_CHUNK_SIZE, sizeof(struct psys_insn));
+        seg->chunks[ofs >> PSYS_PREDECODE_CHUNK_BITS] = chunk;
+    }
+    insn = &chunk[ofs & (PSYS_PREDECODE_CHUNK_SIZE - 1)];
+    decode_insn(s, insn, ipc, handlers);
+    if (!(s->hook_flags & PSYS_HOOK_PER_INSN)) { /* hooks need to see every instruction */
+        fuse_insn(s, insn, ipc, handlers);
+    }
+    if (ipc + insn->len > seg->end) {
+        seg->end = ipc + insn->len;
+        update_range(pd);
+    }
+    return insn;
+}
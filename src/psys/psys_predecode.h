@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Predecoded instruction cache.
+ * Instructions in resident code segments are decoded once into fixed-width
+ * records, which the interpreter executes from instead of parsing operands
+ * byte by byte. Records are created lazily, per segment, on first execution.
+ * Any write to code memory must be reported through psys_invalidate_code so
+ * that stale records are dropped.
+ *
+ * While no trace function is installed, common instruction sequences are
+ * fused into superinstructions (see psys_superinst.h). A fused record covers
+ * all of the instructions in the sequence, but the records at the offsets of
+ * the following instructions are kept separate so that jumps into the middle
+ * of a sequence still work.
+ */
+#ifndef H_PSYS_PREDECODE
+#define H_PSYS_PREDECODE
+
+#include "psys_opcodes.h"
+#include "psys_state.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of segments to keep decoded instructions for */
+#define PSYS_PREDECODE_SEGS 32
+/* Records are allocated in chunks of this many (byte) offsets */
+#define PSYS_PREDECODE_CHUNK_BITS 8
+#define PSYS_PREDECODE_CHUNK_SIZE (1 << PSYS_PREDECODE_CHUNK_BITS)
+/* ipc-curseg cannot exceed 64k */
+#define PSYS_PREDECODE_MAX_OFS 0x10000
+#define PSYS_PREDECODE_CHUNKS (PSYS_PREDECODE_MAX_OFS / PSYS_PREDECODE_CHUNK_SIZE)
+
+/** Predecoded instruction */
+struct psys_insn {
+    const void *handler;               /* handler address (threaded interpreter only) */
+    psys_sword args[PSYS_OP_MAX_ARGS]; /* decoded operands */
+    psys_word op;                      /* opcode, or superinstruction (>=0x100) */
+    psys_byte len;                     /* length of instruction in bytes, 0 if not decoded */
+};
+
+/* Maximum number of instructions in a superinstruction (SUPERINST_MAX_LEN in
+ * tools/gen_interpreter.py) */
+#define PSYS_SUPERINST_MAX_LEN 4
+
+/** Superinstruction description */
+struct psys_superinst_desc {
+    int num; /* number of instructions */
+    struct {
+        psys_byte first, last; /* opcode range */
+        signed char operand;   /* operand: value for first opcode, -1 first argument, -2 none */
+    } insns[PSYS_SUPERINST_MAX_LEN];
+};
+
+/** Predecoded instructions for one segment */
+struct psys_predecode_seg {
+    psys_fulladdr base; /* segment base address, or PSYS_ADDR_ERROR if unused */
+    psys_fulladdr end;  /* end of decoded instructions (exclusive) */
+    struct psys_insn *chunks[PSYS_PREDECODE_CHUNKS];
+};
+
+/** Predecode cache */
+struct psys_predecode {
+    struct psys_predecode_seg *cur; /* segment last used by interpreter */
+    struct psys_predecode_seg segs[PSYS_PREDECODE_SEGS];
+    unsigned next_evict;            /* round-robin eviction index */
+    psys_fulladdr lo, hi;           /* address range covered by all decoded segments */
+    struct psys_insn scratch;       /* for instructions outside segment bounds */
+    const void *const *handlers;    /* handler table the records were decoded with */
+};
+
+/** Create predecode cache */
+extern struct psys_predecode *psys_predecode_new(void);
+
+/** Destroy predecode cache. Can be passed NULL. */
+extern void psys_predecode_destroy(struct psys_predecode *pd);
+
+/** Drop all decoded instructions overlapping a range of memory. */
+extern void psys_predecode_invalidate(struct psys_predecode *pd, psys_fulladdr addr, psys_fulladdr size);
+
+/** Decode the instruction at addr into *insn* again without fusing it,
+ * so that the interpreter can step through a superinstruction one
+ * instruction at a time. Also used by the JIT to decode instructions.
+ */
+extern void psys_predecode_unfuse(struct psys_state *s, struct psys_insn *insn, psys_fulladdr addr, const void *const *handlers);
+
+/** Slow path of psys_predecode_fetch: look up or create segment entry and
+ * decode the instruction at *ipc*. *handlers* is the opcode to handler address
+ * table for the threaded interpreter, or NULL.
+ */
+extern struct psys_insn *psys_predecode_slow(struct psys_state *s, struct psys_predecode *pd, psys_fulladdr ipc, const void *const *handlers);
+
+/** Get predecoded instruction at *ipc*. This is passed in by the interpreter,
+ * which may keep the instruction pointer in a local instead of s->ipc.
+ */
+static inline struct psys_insn *psys_predecode_fetch(struct psys_state *s, struct psys_predecode *pd, psys_fulladdr ipc, const void *const *handlers)
+{
+    struct psys_predecode_seg *seg = pd->cur;
+    psys_fulladdr ofs              = ipc - s->curseg;
+    if (seg->base == s->curseg && ofs < PSYS_PREDECODE_MAX_OFS) {
+        struct psys_insn *chunk = seg->chunks[ofs >> PSYS_PREDECODE_CHUNK_BITS];
+        if (chunk && chunk[ofs & (PSYS_PREDECODE_CHUNK_SIZE - 1)].len) {
+            return &chunk[ofs & (PSYS_PREDECODE_CHUNK_SIZE - 1)];
+        }
+    }
+    return psys_predecode_slow(s, pd, ipc, handlers);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
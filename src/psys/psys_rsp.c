@@ -9,21 +9,24 @@
  */
 #include "psys_rsp.h"
 
+#include "psys_blockdev.h"
 #include "psys_constants.h"
 #include "psys_debug.h"
 #include "psys_helpers.h"
+#include "psys_serialize.h"
 #include "psys_state.h"
 #include "psys_task.h"
 #include "util/memutil.h"
 #include "util/util_minmax.h"
-#include "util/util_save_state.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
 /* Header for savestates */
-#define PSYS_RSP_STATE_ID 0x50525350
+#define PSYS_RSP_STATE_ID 0x50525332
+/* Header for old savestates, which had part of the disk contents */
+#define PSYS_RSP_STATE_ID_V1 0x50525350
 
 /** Internal helper for setting IORESULT register. */
 static void psys_set_io_result(struct psys_state *state, psys_word result)
@@ -72,9 +75,8 @@ static void psys_rsp_moveseg(struct psys_state *state, struct psys_rsp_state *rs
     if (dstoffset == 0) {
         psys_panic("moveseg destination segment not resident\n");
     }
-    memmove(psys_bytes(state, dstpoolbase) + dstoffset,
-        psys_bytes(state, srcpoolbase) + srcoffset,
-        len * 2);
+    psys_move_bytes(state, dstpoolbase + dstoffset, srcpoolbase + srcoffset, len * 2);
+    psys_invalidate_code(state, dstpoolbase + dstoffset, len * 2);
 }
 
 /** moveleft(source,dest:array; length:integer)
@@ -88,7 +90,7 @@ static void psys_rsp_moveleft(struct psys_state *state, struct psys_rsp_state *r
     psys_word dest_base   = psys_pop(state);
     psys_word source_ofs  = psys_pop(state);
     psys_word source_base = psys_pop(state);
-    psys_byte *dest, *source;
+    psys_fulladdr dest, source;
     int x;
     if (PDBG(state, RSP)) {
         psys_debug("moveleft((0x%04x,0x%04x)=0x%04x,(0x%04x,0x%04x)=0x%04x,0x%04x)\n",
@@ -96,10 +98,10 @@ static void psys_rsp_moveleft(struct psys_state *state, struct psys_rsp_state *r
             dest_base, dest_ofs, dest_base + dest_ofs,
             length);
     }
-    source = psys_bytes(state, source_base + source_ofs);
-    dest   = psys_bytes(state, dest_base + dest_ofs);
+    source = source_base + source_ofs;
+    dest   = dest_base + dest_ofs;
     for (x = 0; x < length; ++x) {
-        dest[x] = source[x];
+        psys_stb(state, dest, x, psys_ldb(state, source, x));
     }
 }
 
@@ -114,23 +116,22 @@ static void psys_rsp_moveright(struct psys_state *state, struct psys_rsp_state *
     psys_word dest_base   = psys_pop(state);
     psys_word source_ofs  = psys_pop(state);
     psys_word source_base = psys_pop(state);
-    psys_byte *dest, *source;
+    psys_fulladdr dest, source;
     int x;
     if (PDBG(state, RSP)) {
         psys_debug("moveleft((0x%04x,0x%04x),(0x%04x,0x%04x),0x%04x)\n",
             source_base, source_ofs, dest_base, dest_ofs, length);
     }
-    source = psys_bytes(state, source_base + source_ofs);
-    dest   = psys_bytes(state, dest_base + dest_ofs);
+    source = source_base + source_ofs;
+    dest   = dest_base + dest_ofs;
     for (x = length - 1; x >= 0; --x) {
-        dest[x] = source[x];
+        psys_stb(state, dest, x, psys_ldb(state, source, x));
     }
 }
 
 /** Merged i/o function - internal logic for both unit_read and unit_write */
 static psys_word unitrw(struct psys_state *state, struct psys_rsp_state *rsp, bool wr, psys_word unit, psys_fulladdr buf_addr, psys_word len, psys_word block, psys_word ctrl)
 {
-    psys_byte *buf = psys_bytes(state, buf_addr);
     switch (unit) {
     case PSYS_UNIT_SYSTEM:
         /* Reading or writing to SYS stops the machine */
@@ -138,11 +139,18 @@ static psys_word unitrw(struct psys_state *state, struct psys_rsp_state *rsp, bo
         break;
     case PSYS_UNIT_CONSOLE:
     case PSYS_UNIT_SYSTERM: {
-        if (wr) {
-            size_t ret = fwrite(buf, 1, len, stdout);
-            (void)ret;
-        } else {
-            size_t ret = fread(buf, 1, len, stdin);
+        psys_byte buf[PSYS_BLOCK_SIZE];
+        unsigned x, n;
+        for (x = 0; x < len; x += n) { /* go through buffer, as memory may not be contiguous bytes */
+            size_t ret;
+            n = umin(len - x, PSYS_BLOCK_SIZE);
+            if (wr) {
+                psys_read_bytes(state, buf, buf_addr + x, n);
+                ret = fwrite(buf, 1, n, stdout);
+            } else {
+                ret = fread(buf, 1, n, stdin);
+                psys_write_bytes(state, buf_addr + x, buf, ret);
+            }
             (void)ret;
         }
     } break;
@@ -161,7 +169,7 @@ static psys_word unitrw(struct psys_state *state, struct psys_rsp_state *rsp, bo
 #if 0
             unsigned y = 0;
 #endif
-            if (srcblk > rsp->disk0_size) {
+            if (srcblk >= rsp->disk0_size) {
                 if (!rsp->disk0_wrap) {
                     psys_panic("block out of range and wrap disabled");
                 }
@@ -174,13 +182,18 @@ static psys_word unitrw(struct psys_state *state, struct psys_rsp_state *rsp, bo
                 rsp->pre_access_hook(rsp->pre_access_hook_data, unit, srcblk, wr);
             }
             if (wr) {
-                memcpy(rsp->disk0 + srcblk * PSYS_BLOCK_SIZE, buf + x, remainder);
+                psys_byte *blk = psys_blockdev_write(rsp->disk0, srcblk);
+                if (!blk) {
+                    return PSYS_IO_WRITEPROT;
+                }
+                psys_read_bytes(state, blk, buf_addr + x, remainder);
             } else {
-                memcpy(buf + x, rsp->disk0 + srcblk * PSYS_BLOCK_SIZE, remainder);
+                /* Straight from the device's storage */
+                psys_write_bytes(state, buf_addr + x, psys_blockdev_read(rsp->disk0, srcblk), remainder);
 #if 0
                 psys_debug("  ");
                 for (y=0; y<remainder; ++y) {
-                    psys_debug("0x%02x ", buf[x+y]);
+                    psys_debug("0x%02x ", psys_ldb(state, buf_addr, x + y));
                 }
 #endif
             }
@@ -277,13 +290,11 @@ static void psys_rsp_fillchar(struct psys_state *state, struct psys_rsp_state *r
     psys_sword n_bytes  = psys_spop(state);
     psys_word dest_ofs  = psys_pop(state);
     psys_word dest_base = psys_pop(state);
-    psys_byte *dest;
     if (PDBG(state, RSP)) {
         psys_debug("fillchar (0x%04x,0x%04x) 0x%04x %04x\n", dest_base, dest_ofs, n_bytes, value);
     }
-    dest = psys_bytes(state, dest_base + dest_ofs);
     if (n_bytes > 0) {
-        memset(dest, value, n_bytes);
+        psys_fill_bytes(state, dest_base + dest_ofs, value, n_bytes);
     }
 }
 
@@ -361,7 +372,7 @@ static void psys_rsp_getpoolbytes(struct psys_state *state, struct psys_rsp_stat
         psys_debug("getpoolbytes %04x %04x (base %05x) %04x %04x\n", dest, pooldesc, poolbase, offset, n_bytes);
     }
     if (n_bytes > 0) {
-        memcpy(psys_bytes(state, dest), psys_bytes(state, poolbase) + offset, n_bytes);
+        psys_move_bytes(state, dest, poolbase + offset, n_bytes);
     }
 }
 
@@ -399,6 +410,8 @@ static void psys_rsp_flipsegbytes(struct psys_state *state, struct psys_rsp_stat
     for (int x = 0; x < nwords; ++x) {
         buf[x] = psys_flip_endian(buf[x]);
     }
+    psys_mark_dirty(state, W(segbase, offset), nwords * 2);
+    psys_invalidate_code(state, W(segbase, offset), nwords * 2);
 }
 
 /** quiet()
@@ -578,7 +591,7 @@ static void psys_rsp_treesearch(struct psys_state *state, struct psys_rsp_state
     node     = root;
     lastnode = PSYS_NIL;
     while (node != PSYS_NIL) {
-        cmp      = memcmp(psys_bytes(state, target), psys_bytes(state, node), 8);
+        cmp      = psys_compare_bytes(state, target, node, 8);
         lastnode = node;
         if (cmp == 0) { /* found! */
             break;
@@ -629,11 +642,14 @@ static void psys_rsp_readseg(struct psys_state *state, struct psys_rsp_state *rs
     segbase  = psys_ldw(state, sib + PSYS_SIB_Seg_Base);
     poolbase = psys_pool_get_base(state, segpool);
     if (PDBG(state, RSP)) {
-        psys_debug("read segment %.8s sib=0x%04x vip=0x%04x block 0x%04x to 0x%08x:0x%04x (maxlen 0x%04x)\n", psys_bytes(state, sib + PSYS_SIB_Seg_Name), sib, vip, block,
+        struct psys_segment_id id;
+        psys_read_segment_id(state, &id, sib + PSYS_SIB_Seg_Name);
+        psys_debug("read segment %.8s sib=0x%04x vip=0x%04x block 0x%04x to 0x%08x:0x%04x (maxlen 0x%04x)\n", id.name, sib, vip, block,
             poolbase, segbase, seglen);
     }
     /* TODO figure out VIP structure - for now, always read from disk 0 */
     result = unitrw(state, rsp, false, PSYS_UNIT_DISK0, poolbase + segbase, seglen * 2, block, 0);
+    psys_invalidate_code(state, poolbase + segbase, seglen * 2);
 
     /* write return value (i/o result) */
     psys_set_io_result(state, result);
@@ -649,49 +665,63 @@ static void psys_rsp_setrestricted(struct psys_state *state, struct psys_rsp_sta
     psys_panic("setrestricted not implemented\n");
 }
 
-static int psys_rsp_save_state(struct psys_binding *b, FILE *fd)
+static int psys_rsp_save_state(struct psys_binding *b, struct psys_writer *w)
 {
     struct psys_rsp_state *rsp = (struct psys_rsp_state *)b->userdata;
     uint32_t id                = PSYS_RSP_STATE_ID;
-    if (FD_WRITE(fd, id)
-        || FD_WRITE(fd, rsp->disk0_size)
-        || FD_WRITE(fd, rsp->disk0_track)
-        || FD_WRITE(fd, rsp->disk0_wrap)
-        || FD_WRITE(fd, rsp->events_enabled)
-        || FD_WRITE(fd, rsp->events)
-        || FD_WRITE(fd, rsp->time)) {
+    if (PSYS_WRITE(w, id)
+        || PSYS_WRITE(w, rsp->disk0_size)
+        || PSYS_WRITE(w, rsp->disk0_track)
+        || PSYS_WRITE(w, rsp->disk0_wrap)
+        || PSYS_WRITE(w, rsp->events_enabled)
+        || PSYS_WRITE(w, rsp->events)
+        || PSYS_WRITE(w, rsp->time)) {
         return -1;
     }
-    if (fwrite(rsp->disk0, 1, rsp->disk0_size, fd) < (size_t)rsp->disk0_size) {
+    /* Only the blocks written to, the rest is in the disk image */
+    if (rsp->disk0 && psys_blockdev_save_state(rsp->disk0, w) < 0) {
         return -1;
     }
     return 0;
 }
 
-static int psys_rsp_load_state(struct psys_binding *b, FILE *fd)
+static int psys_rsp_load_state(struct psys_binding *b, struct psys_reader *r)
 {
     struct psys_rsp_state *rsp = (struct psys_rsp_state *)b->userdata;
     uint32_t id;
-    if (FD_READ(fd, id)) {
+    unsigned disk0_size;
+    if (PSYS_READ(r, id)) {
         return -1;
     }
-    if (id != PSYS_RSP_STATE_ID) {
+    if (id != PSYS_RSP_STATE_ID && id != PSYS_RSP_STATE_ID_V1) {
         psys_debug("Invalid psys rsp state record %08x\n", id);
         return -1;
     }
 
-    if (FD_READ(fd, rsp->disk0_size)
-        || FD_READ(fd, rsp->disk0_track)
-        || FD_READ(fd, rsp->disk0_wrap)
-        || FD_READ(fd, rsp->events_enabled)
-        || FD_READ(fd, rsp->events)
-        || FD_READ(fd, rsp->time)) {
+    if (PSYS_READ(r, disk0_size)
+        || PSYS_READ(r, rsp->disk0_track)
+        || PSYS_READ(r, rsp->disk0_wrap)
+        || PSYS_READ(r, rsp->events_enabled)
+        || PSYS_READ(r, rsp->events)
+        || PSYS_READ(r, rsp->time)) {
         return -1;
     }
-    if (fread(rsp->disk0, 1, rsp->disk0_size, fd) < (size_t)rsp->disk0_size) {
+    if (disk0_size != rsp->disk0_size) {
+        psys_debug("Disk size in state does not match mounted disk\n");
         return -1;
     }
-    return 0;
+    if (!rsp->disk0) {
+        return 0;
+    }
+    if (id == PSYS_RSP_STATE_ID_V1) {
+        /* These stored disk0_size bytes from the start of the disk */
+        const psys_byte *data = psys_read_ref(r, disk0_size);
+        if (!data || psys_blockdev_update(rsp->disk0, 0, data, disk0_size) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+    return psys_blockdev_load_state(rsp->disk0, r);
 }
 
 struct psys_binding *psys_new_rsp(struct psys_state *state)
@@ -750,21 +780,28 @@ struct psys_binding *psys_new_rsp(struct psys_state *state)
 void psys_destroy_rsp(struct psys_binding *b)
 {
     struct psys_rsp_state *rsp = (struct psys_rsp_state *)b->userdata;
-    free(rsp->disk0);
+    if (rsp->disk0) {
+        psys_blockdev_destroy(rsp->disk0);
+    }
     free(rsp);
     free(b->handlers);
     free(b);
 }
 
 void psys_rsp_set_disk(struct psys_binding *b, int n, void *data, size_t size, size_t track, bool wrap)
+{
+    psys_rsp_set_blockdev(b, n, data ? psys_blockdev_new_mem(data, size, 0, true) : NULL, track, wrap);
+}
+
+void psys_rsp_set_blockdev(struct psys_binding *b, int n, struct psys_blockdev *dev, size_t track, bool wrap)
 {
     struct psys_rsp_state *rsp = (struct psys_rsp_state *)b->userdata;
     if (n != 0)
         psys_panic("RSP only support disk 0 for now\n");
-    if ((size % PSYS_BLOCK_SIZE) != 0)
-        psys_panic("Disk size must be multiple of block size %d\n", PSYS_BLOCK_SIZE);
-    rsp->disk0       = data;
-    rsp->disk0_size  = size / PSYS_BLOCK_SIZE;
+    if (rsp->disk0)
+        psys_blockdev_destroy(rsp->disk0);
+    rsp->disk0       = dev;
+    rsp->disk0_size  = dev ? dev->num_blocks : 0;
     rsp->disk0_track = track / PSYS_BLOCK_SIZE;
     rsp->disk0_wrap  = wrap;
 }
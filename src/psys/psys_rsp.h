@@ -87,9 +87,11 @@ typedef void(psys_rsp_pre_access_hook)(void *data, int disk, unsigned blk, bool
 
 #define PSYS_MAX_EVENTS 64
 
+struct psys_blockdev;
+
 struct psys_rsp_state {
     struct psys_state *psys;
-    psys_byte *disk0;
+    struct psys_blockdev *disk0;
     unsigned disk0_size;  /* size in blocks */
     unsigned disk0_track; /* track size in blocks */
     bool disk0_wrap;      /* wrap around to beginning */
@@ -109,7 +111,14 @@ struct psys_rsp_state {
 #define PSYS_BLOCK_SIZE 512
 
 extern struct psys_binding *psys_new_rsp(struct psys_state *state);
+/** Set disk *n* to *size* bytes of *data*, which is freed with the RSP. Pass
+ * NULL to remove the disk.
+ */
 extern void psys_rsp_set_disk(struct psys_binding *b, int n, void *data, size_t size, size_t track, bool wrap);
+/** Set disk *n* to block device *dev*, which is destroyed with the RSP. Pass
+ * NULL to remove the disk.
+ */
+extern void psys_rsp_set_blockdev(struct psys_binding *b, int n, struct psys_blockdev *dev, size_t track, bool wrap);
 extern void psys_rsp_set_pre_access_hook(struct psys_binding *b, psys_rsp_pre_access_hook *pre_access_hook, void *data);
 extern void psys_destroy_rsp(struct psys_binding *b);
 
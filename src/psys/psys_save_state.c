@@ -7,89 +7,180 @@
 
 #include "psys_debug.h"
 #include "psys_helpers.h"
+#include "psys_serialize.h"
 #include "psys_state.h"
-#include "util/util_save_state.h"
+#include "util/util_minmax.h"
 
 #include <string.h>
 
 /* Header for savestates */
 #define PSYS_STATE_ID 0x50535953
 
-int psys_save_state(struct psys_state *s, FILE *fd)
+/* Memory is always saved in big-endian layout, so that states can be
+ * exchanged between builds with different memory layouts.
+ */
+static int write_memory(struct psys_state *s, struct psys_writer *w)
 {
-    int rv;
-    unsigned x;
-    uint32_t id = PSYS_STATE_ID;
-    /* Save VM state */
-    if (FD_WRITE(fd, id)
-        || FD_WRITE(fd, s->ipc)
-        || FD_WRITE(fd, s->sp)
-        || FD_WRITE(fd, s->base)
-        || FD_WRITE(fd, s->mp)
-        || FD_WRITE(fd, s->curseg)
-        || FD_WRITE(fd, s->readyq)
-        || FD_WRITE(fd, s->curtask)
-        || FD_WRITE(fd, s->erec)
-        || FD_WRITE(fd, s->curproc)
-        || FD_WRITE(fd, s->syscom)
-        || FD_WRITE(fd, s->stored_ipc)
-        || FD_WRITE(fd, s->stored_sp)
-        || FD_WRITE(fd, s->mem_size)
-        || FD_WRITE(fd, s->mem_fake_base)) {
-        return -1;
+#if PSYS_MEM_BYTE_XOR
+    psys_byte buf[4096];
+    size_t ptr, n;
+    for (ptr = 0; ptr < s->mem_size; ptr += n) {
+        n = umin(s->mem_size - ptr, sizeof(buf));
+        psys_read_bytes(s, buf, ptr, n);
+        if (psys_write(w, buf, n) < 0) {
+            return -1;
+        }
     }
-    if (fwrite(s->memory, 1, s->mem_size, fd) < (size_t)s->mem_size) {
+    return 0;
+#else
+    return psys_write_ref(w, s->memory, s->mem_size);
+#endif
+}
+
+/* Only memory that differs is written, so that pages of memory that is
+ * mapped copy-on-write stay shared when loading a state that matches.
+ */
+static int read_memory(struct psys_state *s, struct psys_reader *r)
+{
+    const psys_byte *data = psys_read_ref(r, s->mem_size);
+    psys_byte cur[4096];
+    size_t ptr, n;
+    if (!data) {
         return -1;
     }
-    /* Save state of bindings */
-    for (x = 0; x < s->num_bindings; ++x) {
-        if (s->bindings[x]->save_state) {
-            rv = s->bindings[x]->save_state(s->bindings[x], fd);
-            if (rv < 0) {
-                return rv;
-            }
+    for (ptr = 0; ptr < s->mem_size; ptr += n) {
+        n = umin(s->mem_size - ptr, sizeof(cur));
+        psys_read_bytes(s, cur, ptr, n);
+        if (memcmp(&data[ptr], cur, n)) {
+            psys_write_bytes(s, ptr, &data[ptr], n);
         }
     }
     return 0;
 }
 
-int psys_load_state(struct psys_state *s, FILE *fd)
+int psys_write_state(struct psys_state *s, struct psys_writer *w)
+{
+    uint32_t id = PSYS_STATE_ID;
+    /* Save VM state */
+    if (PSYS_WRITE(w, id)
+        || psys_write_registers(s, w) < 0
+        || write_memory(s, w) < 0) {
+        return -1;
+    }
+    return psys_write_bindings_state(s, w);
+}
+
+int psys_read_state(struct psys_state *s, struct psys_reader *r)
 {
-    int rv;
-    unsigned x;
     uint32_t id;
     /* Load VM state */
-    if (FD_READ(fd, id)) {
+    if (PSYS_READ(r, id)) {
         return -1;
     }
     if (id != PSYS_STATE_ID) {
         psys_debug("Invalid psys state record %08x\n", id);
         return -1;
     }
+    if (psys_read_registers(s, r) < 0
+        || read_memory(s, r) < 0) {
+        return -1;
+    }
+    psys_invalidate_code(s, 0, s->mem_size);
+    psys_invalidate_display(s);
+    return psys_read_bindings_state(s, r);
+}
 
-    if (FD_READ(fd, s->ipc)
-        || FD_READ(fd, s->sp)
-        || FD_READ(fd, s->base)
-        || FD_READ(fd, s->mp)
-        || FD_READ(fd, s->curseg)
-        || FD_READ(fd, s->readyq)
-        || FD_READ(fd, s->curtask)
-        || FD_READ(fd, s->erec)
-        || FD_READ(fd, s->curproc)
-        || FD_READ(fd, s->syscom)
-        || FD_READ(fd, s->stored_ipc)
-        || FD_READ(fd, s->stored_sp)
-        || FD_READ(fd, s->mem_size)
-        || FD_READ(fd, s->mem_fake_base)) {
+int psys_save_state(struct psys_state *s, FILE *fd)
+{
+    struct psys_writer w;
+    int rv;
+    psys_writer_init(&w);
+    rv = psys_write_state(s, &w);
+    if (rv == 0) {
+        rv = psys_writer_fwrite(&w, fd);
+    }
+    psys_writer_free(&w);
+    return rv;
+}
+
+int psys_load_state(struct psys_state *s, FILE *fd)
+{
+    struct psys_reader r;
+    int rv;
+    if (psys_reader_fopen(&r, fd) < 0) {
         return -1;
     }
-    if (fread(s->memory, 1, s->mem_size, fd) < (size_t)s->mem_size) {
+    rv = psys_read_state(s, &r);
+    if (psys_reader_fclose(&r, fd) < 0) {
+        rv = -1;
+    }
+    return rv;
+}
+
+int psys_write_registers(struct psys_state *s, struct psys_writer *w)
+{
+    if (PSYS_WRITE(w, s->ipc)
+        || PSYS_WRITE(w, s->sp)
+        || PSYS_WRITE(w, s->base)
+        || PSYS_WRITE(w, s->mp)
+        || PSYS_WRITE(w, s->curseg)
+        || PSYS_WRITE(w, s->readyq)
+        || PSYS_WRITE(w, s->curtask)
+        || PSYS_WRITE(w, s->erec)
+        || PSYS_WRITE(w, s->curproc)
+        || PSYS_WRITE(w, s->syscom)
+        || PSYS_WRITE(w, s->stored_ipc)
+        || PSYS_WRITE(w, s->stored_sp)
+        || PSYS_WRITE(w, s->mem_size)
+        || PSYS_WRITE(w, s->mem_fake_base)) {
         return -1;
     }
-    /* Load state of bindings */
+    return 0;
+}
+
+int psys_read_registers(struct psys_state *s, struct psys_reader *r)
+{
+    if (PSYS_READ(r, s->ipc)
+        || PSYS_READ(r, s->sp)
+        || PSYS_READ(r, s->base)
+        || PSYS_READ(r, s->mp)
+        || PSYS_READ(r, s->curseg)
+        || PSYS_READ(r, s->readyq)
+        || PSYS_READ(r, s->curtask)
+        || PSYS_READ(r, s->erec)
+        || PSYS_READ(r, s->curproc)
+        || PSYS_READ(r, s->syscom)
+        || PSYS_READ(r, s->stored_ipc)
+        || PSYS_READ(r, s->stored_sp)
+        || PSYS_READ(r, s->mem_size)
+        || PSYS_READ(r, s->mem_fake_base)) {
+        return -1;
+    }
+    return 0;
+}
+
+int psys_write_bindings_state(struct psys_state *s, struct psys_writer *w)
+{
+    int rv;
+    unsigned x;
+    for (x = 0; x < s->num_bindings; ++x) {
+        if (s->bindings[x]->save_state) {
+            rv = s->bindings[x]->save_state(s->bindings[x], w);
+            if (rv < 0) {
+                return rv;
+            }
+        }
+    }
+    return 0;
+}
+
+int psys_read_bindings_state(struct psys_state *s, struct psys_reader *r)
+{
+    int rv;
+    unsigned x;
     for (x = 0; x < s->num_bindings; ++x) {
         if (s->bindings[x]->load_state) {
-            rv = s->bindings[x]->load_state(s->bindings[x], fd);
+            rv = s->bindings[x]->load_state(s->bindings[x], r);
             if (rv < 0) {
                 return rv;
             }
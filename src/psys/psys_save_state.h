@@ -6,6 +6,7 @@
 #ifndef H_PSYS_SAVE_STATE
 #define H_PSYS_SAVE_STATE
 
+#include "psys_serialize.h"
 #include "psys_types.h"
 
 #include <stdio.h>
@@ -14,12 +15,30 @@
 extern "C" {
 #endif
 
+/** Save state to writer (return 0 on success) */
+extern int psys_write_state(struct psys_state *b, struct psys_writer *w);
+
+/** Load state from reader (return 0 on success) */
+extern int psys_read_state(struct psys_state *b, struct psys_reader *r);
+
 /** Save state to fd (return 0 on success) */
 extern int psys_save_state(struct psys_state *b, FILE *fd);
 
 /** Load state from fd (return 0 on success) */
 extern int psys_load_state(struct psys_state *b, FILE *fd);
 
+/** Save registers (including memory size) only (return 0 on success) */
+extern int psys_write_registers(struct psys_state *b, struct psys_writer *w);
+
+/** Load registers (including memory size) only (return 0 on success) */
+extern int psys_read_registers(struct psys_state *b, struct psys_reader *r);
+
+/** Save state of bindings only (return 0 on success) */
+extern int psys_write_bindings_state(struct psys_state *b, struct psys_writer *w);
+
+/** Load state of bindings only (return 0 on success) */
+extern int psys_read_bindings_state(struct psys_state *b, struct psys_reader *r);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "psys_serialize.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Regions smaller than this are copied instead of referenced */
+#define MIN_REF_SIZE 256
+/* Initial size of copied data buffer */
+#define MIN_CAPACITY 256
+/* Granularity for reading the remainder of a file */
+#define FREAD_CHUNK 65536
+
+/* Make room for *size* more bytes of copied data */
+static void reserve(struct psys_writer *w, size_t size)
+{
+    if (w->size + size > w->capacity || !w->data) {
+        size_t capacity = w->capacity ? w->capacity * 2 : MIN_CAPACITY;
+        w->capacity     = w->size + size > capacity ? w->size + size : capacity;
+        w->data         = realloc(w->data, w->capacity);
+    }
+}
+
+void psys_writer_init(struct psys_writer *w)
+{
+    memset(w, 0, sizeof(*w));
+}
+
+void psys_writer_reset(struct psys_writer *w)
+{
+    w->size       = 0;
+    w->num_refs   = 0;
+    w->total_size = 0;
+}
+
+void psys_writer_free(struct psys_writer *w)
+{
+    free(w->data);
+    free(w->refs);
+    psys_writer_init(w);
+}
+
+int psys_write(struct psys_writer *w, const void *data, size_t size)
+{
+    reserve(w, size);
+    memcpy(&w->data[w->size], data, size);
+    w->size += size;
+    w->total_size += size;
+    return 0;
+}
+
+int psys_write_ref(struct psys_writer *w, const void *data, size_t size)
+{
+    struct psys_writer_ref *ref;
+    if (size < MIN_REF_SIZE) {
+        return psys_write(w, data, size);
+    }
+    reserve(w, 0);
+    if (w->num_refs == w->max_refs) {
+        w->max_refs = w->max_refs ? w->max_refs * 2 : 8;
+        w->refs     = realloc(w->refs, w->max_refs * sizeof(struct psys_writer_ref));
+    }
+    ref         = &w->refs[w->num_refs++];
+    ref->offset = w->size;
+    ref->data   = data;
+    ref->size   = size;
+    w->total_size += size;
+    return 0;
+}
+
+size_t psys_writer_size(const struct psys_writer *w)
+{
+    return w->total_size;
+}
+
+const psys_byte *psys_writer_flatten(struct psys_writer *w)
+{
+    psys_byte *data, *out;
+    size_t pos = 0;
+    size_t x;
+    if (!w->num_refs) {
+        return w->data;
+    }
+    data = malloc(w->total_size);
+    out  = data;
+    for (x = 0; x < w->num_refs; ++x) {
+        const struct psys_writer_ref *ref = &w->refs[x];
+        memcpy(out, &w->data[pos], ref->offset - pos);
+        out += ref->offset - pos;
+        memcpy(out, ref->data, ref->size);
+        out += ref->size;
+        pos = ref->offset;
+    }
+    memcpy(out, &w->data[pos], w->size - pos);
+    free(w->data);
+    w->data     = data;
+    w->size     = w->total_size;
+    w->capacity = w->total_size;
+    w->num_refs = 0;
+    return w->data;
+}
+
+int psys_writer_fwrite(const struct psys_writer *w, FILE *fd)
+{
+    size_t pos = 0;
+    size_t x;
+    for (x = 0; x < w->num_refs; ++x) {
+        const struct psys_writer_ref *ref = &w->refs[x];
+        if (fwrite(&w->data[pos], 1, ref->offset - pos, fd) < ref->offset - pos
+            || fwrite(ref->data, 1, ref->size, fd) < ref->size) {
+            return -1;
+        }
+        pos = ref->offset;
+    }
+    if (fwrite(&w->data[pos], 1, w->size - pos, fd) < w->size - pos) {
+        return -1;
+    }
+    return 0;
+}
+
+void psys_reader_init(struct psys_reader *r, const void *data, size_t size)
+{
+    r->data  = data;
+    r->size  = size;
+    r->pos   = 0;
+    r->owned = NULL;
+}
+
+int psys_read(struct psys_reader *r, void *data, size_t size)
+{
+    const void *src = psys_read_ref(r, size);
+    if (!src) {
+        return -1;
+    }
+    memcpy(data, src, size);
+    return 0;
+}
+
+const void *psys_read_ref(struct psys_reader *r, size_t size)
+{
+    const void *rv;
+    if (size > r->size - r->pos) {
+        return NULL;
+    }
+    rv = &r->data[r->pos];
+    r->pos += size;
+    return rv;
+}
+
+size_t psys_reader_remaining(const struct psys_reader *r)
+{
+    return r->size - r->pos;
+}
+
+int psys_reader_fopen(struct psys_reader *r, FILE *fd)
+{
+    psys_byte *data = NULL;
+    size_t size     = 0;
+    size_t n;
+    do {
+        data = realloc(data, size + FREAD_CHUNK);
+        n    = fread(&data[size], 1, FREAD_CHUNK, fd);
+        size += n;
+    } while (n == FREAD_CHUNK);
+    if (ferror(fd)) {
+        free(data);
+        return -1;
+    }
+    psys_reader_init(r, data, size);
+    r->owned = data;
+    return 0;
+}
+
+int psys_reader_fclose(struct psys_reader *r, FILE *fd)
+{
+    int rv = fseek(fd, -(long)(r->size - r->pos), SEEK_CUR) < 0 ? -1 : 0;
+    free(r->owned);
+    psys_reader_init(r, NULL, 0);
+    return rv;
+}
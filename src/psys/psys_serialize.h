@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Serialization of state to and from memory.
+ *
+ * A writer appends to a growable buffer. Large regions can be added by
+ * reference instead of being copied, as long as they stay unchanged until the
+ * writer is consumed. A reader reads from a buffer with bounds checking, and
+ * can return pointers into the buffer instead of copying.
+ */
+#ifndef H_PSYS_SERIALIZE
+#define H_PSYS_SERIALIZE
+
+#include "psys_types.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Region referenced by a writer, inserted at *offset* in the copied data */
+struct psys_writer_ref {
+    size_t offset;
+    const psys_byte *data;
+    size_t size;
+};
+
+struct psys_writer {
+    psys_byte *data; /* copied data */
+    size_t size;
+    size_t capacity;
+    struct psys_writer_ref *refs;
+    size_t num_refs;
+    size_t max_refs;
+    size_t total_size; /* including referenced data */
+};
+
+struct psys_reader {
+    const psys_byte *data;
+    size_t size;
+    size_t pos;
+    psys_byte *owned; /* buffer read by psys_reader_fopen */
+};
+
+/* Write or read a variable, evaluate to non-zero on error (like FD_WRITE and FD_READ) */
+#define PSYS_WRITE(w, x) psys_write((w), &(x), sizeof(x))
+#define PSYS_READ(r, x) psys_read((r), &(x), sizeof(x))
+
+/** Initialize empty writer. */
+extern void psys_writer_init(struct psys_writer *w);
+
+/** Make writer empty again, keeping its allocation. */
+extern void psys_writer_reset(struct psys_writer *w);
+
+/** Free writer buffers. */
+extern void psys_writer_free(struct psys_writer *w);
+
+/** Append copy of data (return 0 on success). */
+extern int psys_write(struct psys_writer *w, const void *data, size_t size);
+
+/** Append reference to data (return 0 on success). The data must not change
+ * or be freed until the writer is consumed or reset.
+ */
+extern int psys_write_ref(struct psys_writer *w, const void *data, size_t size);
+
+/** Total size of written data. */
+extern size_t psys_writer_size(const struct psys_writer *w);
+
+/** Return written data as one contiguous buffer, owned by the writer. This
+ * copies referenced data into the buffer.
+ */
+extern const psys_byte *psys_writer_flatten(struct psys_writer *w);
+
+/** Write data to fd (return 0 on success). */
+extern int psys_writer_fwrite(const struct psys_writer *w, FILE *fd);
+
+/** Initialize reader for *size* bytes of data. */
+extern void psys_reader_init(struct psys_reader *r, const void *data, size_t size);
+
+/** Read data, fails without reading anything if there is not enough left
+ * (return 0 on success).
+ */
+extern int psys_read(struct psys_reader *r, void *data, size_t size);
+
+/** Return pointer to the next *size* bytes and skip over them, or NULL if
+ * there is not enough left.
+ */
+extern const void *psys_read_ref(struct psys_reader *r, size_t size);
+
+/** Number of bytes left to read. */
+extern size_t psys_reader_remaining(const struct psys_reader *r);
+
+/** Initialize reader with the remainder of fd (return 0 on success). Must be
+ * followed by psys_reader_fclose.
+ */
+extern int psys_reader_fopen(struct psys_reader *r, FILE *fd);
+
+/** Position fd after the data consumed from reader, and free its buffer
+ * (return 0 on success).
+ */
+extern int psys_reader_fclose(struct psys_reader *r, FILE *fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -11,9 +11,9 @@
 #include <string.h>
 
 /* Read from set (in native endian) */
-#define I(x, y) F((x)[(y)])
+#define I(x, y) FM((x)[(y)])
 /* Write to set (in native endian) */
-#define O(x, y, v) (x)[(y)] = F(v)
+#define O(x, y, v) (x)[(y)] = FM(v)
 /* Get size of set */
 #define S(x) (I((x), 0))
 /* Set size of set */
@@ -51,6 +51,7 @@ void psys_set_push(struct psys_state *s, const psys_word *in)
 {
     psys_push_n(s, 1 + S(in));                         /* make room for enough words on stack */
     memcpy(psys_stack_words(s, 0), in, 2 + S(in) * 2); /* copy entire structure */
+    psys_mark_dirty(s, s->sp, 2 + S(in) * 2);
 }
 
 bool psys_set_adj(psys_word *inout, unsigned setsize)
@@ -198,7 +199,7 @@ bool psys_set_from_subrange(psys_word *out, unsigned a, unsigned b)
     memset(&out[1], 0, 2 * outsize);
     /* set bits that should be one */
     for (x = a; x <= b; ++x) {
-        out[1 + (x >> 4)] |= F(BIT(x & 15));
+        out[1 + (x >> 4)] |= FM(BIT(x & 15));
     }
     return true;
 }
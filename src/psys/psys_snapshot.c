@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "psys_snapshot.h"
+
+#include "psys_bindings.h"
+#include "psys_debug.h"
+#include "psys_helpers.h"
+#include "psys_hooks.h"
+#include "psys_interpreter.h"
+#include "psys_state.h"
+#include "util/memutil.h"
+#include "util/util_minmax.h"
+
+#include <string.h>
+
+/* Page of memory, shared between snapshots */
+struct snapshot_page {
+    unsigned refs;
+    psys_byte data[PSYS_PAGE_SIZE];
+};
+
+struct psys_snapshot {
+    unsigned refs;
+    /* Registers */
+    psys_fulladdr ipc;
+    psys_word sp;
+    psys_word base;
+    psys_word mp;
+    psys_fulladdr curseg;
+    psys_word readyq;
+    psys_word curtask;
+    psys_word erec;
+    psys_byte curproc;
+    psys_fulladdr syscom;
+    psys_fulladdr stored_ipc;
+    psys_word stored_sp;
+    psys_fulladdr mem_fake_base;
+    /* Memory */
+    size_t mem_size;
+    size_t num_pages;
+    size_t copied_pages;
+    struct snapshot_page **pages;
+};
+
+static size_t num_pages(size_t mem_size)
+{
+    return (mem_size + PSYS_PAGE_SIZE - 1) >> PSYS_PAGE_SHIFT;
+}
+
+/* Number of bytes of memory in page */
+static size_t page_len(size_t mem_size, size_t page)
+{
+    return umin(mem_size - (page << PSYS_PAGE_SHIFT), PSYS_PAGE_SIZE);
+}
+
+static void page_release(struct snapshot_page *page)
+{
+    if (--page->refs == 0) {
+        free(page);
+    }
+}
+
+void psys_dirty_enable(struct psys_state *s)
+{
+    size_t n = num_pages(s->mem_size);
+    if (s->dirty_pages) {
+        return;
+    }
+    s->dirty_pages = malloc(n);
+    memset(s->dirty_pages, 1, n);
+    s->dirty_base = NULL;
+}
+
+void psys_dirty_disable(struct psys_state *s)
+{
+    free(s->dirty_pages);
+    s->dirty_pages = NULL;
+    psys_snapshot_release(s->dirty_base);
+    s->dirty_base = NULL;
+}
+
+struct psys_snapshot *psys_snapshot_take(struct psys_state *s)
+{
+    struct psys_snapshot *base = s->dirty_base;
+    struct psys_snapshot *snap = CALLOC_STRUCT(psys_snapshot);
+    size_t x;
+
+    snap->refs          = 1;
+    snap->ipc           = s->ipc;
+    snap->sp            = s->sp;
+    snap->base          = s->base;
+    snap->mp            = s->mp;
+    snap->curseg        = s->curseg;
+    snap->readyq        = s->readyq;
+    snap->curtask       = s->curtask;
+    snap->erec          = s->erec;
+    snap->curproc       = s->curproc;
+    snap->syscom        = s->syscom;
+    snap->stored_ipc    = s->stored_ipc;
+    snap->stored_sp     = s->stored_sp;
+    snap->mem_fake_base = s->mem_fake_base;
+    snap->mem_size      = s->mem_size;
+    snap->num_pages     = num_pages(s->mem_size);
+    snap->pages         = calloc(snap->num_pages, sizeof(struct snapshot_page *));
+
+    for (x = 0; x < snap->num_pages; ++x) {
+        const psys_byte *data = &s->memory[x << PSYS_PAGE_SHIFT];
+        size_t len            = page_len(s->mem_size, x);
+        struct snapshot_page *page;
+        /* Share the page with the previous snapshot if it is clean, or was
+         * written but still has the same contents.
+         */
+        if (base && (!s->dirty_pages[x] || !memcmp(base->pages[x]->data, data, len))) {
+            page = base->pages[x];
+            page->refs += 1;
+        } else {
+            page       = CALLOC_STRUCT(snapshot_page);
+            page->refs = 1;
+            memcpy(page->data, data, len);
+            snap->copied_pages += 1;
+        }
+        snap->pages[x] = page;
+    }
+
+    if (s->dirty_pages) {
+        memset(s->dirty_pages, 0, snap->num_pages);
+        snap->refs += 1;
+        psys_snapshot_release(base);
+        s->dirty_base = snap;
+    }
+    return snap;
+}
+
+void psys_snapshot_restore(struct psys_state *s, struct psys_snapshot *snap)
+{
+    struct psys_snapshot *base = s->dirty_base;
+    size_t x;
+
+    if (snap->mem_size != s->mem_size) {
+        psys_panic("Snapshot memory size %x does not match state memory size %x\n",
+            (unsigned)snap->mem_size, (unsigned)s->mem_size);
+    }
+    for (x = 0; x < snap->num_pages; ++x) {
+        psys_byte *data = &s->memory[x << PSYS_PAGE_SHIFT];
+        size_t len      = page_len(s->mem_size, x);
+        if (base && !s->dirty_pages[x] && base->pages[x] == snap->pages[x]) {
+            continue; /* page unchanged */
+        }
+        /* Only write pages that differ, so that memory that is mapped
+         * copy-on-write stays shared.
+         */
+        if (memcmp(data, snap->pages[x]->data, len)) {
+            memcpy(data, snap->pages[x]->data, len);
+            psys_invalidate_code(s, x << PSYS_PAGE_SHIFT, len);
+        }
+    }
+    s->ipc           = snap->ipc;
+    s->sp            = snap->sp;
+    s->base          = snap->base;
+    s->mp            = snap->mp;
+    s->curseg        = snap->curseg;
+    s->readyq        = snap->readyq;
+    s->curtask       = snap->curtask;
+    s->erec          = snap->erec;
+    s->curproc       = snap->curproc;
+    s->syscom        = snap->syscom;
+    s->stored_ipc    = snap->stored_ipc;
+    s->stored_sp     = snap->stored_sp;
+    s->mem_fake_base = snap->mem_fake_base;
+    psys_invalidate_display(s);
+    psys_hooks_segment_changed(s);
+    s->compiled = psys_compiled_procedure(s, s->curseg, s->curproc);
+
+    if (s->dirty_pages) {
+        memset(s->dirty_pages, 0, snap->num_pages);
+        snap->refs += 1;
+        psys_snapshot_release(base);
+        s->dirty_base = snap;
+    }
+}
+
+void psys_snapshot_release(struct psys_snapshot *snap)
+{
+    size_t x;
+    if (!snap || --snap->refs != 0) {
+        return;
+    }
+    for (x = 0; x < snap->num_pages; ++x) {
+        page_release(snap->pages[x]);
+    }
+    free(snap->pages);
+    free(snap);
+}
+
+size_t psys_snapshot_copied_pages(const struct psys_snapshot *snap)
+{
+    return snap->copied_pages;
+}
+
+size_t psys_snapshot_num_pages(const struct psys_snapshot *snap)
+{
+    return snap->num_pages;
+}
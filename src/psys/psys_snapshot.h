@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* In-memory snapshots of the p-system: registers and memory, in pages of
+ * PSYS_PAGE_SIZE bytes. With dirty page tracking enabled, a snapshot only
+ * copies the pages written since the previous snapshot was taken or restored,
+ * and shares the other pages with it. Restoring only writes the pages that
+ * differ. Both scale with the working set instead of the size of memory.
+ *
+ * Snapshots cover the interpreter only, not the state of bindings (use
+ * psys_save_state for that). They are in the in-memory layout of this build
+ * and not meant to be stored. Snapshots and the state that they were taken
+ * from must be used from one thread at a time.
+ */
+#ifndef H_PSYS_SNAPSHOT
+#define H_PSYS_SNAPSHOT
+
+#include "psys_types.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct psys_snapshot;
+
+/** Enable dirty page tracking. Until the first snapshot is taken all pages
+ * count as dirty.
+ */
+extern void psys_dirty_enable(struct psys_state *s);
+
+/** Disable dirty page tracking, and release the last snapshot reference held
+ * by the state.
+ */
+extern void psys_dirty_disable(struct psys_state *s);
+
+/** Take a snapshot. Without dirty page tracking this copies all pages. */
+extern struct psys_snapshot *psys_snapshot_take(struct psys_state *s);
+
+/** Restore state to snapshot. Memory size must match. This can be called
+ * from the asynchronous event handler to restore while running.
+ */
+extern void psys_snapshot_restore(struct psys_state *s, struct psys_snapshot *snap);
+
+/** Release a snapshot. Can be passed NULL. */
+extern void psys_snapshot_release(struct psys_snapshot *snap);
+
+/** Number of pages that were copied when taking the snapshot, the remaining
+ * pages are shared with the previous snapshot.
+ */
+extern size_t psys_snapshot_copied_pages(const struct psys_snapshot *snap);
+
+/** Total number of pages in snapshot. */
+extern size_t psys_snapshot_num_pages(const struct psys_snapshot *snap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
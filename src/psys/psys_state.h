@@ -7,6 +7,7 @@
 #define H_PSYS_STATE
 
 #include "psys_types.h"
+#include "util/util_atomic.h"
 
 #include <stdio.h>
 
@@ -14,6 +15,27 @@
 extern "C" {
 #endif
 
+struct psys_predecode;
+struct psys_jit;
+struct psys_callcache;
+struct psys_binding_index;
+struct psys_hooks;
+struct psys_reader;
+struct psys_writer;
+
+/** P-code procedures of a segment compiled to C ahead of time (see
+ * psys_compiled.h). These are only used if the code of the segment in memory
+ * matches the code they were compiled from.
+ */
+struct psys_compiled_segment {
+    char name[8];        /* segment name */
+    uint32_t code_hash;  /* hash of code (see psys_compiled_code_hash) */
+    psys_word code_size; /* size of code in bytes, from PSYS_SEG_CODESTART */
+    int num_procedures;  /* number of procedures in procedures table */
+    /* procedures indexed by procedure number, NULL if not compiled */
+    psys_compiledfunc *const *procedures;
+};
+
 /** Binding for calling native functions from the p-system.
  * This can overrides procedures in a given segment with a native function
  * call.
@@ -25,18 +47,42 @@ struct psys_binding {
      * override a particular procedure.
      */
     psys_bindingfunc **handlers;
-    /* Save binding state to fd */
-    int (*save_state)(struct psys_binding *b, FILE *fd);
-    /* Load binding state to fd */
-    int (*load_state)(struct psys_binding *b, FILE *fd);
+    /* Save binding state to writer */
+    int (*save_state)(struct psys_binding *b, struct psys_writer *w);
+    /* Load binding state from reader */
+    int (*load_state)(struct psys_binding *b, struct psys_reader *r);
+    /* Compiled p-code procedures for the segment, NULL if none. Set with
+     * psys_register_compiled.
+     */
+    const struct psys_compiled_segment *compiled;
 
     void *userdata;
 };
 
+/** Reason why the interpreter stopped (see psys_run).
+ */
+enum psys_stop_reason {
+    PSYS_STOP_NONE,       /* not stopped */
+    PSYS_STOP_BUDGET,     /* instruction budget exhausted */
+    PSYS_STOP_STOPPED,    /* psys_stop was called */
+    PSYS_STOP_BREAKPOINT, /* breakpoint instruction or psys_break */
+    PSYS_STOP_YIELD,      /* native procedure called psys_yield */
+    PSYS_STOP_ERROR,      /* execution error */
+};
+
+/* Number of lexical levels kept in the display */
+#define PSYS_DISPLAY_SIZE 8
+
 /** The main p-system interpreter state.
  */
 struct psys_state {
     bool running;
+    enum psys_stop_reason stop_reason;
+    /* Number of instructions executed, and the count at which psys_run
+     * returns.
+     */
+    uint64_t insn_count;
+    uint64_t insn_limit;
     /* Main registers - program counter can be in high addresses (code pools),
      * and so can curseg (but note that ipc-curseg cannot exceed 64k), all the
      * other pointers must be in the first 64k that can be addressed directly.
@@ -62,26 +108,77 @@ struct psys_state {
     psys_byte *memory;
     size_t mem_size;             /* base mem + code pool */
     psys_fulladdr mem_fake_base; /* fake base address for pool base */
+    /* Dirty page tracking (see psys_snapshot.h): one byte per PSYS_PAGE_SIZE
+     * page of memory, set when the page is written through the memory
+     * helpers. NULL if tracking is disabled.
+     */
+    psys_byte *dirty_pages;
+    struct psys_snapshot *dirty_base; /* snapshot that clean pages match */
     /* External bindings.
      * Binding 0 must always be RSP (Runtime Support Package). This is an array
      * of native functions to handle global intersegment calls on segment 1.
      * Non-zero function pointers will take precedence to p-code or bindings.
+     * Managed through psys_register_binding and psys_unregister_binding.
      */
     struct psys_binding **bindings;
     unsigned num_bindings;
+    struct psys_binding_index *binding_index; /* lookup index for bindings */
     /* debug flags */
     unsigned debug;
     /* debugging: function called on every instruction.
-     * Put debug hooks and tracing here.
+     * Put debug hooks and tracing here. Set this with psys_set_trace, other
+     * kinds of hooks are in psys_hooks.h.
      */
     psys_tracefunc *trace;
     void *trace_userdata;
     /* Hack to initialize stack junk in locals from trace, to prevent
      * it from messing with comparison. If non-zero, sp has changed
-     * and new locals have "come into view".
+     * and new locals have "come into view". Only kept up to date by the
+     * instrumented interpreter variant, which is used while tracing.
      */
     psys_word local_init_base;
     psys_word local_init_count;
+    /* Opcode of the instruction last printed by psys_print_info, whose
+     * results are printed on the next call, if pending.
+     */
+    bool print_info_pending;
+    psys_byte print_info_opcode;
+    /* Predecoded instruction cache (PSYS_PREDECODE builds only, allocated on
+     * first use by the interpreter).
+     */
+    struct psys_predecode *predecode;
+    /* Compiled code (PSYS_JIT builds only, allocated on first use by the
+     * interpreter).
+     */
+    struct psys_jit *jit;
+    /* Procedure call inline caches (allocated on first use by the
+     * interpreter). Entries are only valid for the segment epoch they were
+     * created in, which is increased whenever code or segment residency may
+     * have changed.
+     */
+    struct psys_callcache *callcache;
+    unsigned seg_epoch;
+    /* Armed hook kinds (see psys_hooks.h). The interpreter checks this
+     * instead of the individual hooks.
+     */
+    unsigned hook_flags;
+    struct psys_hooks *hooks;
+    /* Set when an asynchronous event is pending, may be set from another
+     * thread (see psys_raise_async).
+     */
+    util_atomic_int async_pending;
+    /* Display: MSCW of the current procedure (display[0], equal to mp) and of
+     * its statically enclosing procedures, for intermediate variable access.
+     * The first display_len entries are valid. It is updated on procedure
+     * calls, and rebuilt from the static chain on first use after a return,
+     * task switch or state load.
+     */
+    psys_word display[PSYS_DISPLAY_SIZE];
+    unsigned display_len;
+    /* Compiled code for the current procedure, NULL if none. Updated on
+     * procedure calls, returns and task switches.
+     */
+    psys_compiledfunc *compiled;
 };
 
 #ifdef __cplusplus
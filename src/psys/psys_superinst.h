@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#ifndef H_PSYS_SUPERINST
+#define H_PSYS_SUPERINST
+
+#include "psys_predecode.h"
+
+// clang-format off
+/* auto-generated by gen_interpreter.py */
+#define PSYS_SUPERINST_COUNT 3
+
+enum psys_superinst {
+    PSOP_SUPER_0 = 0x100, /* sldl sldc adi */
+    PSOP_SUPER_1 = 0x101, /* ldo sldc equi fjp */
+    PSOP_SUPER_2 = 0x102, /* slla sind */
+};
+
+#define PSYS_SUPERINST_LABELS(X) \
+    X(do_super_0) \
+    X(do_super_1) \
+    X(do_super_2)
+
+/* Instructions in superinstruction: opcode range, and base value for
+ * operand encoded in opcode, -1 if it is the first argument, -2 if none.
+ */
+static const struct psys_superinst_desc psys_superinst_descriptions[PSYS_SUPERINST_COUNT] = {
+    {3, {{0x20, 0x2f,  1}, {0x00, 0x1f,  0}, {0xa2, 0xa2, -2}}}, /* sldl sldc adi */
+    {4, {{0x85, 0x85, -1}, {0x00, 0x1f,  0}, {0xb0, 0xb0, -2}, {0xd4, 0xd4, -1}}}, /* ldo sldc equi fjp */
+    {2, {{0x60, 0x67,  1}, {0x78, 0x7f,  0}}}, /* slla sind */
+};
+// clang-format on
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Superinstruction handlers, included into the interpreter loop. */
+// clang-format off
+/* auto-generated by gen_interpreter.py */
+HANDLER(do_super_0)
+case PSOP_SUPER_0: /* sldl sldc adi */
+    SUPERINST_ENTRY(3);
+    PUSH(psys_ldw(s, local_addr(s, insn->args[0])));
+    PUSH(insn->args[1]);
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 + tos0);
+    DISPATCH();
+HANDLER(do_super_1)
+case PSOP_SUPER_1: /* ldo sldc equi fjp */
+    SUPERINST_ENTRY(4);
+    PUSH(psys_ldw(s, global_addr(s, insn->args[0])));
+    PUSH(insn->args[1]);
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 == tos0);
+    tos0 = POP(); if (!BOOL(tos0)) { JUMP(insn->args[2]); }
+    DISPATCH();
+HANDLER(do_super_2)
+case PSOP_SUPER_2: /* slla sind */
+    SUPERINST_ENTRY(2);
+    PUSH(local_addr(s, insn->args[0]));
+    tos0 = TOP(); SET_TOP(psys_ldw(s, W(tos0, insn->args[1])));
+    DISPATCH();
+// clang-format on
@@ -4,9 +4,11 @@
  * file COPYING or http://www.opensource.org/licenses/mit-license.php.
  */
 #include "psys_task.h"
+#include "psys_bindings.h"
 #include "psys_constants.h"
 #include "psys_debug.h"
 #include "psys_helpers.h"
+#include "psys_hooks.h"
 #include "psys_state.h"
 
 /* Take TIB from head of queue */
@@ -175,6 +177,7 @@ void psys_restore_state_from_tib(struct psys_state *s)
     psys_word ior_procnum;
     s->sp = psys_ldw(s, s->curtask + PSYS_TIB_SP);
     s->mp = psys_ldw(s, s->curtask + PSYS_TIB_MP);
+    psys_invalidate_display(s);
     /* Change curseg if erec changed.
      * Not sure if it should happen in this function, as the erec will have to be
      * checked for residency before we end up here in the first place
@@ -190,12 +193,14 @@ void psys_restore_state_from_tib(struct psys_state *s)
         }
         s->erec   = new_erec;
         s->curseg = new_segment;
+        psys_hooks_segment_changed(s);
     }
     s->ipc      = s->curseg + psys_ldw(s, s->curtask + PSYS_TIB_IPC);
     ior_procnum = psys_ldw(s, s->curtask + PSYS_TIB_IOR_Proc_Num);
     psys_stw(s, s->syscom + PSYS_SYSCOM_IORSLT, ior_procnum >> 8);
-    s->curproc = ior_procnum & 0xff;
-    s->base    = psys_ldw(s, new_erec + PSYS_EREC_Env_Data);
+    s->curproc  = ior_procnum & 0xff;
+    s->base     = psys_ldw(s, new_erec + PSYS_EREC_Env_Data);
+    s->compiled = psys_compiled_procedure(s, s->curseg, s->curproc);
 }
 
 void psys_store_state_to_tib(struct psys_state *s)
@@ -27,6 +27,8 @@ typedef uint32_t psys_fulladdr;
 typedef void(psys_tracefunc)(struct psys_state *state, void *data);
 /** Function used for caling native binding */
 typedef void(psys_bindingfunc)(struct psys_state *state, void *data, psys_fulladdr segment, psys_fulladdr env_data);
+/** Compiled p-code procedure, entered at offset *ofs* in the current segment */
+typedef void(psys_compiledfunc)(struct psys_state *state, psys_word ofs);
 
 /** 8-byte segment identifier.
  * This can be accessed either as 8 separate characters for printing, or as a
@@ -5,17 +5,23 @@
  */
 #include "sundog.h"
 
+#include "game/game_clock.h"
 #include "game/game_debug.h"
-#include "game/game_gembind.h"
-#include "game/game_screen.h"
-#include "game/game_shiplib.h"
+#include "game/game_replay.h"
+#include "game/game_rewind.h"
+#include "game/game_save_state.h"
+#include "game/game_saver.h"
+#include "game/game_screen_sdl.h"
+#include "game/game_setup.h"
 #include "game/game_sound.h"
 #include "game_renderer.h"
 #include "glutil.h"
-#include "psys/psys_bootstrap.h"
+#include "psys/psys_bindings.h"
+#include "psys/psys_blockdev.h"
 #include "psys/psys_constants.h"
 #include "psys/psys_debug.h"
 #include "psys/psys_helpers.h"
+#include "psys/psys_hooks.h"
 #include "psys/psys_interpreter.h"
 #include "psys/psys_opcodes.h"
 #include "psys/psys_rsp.h"
@@ -27,7 +33,6 @@
 #include "util/memutil.h"
 #include "util/util_minmax.h"
 #include "util/util_save_state.h"
-#include "util/util_time.h"
 #ifdef ENABLE_DEBUGUI
 #include "debugui/debugui.h"
 #endif
@@ -38,17 +43,25 @@
 #include <SDL_main.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 /* Time between vblanks in ms */
-#define VBLANK_TIME (1000 / 50)
+#define VBLANK_TIME GAME_CLOCK_VBLANK_MS
 
 /** Mouse area on upper right corner to consider "cancel area", where clicks are interpreted as right clicks. */
 #define CANCEL_AREA_W (24)
 #define CANCEL_AREA_H (16)
 
+/* Interval between rewind frames, in 60 Hz ticks */
+#define REWIND_INTERVAL 30
+/* Default rewind buffer budget, in MiB */
+#define REWIND_DEFAULT_BUDGET 32
+/* Default interval between digests in recordings, in vblanks (one second) */
+#define RECORD_DEFAULT_DIGEST_INTERVAL 50
+
 /** User-defined event types */
 enum {
     EVC_TIMER    = 0x1000,
@@ -69,9 +82,8 @@ static void watch_integrity_check(struct game_state *gs)
     if (!gs->gembind_ofs) {
         return;
     }
-    static psys_word last_state = 0;
-    psys_word new_state         = psys_ldw(gs->psys, INTEGRITY_CHECK_ADDR(gs));
-    if (new_state != last_state) {
+    psys_word new_state = psys_ldw(gs->psys, INTEGRITY_CHECK_ADDR(gs));
+    if (new_state != gs->integrity_state) {
         char *state_str = "???";
         switch ((short)new_state) {
         case 18278: state_str = "misc1_check"; break;
@@ -93,7 +105,7 @@ static void watch_integrity_check(struct game_state *gs)
         psys_word secret3 = psys_ldw(gs->psys, W((gs)->mainlib_ofs + 8, 0x392));
         psys_debug("\x1b[38;5;196;48;5;235m??? state changed to %s (%d) fail %d %d %d secret %d %d %d\x1b[0m\n", state_str, (short)new_state, fail1, fail2, fail3, secret1, secret2, secret3);
         psys_print_traceback(gs->psys);
-        last_state = new_state;
+        gs->integrity_state = new_state;
     }
 }
 #else
@@ -102,9 +114,9 @@ static void watch_integrity_check(struct game_state *gs)
 }
 #endif
 
-static unsigned get_60hz_time()
+static unsigned get_60hz_time(struct game_state *gs)
 {
-    return SDL_GetTicks() / 17;
+    return game_clock_ms(gs->clock) / 17;
 }
 
 /** Procedures to ignore in tracing because they're called often.
@@ -147,8 +159,7 @@ static const struct psys_function_id trace_ignore_procs[] = {
 };
 
 /** Locations to insert artificial delays (in microseconds) or waits for mouse
- * release (-1), to compensate for emulation speed. Make sure this is sorted by
- * (name, address).
+ * release (-1), to compensate for emulation speed.
  */
 static const struct {
     const char *seg_name;
@@ -162,9 +173,9 @@ static const struct {
     { "XSLOTS  ", 0x00ca, 1 },  /* XSLOTS:0x06   roll_face, fixup for slot machine animation */
 };
 
-/* Called before every instruction executed.
+/* Called before every instruction executed, if instruction tracing is enabled
+ * (see setup_hooks).
  * Put debug hooks and tracing here.
- * Enable with: state->trace = psys_trace;
  */
 static void psys_trace(struct psys_state *s, void *gs_)
 {
@@ -177,220 +188,254 @@ static void psys_trace(struct psys_state *s, void *gs_)
             trace_ignore_procs, ARRAY_SIZE(trace_ignore_procs),
             get_game_debuginfo());
     }
-    if (SDL_AtomicGet(&gs->stop_trigger)) {
-        psys_debug("Interpreter thread stopped\n");
-        psys_stop(s);
-    }
+    watch_integrity_check(gs);
+}
 
-    /* Insert artificial delays at set points. The reason for this is that the emulation speed
-     * is so much higher than an Atari ST. The way the user interaction code is written,
-     * this sometimes can give problems.
-     * XXX if there's more entries switch to a bsearch like in psys_print_call_info.
-     */
-    const char *curseg_name = (const char *)psys_bytes(s, s->curseg + PSYS_SEG_NAME);
-    size_t curaddr          = s->ipc - s->curseg;
+/* Insert artificial delays at set points. The reason for this is that the emulation speed
+ * is so much higher than an Atari ST. The way the user interaction code is written,
+ * this sometimes can give problems.
+ * This is an address hook, so it only runs at the addresses in artificial_delays.
+ */
+static void artificial_delay_hook(struct psys_state *s, void *gs_)
+{
+    struct game_state *gs = (struct game_state *)gs_;
+    size_t curaddr        = s->ipc - s->curseg;
+    struct psys_segment_id curseg;
+    psys_read_segment_id(s, &curseg, s->curseg + PSYS_SEG_NAME);
     for (size_t idx = 0; idx < ARRAY_SIZE(artificial_delays); ++idx) {
-        if (strncmp(curseg_name, artificial_delays[idx].seg_name, 8) == 0 && curaddr == artificial_delays[idx].address) {
+        if (strncmp(curseg.name, artificial_delays[idx].seg_name, 8) == 0 && curaddr == artificial_delays[idx].address) {
             if (artificial_delays[idx].delay_ms >= 0) { /* wait milliseconds */
-                util_msleep(artificial_delays[idx].delay_ms);
+                game_clock_sleep(gs->clock, artificial_delays[idx].delay_ms);
             } else { /* wait for mouse release */
                 unsigned buttons = 1;
                 int x, y;
                 while (buttons && !SDL_AtomicGet(&gs->stop_trigger)) {
                     gs->screen->vq_mouse(gs->screen, &buttons, &x, &y);
-                    util_msleep(10);
+                    game_clock_sleep(gs->clock, 10);
                 }
             }
         }
     }
+}
 
-    /* Look up globals for important game segments once they become available. */
-    if (!gs->gembind_ofs && !strncmp(curseg_name, "GEMBIND ", 8)) {
+/* Look up globals for important game segments once they become available.
+ * This is a call hook, which removes itself when done.
+ */
+static void find_globals_hook(struct psys_state *s, void *gs_)
+{
+    struct game_state *gs = (struct game_state *)gs_;
+    struct psys_segment_id curseg;
+    bool done;
+    psys_read_segment_id(s, &curseg, s->curseg + PSYS_SEG_NAME);
+    if (!gs->gembind_ofs && !strncmp(curseg.name, "GEMBIND ", 8)) {
         gs->gembind_ofs = s->base;
         printf("GEMBIND globals at 0x%08x\n", gs->gembind_ofs);
     }
+    done = gs->gembind_ofs != 0;
 #ifdef GAME_CHEATS
-    if (!gs->mainlib_ofs && !strncmp(curseg_name, "MAINLIB ", 8)) {
+    if (!gs->mainlib_ofs && !strncmp(curseg.name, "MAINLIB ", 8)) {
         gs->mainlib_ofs = s->base;
         printf("MAINLIB globals at 0x%08x\n", gs->mainlib_ofs);
     }
+    done = done && gs->mainlib_ofs != 0;
 #endif
+    if (done) {
+        psys_remove_hook(s, gs->globals_hook);
+        gs->globals_hook = NULL;
+    }
+}
 
-    /* Ideally this would be triggered some other way instead of polling
-     * every instruction. The event should be triggered every 4 vsyncs, which
-     * is 15 times a second on NTSC and 12.5 on PAL on the original Atari ST
-     * version, but I'm not sure how much the exact timing matters.
-     */
-    if (SDL_AtomicGet(&gs->vblank_trigger)) {
-        SDL_AtomicSet(&gs->vblank_trigger, 0);
-        /* First, do sprite movement etc */
-        gs->screen->vblank_interrupt(gs->screen);
-        /* Then pass one in four events to interpreter */
-        gs->vblank_count += 1;
-        if (gs->vblank_count == 4) {
-            psys_rsp_event(gs->rspb, 0, true);
-            gs->vblank_count = 0;
+/* Vblank interrupt, in the interpreter thread.
+ * The event should be triggered every 4 vsyncs, which is 15 times a
+ * second on NTSC and 12.5 on PAL on the original Atari ST version, but
+ * I'm not sure how much the exact timing matters.
+ */
+static void do_vblank(struct game_state *gs)
+{
+    /* When recording, input only changes at vblanks */
+    if (gs->recorder) {
+        int x, y;
+        unsigned buttons;
+        SDL_AtomicLock(&gs->mouse_lock);
+        x       = gs->mouse_x;
+        y       = gs->mouse_y;
+        buttons = gs->mouse_buttons;
+        SDL_AtomicUnlock(&gs->mouse_lock);
+        game_screen_update_mouse(gs->screen, x, y, buttons);
+        game_recorder_mouse(gs->recorder, gs->vblank_number, x, y, buttons);
+        game_recorder_vblank(gs->recorder, gs->vblank_number, gs->psys, gs->rspb);
+    }
+    /* First, do sprite movement etc */
+    gs->screen->vblank_interrupt(gs->screen);
+    /* Then pass one in four events to interpreter */
+    gs->vblank_count += 1;
+    if (gs->vblank_count == 4) {
+        psys_rsp_event(gs->rspb, 0, true);
+        gs->vblank_count = 0;
+    }
+    /* 60hz timer */
+    psys_rsp_settime(gs->rspb, get_60hz_time(gs) - gs->time_offset);
+    /* Rewind frame every REWIND_INTERVAL */
+    if (gs->rewind) {
+        uint32_t time = get_60hz_time(gs) - gs->time_offset;
+        if (time - gs->rewind_time >= REWIND_INTERVAL) {
+            game_rewind_push(gs->rewind, time);
+            gs->rewind_time = time;
         }
-        /* 60hz timer */
-        psys_rsp_settime(gs->rspb, get_60hz_time() - gs->time_offset);
     }
-    watch_integrity_check(gs);
-#ifdef PSYS_DEBUGGER
-    if (psys_debugger_trace(gs->debugger)) {
-        SDL_Event event;
-        /* Stop interpreter loop, break into debugger */
+    gs->vblank_number += 1;
+}
+
+/* Go back *steps* rewind frames. Called from the interpreter thread, or while
+ * it is stopped.
+ */
+static void do_rewind(struct game_state *gs, unsigned steps)
+{
+    uint32_t time;
+    if (!game_rewind_restore(gs->rewind, steps, &time)) {
+        psys_debug("Nothing to rewind to\n");
+        return;
+    }
+    /* Continue from the time of the frame */
+    gs->time_offset = get_60hz_time(gs) - time;
+    gs->saved_time  = time;
+    gs->rewind_time = time;
+    psys_debug("Rewound to time %d (%d frames left)\n", time, game_rewind_count(gs->rewind));
+}
+
+/* Name of save state file */
+#define SAVE_FILENAME "sundog.sav"
+/* Values of save_trigger */
+#define SAVE_REQUESTED 1 /* interpreter thread is to capture state */
+#define SAVE_CAPTURED 2  /* save_capture is ready to be written */
+
+/* Capture state to save in the background. This must be called from the
+ * interpreter thread, or while it is stopped.
+ */
+static void do_save_capture(struct game_state *gs, uint32_t time)
+{
+    gs->save_capture = game_save_capture(gs->save_ref, gs->psys, gs->rspb, gs->screen, &time, sizeof(time));
+    if (!gs->save_capture) {
+        psys_debug("Error capturing game state\n");
+        SDL_AtomicSet(&gs->save_trigger, 0);
+        return;
+    }
+    SDL_AtomicSet(&gs->save_trigger, SAVE_CAPTURED);
+}
+
+/* Hand captured state to the saver, and report on finished saves. Called
+ * from the event loop.
+ */
+static void poll_save(struct game_state *gs)
+{
+    struct game_saver_result result;
+    if (SDL_AtomicGet(&gs->save_trigger) == SAVE_CAPTURED) {
+        if (game_saver_start(gs->saver, gs->save_capture, SAVE_FILENAME)) {
+            psys_debug("Saving game state in the background\n");
+        } else {
+            psys_debug("Previous save is still in progress\n");
+        }
+        gs->save_capture = NULL;
+        SDL_AtomicSet(&gs->save_trigger, 0);
+    }
+    switch (game_saver_poll(gs->saver, &result)) {
+    case GAME_SAVER_DONE:
+        psys_debug("Game state succesfully saved to %s (%d bytes, %d ms)\n", result.filename, (int)result.size, result.time_ms);
+        break;
+    case GAME_SAVER_FAILED:
+        psys_debug("Error during save of game state\n");
+        break;
+    default:
+        break;
+    }
+}
+
+/* Handle events from the main thread. This is called by the interpreter at
+ * the next backward branch or procedure call after psys_raise_async.
+ */
+static void psys_async_event(struct psys_state *s, void *gs_)
+{
+    struct game_state *gs = (struct game_state *)gs_;
+    if (SDL_AtomicGet(&gs->stop_trigger)) {
+        psys_debug("Interpreter thread stopped\n");
         psys_stop(s);
-        event.type      = SDL_USEREVENT;
-        event.user.type = SDL_USEREVENT;
-        event.user.code = EVC_DEBUGGER;
-        SDL_PushEvent(&event);
     }
-#endif
+
+    if (SDL_AtomicGet(&gs->vblank_trigger)) {
+        SDL_AtomicSet(&gs->vblank_trigger, 0);
+        do_vblank(gs);
+    }
+
+    if (SDL_AtomicGet(&gs->rewind_trigger)) {
+        do_rewind(gs, SDL_AtomicSet(&gs->rewind_trigger, 0));
+    }
+
+    if (SDL_AtomicGet(&gs->save_trigger) == SAVE_REQUESTED) {
+        do_save_capture(gs, get_60hz_time(gs) - gs->time_offset);
+    }
 }
 
-static void special_disk_handler(void *data, int disk, unsigned srcblk, bool wr)
+#ifdef PSYS_DEBUGGER
+/* Called by the debugger, from the interpreter thread, on breakpoints and
+ * while stepping.
+ */
+static void debugger_break(struct psys_state *s, void *gs_)
 {
-    /*
-     * Patch for copy protection:
-     * > I've done some reverse engineering to figure out a bit more about the copy
-     * > protection mechanism used by Atart ST Sundog.  Part of the trick is that
-     * > track 3 of the floppy disk has 10 sectors rather than the standard 9 sectors.
-     * > The additional sector is a duplicate of sector 5 (that is, there are two
-     * > sectors that both identify as sector 5.)  The contents of these two sectors
-     * > is identical except that the byte at offset 0x113 (275) is set to 0xBC in one
-     * > sector and to 0xA2 in the other.  In addition, the sectors on track 3 are
-     * > written in this order (1, 4, 7, 5, 2, 5, 8, 3, 6, 9).  This means that the
-     * > code can control which version of sector 5 it reads by varying which sector
-     * > it reads before it tries to read sector 5.
-     * - Wayne Holder
-     */
-    psys_byte *disk0 = (psys_byte *)data;
-    if (srcblk < 9) {
-        const int secret_offset = (5 - 1) * 512 + 0x113;
-        if (srcblk == (5 - 1)) {
-#ifdef DEBUG_INTEGRITY_CHECK
-            printf("Reading track 3 sector 5: %02x\n", disk0[secret_offset]);
-#endif
-        } else if (srcblk == (2 - 1) || srcblk == (8 - 1)) { /* Visited sector 2 or 8 first, special value. */
-#ifdef DEBUG_INTEGRITY_CHECK
-            printf("Reading track 3 sector %d -> setting 0xa2\n", srcblk + 1);
+    SDL_Event event;
+    /* Stop interpreter loop, break into debugger */
+    psys_break(s);
+    event.type      = SDL_USEREVENT;
+    event.user.type = SDL_USEREVENT;
+    event.user.code = EVC_DEBUGGER;
+    SDL_PushEvent(&event);
+}
 #endif
-            disk0[secret_offset] = 0xa2;
-        } else { /* Visited any other sector first, normal value. */
+
+/* Install interpreter hooks for the game. */
+static void setup_hooks(struct game_state *gs)
+{
+    struct psys_state *s = gs->psys;
+    struct psys_segment_id seg;
+    bool trace = PDBG(s, TRACE) || PDBG(s, TRACE_CALLS);
 #ifdef DEBUG_INTEGRITY_CHECK
-            printf("Reading track 3 sector %d -> setting 0xbc\n", srcblk + 1);
+    trace = true; /* watch_integrity_check needs to see every instruction */
 #endif
-            disk0[secret_offset] = 0xbc;
-        }
+    if (trace) { /* only pay for per-instruction tracing if needed */
+        psys_set_trace(s, psys_trace, gs);
     }
+    /* The delays depend on input timing outside of vblanks, so they would
+     * make recordings diverge on replay */
+    for (size_t idx = 0; !gs->recorder && idx < ARRAY_SIZE(artificial_delays); ++idx) {
+        memcpy(seg.name, artificial_delays[idx].seg_name, 8);
+        psys_add_address_hook(s, &seg, artificial_delays[idx].address, artificial_delay_hook, gs);
+    }
+    gs->globals_hook = psys_add_call_hook(s, find_globals_hook, gs);
+    psys_set_async_handler(s, psys_async_event, gs);
 }
 
-static struct psys_state *setup_state(struct game_screen *screen, struct game_sound *sound, const char *imagename, struct psys_binding **rspb_out)
+/** Open disk image as block device. Image files are mapped, so that only
+ * the parts that are used get loaded.
+ */
+static struct psys_blockdev *load_disk_image(const char *imagename)
 {
-    struct psys_state *state = CALLOC_STRUCT(psys_state);
-    psys_byte *disk_data;
-    size_t disk_size, track_size;
-    struct psys_bootstrap_info boot;
-    psys_word ext_memsize     = 786; /* Ext memory size in kB, note that this is way more than the game needs. */
-    psys_fulladdr ext_membase = 0x000337ac;
-    struct psys_binding *rspb;
-
-    /* allocate memory */
-    state->mem_size = (ext_memsize + 64) * 1024;
-    state->memory   = malloc(state->mem_size);
-    memset(state->memory, 0, state->mem_size);
-
-    track_size = 9 * 512;
 #ifdef DISK_IMAGE_AS_RESOURCE
     SDL_RWops *fd = load_resource_sdl(imagename);
-#else
-    SDL_RWops *fd = SDL_RWFromFile(imagename, "rb");
-#endif
-    /* load disk image */
-    disk_size = 80 * track_size;
-    disk_data = malloc(disk_size);
+    psys_byte *image;
     if (!fd) {
         fprintf(stderr, "Could not open disk image %s\n", imagename);
-        exit(1);
+        return NULL;
     }
-    if (SDL_RWread(fd, disk_data + 77 * track_size, 1, 3 * track_size) < (size_t)(3 * track_size)
-        || SDL_RWread(fd, disk_data, 1, 77 * track_size) < (size_t)(77 * track_size)) {
+    image = malloc(GAME_DISK_SIZE);
+    if (SDL_RWread(fd, image, 1, GAME_DISK_SIZE) != GAME_DISK_SIZE) {
         fprintf(stderr, "Could not read disk image\n");
-        exit(1);
+        free(image);
+        image = NULL;
     }
     SDL_RWclose(fd);
-
-    /* override memory size and offset in SYSTEM.MISCINFO */
-    /* This is sneaky: at boot, SUNDOG writes amount of memory and memory
-     * offset to SYSTEM.MISCINFO, which is read later by the p-machine.
-     * Emulate this.
-     */
-    *((psys_word *)&disk_data[0x1e00 + 0x22]) = F(ext_memsize);
-    *((psys_word *)&disk_data[0x1e00 + 0x24]) = F(ext_membase >> 16);
-    *((psys_word *)&disk_data[0x1e00 + 0x26]) = F(ext_membase & 0xffff);
-
-    /* Bootstrap */
-    boot.boot_unit_id  = PSYS_UNIT_DISK0;
-    boot.isp           = 0xfdec; /* initial stack pointer - top of p-system base memory */
-    boot.real_size     = 0;
-    boot.mem_fake_base = ext_membase - 0x10000; /* this is where (virtually) 0x10000 bytes of p-system base memory start */
-    /* was: 0x000237ac in hatari emulation */
-    /* so we have:
-     *
-     * psys addr    "atari" addr    size     description
-     * -----------------------------------------------------------------------
-     * 0xffff0000                   64 kB    GEMBIND memory (game specific)
-     *   0xffff0000                  21 kB    (unused, contains OS/68000 code on atari)
-     *   0xffff5400
-     *     =-0xac00 data_pool        31 kB    "data pool" area used by game (offset queried using psys_rsp_unitstatus 128, size fixed)
-     *   0xffffd000                  12 kB    (unused, contains 68000 code on atari)
-     * 0x00000000   mem_fake_base   64 kB    p-system base memory (16-bit addressable: globals, heap)
-     * 0x00010000   ext_membase     768 kB   p-system ext memory (offset/size passed in SYSTEM.MISCINFO)
-     *                                         used for code segments storage
-     *
-     * where psys_addr is the address from the viewpoint of the p-system,
-     * and "atari" addr the address from more low-level kind of code (like GEM calls)
-     * we've made all these relative to ext_membase which is more or less an arbitrary number to match a certain run of hatari
-     *
-     * XXX theoretically the p-system can address 128kB of memory directly starting from mem_fake_base, because addresses are word-based,
-     * i'm not sure how this matches the 64kB here, but in any case maybe it's because a lot of internal bookkeeping (like the stack pointer)
-     * does use byte addresses?
-     */
-
-    /** These two are dummy (legacy?) values and not used on Atari ST: */
-    boot.ext_mem_base = boot.mem_fake_base + boot.isp;
-    boot.ext_mem_size = 0;
-
-    psys_bootstrap(state, &boot, &disk_data[track_size]);
-
-    /* Debug setting */
-    state->debug = PSYS_DBG_WARNING;
-    {
-        const char *x = getenv("PSYS_DEBUG");
-        if (x) {
-            state->debug = strtol(x, NULL, 0);
-        }
-    }
-
-    /* set up RSP and disk */
-    rspb = psys_new_rsp(state);
-    psys_rsp_set_disk(rspb, 0, disk_data, disk_size, track_size, true);
-    psys_rsp_set_pre_access_hook(rspb, special_disk_handler, disk_data);
-    if (rspb_out) {
-        *rspb_out = rspb;
-    }
-
-    /* Set up bindings */
-    state->num_bindings = 3;
-    state->bindings     = calloc(state->num_bindings, sizeof(struct binding *));
-    state->bindings[0]  = rspb;
-    state->bindings[1]  = new_shiplib(state, screen, sound);
-    state->bindings[2]  = new_gembind(state, screen, sound);
-
-    /* Debugging */
-    state->trace = psys_trace;
-
-    return state;
+    return image ? psys_blockdev_new_mem(image, GAME_DISK_SIZE, GAME_DISK_FIRST_BLOCK, true) : NULL;
+#else
+    return game_open_disk_image(imagename);
+#endif
 }
 
 /* Header for savestates */
@@ -399,6 +444,10 @@ static struct psys_state *setup_state(struct game_screen *screen, struct game_so
 static int game_load_state(struct game_state *gs, FILE *fd)
 {
     uint32_t id;
+    if (game_save_is_v2(fd)) {
+        return game_load_state_v2(fd, gs->save_ref, gs->psys, gs->rspb, gs->screen, &gs->saved_time, sizeof(gs->saved_time));
+    }
+    /* Version 1 state */
     if (FD_READ(fd, id)) {
         return -1;
     }
@@ -406,7 +455,7 @@ static int game_load_state(struct game_state *gs, FILE *fd)
         psys_debug("Invalid sundog state record %08x\n", id);
         return -1;
     }
-    /* get_60hz_time() - gs->time_offset should return the same as at saving time */
+    /* get_60hz_time(gs) - gs->time_offset should return the same as at saving time */
     if (FD_READ(fd, gs->saved_time)) {
         return -1;
     }
@@ -415,26 +464,7 @@ static int game_load_state(struct game_state *gs, FILE *fd)
         psys_debug("Error loading p-system state\n");
         return -1;
     }
-    if (game_sdlscreen_load_state(gs->screen, fd) < 0) {
-        psys_debug("Error screen state\n");
-        return -1;
-    }
-    return 0;
-}
-
-static int game_save_state(struct game_state *gs, FILE *fd)
-{
-    uint32_t id = PSYS_SUND_STATE_ID;
-    if (FD_WRITE(fd, id)
-        || FD_WRITE(fd, gs->saved_time)) {
-        return -1;
-    }
-
-    if (psys_save_state(gs->psys, fd) < 0) {
-        psys_debug("Error loading p-system state\n");
-        return -1;
-    }
-    if (game_sdlscreen_save_state(gs->screen, fd) < 0) {
+    if (game_screen_load_state(gs->screen, fd) < 0) {
         psys_debug("Error screen state\n");
         return -1;
     }
@@ -443,7 +473,19 @@ static int game_save_state(struct game_state *gs, FILE *fd)
 
 static int interpreter_thread(void *ptr)
 {
-    psys_interpreter((struct psys_state *)ptr);
+    struct game_state *gs = (struct game_state *)ptr;
+    enum psys_stop_reason reason;
+    if (!gs->clock) {
+        psys_interpreter(gs->psys);
+        return 0;
+    }
+    /* Virtual clock: run up to the next vblank, delays end the run early */
+    do {
+        while (game_clock_vblank(gs->clock)) {
+            do_vblank(gs);
+        }
+        reason = psys_run(gs->psys, game_clock_until_vblank(gs->clock));
+    } while (reason == PSYS_STOP_BUDGET);
     return 0;
 }
 
@@ -451,10 +493,10 @@ static int interpreter_thread(void *ptr)
 static void start_interpreter_thread(struct game_state *gs)
 {
     SDL_AtomicSet(&gs->stop_trigger, 0);
-    gs->time_offset = get_60hz_time() - gs->saved_time; /* Set time to saved time when thread last stopped */
-    gs->thread      = SDL_CreateThread(interpreter_thread, "interpreter_thread", gs->psys);
+    gs->time_offset = get_60hz_time(gs) - gs->saved_time; /* Set time to saved time when thread last stopped */
+    gs->thread      = SDL_CreateThread(interpreter_thread, "interpreter_thread", gs);
 #if 0
-    psys_debug("[%d] Interpreter thread started\n", get_60hz_time() - gs->time_offset);
+    psys_debug("[%d] Interpreter thread started\n", get_60hz_time(gs) - gs->time_offset);
 #endif
 }
 
@@ -462,8 +504,9 @@ static void start_interpreter_thread(struct game_state *gs)
 static void stop_interpreter_thread(struct game_state *gs)
 {
     SDL_AtomicSet(&gs->stop_trigger, 1);
+    psys_raise_async(gs->psys);
     SDL_WaitThread(gs->thread, NULL);
-    gs->saved_time = get_60hz_time() - gs->time_offset; /* Write current time */
+    gs->saved_time = get_60hz_time(gs) - gs->time_offset; /* Write current time */
     gs->thread     = NULL;
 #if 0
     psys_debug("[%d] Interpreter thread stopped\n", gs->saved_time);
@@ -506,6 +549,20 @@ static void update_window_size(struct game_state *gs)
     gs->force_redraw = true;
 }
 
+/** Pass mouse state to the game, from the main thread */
+static void set_mouse_state(struct game_state *gs, int x, int y, unsigned buttons)
+{
+    if (gs->recorder) { /* applied at the next vblank */
+        SDL_AtomicLock(&gs->mouse_lock);
+        gs->mouse_x       = x;
+        gs->mouse_y       = y;
+        gs->mouse_buttons = buttons;
+        SDL_AtomicUnlock(&gs->mouse_lock);
+    } else {
+        game_screen_update_mouse(gs->screen, x, y, buttons);
+    }
+}
+
 /** Mouse button pressed or mouse moved */
 static void update_mouse_state(struct game_state *gs)
 {
@@ -531,7 +588,7 @@ static void update_mouse_state(struct game_state *gs)
     if ((gs->has_right_click_emulation) && (buttons == 1) && x >= (320 - CANCEL_AREA_W) && y < CANCEL_AREA_H) {
         buttons = 2;
     }
-    game_sdlscreen_update_mouse(gs->screen, x, y, buttons);
+    set_mouse_state(gs, x, y, buttons);
 }
 
 /** SDL timer callback. This just sends an event to the main thread.
@@ -591,7 +648,8 @@ static void event_loop(struct game_state *gs)
             } break;
             case SDLK_y: { /* Dump gamestate as hex */
                 unsigned i;
-                psys_byte *curstate = psys_bytes(gs->psys, W(gs->mainlib_ofs + 8, 0x1f));
+                psys_byte curstate[512];
+                psys_read_bytes(gs->psys, curstate, W(gs->mainlib_ofs + 8, 0x1f), sizeof(curstate));
                 for (i = 0; i < 512; ++i) {
                     if (curstate[i] != gamestate[i]) {
                         hl[i]        = 0x02; /* Highlight changed bytes since last time in green */
@@ -605,7 +663,7 @@ static void event_loop(struct game_state *gs)
             } break;
 #endif
             case SDLK_t: /* Print timer */
-                psys_debug("Time: %d\n", get_60hz_time() - gs->time_offset);
+                psys_debug("Time: %d\n", get_60hz_time(gs) - gs->time_offset);
                 break;
             case SDLK_d: /* Go to interactive debugger */
 #ifdef PSYS_DEBUGGER
@@ -616,24 +674,25 @@ static void event_loop(struct game_state *gs)
                 psys_debug("Internal debugger was not compiled in.\n");
 #endif
                 break;
-            case SDLK_s: {                   /* Save state */
-                stop_interpreter_thread(gs); /* stop interpreter thread while saving */
-                FILE *f = fopen("sundog.sav", "wb");
-                if (f == NULL) {
-                    psys_debug("Error opening game state file for writing\n");
-                    break;
+            case SDLK_s: /* Save state */
+                if (SDL_AtomicGet(&gs->save_trigger)) {
+                    psys_debug("Save already requested\n");
+                } else if (!gs->thread) { /* paused: capture right away */
+                    SDL_AtomicSet(&gs->save_trigger, SAVE_REQUESTED);
+                    do_save_capture(gs, gs->saved_time);
+                    poll_save(gs);
+                } else { /* capture at the next safe point, without stopping */
+                    SDL_AtomicSet(&gs->save_trigger, SAVE_REQUESTED);
+                    psys_raise_async(gs->psys);
                 }
-                if (game_save_state(gs, f) < 0) {
-                    psys_debug("Error during save of game state\n");
-                } else {
-                    psys_debug("Game state succesfully saved\n");
+                break;
+            case SDLK_l: { /* Load state */
+                if (gs->recorder) {
+                    psys_debug("Cannot load state while recording.\n");
+                    break;
                 }
-                start_interpreter_thread(gs);
-                fclose(f);
-            } break;
-            case SDLK_l: {                   /* Load state */
                 stop_interpreter_thread(gs); /* stop interpreter thread while loading */
-                FILE *f = fopen("sundog.sav", "rb");
+                FILE *f = fopen(SAVE_FILENAME, "rb");
                 if (f == NULL) {
                     psys_debug("Error opening game state file for reading\n");
                     break;
@@ -647,6 +706,17 @@ static void event_loop(struct game_state *gs)
                 }
                 fclose(f);
             } break;
+            case SDLK_r: /* Rewind */
+                if (!gs->rewind) {
+                    psys_debug("Rewind is disabled.\n");
+                } else if (!gs->thread) { /* paused: rewind right away */
+                    do_rewind(gs, 1);
+                    gs->force_redraw = true;
+                } else { /* rewind in interpreter thread, at the next safe point */
+                    SDL_AtomicAdd(&gs->rewind_trigger, 1);
+                    psys_raise_async(gs->psys);
+                }
+                break;
             case SDLK_SPACE: /* Pause */
                 if (!gs->thread) {
                     start_interpreter_thread(gs);
@@ -676,7 +746,7 @@ static void event_loop(struct game_state *gs)
             switch (event.user.code) {
             case EVC_TIMER: /* Timer event */
                 /* Update textures and uniforms from VM state/thread */
-                need_redraw = game_sdlscreen_update_textures(gs->screen, gs->renderer, (update_texture_func *)gs->renderer->update_texture, (update_palette_func *)gs->renderer->update_palette);
+                need_redraw = game_screen_update_textures(gs->screen, gs->renderer, (update_texture_func *)gs->renderer->update_texture, (update_palette_func *)gs->renderer->update_palette);
 #ifdef ENABLE_DEBUGUI
                 need_redraw |= debugui_is_visible();
 #endif
@@ -684,7 +754,7 @@ static void event_loop(struct game_state *gs)
 #ifdef ENABLE_DEBUGUI
                     if (debugui_newframe(gs->window)) {
                         gs->input_bypass = true;
-                        game_sdlscreen_update_mouse(gs->screen, 0, 0, 0);
+                        set_mouse_state(gs, 0, 0, 0);
                     } else {
                         gs->input_bypass = false;
                     }
@@ -697,10 +767,16 @@ static void event_loop(struct game_state *gs)
                     SDL_GL_SwapWindow(gs->window);
                     gs->force_redraw = false;
                 }
-                /* Trigger vblank interrupt in interpreter thread */
-                SDL_AtomicSet(&gs->vblank_trigger, 1);
+                /* Trigger vblank interrupt in interpreter thread, unless
+                 * that is driven by the virtual clock */
+                if (!gs->clock) {
+                    SDL_AtomicSet(&gs->vblank_trigger, 1);
+                    psys_raise_async(gs->psys);
+                }
                 /* Change cursor (if needed) */
                 game_sdlscreen_update_cursor(gs->screen, (void **)&gs->cursor);
+                /* Start and report on background saves */
+                poll_save(gs);
                 /* Congestion control */
                 SDL_AtomicSet(&gs->timer_queued, 0);
                 break;
@@ -757,11 +833,16 @@ const struct renderer_desc {
 int main(int argc, char **argv)
 {
     struct psys_state *state;
+    struct psys_blockdev *image;
     struct game_state *gs                     = CALLOC_STRUCT(game_state);
     const char *image_name                    = NULL;
     const struct renderer_desc *renderer_type = &renderer_names[0];
     bool print_usage                          = false;
     bool fullscreen                           = false;
+    unsigned vblank_insns                     = 0;
+    unsigned rewind_budget                    = REWIND_DEFAULT_BUDGET;
+    const char *record_name                   = NULL;
+    unsigned digest_interval                  = RECORD_DEFAULT_DIGEST_INTERVAL;
 
 #ifdef __APPLE__
 #include <TargetConditionals.h>
@@ -804,6 +885,43 @@ int main(int argc, char **argv)
                     print_usage = true;
                     break;
                 }
+            } else if (strcmp(arg, "--virtual-clock") == 0) {
+                argidx += 1;
+                if (argidx == argc) {
+                    fprintf(stderr, "Missing argument for %s\n", arg);
+                    print_usage = true;
+                    break;
+                }
+                vblank_insns = strtoul(argv[argidx], NULL, 0);
+                if (vblank_insns == 0) {
+                    fprintf(stderr, "Invalid number of instructions per vblank: %s\n", argv[argidx]);
+                    print_usage = true;
+                    break;
+                }
+            } else if (strcmp(arg, "--rewind") == 0) {
+                argidx += 1;
+                if (argidx == argc) {
+                    fprintf(stderr, "Missing argument for %s\n", arg);
+                    print_usage = true;
+                    break;
+                }
+                rewind_budget = strtoul(argv[argidx], NULL, 0);
+            } else if (strcmp(arg, "--record") == 0) {
+                argidx += 1;
+                if (argidx == argc) {
+                    fprintf(stderr, "Missing argument for %s\n", arg);
+                    print_usage = true;
+                    break;
+                }
+                record_name = argv[argidx];
+            } else if (strcmp(arg, "--record-digest-interval") == 0) {
+                argidx += 1;
+                if (argidx == argc) {
+                    fprintf(stderr, "Missing argument for %s\n", arg);
+                    print_usage = true;
+                    break;
+                }
+                digest_interval = strtoul(argv[argidx], NULL, 0);
             } else if (strcmp(arg, "--right-click-emulation") == 0) {
                 gs->has_right_click_emulation = true;
             } else if (strcmp(arg, "--no-right-click-emulation") == 0) {
@@ -844,6 +962,10 @@ int main(int argc, char **argv)
         fprintf(stderr, "      --renderer                   Set renderer to use (\"basic\" or \"hq4x\" or \"hqish\"), default is \"basic\". Renderers other than \"basic\" require OpenGL ES 3.\n");
         fprintf(stderr, "      --right-click-emulation      Dedicate the top right corner of the screen to right-click emulation (e.g. for tablets)\n");
         fprintf(stderr, "      --no-right-click-emulation   Disable right-click emulation in the top right corner\n");
+        fprintf(stderr, "      --virtual-clock <n>          Derive time from the number of instructions executed, with a vblank every <n> instructions (e.g. %d).\n", GAME_CLOCK_DEFAULT_VBLANK_INSNS);
+        fprintf(stderr, "      --rewind <MiB>               Memory budget of rewind buffer (default %d), 0 disables rewind.\n", REWIND_DEFAULT_BUDGET);
+        fprintf(stderr, "      --record <file>              Record input to <file>, for replay with sundog_headless. Implies --virtual-clock.\n");
+        fprintf(stderr, "      --record-digest-interval <n> Record a state digest every <n> vblanks (default %d), 0 disables digests.\n", RECORD_DEFAULT_DIGEST_INTERVAL);
 
         fprintf(stderr, "      --help                       Display this help and exit.\n");
         fprintf(stderr, "\n");
@@ -853,6 +975,15 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    /* Recordings can only be replayed on the virtual clock, and rewinding
+     * would make them diverge */
+    if (record_name) {
+        if (!vblank_insns) {
+            vblank_insns = GAME_CLOCK_DEFAULT_VBLANK_INSNS;
+        }
+        rewind_budget = 0;
+    }
+
 #ifdef SDL_HINT_NO_SIGNAL_HANDLERS
     SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1"); /* Allow ctrl-c to quit */
 #endif
@@ -892,7 +1023,7 @@ int main(int argc, char **argv)
 
     /* Set up "vblank" timer */
     gs->vblank_count = 0;
-    gs->time_offset  = get_60hz_time();
+    gs->time_offset  = get_60hz_time(gs);
     gs->saved_time   = 0;
     gs->timer        = SDL_AddTimer(VBLANK_TIME, &timer_callback, gs);
 
@@ -903,13 +1034,30 @@ int main(int argc, char **argv)
     }
 
     /* Create object to manage rendering from interpreter */
-    gs->screen = new_game_screen();
-    gs->psys = state      = setup_state(gs->screen, gs->sound, image_name, &gs->rspb);
-    state->trace_userdata = gs;
+    gs->screen = new_game_sdlscreen();
+    image      = load_disk_image(image_name);
+    if (!image) {
+        exit(1);
+    }
+    gs->psys = state = game_setup_state_blockdev(image, gs->screen, gs->sound, vblank_insns, true, &gs->clock, &gs->rspb);
+    if (record_name) {
+        gs->recorder = new_game_recorder(record_name, vblank_insns, digest_interval);
+        if (!gs->recorder) {
+            exit(1);
+        }
+        printf("Recording input to %s\n", record_name);
+    }
+    setup_hooks(gs);
+    gs->save_ref = game_save_ref_new(state, gs->rspb);
+    gs->saver    = new_game_saver();
+    if (rewind_budget) {
+        gs->rewind = new_game_rewind(state, gs->screen, (size_t)rewind_budget << 20);
+    }
 
 #ifdef PSYS_DEBUGGER
     /* Set up debugger */
     gs->debugger = psys_debugger_new(state);
+    psys_debugger_set_break_func(gs->debugger, debugger_break, gs);
 #endif
 #ifdef ENABLE_DEBUGUI
     debugui_init(gs->window, gs);
@@ -932,7 +1080,22 @@ int main(int argc, char **argv)
      * rsp
      * bindings
      */
+    if (gs->rewind) {
+        game_rewind_destroy(gs->rewind);
+    }
+    if (gs->recorder && game_recorder_close(gs->recorder, gs->vblank_number) < 0) {
+        psys_debug("Error writing recording\n");
+    }
+    game_saver_destroy(gs->saver);
+    if (gs->save_capture) {
+        game_save_capture_free(gs->save_capture);
+    }
+    game_save_ref_destroy(gs->save_ref);
+    psys_bindings_destroy(state);
+    psys_hooks_destroy(state);
+    psys_caches_destroy(state);
     free(state);
+    game_clock_destroy(gs->clock);
     free(gs);
 
     return 0;
@@ -7,8 +7,15 @@
 
 struct psys_state;
 struct psys_binding;
+struct psys_hook;
+struct game_clock;
+struct game_recorder;
 struct game_screen;
 struct game_renderer;
+struct game_rewind;
+struct game_save_capture;
+struct game_save_ref;
+struct game_saver;
 
 struct game_state {
     bool running;
@@ -29,13 +36,38 @@ struct game_state {
 #ifdef GAME_CHEATS
     uint32_t mainlib_ofs;
 #endif
+#ifdef DEBUG_INTEGRITY_CHECK
+    /** Last seen state of integrity check, see watch_integrity_check. */
+    uint16_t integrity_state;
+#endif
+    /** Call hook that looks for game globals, removed when all are found. */
+    struct psys_hook *globals_hook;
 
     SDL_atomic_t timer_queued;
     SDL_atomic_t stop_trigger;
     SDL_atomic_t vblank_trigger;
     unsigned vblank_count;
+    unsigned vblank_number; /* vblanks delivered since boot */
     unsigned time_offset;
     uint32_t saved_time;
+    /** Virtual clock, or NULL to follow the wall clock. */
+    struct game_clock *clock;
+    /** Rewind buffer, or NULL if disabled. */
+    struct game_rewind *rewind;
+    uint32_t rewind_time;        /* time of last rewind frame */
+    SDL_atomic_t rewind_trigger; /* number of frames to rewind */
+    /** Image after boot, to save states as delta against. */
+    struct game_save_ref *save_ref;
+    /** Writes save states in the background. */
+    struct game_saver *saver;
+    SDL_atomic_t save_trigger;              /* SAVE_REQUESTED or SAVE_CAPTURED */
+    struct game_save_capture *save_capture; /* state to save, once captured */
+    /** Input recorder, or NULL if not recording. While recording, the mouse
+     * state is passed to the interpreter thread at vblanks. */
+    struct game_recorder *recorder;
+    SDL_SpinLock mouse_lock; /* protects mouse state below */
+    int mouse_x, mouse_y;
+    unsigned mouse_buttons;
 
     /** Whether clicking in the top right corner acts as right mouse button
      * (e.g. for tablets). */
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Batch runner: boots the game once, takes a snapshot, then runs many headless
+ * instances forked from that snapshot on a pool of threads. Every instance has
+ * its own input script and globals to override (for example to pick a
+ * different universe seed), and runs for the same number of vblanks. Reports a
+ * memory digest and selected globals per instance, and optionally a final
+ * screenshot.
+ */
+#include "game/game_clock.h"
+#include "game/game_headless.h"
+#include "game/game_replay.h"
+#include "game/game_setup.h"
+#include "psys/psys_constants.h"
+#include "psys/psys_debug.h"
+#include "psys/psys_helpers.h"
+#include "psys/psys_state.h"
+#include "util/memutil.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum number of globals to report, or to override per job */
+#define MAX_GLOBALS 16
+
+/** Global variable of a segment, with value to set */
+struct batch_global {
+    char segment[9];
+    unsigned index;
+    psys_word value;
+};
+
+struct batch_job {
+    char name[64];
+    struct game_script *script;
+    struct batch_global sets[MAX_GLOBALS];
+    unsigned num_sets;
+
+    /* Results */
+    bool ok;
+    enum psys_stop_reason reason;
+    bool diverged;
+    unsigned vblank;
+    uint64_t insn_count;
+    uint64_t digest;
+    psys_word fields[MAX_GLOBALS];
+    bool field_valid[MAX_GLOBALS];
+};
+
+struct batch {
+    unsigned vblank_insns;
+    /* State that every instance starts from */
+    struct game_headless_image *snapshot;
+    /* Vblank to stop at */
+    unsigned end_vblank;
+    /* Globals to report */
+    struct batch_global fields[MAX_GLOBALS];
+    unsigned num_fields;
+    const char *screenshot_dir;
+
+    struct batch_job *jobs;
+    unsigned num_jobs;
+    /* Index of next job to run. Jobs are whole runs of the game, so a shared
+     * counter is all the scheduling that is needed.
+     */
+    SDL_atomic_t next_job;
+};
+
+/** Parse "<segment>:<index>", or "<segment>:<index>=<value>" if *with_value*.
+ */
+static bool parse_global(const char *spec, struct batch_global *g, bool with_value)
+{
+    const char *colon = strchr(spec, ':');
+    char *end;
+    if (!colon || colon == spec || colon - spec > 8) {
+        return false;
+    }
+    memset(g, 0, sizeof(*g));
+    memcpy(g->segment, spec, colon - spec);
+    g->index = strtoul(colon + 1, &end, 0);
+    if (end == colon + 1) {
+        return false;
+    }
+    if (with_value) {
+        if (*end != '=') {
+            return false;
+        }
+        spec     = end + 1;
+        g->value = strtol(spec, &end, 0);
+        if (end == spec) {
+            return false;
+        }
+    }
+    return *end == 0;
+}
+
+/** Load job list. Every line is "<name> <script> [<segment>:<index>=<value> ...]",
+ * where script is - for none. Empty lines and lines starting with # are
+ * ignored.
+ */
+static bool load_jobs(struct batch *b, const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    char line[1024];
+    unsigned lineno = 0;
+    unsigned alloc  = 0;
+    if (!f) {
+        fprintf(stderr, "Could not open job list %s\n", filename);
+        return false;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        struct batch_job *job;
+        char *tok;
+        lineno += 1;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+        if (b->num_jobs == alloc) {
+            alloc   = alloc ? alloc * 2 : 64;
+            b->jobs = realloc(b->jobs, alloc * sizeof(struct batch_job));
+        }
+        job = &b->jobs[b->num_jobs++];
+        memset(job, 0, sizeof(*job));
+
+        tok = strtok(line, " \t\r\n");
+        snprintf(job->name, sizeof(job->name), "%s", tok);
+        tok = strtok(NULL, " \t\r\n");
+        if (!tok) {
+            fprintf(stderr, "%s:%u: missing script\n", filename, lineno);
+            goto error;
+        }
+        if (strcmp(tok, "-") != 0 && !(job->script = game_script_load(tok))) {
+            goto error;
+        }
+        while ((tok = strtok(NULL, " \t\r\n"))) {
+            if (job->num_sets == MAX_GLOBALS || !parse_global(tok, &job->sets[job->num_sets], true)) {
+                fprintf(stderr, "%s:%u: invalid global assignment %s\n", filename, lineno, tok);
+                goto error;
+            }
+            job->num_sets += 1;
+        }
+    }
+    fclose(f);
+    return true;
+error:
+    fclose(f);
+    return false;
+}
+
+/** Address of a global, or PSYS_NIL if the segment is not known or the
+ * index is out of range.
+ */
+static psys_fulladdr global_addr(struct psys_state *s, struct batch_global *g)
+{
+    psys_word data_size;
+    psys_fulladdr data_base = psys_debug_get_globals(s, g->segment, &data_size);
+    if (data_base == PSYS_NIL || g->index >= data_size) {
+        return PSYS_NIL;
+    }
+    return W(data_base + PSYS_MSCW_VAROFS, g->index);
+}
+
+/** Run one instance from the snapshot */
+static void run_job(struct batch *b, struct batch_job *job)
+{
+    struct game_headless *hs = game_headless_fork(b->snapshot, job->script);
+    struct game_digest digest;
+    unsigned i;
+
+    if (!hs) {
+        fprintf(stderr, "%s: could not fork snapshot\n", job->name);
+        return;
+    }
+    for (i = 0; i < job->num_sets; ++i) {
+        psys_fulladdr addr = global_addr(hs->psys, &job->sets[i]);
+        if (addr == PSYS_NIL) {
+            fprintf(stderr, "%s: no global %s:%u\n", job->name, job->sets[i].segment, job->sets[i].index);
+            goto done;
+        }
+        psys_stw(hs->psys, addr, job->sets[i].value);
+    }
+
+    job->reason     = game_headless_run(hs, b->end_vblank);
+    job->diverged   = hs->diverged;
+    job->vblank     = hs->vblank;
+    job->insn_count = hs->psys->insn_count;
+    game_digest_compute(&digest, hs->psys, NULL);
+    job->digest = digest.memory;
+    for (i = 0; i < b->num_fields; ++i) {
+        psys_fulladdr addr = global_addr(hs->psys, &b->fields[i]);
+        job->field_valid[i] = addr != PSYS_NIL;
+        if (job->field_valid[i]) {
+            job->fields[i] = psys_ldw(hs->psys, addr);
+        }
+    }
+    if (b->screenshot_dir) {
+        char filename[1024];
+        snprintf(filename, sizeof(filename), "%s/%s.bmp", b->screenshot_dir, job->name);
+        game_headless_screenshot(hs, filename);
+    }
+    job->ok = true;
+done:
+    game_headless_destroy(hs);
+}
+
+static int worker_thread(void *b_)
+{
+    struct batch *b = (struct batch *)b_;
+    while (true) {
+        unsigned idx = SDL_AtomicAdd(&b->next_job, 1);
+        if (idx >= b->num_jobs) {
+            break;
+        }
+        run_job(b, &b->jobs[idx]);
+    }
+    return 0;
+}
+
+/** Boot the game, run *boot_vblanks* vblanks, and keep the state as the
+ * snapshot for all instances.
+ */
+static bool take_snapshot(struct batch *b, const psys_byte *image, unsigned boot_vblanks, unsigned vblanks)
+{
+    struct game_headless *hs = new_game_headless(image, b->vblank_insns);
+    if (boot_vblanks) {
+        game_headless_run(hs, boot_vblanks);
+    }
+    b->snapshot   = game_headless_image_new(hs);
+    b->end_vblank = hs->vblank + vblanks;
+    printf("# snapshot at vblank %u, %llu instructions\n",
+        hs->vblank, (unsigned long long)hs->psys->insn_count);
+    game_headless_destroy(hs);
+    return b->snapshot != NULL;
+}
+
+static const char *job_status(const struct batch_job *job)
+{
+    if (!job->ok) {
+        return "error";
+    }
+    if (job->diverged) {
+        return "diverged";
+    }
+    switch (job->reason) {
+    case PSYS_STOP_NONE: return "ok";
+    case PSYS_STOP_STOPPED: return "stopped";
+    case PSYS_STOP_BREAKPOINT: return "breakpoint";
+    case PSYS_STOP_ERROR: return "crashed";
+    default: return "unknown";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct batch *b           = CALLOC_STRUCT(batch);
+    const char *image_name    = NULL;
+    const char *jobs_name     = NULL;
+    unsigned boot_vblanks     = 0;
+    unsigned vblanks          = 0;
+    unsigned num_threads      = SDL_GetCPUCount();
+    bool print_usage          = false;
+    bool all_ok               = true;
+    psys_byte *image;
+    SDL_Thread **threads;
+    uint32_t start_time, elapsed;
+    unsigned i, j;
+
+    b->vblank_insns = GAME_CLOCK_DEFAULT_VBLANK_INSNS;
+
+    /** Command-line argument parsing. */
+    for (int argidx = 1; argidx < argc; ++argidx) {
+        const char *arg = argv[argidx];
+        if (arg[0] == '-') {
+            if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+                print_usage = true;
+                break;
+            }
+            if (argidx + 1 == argc) {
+                fprintf(stderr, "Missing argument for %s\n", arg);
+                print_usage = true;
+                break;
+            }
+            argidx += 1;
+            if (strcmp(arg, "--virtual-clock") == 0) {
+                b->vblank_insns = strtoul(argv[argidx], NULL, 0);
+                if (b->vblank_insns == 0) {
+                    fprintf(stderr, "Invalid number of instructions per vblank: %s\n", argv[argidx]);
+                    print_usage = true;
+                    break;
+                }
+            } else if (strcmp(arg, "--boot-vblanks") == 0) {
+                boot_vblanks = strtoul(argv[argidx], NULL, 0);
+            } else if (strcmp(arg, "--vblanks") == 0) {
+                vblanks = strtoul(argv[argidx], NULL, 0);
+            } else if (strcmp(arg, "--threads") == 0) {
+                num_threads = strtoul(argv[argidx], NULL, 0);
+            } else if (strcmp(arg, "--field") == 0) {
+                if (b->num_fields == MAX_GLOBALS || !parse_global(argv[argidx], &b->fields[b->num_fields], false)) {
+                    fprintf(stderr, "Invalid field: %s\n", argv[argidx]);
+                    print_usage = true;
+                    break;
+                }
+                b->num_fields += 1;
+            } else if (strcmp(arg, "--screenshots") == 0) {
+                b->screenshot_dir = argv[argidx];
+            } else {
+                fprintf(stderr, "Unknown argument: %s\n", arg);
+                print_usage = true;
+                break;
+            }
+        } else {
+            /* Loose arguments: image name, then job list */
+            if (image_name == NULL) {
+                image_name = argv[argidx];
+            } else if (jobs_name == NULL) {
+                jobs_name = argv[argidx];
+            } else {
+                fprintf(stderr, "Surplus argument: %s\n", arg);
+                print_usage = true;
+                break;
+            }
+        }
+    }
+    if (!jobs_name && !print_usage) {
+        fprintf(stderr, "No image and job list provided.\n");
+        print_usage = true;
+    }
+    if (!vblanks && !print_usage) {
+        fprintf(stderr, "Need a number of vblanks to run.\n");
+        print_usage = true;
+    }
+    if (print_usage) {
+        fprintf(stderr, "Usage: %s [options] <image.st> <jobs.txt>\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "      --virtual-clock <n>          Instructions per vblank (default %d).\n", GAME_CLOCK_DEFAULT_VBLANK_INSNS);
+        fprintf(stderr, "      --boot-vblanks <n>           Run <n> vblanks before taking the snapshot instances start from.\n");
+        fprintf(stderr, "      --vblanks <n>                Run every instance for <n> vblanks after the snapshot.\n");
+        fprintf(stderr, "      --threads <n>                Number of threads (default: number of CPUs).\n");
+        fprintf(stderr, "      --field <segment>:<index>    Report global <index> of <segment>. Can be repeated.\n");
+        fprintf(stderr, "      --screenshots <dir>          Write final screenshot of every instance to <dir>/<name>.bmp.\n");
+        fprintf(stderr, "      --help                       Display this help and exit.\n");
+        exit(1);
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    if (!load_jobs(b, jobs_name)) {
+        exit(1);
+    }
+
+    image = malloc(GAME_DISK_SIZE);
+    if (!game_load_disk_image(image_name, image)) {
+        exit(1);
+    }
+    if (!take_snapshot(b, image, boot_vblanks, vblanks)) {
+        fprintf(stderr, "Could not take snapshot\n");
+        exit(1);
+    }
+    free(image);
+
+    /* Run all jobs */
+    start_time = SDL_GetTicks();
+    threads    = calloc(num_threads, sizeof(SDL_Thread *));
+    for (i = 0; i < num_threads; ++i) {
+        threads[i] = SDL_CreateThread(worker_thread, "batch", b);
+        if (!threads[i]) {
+            psys_panic("Could not create thread: %s\n", SDL_GetError());
+        }
+    }
+    for (i = 0; i < num_threads; ++i) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+    elapsed = SDL_GetTicks() - start_time;
+
+    /* Report results, in job order */
+    printf("# name status vblank instructions digest");
+    for (j = 0; j < b->num_fields; ++j) {
+        printf(" %s:0x%x", b->fields[j].segment, b->fields[j].index);
+    }
+    printf("\n");
+    for (i = 0; i < b->num_jobs; ++i) {
+        const struct batch_job *job = &b->jobs[i];
+        printf("%s %s %u %llu %016llx", job->name, job_status(job), job->vblank,
+            (unsigned long long)job->insn_count, (unsigned long long)job->digest);
+        for (j = 0; j < b->num_fields; ++j) {
+            if (job->field_valid[j]) {
+                printf(" 0x%04x", job->fields[j]);
+            } else {
+                printf(" -");
+            }
+        }
+        printf("\n");
+        all_ok = all_ok && job->ok && !job->diverged && (job->reason == PSYS_STOP_NONE || job->reason == PSYS_STOP_STOPPED);
+    }
+    fprintf(stderr, "%u instances in %.2f s on %u threads (%.1f instances/s)\n",
+        b->num_jobs, elapsed / 1000.0, num_threads, elapsed ? b->num_jobs * 1000.0 / elapsed : 0.0);
+
+    /* Destroy everything */
+    for (i = 0; i < b->num_jobs; ++i) {
+        game_script_destroy(b->jobs[i].script);
+    }
+    free(threads);
+    free(b->jobs);
+    game_headless_image_destroy(b->snapshot);
+    free(b);
+
+    return all_ok ? 0 : 1;
+}
@@ -3,10 +3,12 @@
  * Distributed under the MIT software license, see the accompanying
  * file COPYING or http://www.opensource.org/licenses/mit-license.php.
  */
+#include "psys/psys_bindings.h"
 #include "psys/psys_bootstrap.h"
 #include "psys/psys_constants.h"
 #include "psys/psys_debug.h"
 #include "psys/psys_helpers.h"
+#include "psys/psys_hooks.h"
 #include "psys/psys_interpreter.h"
 #include "psys/psys_opcodes.h"
 #include "psys/psys_rsp.h"
@@ -26,11 +28,6 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-int tracefd;
-uint32_t tracerecsize;
-int traceskip; /* number of steps to skip */
-int tracecount;
-
 #define TRACE_STACK_BYTES 128
 #define TRACE_SYSCOM_BYTES 128
 struct __attribute__((__packed__)) psys_tracerec {
@@ -50,26 +47,38 @@ struct __attribute__((__packed__)) psys_tracerec {
     uint32_t time;
 };
 
-static void setup_trace_compare()
+/* Trace comparison state */
+struct trace_compare {
+    int fd;
+    uint32_t recsize;
+    int skip; /* number of steps to skip */
+    int count;
+    psys_byte prev_opc;
+    bool taskswitch_later;
+};
+
+static void setup_trace_compare(struct trace_compare *tc)
 {
-    tracefd = open("../sundog.psystrace", O_RDONLY);
-    if (tracefd < 0) {
+    tc->fd = open("../sundog.psystrace", O_RDONLY);
+    if (tc->fd < 0) {
         perror("Could not open trace file\n");
         exit(1);
     }
-    if (read(tracefd, &tracerecsize, 4) < 0) {
+    if (read(tc->fd, &tc->recsize, 4) < 0) {
         perror("Trace file read error\n");
         exit(1);
     }
-    if (tracerecsize != sizeof(struct psys_tracerec)) {
-        fprintf(stderr, "Trace record size mismatch (%d versus %d)\n", (int)tracerecsize, (int)sizeof(struct psys_tracerec));
+    if (tc->recsize != sizeof(struct psys_tracerec)) {
+        fprintf(stderr, "Trace record size mismatch (%d versus %d)\n", (int)tc->recsize, (int)sizeof(struct psys_tracerec));
         exit(1);
     }
-    traceskip  = 2;
-    tracecount = 0;
+    tc->skip             = 2;
+    tc->count            = 0;
+    tc->prev_opc         = 0;
+    tc->taskswitch_later = false;
 }
 
-static void detect_mismatch(struct psys_state *s, struct psys_tracerec *rec)
+static void detect_mismatch(struct trace_compare *tc, struct psys_state *s, struct psys_tracerec *rec)
 {
     int x;
     int mismatch = false;
@@ -101,7 +110,7 @@ static void detect_mismatch(struct psys_state *s, struct psys_tracerec *rec)
         || s->erec != rec->erec
         || s->curproc != rec->curproc) {
         printf("\x1b[41;30m Mismatch detected between trace and run! \x1b[0m\n");
-        printf("(after %i steps - our versus ref)\n", tracecount);
+        printf("(after %i steps - our versus ref)\n", tc->count);
         printf("ipc    %05x:%04x %05x:%04x\n",
             s->curseg, s->ipc - s->curseg,
             rec->curseg, rec->ipc - rec->curseg);
@@ -129,25 +138,23 @@ static void detect_mismatch(struct psys_state *s, struct psys_tracerec *rec)
 
         exit(1);
     }
-    tracecount += 1;
+    tc->count += 1;
 }
 
-static psys_byte prev_opc;
-static bool taskswitch_later;
-
 /* Called before every instruction executed.
  * Put debug hooks and tracing here.
- * Enable with: state->trace = psys_trace;
+ * Enable with: psys_set_trace(state, psys_trace, &tc);
  */
-static void psys_trace(struct psys_state *s, void *dummy)
+static void psys_trace(struct psys_state *s, void *tc_)
 {
+    struct trace_compare *tc = (struct trace_compare *)tc_;
     struct psys_tracerec rec;
     if (PDBG(s, TRACE)) {
         psys_print_info(s);
     }
-    if (traceskip == 0) {
+    if (tc->skip == 0) {
         /* psys_debug("ipc=0x%05x (seg+0x%05x) sp=%04x\n", s->ipc, s->ipc - s->curseg, s->sp); */
-        if (read(tracefd, &rec, sizeof(rec)) < (ssize_t)sizeof(rec)) {
+        if (read(tc->fd, &rec, sizeof(rec)) < (ssize_t)sizeof(rec)) {
             perror("Trace file read error");
             exit(1);
         }
@@ -161,12 +168,12 @@ static void psys_trace(struct psys_state *s, void *dummy)
 #if 0
             psys_debug("Last opcode was call - filling in %d local initial values\n", num_locals);
 #endif
-            memcpy(psys_words(s, s->sp + local_init_base), &rec.stack[local_init_base], num_locals * 2);
+            psys_write_bytes(s, s->sp + local_init_base, &rec.stack[local_init_base], num_locals * 2);
         }
         /* trigger delayed task switches */
-        if (taskswitch_later) {
+        if (tc->taskswitch_later) {
             psys_task_switch(s);
-            taskswitch_later = false;
+            tc->taskswitch_later = false;
         }
         /* trigger events before instruction executes */
         if (rec.event) {
@@ -174,8 +181,8 @@ static void psys_trace(struct psys_state *s, void *dummy)
             bool taskswitch = true;
             if (rec.event & 0x8000) {
                 psys_debug("\x1b[30;104mDELAYED EVENT\x1b[0m %d\n", rec.event & 0x7fff);
-                taskswitch       = false; /* don't immediately task switch */
-                taskswitch_later = true;  /* but before next instruction */
+                taskswitch           = false; /* don't immediately task switch */
+                tc->taskswitch_later = true;  /* but before next instruction */
             } else {
                 psys_debug("\x1b[30;104mEVENT\x1b[0m %d\n", rec.event & 0x7fff);
             }
@@ -185,11 +192,11 @@ static void psys_trace(struct psys_state *s, void *dummy)
         /* set system input before instruction executes */
         psys_rsp_settime(s->bindings[0], rec.time);
         /* detect mismatches (do this last) */
-        detect_mismatch(s, &rec);
+        detect_mismatch(tc, s, &rec);
     } else {
-        traceskip--;
+        tc->skip--;
     }
-    prev_opc            = psys_ldb(s, 0, s->ipc);
+    tc->prev_opc        = psys_ldb(s, 0, s->ipc);
     s->local_init_count = 0;
 }
 
@@ -284,10 +291,12 @@ static struct psys_state *setup_state(struct game_screen *screen)
      * (logical to physical sector mapping) there.
      */
     for (ptr = 0; ptr < 0xfde0; ptr += 0x10) {
-        if (memcmp(&verify_mem[ptr], &state->memory[ptr], 0x10)) {
+        psys_byte our_mem[0x10];
+        psys_read_bytes(state, our_mem, ptr, 0x10);
+        if (memcmp(&verify_mem[ptr], our_mem, 0x10)) {
             printf("Discrepancy at address 0x%04x:\n", ptr);
             printf("(our) ");
-            psys_debug_hexdump_ofs(&state->memory[ptr], ptr, 0x10);
+            psys_debug_hexdump_ofs(our_mem, ptr, 0x10);
             printf("(ref) ");
             psys_debug_hexdump_ofs(&verify_mem[ptr], ptr, 0x10);
             errors += 1;
@@ -325,14 +334,9 @@ static struct psys_state *setup_state(struct game_screen *screen)
     psys_rsp_set_disk(rspb, 0, disk_data, disk_size, track_size, true);
 
     /* Set up bindings */
-    state->num_bindings = 3;
-    state->bindings     = calloc(state->num_bindings, sizeof(struct binding *));
-    state->bindings[0]  = rspb;
-    state->bindings[1]  = new_shiplib(state, screen, 0);
-    state->bindings[2]  = new_gembind(state, screen, 0);
-
-    /* Debugging */
-    state->trace = psys_trace;
+    psys_register_binding(state, rspb);
+    psys_register_binding(state, new_shiplib(state, screen, 0, NULL));
+    psys_register_binding(state, new_gembind(state, screen, 0, NULL));
 
     return state;
 }
@@ -341,11 +345,13 @@ int main(int argc, char **argv)
 {
     struct psys_state *state;
     struct game_screen *screen = NULL;
+    struct trace_compare tc;
 
-    screen = new_game_screen();
+    screen = new_game_screen(NULL);
 
     state = setup_state(screen);
-    setup_trace_compare();
+    setup_trace_compare(&tc);
+    psys_set_trace(state, psys_trace, &tc);
     psys_interpreter(state);
 
     screen->destroy(screen);
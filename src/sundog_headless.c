@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Headless frontend: runs the game without display, audio or SDL input, on the
+ * virtual clock. Input comes from a script, and screenshots are written on
+ * request. Meant for automated testing, many instances at a time.
+ */
+#include "game/game_clock.h"
+#include "game/game_headless.h"
+#include "game/game_setup.h"
+#include "psys/psys_state.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+    struct game_headless *hs;
+    struct game_script *script   = NULL;
+    const char *image_name       = NULL;
+    const char *script_name      = NULL;
+    const char *final_screenshot = NULL;
+    unsigned vblank_insns        = GAME_CLOCK_DEFAULT_VBLANK_INSNS;
+    unsigned max_vblanks         = 0;
+    bool print_usage             = false;
+    bool diverged;
+    psys_byte *image;
+    enum psys_stop_reason reason;
+
+    /** Command-line argument parsing. */
+    for (int argidx = 1; argidx < argc; ++argidx) {
+        const char *arg = argv[argidx];
+        if (arg[0] == '-') {
+            if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+                print_usage = true;
+                break;
+            }
+            if (argidx + 1 == argc) {
+                fprintf(stderr, "Missing argument for %s\n", arg);
+                print_usage = true;
+                break;
+            }
+            argidx += 1;
+            if (strcmp(arg, "--virtual-clock") == 0) {
+                vblank_insns = strtoul(argv[argidx], NULL, 0);
+                if (vblank_insns == 0) {
+                    fprintf(stderr, "Invalid number of instructions per vblank: %s\n", argv[argidx]);
+                    print_usage = true;
+                    break;
+                }
+            } else if (strcmp(arg, "--vblanks") == 0) {
+                max_vblanks = strtoul(argv[argidx], NULL, 0);
+            } else if (strcmp(arg, "--script") == 0) {
+                script_name = argv[argidx];
+            } else if (strcmp(arg, "--screenshot") == 0) {
+                final_screenshot = argv[argidx];
+            } else {
+                fprintf(stderr, "Unknown argument: %s\n", arg);
+                print_usage = true;
+                break;
+            }
+        } else {
+            /* Loose argument: consider as image name */
+            if (image_name == NULL) {
+                image_name = argv[argidx];
+            } else {
+                fprintf(stderr, "Surplus argument: %s\n", arg);
+                print_usage = true;
+                break;
+            }
+        }
+    }
+    if (!image_name && !print_usage) {
+        fprintf(stderr, "No image provided.\n");
+        print_usage = true;
+    }
+    if (!script_name && !max_vblanks && !print_usage) {
+        fprintf(stderr, "Need a script or a number of vblanks to run.\n");
+        print_usage = true;
+    }
+    if (print_usage) {
+        fprintf(stderr, "Usage: %s [options] <image.st>\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "      --virtual-clock <n>          Instructions per vblank (default %d).\n", GAME_CLOCK_DEFAULT_VBLANK_INSNS);
+        fprintf(stderr, "      --vblanks <n>                Stop after <n> vblanks.\n");
+        fprintf(stderr, "      --script <file>              Read input and screenshot commands from <file>.\n");
+        fprintf(stderr, "      --screenshot <file.bmp>      Write screenshot when stopping.\n");
+        fprintf(stderr, "      --help                       Display this help and exit.\n");
+        exit(1);
+    }
+    if (script_name && !(script = game_script_load(script_name))) {
+        exit(1);
+    }
+
+    image = malloc(GAME_DISK_SIZE);
+    if (!game_load_disk_image(image_name, image)) {
+        exit(1);
+    }
+    hs = new_game_headless(image, vblank_insns);
+    free(image);
+    hs->script = script;
+
+    reason = game_headless_run(hs, max_vblanks);
+    if (final_screenshot) {
+        game_headless_screenshot(hs, final_screenshot);
+        printf("[%u] Wrote screenshot to %s\n", hs->vblank, final_screenshot);
+    }
+    printf("Stopped after %u vblanks, %llu instructions\n", hs->vblank, (unsigned long long)hs->psys->insn_count);
+
+    /* Destroy everything */
+    diverged = hs->diverged;
+    game_headless_destroy(hs);
+    game_script_destroy(script);
+
+    return (reason == PSYS_STOP_NONE || reason == PSYS_STOP_STOPPED) && !diverged ? 0 : 1;
+}
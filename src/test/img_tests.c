@@ -8,8 +8,11 @@
 
 #include "psys/psys_debug.h"
 #include "util/util_img.h"
+#include "util/util_lz.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 unsigned width  = 320;
 unsigned height = 200;
@@ -17,6 +20,29 @@ uint8_t scratch[320 * 200 * 4];
 uint8_t destdata[320 * 200];
 uint8_t verify[320 * 200];
 
+/* Compress and decompress data, return compressed size or -1 on error */
+static int lz_roundtrip(const uint8_t *data, size_t size)
+{
+    uint8_t *comp    = malloc(util_lz_bound(size));
+    uint8_t *out     = malloc(size + 1);
+    size_t comp_size = util_lz_compress(data, size, comp);
+    int rv           = -1;
+    if (util_lz_decompress(comp, comp_size, out, size) < 0) {
+        printf("lz: decompression failed\n");
+    } else if (memcmp(data, out, size)) {
+        printf("lz: mismatch after decompression\n");
+    } else if (size > 0 && util_lz_decompress(comp, comp_size - 1, out, size) == 0) {
+        printf("lz: truncated data not detected\n");
+    } else if (util_lz_decompress(comp, comp_size, out, size + 1) == 0) {
+        printf("lz: wrong output size not detected\n");
+    } else {
+        rv = comp_size;
+    }
+    free(comp);
+    free(out);
+    return rv;
+}
+
 int main()
 {
     size_t sourcedata_size;
@@ -62,5 +88,22 @@ int main()
         return 1;
     }
 
+    /* Test LZ compression */
+    if (lz_roundtrip(sourcedata, sourcedata_size) < 0
+        || lz_roundtrip(destdata, width * height) < 0
+        || lz_roundtrip(destdata, 0) < 0
+        || lz_roundtrip(destdata, 5) < 0) {
+        return 1;
+    }
+    /* A sparse delta, as in save states, must compress well */
+    memset(scratch, 0, sizeof(scratch));
+    for (ptr = 0; ptr < sizeof(scratch); ptr += 997) {
+        scratch[ptr] = ptr;
+    }
+    if (lz_roundtrip(scratch, sizeof(scratch)) > (int)sizeof(scratch) / 20) {
+        printf("lz: sparse data compressed poorly\n");
+        return 1;
+    }
+
     return 0;
 }
@@ -5,15 +5,38 @@
  */
 #include "test_common.h"
 
+#include "game/game_clock.h"
+#include "game/game_gembind.h"
+#include "game/game_headless.h"
+#include "game/game_replay.h"
+#include "game/game_rewind.h"
+#include "game/game_save_state.h"
+#include "game/game_saver.h"
+#include "game/game_setup.h"
+#include "game/game_screen.h"
+#include "game/game_shiplib.h"
+#include "game/game_sound.h"
+#include "psys/psys_bindings.h"
+#include "psys/psys_blockdev.h"
+#include "psys/psys_compiled.h"
 #include "psys/psys_constants.h"
 #include "psys/psys_debug.h"
 #include "psys/psys_helpers.h"
+#include "psys/psys_hooks.h"
 #include "psys/psys_interpreter.h"
 #include "psys/psys_opcodes.h"
+#include "psys/psys_rsp.h"
+#include "psys/psys_save_state.h"
+#include "psys/psys_serialize.h"
+#include "psys/psys_snapshot.h"
 #include "psys/psys_state.h"
 
 #include "util/memutil.h"
+#include "util/util_cow.h"
+#include "util/util_time.h"
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -29,6 +52,92 @@ static void psys_trace(struct psys_state *s, void *dummy)
     }
 }
 
+/* Count executed instructions */
+static void count_trace(struct psys_state *s, void *count)
+{
+    *(unsigned *)count += 1;
+}
+
+/* Count hook invocations */
+static void count_hook(struct psys_state *s, void *count)
+{
+    *(unsigned *)count += 1;
+}
+
+/* Hook that removes itself, userdata points to the hook */
+static void remove_self_hook(struct psys_state *s, void *hook)
+{
+    psys_remove_hook(s, *(struct psys_hook **)hook);
+}
+
+/* Hook that turns on a debug flag checked in the interpreter loop */
+static void set_debug_hook(struct psys_state *s, void *dummy)
+{
+    s->debug |= PSYS_DBG_DISPLAY;
+}
+
+/* Native procedure: increase global 1 */
+static void native_inc_global(struct psys_state *s, void *dummy, psys_fulladdr segment, psys_fulladdr env_data)
+{
+    psys_stw(s, W(env_data + PSYS_MSCW_VAROFS, 1), psys_ldw(s, W(env_data + PSYS_MSCW_VAROFS, 1)) + 1);
+}
+
+/* Native procedure: sleep 30 ms on the clock in userdata */
+static void native_sleep(struct psys_state *s, void *clock, psys_fulladdr segment, psys_fulladdr env_data)
+{
+    game_clock_sleep((struct game_clock *)clock, 30);
+}
+
+/* Number of times compiled_proc1 was entered */
+static unsigned compiled_entries;
+
+/* Procedure 1 of the compiled code test, as translated by pcode_to_c.py */
+// clang-format off
+static void compiled_proc1(struct psys_state *s, psys_word ofs)
+{
+    psys_word sp = s->sp;
+    int tos0, tos1;
+    switch (ofs) {
+    case 0x0042: compiled_entries += 1; goto L_0042;
+    case 0x0047: compiled_entries += 1; goto L_0047;
+    case 0x0058: compiled_entries += 1; goto L_0058;
+    default: return;
+    }
+L_0042:
+    BLOCK(0x0042, 4);
+    PUSH(0); /* 0042 sldc0 */
+    tos0 = POP(); psys_stw(s, global_addr(s, 1), tos0); /* 0043 sro 0x1 */
+    PUSH(1); /* 0045 sldc1 */
+    tos0 = POP(); psys_stw(s, local_addr(s, 1), tos0); /* 0046 sstl1 */
+L_0047:
+    BLOCK(0x0047, 4);
+    PUSH(psys_ldw(s, local_addr(s, 1))); /* 0047 sldl1 */
+    PUSH(10); /* 0048 ldcb 0xa */
+    tos0 = SPOP(); tos1 = signext_word(TOP()); SET_TOP(tos1 <= tos0); /* 004a leqi */
+    tos0 = POP(); if (!BOOL(tos0)) { goto L_005a; } /* 004b fjp 0x5a */
+    BLOCK(0x004d, 8);
+    PUSH(psys_ldw(s, global_addr(s, 1))); /* 004d sldo1 */
+    PUSH(psys_ldw(s, local_addr(s, 1))); /* 004e sldl1 */
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 + tos0); /* 004f adi */
+    tos0 = POP(); psys_stw(s, global_addr(s, 1), tos0); /* 0050 sro 0x1 */
+    PUSH(psys_ldw(s, local_addr(s, 1))); /* 0052 sldl1 */
+    PUSH(1); /* 0053 sldc1 */
+    tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 + tos0); /* 0054 adi */
+    tos0 = POP(); psys_stw(s, local_addr(s, 1), tos0); /* 0055 sstl1 */
+    EXIT(0x0056); /* 0056 clp 0x2 */
+L_0058:
+    BLOCK(0x0058, 1);
+    goto L_0047; /* 0058 ujp 0x47 */
+L_005a:
+    EXIT(0x005a); /* 005a rpu 0x0 */
+}
+// clang-format on
+
+static psys_compiledfunc *const compiled_procedures[] = {
+    NULL,
+    &compiled_proc1,
+};
+
 static void reset_state(struct psys_state *state)
 {
     state->running = false;
@@ -42,6 +151,8 @@ static void reset_state(struct psys_state *state)
     state->erec    = 0x0080;
     state->curproc = 1;
     memset(state->memory, 0, state->mem_size);
+    /* tests poke code directly into memory */
+    psys_invalidate_code(state, 0, state->mem_size);
 }
 
 /* set up VM state for testing */
@@ -60,10 +171,301 @@ static struct psys_state *new_state()
     return state;
 }
 
+/* FNV-1a of memory, leaving out the words in [dead_start, dead_end) that were
+ * popped off the stack. The interpreter does not have to write those back.
+ */
+static uint32_t live_memory_hash(struct psys_state *state, psys_fulladdr dead_start, psys_fulladdr dead_end)
+{
+    uint32_t hash = 2166136261u;
+    unsigned i;
+    for (i = 0; i < state->mem_size; ++i) {
+        if (i < dead_start || i >= dead_end) {
+            hash = (hash ^ state->memory[i]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+/* One step of the trace in the interpreter comparison test */
+struct trace_step {
+    psys_fulladdr ipc;
+    psys_word sp;
+    psys_word mp;
+    uint64_t insn_count;
+    uint32_t mem_hash;
+};
+
+/* Program run by every instance in the concurrency test: sums (i*i) % 1009
+ * for i < 180 into local 1.
+ */
+// clang-format off
+static const psys_byte job_code[] = {
+/* 0*/  PSOP_SLDC0,
+/* 1*/  PSOP_SSTL1,
+/* 2*/  PSOP_SLDC0,
+/* 3*/  PSOP_SSTL2,
+        /* label */
+/* 4*/  PSOP_SLDL2,
+/* 5*/  PSOP_LDCB, 180,
+/* 7*/  PSOP_GEQI,
+/* 8*/  PSOP_TJP, 15,
+/*10*/  PSOP_SLDL1,
+/*11*/  PSOP_SLDL2,
+/*12*/  PSOP_SLDL2,
+/*13*/  PSOP_MPI,
+/*14*/  PSOP_LDCI, 0xf1, 0x03,
+/*17*/  PSOP_MODI,
+/*18*/  PSOP_ADI,
+/*19*/  PSOP_SSTL1,
+/*20*/  PSOP_SLDL2,
+/*21*/  PSOP_INCI,
+/*22*/  PSOP_SSTL2,
+/*23*/  PSOP_UJP, -21,
+/*25*/  PSOP_BPT,
+};
+// clang-format on
+
+/* Program run in the SHIPLIB segment in the concurrency test: draws the
+ * starfield with shiplib procedure 0x16 fifty times, moving it every time.
+ */
+// clang-format off
+static const psys_byte shiplib_job_code[] = {
+/* 0*/  PSOP_SLDC0,
+/* 1*/  PSOP_SSTL1,
+        /* label */
+/* 2*/  PSOP_LDO, 0x11, /* start x */
+/* 4*/  PSOP_SLDC3,
+/* 5*/  PSOP_ADI,
+/* 6*/  PSOP_SRO, 0x11,
+/* 8*/  PSOP_SLDO16,    /* start offset */
+/* 9*/  PSOP_INCI,
+/*10*/  PSOP_SRO, 0x10,
+/*12*/  PSOP_CGP, 0x16,
+/*14*/  PSOP_SLDL1,
+/*15*/  PSOP_INCI,
+/*16*/  PSOP_SSTL1,
+/*17*/  PSOP_SLDL1,
+/*18*/  PSOP_LDCB, 50,
+/*20*/  PSOP_EQUI,
+/*21*/  PSOP_FJP, -21,
+/*23*/  PSOP_BPT,
+};
+
+/* Program run in the GEMBIND segment in the concurrency test: sets the
+ * palette, copies the starfield buffer through GEM pointers, and scrolls the
+ * screen.
+ */
+static const psys_byte gembind_job_code[] = {
+/* 0*/  PSOP_SLDC0,
+/* 1*/  PSOP_SSTL1,
+        /* label */
+/* 2*/  PSOP_SLDL1,     /* color */
+/* 3*/  PSOP_LDCI, 0x11, 0x01,
+/* 6*/  PSOP_MPI,
+/* 7*/  PSOP_SLDL1,     /* index */
+/* 8*/  PSOP_CGP, 0x0b, /* SetColor */
+/*10*/  PSOP_SLDL1,
+/*11*/  PSOP_INCI,
+/*12*/  PSOP_SSTL1,
+/*13*/  PSOP_SLDL1,
+/*14*/  PSOP_SLDC16,
+/*15*/  PSOP_EQUI,
+/*16*/  PSOP_FJP, -16,
+/*18*/  PSOP_LDCI, 0x00, 0x90, /* starfield buffer */
+/*21*/  PSOP_LDCI, 0x00, 0xa0,
+/*24*/  PSOP_CGP, 0x05, /* GetAbsoluteAddress */
+/*26*/  PSOP_LDCI, 0x00, 0xa1, /* copy */
+/*29*/  PSOP_LDCI, 0x04, 0xa0,
+/*32*/  PSOP_CGP, 0x05, /* GetAbsoluteAddress */
+/*34*/  PSOP_LDCI, 0x00, 0xa0,
+/*37*/  PSOP_LDCI, 0x04, 0xa0,
+/*40*/  PSOP_LDCI, 0x00, 0x02,
+/*43*/  PSOP_CGP, 0x04, /* MemoryCopy */
+/*45*/  PSOP_SLDC0,     /* 32 pixels */
+/*46*/  PSOP_SLDC1,     /* up */
+/*47*/  PSOP_CGP, 0x0d, /* ScrollScreen */
+/*49*/  PSOP_BPT,
+};
+// clang-format on
+
+/* Set up segment *name* at *seg*, in which every procedure up to *num_procs*
+ * is native, and make it current. Code can be written at seg + 0x120.
+ */
+static void setup_native_segment(struct psys_state *state, psys_fulladdr seg, psys_fulladdr erec, psys_fulladdr sib,
+    const char *name, unsigned num_procs)
+{
+    unsigned i;
+    state->curseg = seg;
+    state->erec   = erec;
+    state->ipc    = seg + 0x120;
+    psys_stw(state, erec + PSYS_EREC_Env_Data, state->base);
+    psys_stw(state, erec + PSYS_EREC_Env_SIB, sib);
+    psys_stw(state, sib + PSYS_SIB_Seg_Pool, PSYS_NIL);
+    psys_stw(state, sib + PSYS_SIB_Seg_Base, seg);
+    psys_write_bytes(state, seg + PSYS_SEG_NAME, name, 8);
+    psys_stw(state, seg + PSYS_SEG_PROCDICT, 0x80); /* procedure dictionary at 0x100 */
+    psys_stw(state, seg + 0x100, num_procs);
+    for (i = 1; i <= num_procs; ++i) {
+        psys_stw(state, seg + 0x100 - i * 2, 0x88); /* all at 0x110 */
+    }
+    psys_stw(state, seg + 0x110, 0xffff); /* native */
+}
+
+/* Program run in the virtual clock test: counts in global 1, and sleeps
+ * after every increment.
+ */
+// clang-format off
+static const psys_byte clock_job_code[] = {
+/* 0*/  PSOP_SLDO1,
+/* 1*/  PSOP_INCI,
+/* 2*/  PSOP_SRO, 0x01,
+/* 4*/  PSOP_CGP, 0x01, /* sleep */
+/* 6*/  PSOP_UJP, -8,
+};
+// clang-format on
+
+/* Result of a run in the virtual clock test */
+struct clock_job {
+    uint64_t insn_count;
+    uint32_t time_ms;
+    psys_word count;
+};
+
+/* Run the virtual clock test program in a fresh VM for *vblanks* vblanks, the
+ * way the headless frontend does.
+ */
+static void run_clock_job(struct clock_job *job, unsigned vblanks)
+{
+    static psys_bindingfunc *handlers[] = { NULL, native_sleep };
+    struct psys_state *state            = new_state();
+    struct game_clock *clock            = new_game_clock_virtual(state, 100, false);
+    struct psys_binding binding         = { .num_handlers = 2, .handlers = handlers, .userdata = clock };
+    unsigned vblank                     = 0;
+
+    memcpy(binding.seg.name, "TESTSEG ", 8);
+    psys_register_binding(state, &binding);
+    state->trace = NULL;
+    setup_native_segment(state, 0x4000, 0x0080, 0x0100, "TESTSEG ", 1);
+    psys_write_bytes(state, state->ipc, clock_job_code, sizeof(clock_job_code));
+    while (vblank < vblanks) {
+        while (game_clock_vblank(clock)) {
+            vblank += 1;
+        }
+        psys_run(state, game_clock_until_vblank(clock));
+    }
+    job->insn_count = state->insn_count;
+    job->time_ms    = game_clock_ms(clock);
+    job->count      = psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1));
+
+    psys_bindings_destroy(state);
+    game_clock_destroy(clock);
+    psys_caches_destroy(state);
+    free(state->memory);
+    free(state);
+}
+
+/* Result of one instance in the concurrency test */
+struct vm_job {
+    psys_word sum;
+    uint64_t insn_count;
+    uint32_t mem_hash;
+    uint32_t screen_hash;
+};
+
+/* Work queue shared by the threads in the concurrency test */
+struct vm_pool {
+    pthread_mutex_t lock;
+    unsigned next_job;
+    unsigned num_jobs;
+    struct vm_job *jobs;
+};
+
+/* Run the concurrency test programs to completion in a fresh VM, with its own
+ * screen and game bindings.
+ */
+static void run_vm_job(struct vm_job *job)
+{
+    struct psys_state *state     = new_state();
+    struct game_screen *screen   = new_game_screen(NULL);
+    struct game_sound *sound     = new_null_sound();
+    struct psys_binding *shiplib = new_shiplib(state, screen, sound, NULL);
+    struct psys_binding *gembind = new_gembind(state, screen, sound, NULL);
+    struct psys_writer w;
+    const psys_byte *data;
+    size_t size;
+    uint32_t hash = 2166136261u;
+    unsigned i;
+
+    state->trace = NULL; /* use predecoded and compiled paths, if available */
+    psys_write_bytes(state, state->ipc, job_code, sizeof(job_code));
+    /* small slices so that instances are interleaved */
+    while (psys_run(state, 97) == PSYS_STOP_BUDGET)
+        ;
+    job->sum = psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1));
+
+    /* starfield: buffer of x offsets at 0x9000, rows after that */
+    psys_register_binding(state, shiplib);
+    psys_register_binding(state, gembind);
+    for (i = 0; i < 0x100; ++i) {
+        psys_stb(state, 0x9000, i, (i * 167 + 13) & 0xff);
+    }
+    psys_stw(state, W(state->base + PSYS_MSCW_VAROFS, 0x06), 0x9000);
+    psys_stw(state, W(state->base + PSYS_MSCW_VAROFS, 0x12), 100); /* rows */
+    setup_native_segment(state, 0x4000, 0x0080, 0x0100, "SHIPLIB ", 0x16);
+    psys_write_bytes(state, state->ipc, shiplib_job_code, sizeof(shiplib_job_code));
+    while (psys_run(state, 97) == PSYS_STOP_BUDGET)
+        ;
+    setup_native_segment(state, 0x6000, 0x00a0, 0x0120, "GEMBIND ", 0x0d);
+    psys_write_bytes(state, state->ipc, gembind_job_code, sizeof(gembind_job_code));
+    while (psys_run(state, 97) == PSYS_STOP_BUDGET)
+        ;
+
+    job->insn_count = state->insn_count;
+    for (i = 0; i < state->mem_size; ++i) {
+        hash = (hash ^ state->memory[i]) * 16777619u;
+    }
+    job->mem_hash = hash;
+    psys_writer_init(&w);
+    game_screen_write_state(screen, &w);
+    size = psys_writer_size(&w);
+    data = psys_writer_flatten(&w);
+    hash = 2166136261u;
+    for (i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    job->screen_hash = hash;
+
+    psys_writer_free(&w);
+    psys_bindings_destroy(state);
+    destroy_gembind(gembind);
+    destroy_shiplib(shiplib);
+    sound->destroy(sound);
+    screen->destroy(screen);
+    psys_caches_destroy(state);
+    free(state->memory);
+    free(state);
+}
+
+static void *vm_pool_thread(void *pool_)
+{
+    struct vm_pool *pool = (struct vm_pool *)pool_;
+    while (true) {
+        unsigned job;
+        pthread_mutex_lock(&pool->lock);
+        job = pool->next_job++;
+        pthread_mutex_unlock(&pool->lock);
+        if (job >= pool->num_jobs) {
+            break;
+        }
+        run_vm_job(&pool->jobs[job]);
+    }
+    return NULL;
+}
+
 int main()
 {
     struct psys_state *state = new_state();
-    psys_byte *code          = psys_bytes(state, state->ipc);
+    psys_fulladdr code       = state->ipc;
 
     { /* Basic arithmetic */
         static const psys_byte testcode[] = {
@@ -74,7 +476,7 @@ int main()
             PSOP_RPU,
         };
         reset_state(state);
-        memcpy(code, testcode, sizeof(testcode));
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
         psys_interpreter(state);
         CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 3);
     }
@@ -95,7 +497,7 @@ int main()
             PSOP_RPU,
         };
         reset_state(state);
-        memcpy(code, testcode, sizeof(testcode));
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
         psys_interpreter(state);
         CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 79);
     }
@@ -113,7 +515,7 @@ int main()
             PSOP_RPU,
         };
         reset_state(state);
-        memcpy(code, testcode, sizeof(testcode));
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
         psys_interpreter(state);
         CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 0xdc56);
     }
@@ -131,7 +533,7 @@ int main()
             PSOP_RPU,
         };
         reset_state(state);
-        memcpy(code, testcode, sizeof(testcode));
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
         psys_interpreter(state);
         CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 0xff89);
     }
@@ -149,7 +551,7 @@ int main()
             PSOP_RPU,
         };
         reset_state(state);
-        memcpy(code, testcode, sizeof(testcode));
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
         psys_interpreter(state);
         CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 0x1);
     }
@@ -169,7 +571,7 @@ int main()
             PSOP_RPU,
         };
         reset_state(state);
-        memcpy(code, testcode, sizeof(testcode));
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
         psys_stw(state, W(state->mp + PSYS_MSCW_VAROFS, 1), 0x1234);
         psys_interpreter(state);
         CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 0x0);
@@ -208,7 +610,7 @@ int main()
             PSOP_RPU,
         };
         reset_state(state);
-        memcpy(code, testcode, sizeof(testcode));
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
         psys_stw(state, W(state->mp + PSYS_MSCW_VAROFS, 1), 0x1234);
         psys_interpreter(state);
         psys_word *w = psys_words(state, W(state->mp + PSYS_MSCW_VAROFS, 1));
@@ -250,7 +652,7 @@ int main()
     };
         // clang-format on
         reset_state(state);
-        memcpy(code, testcode, sizeof(testcode));
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
         psys_stw(state, W(state->mp + PSYS_MSCW_VAROFS, 1), 0x1234);
         psys_interpreter(state);
         psys_word *w = psys_words(state, W(state->mp + PSYS_MSCW_VAROFS, 2));
@@ -259,5 +661,1128 @@ int main()
         }
         // CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 0x0);
     }
+    { /* MOV into code that has already been executed */
+        // clang-format off
+    static const psys_byte testcode[] = {
+/* 0*/  PSOP_SLDC1, /* patched to SLDC5 */
+/* 1*/  PSOP_SSTL1,
+/* 2*/  PSOP_SLDL2, /* patched already? */
+/* 3*/  PSOP_FJP, 2,
+/* 5*/  PSOP_RPU, 0x00,
+/* 7*/  PSOP_SLDC1,
+/* 8*/  PSOP_SSTL2,
+/* 9*/  PSOP_LDCI, 0x00, 0x40, /* dst */
+/*12*/  PSOP_LDCI, 0x00, 0x60, /* src */
+/*15*/  PSOP_MOV, 0x00, 0x01,
+/*18*/  PSOP_UJP, -20,
+    };
+        // clang-format on
+        reset_state(state);
+        state->ipc    = 0x4000; /* MOV can only write to the first 64k */
+        state->curseg = 0x4000;
+        psys_write_bytes(state, 0x4000, testcode, sizeof(testcode));
+        psys_stb(state, 0x6000, 0, PSOP_SLDC5);
+        psys_stb(state, 0x6000, 1, PSOP_SSTL1);
+        psys_interpreter(state);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 5);
+    }
+    { /* Sequences that can be fused into superinstructions */
+        // clang-format off
+    static const psys_byte testcode[] = {
+/* 0*/  PSOP_SLDC0, /* counter */
+/* 1*/  PSOP_SSTL1,
+/* 2*/  PSOP_SLDC0, /* sum */
+/* 3*/  PSOP_SSTL2,
+        /* label */
+/* 4*/  PSOP_SLDL2,
+/* 5*/  PSOP_SLDC3,
+/* 6*/  PSOP_ADI,
+/* 7*/  PSOP_SSTL2,
+/* 8*/  PSOP_SLDL1,
+/* 9*/  PSOP_SLDC1,
+/*10*/  PSOP_ADI,
+/*11*/  PSOP_SSTL1,
+/*12*/  PSOP_SLDL1,
+/*13*/  PSOP_SRO, 0x01,
+/*15*/  PSOP_LDO, 0x01, /* check loop condition */
+/*17*/  PSOP_SLDC10,
+/*18*/  PSOP_EQUI,
+/*19*/  PSOP_FJP, -17,
+/*21*/  PSOP_SLLA2,
+/*22*/  PSOP_SIND0,
+/*23*/  PSOP_SSTL3,
+/*24*/  PSOP_BPT,
+    };
+        // clang-format on
+        unsigned count = 0;
+        reset_state(state);
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
+        /* without tracing, so that instructions are fused */
+        state->trace = NULL;
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, 0x10080 + 24);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 10);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 2)), 30);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 3)), 30);
+        /* run again with tracing: every instruction must be seen separately */
+        state->ipc            = 0x10080;
+        state->sp             = 0xff00;
+        state->trace          = &count_trace;
+        state->trace_userdata = &count;
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, 0x10080 + 24);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 3)), 30);
+        /* trace is also called once after the breakpoint stopped execution */
+        CHECK_EQUAL(count, 4 + 10 * 14 + 4 + 1);
+        state->trace          = &psys_trace;
+        state->trace_userdata = NULL;
+    }
+    { /* Running a limited number of instructions */
+        // clang-format off
+    static const psys_byte testcode[] = {
+/* 0*/  PSOP_SLDC0,
+/* 1*/  PSOP_SSTL1,
+        /* label */
+/* 2*/  PSOP_SLDL1,
+/* 3*/  PSOP_SLDC1,
+/* 4*/  PSOP_ADI,
+/* 5*/  PSOP_SSTL1,
+/* 6*/  PSOP_SLDL1,
+/* 7*/  PSOP_SLDC5,
+/* 8*/  PSOP_EQUI,
+/* 9*/  PSOP_FJP, -9,
+/*11*/  PSOP_BPT,
+    };
+        // clang-format on
+        uint64_t start;
+        reset_state(state);
+        psys_write_bytes(state, code, testcode, sizeof(testcode));
+        /* without tracing, so that the budget has to split superinstructions */
+        state->trace = NULL;
+        start        = state->insn_count;
+        CHECK_EQUAL(psys_run(state, 0), PSYS_STOP_BUDGET);
+        CHECK_EQUAL(state->ipc, 0x10080);
+        CHECK_EQUAL(psys_run(state, 3), PSYS_STOP_BUDGET);
+        CHECK_EQUAL(state->ipc, 0x10083);
+        CHECK_EQUAL(state->insn_count - start, 3);
+        CHECK_EQUAL(psys_run(state, 3), PSYS_STOP_BUDGET);
+        CHECK_EQUAL(state->ipc, 0x10086);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 1);
+        CHECK_EQUAL(psys_run(state, 1000), PSYS_STOP_BREAKPOINT);
+        CHECK_EQUAL(state->ipc, 0x10080 + 11);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 5);
+        CHECK_EQUAL(state->insn_count - start, 2 + 5 * 8 + 1);
+        state->trace = &psys_trace;
+    }
+    { /* Loops give the same results with and without per-instruction hooks */
+        // clang-format off
+    static const psys_byte testcode[] = {
+/* 0*/  PSOP_SLDC0,
+/* 1*/  PSOP_SSTL1,
+/* 2*/  PSOP_SLDC0,
+/* 3*/  PSOP_SSTL2,
+        /* label */
+/* 4*/  PSOP_SLDL2,
+/* 5*/  PSOP_LDCB, 100,
+/* 7*/  PSOP_GEQI,
+/* 8*/  PSOP_TJP, 12,
+/*10*/  PSOP_SLDL1,
+/*11*/  PSOP_SLDL2,
+/*12*/  PSOP_SLDC7,
+/*13*/  PSOP_MODI,
+/*14*/  PSOP_ADI,
+/*15*/  PSOP_SSTL1,
+/*16*/  PSOP_SLDL2,
+/*17*/  PSOP_INCI,
+/*18*/  PSOP_SSTL2,
+/*19*/  PSOP_NOP,
+/*20*/  PSOP_UJP, -18,
+/*22*/  PSOP_BPT,
+    };
+        // clang-format on
+        psys_fulladdr ipc[4];
+        psys_word sum[4];
+        uint64_t insn_count[4];
+        struct psys_hook *hook;
+        unsigned count = 0;
+        int pass;
+        state->trace = NULL;
+        for (pass = 0; pass < 4; ++pass) {
+            uint64_t start;
+            reset_state(state);
+            psys_write_bytes(state, code, testcode, sizeof(testcode));
+            hook = NULL;
+            if (pass & 1) { /* interpret every instruction */
+                hook = psys_add_insn_hook(state, count_hook, &count);
+            }
+            if (pass == 2) {
+                state->debug |= PSYS_DBG_JIT_DIFF;
+            }
+            start = state->insn_count;
+            CHECK_EQUAL(psys_run(state, 700), PSYS_STOP_BUDGET);
+            ipc[pass] = state->ipc;
+            sum[pass] = psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1));
+            CHECK_EQUAL(psys_run(state, 10000), PSYS_STOP_BREAKPOINT);
+            CHECK_EQUAL(state->ipc, code + 22);
+            CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 295);
+            insn_count[pass] = state->insn_count - start;
+            state->debug &= ~PSYS_DBG_JIT_DIFF;
+            if (hook) {
+                psys_remove_hook(state, hook);
+            }
+        }
+        for (pass = 1; pass < 4; ++pass) {
+            CHECK_EQUAL(ipc[pass], ipc[0]);
+            CHECK_EQUAL(sum[pass], sum[0]);
+            CHECK_EQUAL(insn_count[pass], insn_count[0]);
+        }
+        CHECK_EQUAL(insn_count[0], 4 + 100 * 15 + 4 + 1);
+        /* changed code is picked up */
+        state->ipc = code;
+        CHECK_EQUAL(psys_run(state, 10000), PSYS_STOP_BREAKPOINT);
+        psys_stb(state, code, 6, 50);
+        psys_invalidate_code(state, code + 6, 1);
+        state->ipc = code;
+        CHECK_EQUAL(psys_run(state, 10000), PSYS_STOP_BREAKPOINT);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 147);
+        state->trace = &psys_trace;
+    }
+    { /* Repeated call from the same call site, and replacing the callee */
+        // clang-format off
+    static const psys_byte maincode[] = {
+/* 0*/  PSOP_CGP, 0x01,
+/* 2*/  PSOP_SLDO1,
+/* 3*/  PSOP_SLDC3,
+/* 4*/  PSOP_EQUI,
+/* 5*/  PSOP_FJP, -7,
+/* 7*/  PSOP_BPT,
+    };
+    static const psys_byte proc1code[] = {
+        0x00, 0x00, /* number of locals */
+        PSOP_SLDO1, PSOP_SLDC1, PSOP_ADI, PSOP_SRO, 0x01, PSOP_RPU, 0x00,
+    };
+    static const psys_byte proc2code[] = {
+        0x00, 0x00, /* number of locals */
+        PSOP_SLDO2, PSOP_SLDC1, PSOP_ADI, PSOP_SRO, 0x02, PSOP_SLDO1, PSOP_SLDC1, PSOP_ADI, PSOP_SRO, 0x01, PSOP_RPU, 0x00,
+    };
+        // clang-format on
+        const psys_fulladdr seg  = 0x4000;
+        const psys_fulladdr sib  = 0x0100;
+        const psys_fulladdr erec = 0x0080;
+        reset_state(state);
+        state->curseg = seg;
+        state->ipc    = seg + 0x20;
+        state->erec   = erec;
+        psys_stw(state, erec + PSYS_EREC_Env_Data, state->base);
+        psys_stw(state, erec + PSYS_EREC_Env_SIB, sib);
+        psys_stw(state, sib + PSYS_SIB_Seg_Pool, PSYS_NIL);
+        psys_stw(state, sib + PSYS_SIB_Seg_Base, seg);
+        psys_stw(state, seg + PSYS_SEG_PROCDICT, 0x80); /* procedure dictionary at 0x100 */
+        psys_stw(state, seg + 0x100, 1);                /* one procedure */
+        psys_stw(state, seg + 0xfe, 0x20);              /* procedure 1 at 0x40 */
+        psys_write_bytes(state, seg + 0x20, maincode, sizeof(maincode));
+        psys_write_bytes(state, seg + 0x40, proc1code, sizeof(proc1code));
+        psys_write_bytes(state, seg + 0x60, proc2code, sizeof(proc2code));
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, seg + 0x27);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 3);
+        /* replace procedure 1, as if the segment was read again */
+        psys_stw(state, seg + 0xfe, 0x30);
+        psys_invalidate_code(state, seg, 0x200);
+        psys_stw(state, W(state->base + PSYS_MSCW_VAROFS, 1), 0);
+        state->ipc = seg + 0x20;
+        psys_interpreter(state);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 3);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 2)), 3);
+    }
+    { /* Native procedure provided by binding */
+        // clang-format off
+    static const psys_byte maincode[] = {
+/* 0*/  PSOP_CGP, 0x01,
+/* 2*/  PSOP_SLDO1,
+/* 3*/  PSOP_SLDC3,
+/* 4*/  PSOP_EQUI,
+/* 5*/  PSOP_FJP, -7,
+/* 7*/  PSOP_BPT,
+    };
+        // clang-format on
+        static psys_bindingfunc *handlers[] = { NULL, native_inc_global };
+        struct psys_binding binding         = { .num_handlers = 2, .handlers = handlers };
+        struct psys_binding other           = { .num_handlers = 0 };
+        const psys_fulladdr seg             = 0x4000;
+        const psys_fulladdr sib             = 0x0100;
+        const psys_fulladdr erec            = 0x0080;
+        memcpy(binding.seg.name, "TESTSEG ", 8);
+        memcpy(other.seg.name, "TESTSEG ", 8);
+        CHECK_EQUAL(psys_register_binding(state, &binding), 0);
+        CHECK_EQUAL(psys_register_binding(state, &other), -1); /* duplicate segment */
+        CHECK(psys_find_binding(state, &binding.seg) == &binding);
+
+        reset_state(state);
+        state->curseg = seg;
+        state->ipc    = seg + 0x20;
+        state->erec   = erec;
+        psys_stw(state, erec + PSYS_EREC_Env_Data, state->base);
+        psys_stw(state, erec + PSYS_EREC_Env_SIB, sib);
+        psys_stw(state, sib + PSYS_SIB_Seg_Pool, PSYS_NIL);
+        psys_stw(state, sib + PSYS_SIB_Seg_Base, seg);
+        psys_write_bytes(state, seg + PSYS_SEG_NAME, "TESTSEG ", 8);
+        psys_stw(state, seg + PSYS_SEG_PROCDICT, 0x80); /* procedure dictionary at 0x100 */
+        psys_stw(state, seg + 0x100, 1);                /* one procedure */
+        psys_stw(state, seg + 0xfe, 0x20);              /* procedure 1 at 0x40 */
+        psys_stw(state, seg + 0x40, 0xffff);            /* native */
+        psys_write_bytes(state, seg + 0x20, maincode, sizeof(maincode));
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, seg + 0x27);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 3);
+
+        CHECK_EQUAL(psys_unregister_binding(state, &binding), 0);
+        CHECK_EQUAL(psys_unregister_binding(state, &binding), -1);
+        CHECK(psys_find_binding(state, &binding.seg) == NULL);
+        CHECK(psys_segment_binding(state, seg) == NULL);
+        psys_bindings_destroy(state);
+    }
+    { /* Virtual clock: vblanks, sleeping, and reproducible runs */
+        static psys_bindingfunc *handlers[] = { NULL, native_sleep };
+        struct game_clock *clock            = new_game_clock_virtual(state, 100, false);
+        struct psys_binding binding         = { .num_handlers = 2, .handlers = handlers, .userdata = clock };
+        struct clock_job jobs[2];
+        uint64_t start;
+        uint32_t start_ms;
+        unsigned i;
+        memcpy(binding.seg.name, "TESTSEG ", 8);
+        CHECK_EQUAL(psys_register_binding(state, &binding), 0);
+        reset_state(state);
+        state->trace = NULL;
+        psys_write_bytes(state, state->ipc, job_code, sizeof(job_code));
+        /* vblanks are due every 100 instructions */
+        start    = state->insn_count;
+        start_ms = game_clock_ms(clock);
+        CHECK(!game_clock_vblank(clock));
+        CHECK_EQUAL(game_clock_until_vblank(clock), 100);
+        for (i = 1; i <= 5; ++i) {
+            CHECK_EQUAL(psys_run(state, game_clock_until_vblank(clock)), PSYS_STOP_BUDGET);
+            CHECK_EQUAL(state->insn_count - start, i * 100);
+            CHECK_EQUAL(game_clock_until_vblank(clock), 0);
+            CHECK(game_clock_vblank(clock));
+            CHECK(!game_clock_vblank(clock));
+            CHECK_EQUAL(game_clock_until_vblank(clock), 100);
+            CHECK_EQUAL(game_clock_ms(clock) - start_ms, i * GAME_CLOCK_VBLANK_MS);
+        }
+        /* sleeping advances time, and ends the run after the current
+         * instruction
+         */
+        setup_native_segment(state, 0x4000, 0x0080, 0x0100, "TESTSEG ", 1);
+        psys_write_bytes(state, state->ipc, clock_job_code, sizeof(clock_job_code));
+        CHECK_EQUAL(psys_run(state, 50), PSYS_STOP_BUDGET);
+        CHECK_EQUAL(state->insn_count - start, 500 + 4);
+        CHECK_EQUAL(state->ipc, 0x4000 + 0x120 + 6);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 1);
+        /* 30 ms is 150 instructions: the vblank is due, and the next one is
+         * closer
+         */
+        CHECK_EQUAL(game_clock_ms(clock), (state->insn_count + 150) * GAME_CLOCK_VBLANK_MS / 100);
+        CHECK_EQUAL(game_clock_until_vblank(clock), 0);
+        CHECK(game_clock_vblank(clock));
+        CHECK(!game_clock_vblank(clock));
+        CHECK_EQUAL(game_clock_until_vblank(clock), 200 - 154);
+        CHECK_EQUAL(psys_unregister_binding(state, &binding), 0);
+        psys_bindings_destroy(state);
+        game_clock_destroy(clock);
+        state->trace = &psys_trace;
+        /* identical runs take the same number of instructions and time */
+        run_clock_job(&jobs[0], 50);
+        run_clock_job(&jobs[1], 50);
+        CHECK(jobs[0].count > 0);
+        CHECK_EQUAL(jobs[0].insn_count, jobs[1].insn_count);
+        CHECK_EQUAL(jobs[0].time_ms, jobs[1].time_ms);
+        CHECK_EQUAL(jobs[0].count, jobs[1].count);
+    }
+    { /* Hooks */
+        // clang-format off
+    static const psys_byte maincode[] = {
+/* 0*/  PSOP_CGP, 0x01,
+/* 2*/  PSOP_SLDO1,
+/* 3*/  PSOP_SLDC3,
+/* 4*/  PSOP_EQUI,
+/* 5*/  PSOP_FJP, -7,
+/* 7*/  PSOP_BPT,
+    };
+    static const psys_byte proc1code[] = {
+        0x00, 0x00, /* number of locals */
+        PSOP_SLDO1, PSOP_SLDC1, PSOP_ADI, PSOP_SRO, 0x01, PSOP_RPU, 0x00,
+    };
+        // clang-format on
+        const psys_fulladdr seg  = 0x4000;
+        const psys_fulladdr sib  = 0x0100;
+        const psys_fulladdr erec = 0x0080;
+        struct psys_segment_id id;
+        struct psys_hook *addr_hook;
+        unsigned addr_count = 0, call_count = 0, return_count = 0, async_count = 0;
+        memcpy(id.name, "HOOKSEG ", 8);
+        reset_state(state);
+        state->curseg = seg;
+        state->ipc    = seg + 0x20;
+        state->erec   = erec;
+        psys_stw(state, erec + PSYS_EREC_Env_Data, state->base);
+        psys_stw(state, erec + PSYS_EREC_Env_SIB, sib);
+        psys_stw(state, sib + PSYS_SIB_Seg_Pool, PSYS_NIL);
+        psys_stw(state, sib + PSYS_SIB_Seg_Base, seg);
+        psys_write_bytes(state, seg + PSYS_SEG_NAME, id.name, 8);
+        psys_stw(state, seg + PSYS_SEG_PROCDICT, 0x80); /* procedure dictionary at 0x100 */
+        psys_stw(state, seg + 0x100, 1);                /* one procedure */
+        psys_stw(state, seg + 0xfe, 0x20);              /* procedure 1 at 0x40 */
+        psys_write_bytes(state, seg + 0x20, maincode, sizeof(maincode));
+        psys_write_bytes(state, seg + 0x40, proc1code, sizeof(proc1code));
+        /* without tracing, so that only the hooks are armed */
+        psys_set_trace(state, NULL, NULL);
+        addr_hook = psys_add_address_hook(state, &id, 0x42, &count_hook, &addr_count);
+        psys_add_call_hook(state, &count_hook, &call_count);
+        psys_add_return_hook(state, &count_hook, &return_count);
+        psys_set_async_handler(state, &count_hook, &async_count);
+        psys_raise_async(state);
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, seg + 0x27);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 3);
+        CHECK_EQUAL(addr_count, 3);
+        CHECK_EQUAL(call_count, 3);
+        CHECK_EQUAL(return_count, 3);
+        CHECK_EQUAL(async_count, 1); /* handled at first call */
+        /* instruction budget: stop before the fifth instruction (SRO) */
+        psys_remove_hook(state, addr_hook);
+        psys_stw(state, W(state->base + PSYS_MSCW_VAROFS, 1), 0);
+        state->ipc = seg + 0x20;
+        psys_set_budget(state, 4, NULL, NULL);
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, seg + 0x45);
+        CHECK_EQUAL(psys_get_budget(state), 0);
+        CHECK_EQUAL(state->hook_flags & PSYS_HOOK_BUDGET, 0);
+        CHECK_EQUAL(addr_count, 3);
+        CHECK_EQUAL(call_count, 4);
+        psys_hooks_destroy(state);
+        CHECK_EQUAL(state->hook_flags, 0);
+        psys_set_trace(state, &psys_trace, NULL);
+    }
+    { /* Switching between instrumented and lean interpreter variants */
+        // clang-format off
+    static const psys_byte maincode[] = {
+/* 0*/  PSOP_CGP, 0x01,
+/* 2*/  PSOP_SLDO1,
+/* 3*/  PSOP_SLDC3,
+/* 4*/  PSOP_EQUI,
+/* 5*/  PSOP_FJP, -7,
+/* 7*/  PSOP_BPT,
+    };
+    static const psys_byte proc1code[] = {
+        0x00, 0x00, /* number of locals */
+        PSOP_SLDO1, PSOP_SLDC1, PSOP_ADI, PSOP_SRO, 0x01, PSOP_RPU, 0x00,
+    };
+        // clang-format on
+        const psys_fulladdr seg  = 0x4000;
+        const psys_fulladdr sib  = 0x0100;
+        const psys_fulladdr erec = 0x0080;
+        struct psys_segment_id id;
+        struct psys_hook *hook;
+        unsigned count = 0;
+        memcpy(id.name, "VARSEG  ", 8);
+        reset_state(state);
+        state->curseg = seg;
+        state->erec   = erec;
+        psys_stw(state, erec + PSYS_EREC_Env_Data, state->base);
+        psys_stw(state, erec + PSYS_EREC_Env_SIB, sib);
+        psys_stw(state, sib + PSYS_SIB_Seg_Pool, PSYS_NIL);
+        psys_stw(state, sib + PSYS_SIB_Seg_Base, seg);
+        psys_write_bytes(state, seg + PSYS_SEG_NAME, id.name, 8);
+        psys_stw(state, seg + PSYS_SEG_PROCDICT, 0x80); /* procedure dictionary at 0x100 */
+        psys_stw(state, seg + 0x100, 1);                /* one procedure */
+        psys_stw(state, seg + 0xfe, 0x20);              /* procedure 1 at 0x40 */
+        psys_write_bytes(state, seg + 0x20, maincode, sizeof(maincode));
+        psys_write_bytes(state, seg + 0x40, proc1code, sizeof(proc1code));
+        psys_set_trace(state, NULL, NULL);
+        /* instrumented while an instruction hook is armed: calls keep track
+         * of new locals for trace comparison
+         */
+        hook                   = psys_add_insn_hook(state, &count_hook, &count);
+        state->ipc             = seg + 0x20;
+        state->local_init_base = 0;
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, seg + 0x27);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 3);
+        CHECK_EQUAL(state->local_init_base, 5);
+        CHECK_EQUAL(count, 32); /* including the instruction after the breakpoint */
+        psys_remove_hook(state, hook);
+        /* switch to lean as soon as the hook is gone */
+        hook = psys_add_insn_hook(state, &remove_self_hook, &hook);
+        psys_stw(state, W(state->base + PSYS_MSCW_VAROFS, 1), 0);
+        state->ipc             = seg + 0x20;
+        state->local_init_base = 0;
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, seg + 0x27);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 3);
+        CHECK_EQUAL(state->local_init_base, 0);
+        /* and back to instrumented when a hook sets a debug flag, without
+         * running hooks twice
+         */
+        psys_add_address_hook(state, &id, 0x45, &set_debug_hook, NULL);
+        hook = psys_add_address_hook(state, &id, 0x45, &count_hook, &count);
+        psys_stw(state, W(state->base + PSYS_MSCW_VAROFS, 1), 0);
+        state->ipc             = seg + 0x20;
+        state->local_init_base = 0;
+        count                  = 0;
+        psys_interpreter(state);
+        CHECK_EQUAL(state->ipc, seg + 0x27);
+        CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 3);
+        CHECK_EQUAL(state->local_init_base, 5);
+        CHECK_EQUAL(count, 3);
+        state->debug &= ~PSYS_DBG_DISPLAY;
+        psys_hooks_destroy(state);
+        psys_set_trace(state, &psys_trace, NULL);
+    }
+    { /* Lean and instrumented interpreter variants give the same trace */
+        // clang-format off
+    static const psys_byte maincode[] = {
+/* 0*/  PSOP_SLDC0,
+/* 1*/  PSOP_SSTL1,
+        /* label */
+/* 2*/  PSOP_SLDL1, /* i + 3 * (5 + i % 7): five words deep */
+/* 3*/  PSOP_SLDC3,
+/* 4*/  PSOP_SLDC5,
+/* 5*/  PSOP_SLDL1,
+/* 6*/  PSOP_SLDC7,
+/* 7*/  PSOP_MODI,
+/* 8*/  PSOP_ADI,
+/* 9*/  PSOP_MPI,
+/*10*/  PSOP_ADI,
+/*11*/  PSOP_CGP, 0x01, /* add to global 1 */
+/*13*/  PSOP_SLDL1,
+/*14*/  PSOP_INCI,
+/*15*/  PSOP_SSTL1,
+/*16*/  PSOP_SLDL1,
+/*17*/  PSOP_LDCB, 40,
+/*19*/  PSOP_EQUI,
+/*20*/  PSOP_FJP, -20,
+/*22*/  PSOP_BPT,
+    };
+    static const psys_byte proc1code[] = {
+        0x00, 0x00, /* number of locals, the parameter is local 1 */
+        PSOP_SLDO1, PSOP_SLDL1, PSOP_ADI, PSOP_SRO, 0x01, PSOP_RPU, 0x01,
+    };
+        // clang-format on
+        const psys_fulladdr seg     = 0x4000;
+        const psys_fulladdr sib     = 0x0100;
+        const psys_fulladdr erec    = 0x0080;
+        const psys_word stack_limit = 0xfe00; /* lowest stack address used */
+        static struct trace_step steps[2][1024];
+        unsigned num_steps[2];
+        unsigned pass, i;
+        state->trace = NULL;
+        /* pass 0 runs the lean variant, which caches the top of the stack
+         * with PSYS_TOS_CACHE, pass 1 the instrumented variant, which does not
+         */
+        for (pass = 0; pass < 2; ++pass) {
+            enum psys_stop_reason reason;
+            uint64_t start;
+            reset_state(state);
+            state->curseg = seg;
+            state->ipc    = seg + 0x20;
+            state->erec   = erec;
+            psys_stw(state, erec + PSYS_EREC_Env_Data, state->base);
+            psys_stw(state, erec + PSYS_EREC_Env_SIB, sib);
+            psys_stw(state, sib + PSYS_SIB_Seg_Pool, PSYS_NIL);
+            psys_stw(state, sib + PSYS_SIB_Seg_Base, seg);
+            psys_stw(state, seg + PSYS_SEG_PROCDICT, 0x80); /* procedure dictionary at 0x100 */
+            psys_stw(state, seg + 0x100, 1);                /* one procedure */
+            psys_stw(state, seg + 0xfe, 0x20);              /* procedure 1 at 0x40 */
+            psys_write_bytes(state, seg + 0x20, maincode, sizeof(maincode));
+            psys_write_bytes(state, seg + 0x40, proc1code, sizeof(proc1code));
+            if (pass == 1) {
+                state->debug |= PSYS_DBG_DISPLAY;
+            }
+            /* stop after slices of varying length, so that both variants are
+             * compared at many points, and the cache has to be written back
+             * in the middle of every kind of instruction sequence
+             */
+            num_steps[pass] = 0;
+            start           = state->insn_count;
+            do {
+                struct trace_step *step;
+                reason = psys_run(state, 1 + num_steps[pass] % 7);
+                CHECK(num_steps[pass] < 1024);
+                step             = &steps[pass][num_steps[pass]++];
+                step->ipc        = state->ipc;
+                step->sp         = state->sp;
+                step->mp         = state->mp;
+                step->insn_count = state->insn_count - start;
+                step->mem_hash   = live_memory_hash(state, stack_limit, state->sp);
+            } while (reason == PSYS_STOP_BUDGET);
+            CHECK_EQUAL(reason, PSYS_STOP_BREAKPOINT);
+            CHECK_EQUAL(state->ipc, seg + 0x20 + 22);
+            CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 1725);
+            state->debug &= ~PSYS_DBG_DISPLAY;
+        }
+        CHECK_EQUAL(num_steps[0], num_steps[1]);
+        for (i = 0; i < num_steps[0]; ++i) {
+            CHECK_EQUAL(steps[0][i].ipc, steps[1][i].ipc);
+            CHECK_EQUAL(steps[0][i].sp, steps[1][i].sp);
+            CHECK_EQUAL(steps[0][i].mp, steps[1][i].mp);
+            CHECK_EQUAL(steps[0][i].insn_count, steps[1][i].insn_count);
+            CHECK_EQUAL(steps[0][i].mem_hash, steps[1][i].mem_hash);
+        }
+        state->trace = &psys_trace;
+    }
+    { /* Intermediate variable access from nested procedures */
+        // clang-format off
+    static const psys_byte maincode[] = {
+/* 0*/  PSOP_CLP, 0x01,
+/* 2*/  PSOP_BPT,
+    };
+    static const psys_byte proc1code[] = {
+        0x00, 0x01, /* number of locals */
+        PSOP_SLDC5, PSOP_SSTL1, PSOP_CLP, 0x02, PSOP_SLDL1, PSOP_STR, 0x01, 0x02, PSOP_RPU, 0x00,
+    };
+    static const psys_byte proc2code[] = {
+        0x00, 0x00, /* number of locals */
+        PSOP_CIP, 0x01, 0x03, PSOP_RPU, 0x00,
+    };
+    static const psys_byte proc3code[] = {
+        0x00, 0x00, /* number of locals */
+        PSOP_LOD, 0x02, 0x01, PSOP_SLDC1, PSOP_ADI, PSOP_STR, 0x02, 0x01,
+        PSOP_LOD, 0x01, 0x01, PSOP_SLDC2, PSOP_ADI, PSOP_STR, 0x01, 0x01, PSOP_RPU, 0x00,
+    };
+        // clang-format on
+        const psys_fulladdr seg  = 0x4000;
+        const psys_fulladdr sib  = 0x0100;
+        const psys_fulladdr erec = 0x0080;
+        reset_state(state);
+        state->curseg = seg;
+        state->ipc    = seg + 0x20;
+        state->erec   = erec;
+        state->debug |= PSYS_DBG_DISPLAY; /* check display against static chain */
+        psys_stw(state, erec + PSYS_EREC_Env_Data, state->base);
+        psys_stw(state, erec + PSYS_EREC_Env_SIB, sib);
+        psys_stw(state, sib + PSYS_SIB_Seg_Pool, PSYS_NIL);
+        psys_stw(state, sib + PSYS_SIB_Seg_Base, seg);
+        psys_stw(state, seg + PSYS_SEG_PROCDICT, 0x80); /* procedure dictionary at 0x100 */
+        psys_stw(state, seg + 0x100, 3);                /* three procedures */
+        psys_stw(state, seg + 0xfe, 0x20);              /* procedure 1 at 0x40 */
+        psys_stw(state, seg + 0xfc, 0x30);              /* procedure 2 at 0x60 */
+        psys_stw(state, seg + 0xfa, 0x40);              /* procedure 3 at 0x80 */
+        psys_write_bytes(state, seg + 0x20, maincode, sizeof(maincode));
+        psys_write_bytes(state, seg + 0x40, proc1code, sizeof(proc1code));
+        psys_write_bytes(state, seg + 0x60, proc2code, sizeof(proc2code));
+        psys_write_bytes(state, seg + 0x80, proc3code, sizeof(proc3code));
+        psys_interpreter(state);
+        state->debug &= ~PSYS_DBG_DISPLAY;
+        CHECK_EQUAL(state->ipc, seg + 0x22);
+        CHECK_EQUAL(state->mp, 0xff00);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 1);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 2)), 7);
+    }
+    { /* Compiled procedures */
+        // clang-format off
+    static const psys_byte maincode[] = {
+/* 0*/  PSOP_CLP, 0x01,
+/* 2*/  PSOP_BPT,
+    };
+    static const psys_byte proc1code[] = { /* sum 1..10 into global 1, calling procedure 2 every iteration */
+        0x00, 0x01, /* number of locals */
+/*42*/  PSOP_SLDC0, PSOP_SRO, 0x01, PSOP_SLDC1, PSOP_SSTL1,
+/*47*/  PSOP_SLDL1, PSOP_LDCB, 0x0a, PSOP_LEQI, PSOP_FJP, 0x0d,
+/*4d*/  PSOP_SLDO1, PSOP_SLDL1, PSOP_ADI, PSOP_SRO, 0x01,
+/*52*/  PSOP_SLDL1, PSOP_SLDC1, PSOP_ADI, PSOP_SSTL1,
+/*56*/  PSOP_CLP, 0x02,
+/*58*/  PSOP_UJP, 0xed,
+/*5a*/  PSOP_RPU, 0x00,
+    };
+    static const psys_byte proc2code[] = { /* increase global 2 */
+        0x00, 0x00, /* number of locals */
+        PSOP_SLDO2, PSOP_SLDC1, PSOP_ADI, PSOP_SRO, 0x02, PSOP_RPU, 0x00,
+    };
+        // clang-format on
+        const psys_fulladdr seg  = 0x4000;
+        const psys_fulladdr sib  = 0x0100;
+        const psys_fulladdr erec = 0x0080;
+        struct psys_compiled_segment compiled;
+        struct psys_segment_id id;
+        uint64_t insn_count[2], start;
+        psys_fulladdr ipc[2];
+        unsigned pass;
+        state->trace = NULL; /* compiled code is not used while tracing */
+        for (pass = 0; pass < 2; ++pass) { /* with and without matching code */
+            reset_state(state);
+            state->curseg = seg;
+            state->ipc    = seg + 0x20;
+            state->erec   = erec;
+            psys_stw(state, erec + PSYS_EREC_Env_Data, state->base);
+            psys_stw(state, erec + PSYS_EREC_Env_SIB, sib);
+            psys_stw(state, sib + PSYS_SIB_Seg_Pool, PSYS_NIL);
+            psys_stw(state, sib + PSYS_SIB_Seg_Base, seg);
+            psys_stw(state, seg + PSYS_SEG_PROCDICT, 0x80); /* procedure dictionary at 0x100 */
+            psys_write_bytes(state, seg + PSYS_SEG_NAME, "TESTSEG ", 8);
+            psys_stw(state, seg + 0x100, 2);                /* two procedures */
+            psys_stw(state, seg + 0xfe, 0x20);              /* procedure 1 at 0x40 */
+            psys_stw(state, seg + 0xfc, 0x30);              /* procedure 2 at 0x60 */
+            psys_write_bytes(state, seg + 0x20, maincode, sizeof(maincode));
+            psys_write_bytes(state, seg + 0x40, proc1code, sizeof(proc1code));
+            psys_write_bytes(state, seg + 0x60, proc2code, sizeof(proc2code));
+            if (pass == 0) {
+                memcpy(compiled.name, "TESTSEG ", 8);
+                compiled.code_size      = 0x70 - PSYS_SEG_CODESTART;
+                compiled.code_hash      = psys_compiled_code_hash(state, seg, compiled.code_size);
+                compiled.num_procedures = 2;
+                compiled.procedures     = compiled_procedures;
+                CHECK_EQUAL(psys_register_compiled(state, &compiled), 0);
+                CHECK_EQUAL(psys_register_compiled(state, &compiled), -1);
+            } else { /* change unused byte in code; compiled code no longer matches */
+                psys_stb(state, seg, 0x30, PSOP_NOP);
+                psys_invalidate_code(state, seg + 0x30, 1);
+            }
+            compiled_entries = 0;
+            start            = state->insn_count;
+            /* budget runs out halfway a compiled basic block in the third iteration */
+            CHECK_EQUAL(psys_run(state, 30), PSYS_STOP_BUDGET);
+            CHECK_EQUAL(state->insn_count - start, 30);
+            ipc[pass] = state->ipc;
+            CHECK_EQUAL(psys_run(state, 1000), PSYS_STOP_BREAKPOINT);
+            CHECK_EQUAL(state->ipc, seg + 0x22);
+            CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 1)), 55);
+            CHECK_EQUAL(psys_ldw(state, W(state->base + PSYS_MSCW_VAROFS, 2)), 10);
+            CHECK(pass == 0 ? compiled_entries > 0 : compiled_entries == 0);
+            insn_count[pass] = state->insn_count - start;
+        }
+        CHECK_EQUAL(ipc[0], seg + 0x4f);
+        CHECK_EQUAL(ipc[1], seg + 0x4f);
+        CHECK_EQUAL(insn_count[0], insn_count[1]);
+        psys_read_segment_id(state, &id, seg + PSYS_SEG_NAME);
+        CHECK_EQUAL(psys_unregister_binding(state, psys_find_binding(state, &id)), 0);
+        psys_bindings_destroy(state);
+        state->trace = &psys_trace;
+    }
+    { /* Byte addressing is big-endian regardless of memory layout */
+        psys_byte buf[6];
+        reset_state(state);
+        psys_stw(state, 0x4000, 0x1234);
+        psys_stw(state, 0x4002, 0x0000);
+        CHECK_EQUAL(psys_ldb(state, 0x4000, 0), 0x12);
+        CHECK_EQUAL(psys_ldb(state, 0x4000, 1), 0x34);
+        psys_write_bytes(state, 0x4001, "\xab\xcd", 2);
+        CHECK_EQUAL(psys_ldw(state, 0x4000), 0x12ab);
+        CHECK_EQUAL(psys_ldw(state, 0x4002), 0xcd00);
+        psys_move_bytes(state, 0x4003, 0x4000, 3); /* overlapping */
+        psys_read_bytes(state, buf, 0x4000, 6);
+        CHECK(!memcmp(buf, "\x12\xab\xcd\x12\xab\xcd", 6));
+        psys_fill_bytes(state, 0x4001, 0xee, 2);
+        CHECK_EQUAL(psys_ldw(state, 0x4000), 0x12ee);
+        CHECK(psys_compare_bytes(state, 0x4000, 0x4003, 3) > 0);
+    }
+    { /* Incremental snapshots only copy pages written since the last one */
+        struct psys_snapshot *snap0, *snap1, *snap2;
+        psys_fulladdr ipc1;
+        uint64_t start, insns;
+        reset_state(state);
+        state->trace = NULL;
+        psys_write_bytes(state, state->ipc, job_code, sizeof(job_code));
+        psys_dirty_enable(state);
+        snap0 = psys_snapshot_take(state);
+        CHECK_EQUAL(psys_snapshot_copied_pages(snap0), psys_snapshot_num_pages(snap0));
+        CHECK_EQUAL(psys_run(state, 500), PSYS_STOP_BUDGET);
+        snap1 = psys_snapshot_take(state);
+        ipc1  = state->ipc;
+        CHECK(psys_snapshot_copied_pages(snap1) > 0 && psys_snapshot_copied_pages(snap1) <= 2);
+        start = state->insn_count;
+        while (psys_run(state, 97) == PSYS_STOP_BUDGET)
+            ;
+        insns = state->insn_count - start;
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 0x49a3);
+        /* back to the middle, and run the rest again */
+        psys_snapshot_restore(state, snap1);
+        CHECK_EQUAL(state->ipc, ipc1);
+        CHECK(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)) != 0x49a3);
+        start = state->insn_count;
+        while (psys_run(state, 97) == PSYS_STOP_BUDGET)
+            ;
+        CHECK_EQUAL(state->insn_count - start, insns);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 0x49a3);
+        /* back to the start; a write is tracked by the next snapshot */
+        psys_snapshot_restore(state, snap0);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), 0);
+        psys_fill_bytes(state, 0x4000, 0xaa, 4);
+        snap2 = psys_snapshot_take(state);
+        CHECK_EQUAL(psys_snapshot_copied_pages(snap2), 1);
+        psys_snapshot_restore(state, snap1);
+        CHECK_EQUAL(psys_ldw(state, 0x4000), 0);
+        psys_snapshot_restore(state, snap2);
+        CHECK_EQUAL(psys_ldw(state, 0x4000), 0xaaaa);
+        psys_snapshot_release(snap0);
+        psys_snapshot_release(snap1);
+        psys_snapshot_release(snap2);
+        psys_dirty_disable(state);
+        state->trace = &psys_trace;
+    }
+    { /* Rewind buffer: budget eviction, and restoring frames further back */
+#define NUM_FRAMES 20
+        struct game_screen *screen = new_game_screen(NULL);
+        struct game_rewind *rw;
+        struct trace_step frames[NUM_FRAMES];
+        psys_word sum[NUM_FRAMES];
+        size_t budget;
+        uint32_t time;
+        unsigned i;
+        reset_state(state);
+        state->trace = NULL;
+        psys_write_bytes(state, state->ipc, job_code, sizeof(job_code));
+        /* one frame costs the whole state, every next one about a page */
+        rw = new_game_rewind(state, screen, SIZE_MAX);
+        CHECK(game_rewind_push(rw, 0));
+        budget = game_rewind_size(rw) + 4 * PSYS_PAGE_SIZE;
+        game_rewind_destroy(rw);
+        rw = new_game_rewind(state, screen, budget);
+        for (i = 0; i < NUM_FRAMES; ++i) {
+            CHECK_EQUAL(psys_run(state, 37), PSYS_STOP_BUDGET);
+            frames[i].ipc      = state->ipc;
+            frames[i].sp       = state->sp;
+            frames[i].mp       = state->mp;
+            frames[i].mem_hash = live_memory_hash(state, 0, 0);
+            sum[i]             = psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1));
+            CHECK(game_rewind_push(rw, i * 10));
+            CHECK(game_rewind_size(rw) <= budget);
+        }
+        /* older frames were dropped to stay within the budget */
+        CHECK(game_rewind_count(rw) > 1 && game_rewind_count(rw) < NUM_FRAMES);
+        CHECK(game_rewind_count(rw) <= 5);
+        /* run on, then go back three frames */
+        CHECK_EQUAL(psys_run(state, 100), PSYS_STOP_BUDGET);
+        i = game_rewind_count(rw);
+        CHECK(game_rewind_restore(rw, 3, &time));
+        CHECK_EQUAL(game_rewind_count(rw), i - 3);
+        CHECK_EQUAL(time, (NUM_FRAMES - 3) * 10);
+        CHECK_EQUAL(state->ipc, frames[NUM_FRAMES - 3].ipc);
+        CHECK_EQUAL(state->sp, frames[NUM_FRAMES - 3].sp);
+        CHECK_EQUAL(state->mp, frames[NUM_FRAMES - 3].mp);
+        CHECK_EQUAL(live_memory_hash(state, 0, 0), frames[NUM_FRAMES - 3].mem_hash);
+        CHECK_EQUAL(psys_ldw(state, W(state->mp + PSYS_MSCW_VAROFS, 1)), sum[NUM_FRAMES - 3]);
+        /* the restored frame was removed, so one step back is the one before */
+        CHECK(game_rewind_restore(rw, 1, &time));
+        CHECK_EQUAL(time, (NUM_FRAMES - 4) * 10);
+        CHECK_EQUAL(state->ipc, frames[NUM_FRAMES - 4].ipc);
+        CHECK_EQUAL(live_memory_hash(state, 0, 0), frames[NUM_FRAMES - 4].mem_hash);
+        CHECK(!game_rewind_restore(rw, game_rewind_count(rw) + 1, &time));
+        CHECK(!game_rewind_restore(rw, 0, &time));
+        game_rewind_destroy(rw);
+        screen->destroy(screen);
+        state->trace = &psys_trace;
+#undef NUM_FRAMES
+    }
+    { /* Background saver writes the state at capture time */
+#define NUM_BLOCKS 8
+        struct game_screen *screen = new_game_screen(NULL);
+        struct psys_binding *rspb  = psys_new_rsp(state);
+        struct game_saver *sv      = new_game_saver();
+        const char *filename       = "saver_test.sav";
+        struct game_save_ref *ref;
+        struct game_save_capture *cap;
+        struct game_saver_result result;
+        enum game_saver_status status;
+        struct psys_blockdev *disk;
+        struct trace_step saved;
+        psys_byte value;
+        uint32_t extra = 0x12345678;
+        FILE *f;
+        reset_state(state);
+        state->trace = NULL;
+        psys_write_bytes(state, state->ipc, job_code, sizeof(job_code));
+        psys_rsp_set_blockdev(rspb, 0,
+            psys_blockdev_new_overlay(psys_blockdev_new_mem(calloc(NUM_BLOCKS, PSYS_BLOCK_SIZE), NUM_BLOCKS * PSYS_BLOCK_SIZE, 0, true)),
+            PSYS_BLOCK_SIZE, true);
+        CHECK_EQUAL(psys_register_binding(state, rspb), 0);
+        disk = ((struct psys_rsp_state *)rspb->userdata)->disk0;
+        ref  = game_save_ref_new(state, rspb);
+        /* an existing save is replaced */
+        f = fopen(filename, "wb");
+        CHECK(f != NULL);
+        fputs("old save", f);
+        fclose(f);
+
+        CHECK_EQUAL(psys_run(state, 500), PSYS_STOP_BUDGET);
+        value = 0x55;
+        CHECK_EQUAL(psys_blockdev_update(disk, 3 * PSYS_BLOCK_SIZE, &value, 1), 0);
+        saved.ipc      = state->ipc;
+        saved.sp       = state->sp;
+        saved.mp       = state->mp;
+        saved.mem_hash = live_memory_hash(state, 0, 0);
+        cap            = game_save_capture(ref, state, rspb, screen, &extra, sizeof(extra));
+        CHECK(cap != NULL);
+        CHECK(game_saver_start(sv, cap, filename));
+        /* the game continues while the save is written */
+        CHECK_EQUAL(psys_run(state, 500), PSYS_STOP_BUDGET);
+        value = 0x66;
+        CHECK_EQUAL(psys_blockdev_update(disk, 3 * PSYS_BLOCK_SIZE, &value, 1), 0);
+        while ((status = game_saver_poll(sv, &result)) == GAME_SAVER_BUSY) {
+            util_msleep(1);
+        }
+        CHECK_EQUAL(status, GAME_SAVER_DONE);
+        CHECK(!strcmp(result.filename, filename));
+        CHECK(result.size > 0);
+        CHECK_EQUAL(game_saver_poll(sv, &result), GAME_SAVER_IDLE);
+        /* the temporary file was renamed over the save */
+        f = fopen("saver_test.sav.tmp", "rb");
+        CHECK(f == NULL);
+
+        extra = 0;
+        f     = fopen(filename, "rb");
+        CHECK(f != NULL);
+        CHECK(game_save_is_v2(f));
+        CHECK_EQUAL(game_load_state_v2(f, ref, state, rspb, screen, &extra, sizeof(extra)), 0);
+        fclose(f);
+        CHECK_EQUAL(extra, 0x12345678);
+        CHECK_EQUAL(state->ipc, saved.ipc);
+        CHECK_EQUAL(state->sp, saved.sp);
+        CHECK_EQUAL(state->mp, saved.mp);
+        CHECK_EQUAL(live_memory_hash(state, 0, 0), saved.mem_hash);
+        CHECK_EQUAL(psys_blockdev_read(disk, 3)[0], 0x55);
+        remove(filename);
+
+        game_saver_destroy(sv);
+        game_save_ref_destroy(ref);
+        psys_bindings_destroy(state);
+        psys_destroy_rsp(rspb);
+        screen->destroy(screen);
+        state->trace = &psys_trace;
+#undef NUM_BLOCKS
+    }
+    { /* State can be serialized to memory and back */
+        struct psys_writer w;
+        struct psys_reader r;
+        psys_byte code[sizeof(job_code)];
+        const psys_byte *data;
+        psys_fulladdr ipc;
+        uint32_t x = 0;
+        reset_state(state);
+        psys_write_bytes(state, state->ipc, job_code, sizeof(job_code));
+        ipc = state->ipc;
+        psys_writer_init(&w);
+        CHECK_EQUAL(psys_write_state(state, &w), 0);
+        CHECK(psys_writer_size(&w) > state->mem_size);
+        data = psys_writer_flatten(&w);
+        psys_fill_bytes(state, state->ipc, 0, sizeof(job_code));
+        state->ipc = 0;
+        psys_reader_init(&r, data, psys_writer_size(&w));
+        CHECK_EQUAL(psys_read_state(state, &r), 0);
+        CHECK_EQUAL(psys_reader_remaining(&r), 0);
+        CHECK_EQUAL(state->ipc, ipc);
+        psys_read_bytes(state, code, ipc, sizeof(code));
+        CHECK(!memcmp(code, job_code, sizeof(code)));
+        /* reads past the end fail without consuming anything */
+        psys_reader_init(&r, data, 2);
+        CHECK(PSYS_READ(&r, x) != 0);
+        CHECK_EQUAL(psys_reader_remaining(&r), 2);
+        CHECK(psys_read_ref(&r, 3) == NULL);
+        CHECK(psys_read_ref(&r, 2) == data);
+        psys_reader_init(&r, data, psys_writer_size(&w) - 1);
+        CHECK(psys_read_state(state, &r) < 0);
+        psys_writer_free(&w);
+    }
+    { /* Block devices: rotation, copy-on-write overlay and saving written blocks */
+#define NUM_BLOCKS 6
+        psys_byte *image = malloc(NUM_BLOCKS * PSYS_BLOCK_SIZE);
+        psys_byte all[NUM_BLOCKS * PSYS_BLOCK_SIZE];
+        psys_byte value = 0x55;
+        struct psys_blockdev *file, *dev;
+        struct psys_writer w;
+        struct psys_reader r;
+        const psys_byte *data;
+        const char *filename = "blockdev_test.img";
+        FILE *f;
+        unsigned blk;
+        for (blk = 0; blk < NUM_BLOCKS; ++blk) {
+            memset(&image[blk * PSYS_BLOCK_SIZE], blk, PSYS_BLOCK_SIZE);
+        }
+        /* file device is read-only and rotated the same way */
+        f = fopen(filename, "wb");
+        CHECK(f != NULL);
+        CHECK_EQUAL(fwrite(image, 1, NUM_BLOCKS * PSYS_BLOCK_SIZE, f), NUM_BLOCKS * PSYS_BLOCK_SIZE);
+        fclose(f);
+        CHECK(psys_blockdev_open_file(filename, NUM_BLOCKS + 1, 2) == NULL);
+        file = psys_blockdev_open_file(filename, NUM_BLOCKS, 2);
+        CHECK(file != NULL);
+        CHECK_EQUAL(psys_blockdev_read(file, 0)[0], 2);
+        CHECK_EQUAL(psys_blockdev_read(file, NUM_BLOCKS - 1)[0], 1);
+        CHECK(psys_blockdev_write(file, 0) == NULL);
+        CHECK(psys_blockdev_update(file, 0, &value, 1) < 0);
+        psys_blockdev_destroy(file);
+        remove(filename);
+
+        dev = psys_blockdev_new_overlay(psys_blockdev_new_mem(image, NUM_BLOCKS * PSYS_BLOCK_SIZE, 2, true));
+        CHECK_EQUAL(psys_blockdev_read(dev, 0)[0], 2);
+        CHECK_EQUAL(psys_blockdev_read(dev, NUM_BLOCKS - 1)[0], 1);
+        /* writes with the same contents are skipped */
+        value = 3;
+        CHECK_EQUAL(psys_blockdev_update(dev, PSYS_BLOCK_SIZE + 7, &value, 1), 0);
+        CHECK(!dev->is_written(dev, 1));
+        value = 0x55;
+        CHECK_EQUAL(psys_blockdev_update(dev, PSYS_BLOCK_SIZE + 7, &value, 1), 0);
+        CHECK(dev->is_written(dev, 1));
+        CHECK_EQUAL(psys_blockdev_read(dev, 1)[7], 0x55);
+        CHECK_EQUAL(psys_blockdev_read(dev, 1)[8], 3);
+        CHECK_EQUAL(image[3 * PSYS_BLOCK_SIZE + 7], 3);
+        CHECK(psys_blockdev_update(dev, NUM_BLOCKS * PSYS_BLOCK_SIZE, &value, 1) < 0);
+        psys_blockdev_read_all(dev, all);
+        CHECK_EQUAL(all[PSYS_BLOCK_SIZE + 7], 0x55);
+        CHECK_EQUAL(all[(NUM_BLOCKS - 1) * PSYS_BLOCK_SIZE], 1);
+        /* only the written block is saved */
+        psys_writer_init(&w);
+        CHECK_EQUAL(psys_blockdev_save_state(dev, &w), 0);
+        CHECK_EQUAL(psys_writer_size(&w), 2 * sizeof(uint32_t) + PSYS_BLOCK_SIZE);
+        data = psys_writer_flatten(&w);
+        psys_blockdev_write(dev, 4)[0] = 0xaa;
+        psys_blockdev_write(dev, 1)[7] = 0xaa;
+        psys_reader_init(&r, data, psys_writer_size(&w) - 1);
+        CHECK(psys_blockdev_load_state(dev, &r) < 0);
+        CHECK_EQUAL(psys_blockdev_read(dev, 4)[0], 0xaa);
+        psys_reader_init(&r, data, psys_writer_size(&w));
+        CHECK_EQUAL(psys_blockdev_load_state(dev, &r), 0);
+        CHECK_EQUAL(psys_reader_remaining(&r), 0);
+        CHECK(!dev->is_written(dev, 4));
+        CHECK_EQUAL(psys_blockdev_read(dev, 4)[0], 0);
+        CHECK_EQUAL(psys_blockdev_read(dev, 1)[7], 0x55);
+        psys_writer_free(&w);
+        psys_blockdev_destroy(dev);
+#undef NUM_BLOCKS
+    }
+    { /* Copy-on-write images: writes to a mapping are private to it */
+#define IMAGE_SIZE (3 * 4096 + 100)
+        psys_byte *data = malloc(IMAGE_SIZE);
+        struct util_cow_image *img;
+        psys_byte *map0, *map1, *map2;
+        unsigned i;
+        for (i = 0; i < IMAGE_SIZE; ++i) {
+            data[i] = i * 7;
+        }
+        img = util_cow_image_new(data, IMAGE_SIZE);
+        CHECK(img != NULL);
+        /* the image is a copy */
+        data[0] = 0xaa;
+        map0    = util_cow_map(img);
+        map1    = util_cow_map(img);
+        CHECK(map0 != NULL && map1 != NULL && map0 != map1);
+        CHECK_EQUAL(map0[0], 0);
+        CHECK(!memcmp(map0 + 1, data + 1, IMAGE_SIZE - 1));
+        CHECK(!memcmp(map0, map1, IMAGE_SIZE));
+        /* write to every page of one mapping */
+        for (i = 0; i < IMAGE_SIZE; i += 1000) {
+            map0[i] ^= 0xff;
+        }
+        map0[IMAGE_SIZE - 1] ^= 0xff;
+        CHECK_EQUAL(map0[1000], (psys_byte)(1000 * 7) ^ 0xff);
+        CHECK_EQUAL(map1[1000], (psys_byte)(1000 * 7));
+        CHECK_EQUAL(map1[IMAGE_SIZE - 1], (psys_byte)((IMAGE_SIZE - 1) * 7));
+        CHECK(!memcmp(map1 + 1, data + 1, IMAGE_SIZE - 1));
+        /* a new mapping sees the original, also after unmapping the written one */
+        map2 = util_cow_map(img);
+        CHECK(map2 != NULL);
+        CHECK(!memcmp(map2, map1, IMAGE_SIZE));
+        util_cow_unmap(img, map0);
+        util_cow_unmap(img, map2);
+        map2 = util_cow_map(img);
+        CHECK(map2 != NULL);
+        CHECK(!memcmp(map2, map1, IMAGE_SIZE));
+        util_cow_unmap(img, map1);
+        util_cow_unmap(img, map2);
+        util_cow_image_destroy(img);
+        free(data);
+#undef IMAGE_SIZE
+    }
+    { /* Replaying recorded input gives the same state, and detects divergence */
+#define NUM_VBLANKS 60
+        psys_byte *image = malloc(GAME_DISK_SIZE);
+        struct game_headless *hs, *replay;
+        struct game_headless_image *img;
+        struct game_recorder *rec;
+        struct game_script *script;
+        struct game_digest digest, replay_digest;
+        unsigned start, vblank;
+
+        /* tools/make_test_disk.py: polls the mouse, and hashes the result */
+        CHECK(game_load_disk_image("src/test/test_disk.st", image));
+        hs = new_game_headless(image, 1000);
+        CHECK_EQUAL(game_headless_run(hs, 5), PSYS_STOP_NONE);
+        img = game_headless_image_new(hs);
+        CHECK(img != NULL);
+        /* record scripted input, the way the SDL frontend does before every vblank */
+        rec = new_game_recorder("replay_test.txt", 1000, 8);
+        CHECK(rec != NULL);
+        start = hs->vblank;
+        for (vblank = start; vblank < start + NUM_VBLANKS; ++vblank) {
+            int x            = (vblank / 3) * 7 % SCREEN_WIDTH;
+            int y            = (vblank / 4) * 5 % SCREEN_HEIGHT;
+            unsigned buttons = (vblank / 10) & 1;
+            CHECK_EQUAL(game_headless_run(hs, vblank), PSYS_STOP_NONE);
+            game_screen_update_mouse(hs->screen, x, y, buttons);
+            game_recorder_mouse(rec, vblank, x, y, buttons);
+            game_recorder_vblank(rec, vblank, hs->psys, hs->rspb);
+        }
+        CHECK_EQUAL(game_headless_run(hs, vblank), PSYS_STOP_NONE);
+        CHECK_EQUAL(game_recorder_close(rec, vblank), 0);
+        game_digest_compute(&digest, hs->psys, hs->rspb);
+        CHECK(psys_ldw(hs->psys, W(hs->psys->base + PSYS_MSCW_VAROFS, 15)) > NUM_VBLANKS);
+
+        /* replay on an instance forked from before the recording */
+        script = game_script_load("replay_test.txt");
+        CHECK(script != NULL);
+        replay = game_headless_fork(img, script);
+        CHECK(replay != NULL);
+        CHECK_EQUAL(game_headless_run(replay, 0), PSYS_STOP_NONE);
+        CHECK(!replay->diverged);
+        CHECK_EQUAL(replay->vblank, vblank);
+        game_digest_compute(&replay_digest, replay->psys, replay->rspb);
+        CHECK_EQUAL(replay_digest.time, digest.time);
+        CHECK_EQUAL(replay_digest.memory, digest.memory);
+        game_headless_destroy(replay);
+
+        /* one corrupted byte is caught at the next digest */
+        replay = game_headless_fork(img, script);
+        CHECK(replay != NULL);
+        replay->psys->memory[0x8000] ^= 0x01;
+        CHECK_EQUAL(game_headless_run(replay, 0), PSYS_STOP_NONE);
+        CHECK(replay->diverged);
+        CHECK(replay->vblank < start + 8);
+        game_headless_destroy(replay);
+
+        game_script_destroy(script);
+        game_headless_image_destroy(img);
+        game_headless_destroy(hs);
+        free(image);
+        remove("replay_test.txt");
+#undef NUM_VBLANKS
+    }
+    { /* Independent VMs running game bindings concurrently give the same results */
+#define NUM_JOBS 16
+#define NUM_THREADS 4
+        struct vm_job reference, jobs[NUM_JOBS];
+        struct vm_pool pool;
+        pthread_t threads[NUM_THREADS];
+        unsigned i;
+        run_vm_job(&reference);
+        CHECK_EQUAL(reference.sum, 0x49a3);
+        pthread_mutex_init(&pool.lock, NULL);
+        pool.next_job = 0;
+        pool.num_jobs = NUM_JOBS;
+        pool.jobs     = jobs;
+        for (i = 0; i < NUM_THREADS; ++i) {
+            CHECK_EQUAL(pthread_create(&threads[i], NULL, vm_pool_thread, &pool), 0);
+        }
+        for (i = 0; i < NUM_THREADS; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&pool.lock);
+        for (i = 0; i < NUM_JOBS; ++i) {
+            CHECK_EQUAL(jobs[i].sum, reference.sum);
+            CHECK_EQUAL(jobs[i].insn_count, reference.insn_count);
+            CHECK_EQUAL(jobs[i].mem_hash, reference.mem_hash);
+            CHECK_EQUAL(jobs[i].screen_hash, reference.screen_hash);
+        }
+#undef NUM_JOBS
+#undef NUM_THREADS
+    }
     return 0;
 }
@@ -11,9 +11,9 @@
 #include <string.h>
 
 /* Read from set (in native endian) */
-#define I(x, y) F((x)[(y)])
+#define I(x, y) FM((x)[(y)])
 /* Write to set (in native endian) */
-#define O(x, y, v) (x)[(y)] = F(v)
+#define O(x, y, v) (x)[(y)] = FM(v)
 
 int main()
 {
@@ -8,9 +8,11 @@
 #include "psys/psys_constants.h"
 #include "psys/psys_debug.h"
 #include "psys/psys_helpers.h"
+#include "psys/psys_interpreter.h"
 #include "psys/psys_registers.h"
 #include "psys/psys_state.h"
 #include "util/memutil.h"
+#include "util/util_minmax.h"
 
 #include <readline/history.h>
 #include <readline/readline.h>
@@ -99,6 +101,12 @@ struct psys_debugger {
     /* Currently selected frame pointers (used for step-out and step-over) */
     psys_word target_mp1;
     psys_word target_mp2;
+    /* Function to call when debugger should trigger */
+    psys_hookfunc *break_func;
+    void *break_userdata;
+    /* Installed interpreter hooks */
+    int num_hooks;
+    struct psys_hook *hooks[MAX_BREAKPOINTS];
 };
 
 /** Primitive argument parsing / splitting.
@@ -185,7 +193,7 @@ static struct dbg_stackframe *get_stack_frames(struct psys_state *s)
         struct dbg_stackframe *frame_down;
         /** Fill in sib, segment name and static link for current frame */
         frame->sib = psys_ldw(s, frame->erec + PSYS_EREC_Env_SIB);
-        memcpy(&frame->seg, psys_bytes(s, frame->sib + PSYS_SIB_Seg_Name), 8);
+        psys_read_segment_id(s, &frame->seg, frame->sib + PSYS_SIB_Seg_Name);
         frame->msstat = psys_ldw(s, frame->mp + PSYS_MSCW_MSSTAT);
 
         /* Advance to caller frame, if there are any */
@@ -249,6 +257,42 @@ static struct dbg_stackframe *stack_frame_static_child(struct dbg_stackframe *fr
  */
 #define MAX_ARGS (10)
 
+/** Interpreter hook: check breakpoints and stepping */
+static void debugger_hook(struct psys_state *s, void *dbg_)
+{
+    struct psys_debugger *dbg = (struct psys_debugger *)dbg_;
+    if (psys_debugger_trace(dbg)) {
+        if (dbg->break_func) {
+            dbg->break_func(s, dbg->break_userdata);
+        } else {
+            psys_break(s);
+        }
+    }
+}
+
+/** Install interpreter hooks for the current breakpoints and mode. While
+ * stepping every instruction is checked, otherwise only breakpoint addresses.
+ */
+static void update_hooks(struct psys_debugger *dbg)
+{
+    struct psys_state *s = dbg->state;
+    int i;
+    for (i = 0; i < dbg->num_hooks; ++i) {
+        psys_remove_hook(s, dbg->hooks[i]);
+    }
+    dbg->num_hooks = 0;
+    if (dbg->mode != DM_NONE) {
+        dbg->hooks[dbg->num_hooks++] = psys_add_insn_hook(s, debugger_hook, dbg);
+        return;
+    }
+    for (i = 0; i < dbg->num_breakpoints; ++i) {
+        struct dbg_breakpoint *brk = &dbg->breakpoints[i];
+        if (brk->used && brk->active) {
+            dbg->hooks[dbg->num_hooks++] = psys_add_address_hook(s, &brk->seg, brk->addr, debugger_hook, dbg);
+        }
+    }
+}
+
 void psys_debugger_run(struct psys_debugger *dbg, bool user)
 {
     struct psys_state *s = dbg->state;
@@ -334,13 +378,15 @@ void psys_debugger_run(struct psys_debugger *dbg, bool user)
                     psys_word data_size = psys_ldw(s, sib + PSYS_SIB_Data_Size) * 2; /* globals size in bytes */
                     psys_word evec      = psys_ldw(s, erec + PSYS_EREC_Env_Vect);
                     psys_word num_evec  = psys_ldw(s, W(evec, 0));
+                    struct psys_segment_id id;
 
                     unsigned i;
                     /* Print main segment */
+                    psys_read_segment_id(s, &id, sib + PSYS_SIB_Seg_Name);
                     printf("%04x   %04x %c %-8.8s %04x %04x\n",
                         erec, sib,
                         is_segment_resident(s, erec) ? 'R' : '-',
-                        psys_bytes(s, sib + PSYS_SIB_Seg_Name),
+                        id.name,
                         data_base, data_size);
                     /* Subsidiary segments. These will be referenced in the segment's evec
                      * and have the same evec pointer (and the same BASE, but that's less reliable
@@ -352,10 +398,11 @@ void psys_debugger_run(struct psys_debugger *dbg, bool user)
                             psys_word ssib  = psys_ldw(s, serec + PSYS_EREC_Env_SIB);
                             psys_word sevec = psys_ldw(s, serec + PSYS_EREC_Env_Vect);
                             if (serec != erec && sevec == evec) {
+                                psys_read_segment_id(s, &id, ssib + PSYS_SIB_Seg_Name);
                                 printf("  %04x %04x %c %-8.8s\n",
                                     serec, ssib,
                                     is_segment_resident(s, serec) ? 'R' : '-',
-                                    psys_bytes(s, ssib + PSYS_SIB_Seg_Name));
+                                    id.name);
                             }
                         }
                     }
@@ -380,9 +427,16 @@ void psys_debugger_run(struct psys_debugger *dbg, bool user)
                 goto cleanup;
             } else if (!strcmp(cmd, "dm")) { /* Dump memory */
                 if (num >= 2) {
-                    FILE *f   = fopen(args[1], "wb");
-                    size_t rv = fwrite(s->memory, 1, s->mem_size, f);
-                    (void)rv;
+                    FILE *f = fopen(args[1], "wb");
+                    psys_byte buf[4096];
+                    size_t ptr, n;
+                    for (ptr = 0; ptr < s->mem_size; ptr += n) { /* dump in big-endian layout */
+                        size_t rv;
+                        n = umin(s->mem_size - ptr, sizeof(buf));
+                        psys_read_bytes(s, buf, ptr, n);
+                        rv = fwrite(buf, 1, n, f);
+                        (void)rv;
+                    }
                     fclose(f);
                     printf("Wrote memory dump to %s\n", args[1]);
                 } else {
@@ -580,15 +634,16 @@ cleanup:
     /* Clean up state and exit */
     stack_frames_free(frames);
     free(line);
+    update_hooks(dbg);
 }
 
-/** Called for every instruction - this should break on breakpoints */
+/** Called from interpreter hooks - this should break on breakpoints */
 bool psys_debugger_trace(struct psys_debugger *dbg)
 {
-    struct psys_state *s     = dbg->state;
-    psys_word sib            = psys_ldw(s, s->erec + PSYS_EREC_Env_SIB);
-    const psys_byte *segname = psys_bytes(s, sib + PSYS_SIB_Seg_Name);
-    psys_word pc             = s->ipc - s->curseg; /* PC relative to current segment */
+    struct psys_state *s = dbg->state;
+    psys_word sib        = psys_ldw(s, s->erec + PSYS_EREC_Env_SIB);
+    psys_word pc         = s->ipc - s->curseg; /* PC relative to current segment */
+    struct psys_segment_id seg;
     int i;
     if (!(s->erec == dbg->curerec && pc == dbg->curipc)) {
         /* Make sure at least one instruction has been executed after the command was set.
@@ -609,9 +664,10 @@ bool psys_debugger_trace(struct psys_debugger *dbg)
             }
         }
 
+        psys_read_segment_id(s, &seg, sib + PSYS_SIB_Seg_Name);
         for (i = 0; i < dbg->num_breakpoints; ++i) {
             struct dbg_breakpoint *brk = &dbg->breakpoints[i];
-            if (brk->used && brk->active && pc == brk->addr && !memcmp(segname, &brk->seg, 8)) {
+            if (brk->used && brk->active && pc == brk->addr && seg.num == brk->seg.num) {
                 printf("Hit breakpoint %d at %.8s:0x%x\n", i, brk->seg.name, brk->addr);
                 return true;
             }
@@ -631,7 +687,17 @@ struct psys_debugger *psys_debugger_new(struct psys_state *s)
     return dbg;
 }
 
+void psys_debugger_set_break_func(struct psys_debugger *dbg, psys_hookfunc *func, void *userdata)
+{
+    dbg->break_func     = func;
+    dbg->break_userdata = userdata;
+}
+
 void psys_debugger_destroy(struct psys_debugger *dbg)
 {
+    int i;
+    for (i = 0; i < dbg->num_hooks; ++i) {
+        psys_remove_hook(dbg->state, dbg->hooks[i]);
+    }
     free(dbg);
 }
@@ -6,6 +6,7 @@
 #ifndef H_DEBUGGER
 #define H_DEBUGGER
 
+#include "psys/psys_hooks.h"
 #include "psys/psys_types.h"
 
 #ifdef __cplusplus
@@ -16,15 +17,23 @@ struct psys_debugger;
 
 extern struct psys_debugger *psys_debugger_new(struct psys_state *s);
 
+/** Set function to call (from the interpreter thread) when a breakpoint is
+ * hit or a step completes. If not set, the interpreter is stopped with
+ * psys_break.
+ */
+extern void psys_debugger_set_break_func(struct psys_debugger *dbg, psys_hookfunc *func, void *userdata);
+
 /** Start interactive debugger.
  * *user* should be true if the user requested entering the debugger,
  * or it was entered for an outside reason, false if this was automatic due to
- * psys_debugger_trace returning true.
+ * the break function being called.
+ * On exit, the interpreter hooks are updated for the current breakpoints and
+ * stepping mode.
  */
 extern void psys_debugger_run(struct psys_debugger *dbg, bool user);
 
-/** Trace function - call this for every instruction. Returns true if debugger
- * should trigger, false otherwise.
+/** Trace function - returns true if debugger should trigger, false otherwise.
+ * The hooks installed by psys_debugger_run call this when needed.
  */
 extern bool psys_debugger_trace(struct psys_debugger *dbg);
 
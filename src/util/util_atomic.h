@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Atomic flags shared between threads, for code that cannot depend on SDL.
+ * The project is C99, so this uses compiler intrinsics instead of stdatomic.h.
+ */
+#ifndef H_UTIL_ATOMIC
+#define H_UTIL_ATOMIC
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+typedef volatile long util_atomic_int;
+
+/* Read value, without ordering (for polling) */
+static inline int util_atomic_get(util_atomic_int *a)
+{
+    return *a; /* aligned volatile loads are atomic on MSVC targets */
+}
+
+/* Set value, ordered after preceding writes */
+static inline void util_atomic_set(util_atomic_int *a, int v)
+{
+    _InterlockedExchange(a, v);
+}
+
+/* Set value and return the previous value, with full ordering */
+static inline int util_atomic_exchange(util_atomic_int *a, int v)
+{
+    return _InterlockedExchange(a, v);
+}
+#else
+typedef int util_atomic_int;
+
+static inline int util_atomic_get(util_atomic_int *a)
+{
+    return __atomic_load_n(a, __ATOMIC_RELAXED);
+}
+
+static inline void util_atomic_set(util_atomic_int *a, int v)
+{
+    __atomic_store_n(a, v, __ATOMIC_RELEASE);
+}
+
+static inline int util_atomic_exchange(util_atomic_int *a, int v)
+{
+    return __atomic_exchange_n(a, v, __ATOMIC_ACQ_REL);
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
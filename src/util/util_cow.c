@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L /* fileno */
+#define UTIL_COW_MMAP
+#endif
+
+#include "util_cow.h"
+
+#include "util/memutil.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef UTIL_COW_MMAP
+#include <sys/mman.h>
+#endif
+
+struct util_cow_image {
+    size_t size;
+#ifdef UTIL_COW_MMAP
+    FILE *file; /* unlinked temporary file with contents */
+#else
+    void *data;
+#endif
+};
+
+struct util_cow_image *util_cow_image_new(const void *data, size_t size)
+{
+    struct util_cow_image *img = CALLOC_STRUCT(util_cow_image);
+    img->size                  = size;
+#ifdef UTIL_COW_MMAP
+    img->file = tmpfile();
+    if (!img->file || fwrite(data, 1, size, img->file) < size || fflush(img->file)) {
+        util_cow_image_destroy(img);
+        return NULL;
+    }
+#else
+    img->data = malloc(size);
+    memcpy(img->data, data, size);
+#endif
+    return img;
+}
+
+void util_cow_image_destroy(struct util_cow_image *img)
+{
+    if (!img) {
+        return;
+    }
+#ifdef UTIL_COW_MMAP
+    if (img->file) {
+        fclose(img->file);
+    }
+#else
+    free(img->data);
+#endif
+    free(img);
+}
+
+void *util_cow_map(const struct util_cow_image *img)
+{
+#ifdef UTIL_COW_MMAP
+    void *ptr = mmap(NULL, img->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(img->file), 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+#else
+    void *ptr = malloc(img->size);
+    if (ptr) {
+        memcpy(ptr, img->data, img->size);
+    }
+    return ptr;
+#endif
+}
+
+void util_cow_unmap(const struct util_cow_image *img, void *ptr)
+{
+#ifdef UTIL_COW_MMAP
+    munmap(ptr, img->size);
+#else
+    free(ptr);
+#endif
+}
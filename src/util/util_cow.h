@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Read-only images that can be mapped copy-on-write any number of times.
+ *
+ * On POSIX systems the image is kept in an unlinked temporary file, and every
+ * mapping is a private mapping of that file, so pages are shared between
+ * mappings until they are written to. Elsewhere, every mapping is a copy.
+ */
+#ifndef H_UTIL_COW
+#define H_UTIL_COW
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct util_cow_image;
+
+/** Create image with a copy of *size* bytes of *data*. Returns NULL on
+ * failure.
+ */
+struct util_cow_image *util_cow_image_new(const void *data, size_t size);
+
+/** Destroy image. All mappings must have been unmapped. Can be passed NULL. */
+void util_cow_image_destroy(struct util_cow_image *img);
+
+/** Map the image copy-on-write. Returns NULL on failure. */
+void *util_cow_map(const struct util_cow_image *img);
+
+/** Unmap a mapping of the image. */
+void util_cow_unmap(const struct util_cow_image *img, void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
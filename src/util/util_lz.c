@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "util_lz.h"
+
+#include <string.h>
+
+/* Minimum match length */
+#define MIN_MATCH 4
+/* Maximum match offset */
+#define MAX_OFFSET 0xffff
+/* The last bytes of input are always literals, so that the matcher can read
+ * ahead without bounds checks.
+ */
+#define LAST_LITERALS 8
+/* Hash table of positions of 4-byte sequences */
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t rv;
+    memcpy(&rv, p, sizeof(rv));
+    return rv;
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t rv;
+    memcpy(&rv, p, sizeof(rv));
+    return rv;
+}
+
+static inline unsigned hash32(uint32_t x)
+{
+    return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Write length that did not fit in the token */
+static uint8_t *write_length(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/* Write sequence of literals followed by a match, or only literals if
+ * match_len is 0.
+ */
+static uint8_t *write_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len, size_t offset, size_t match_len)
+{
+    uint8_t *token = op++;
+    size_t ml      = match_len ? match_len - MIN_MATCH : 0;
+    *token         = ((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15);
+    if (lit_len >= 15) {
+        op = write_length(op, lit_len - 15);
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len) {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        if (ml >= 15) {
+            op = write_length(op, ml - 15);
+        }
+    }
+    return op;
+}
+
+size_t util_lz_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+size_t util_lz_compress(const uint8_t *in, size_t len, uint8_t *out)
+{
+    uint32_t table[HASH_SIZE];
+    const uint8_t *ip     = in;
+    const uint8_t *anchor = in;
+    const uint8_t *limit  = in + (len > LAST_LITERALS ? len - LAST_LITERALS : 0);
+    uint8_t *op           = out;
+
+    memset(table, 0, sizeof(table));
+    while (ip + MIN_MATCH <= limit) {
+        uint32_t seq       = read32(ip);
+        unsigned h         = hash32(seq);
+        const uint8_t *ref = in + table[h];
+        table[h]           = ip - in;
+        if (ref < ip && ip - ref <= MAX_OFFSET && read32(ref) == seq) {
+            const uint8_t *mp = ip + MIN_MATCH;
+            /* extend match, a word at a time */
+            while (mp + 8 <= limit && read64(mp) == read64(ref + (mp - ip))) {
+                mp += 8;
+            }
+            while (mp < limit && *mp == ref[mp - ip]) {
+                mp += 1;
+            }
+            op     = write_sequence(op, anchor, ip - anchor, ip - ref, mp - ip);
+            ip     = mp;
+            anchor = ip;
+        } else {
+            /* skip faster through data that does not compress */
+            ip += 1 + ((ip - anchor) >> 6);
+        }
+    }
+    op = write_sequence(op, anchor, in + len - anchor, 0, 0);
+    return op - out;
+}
+
+/* Read length that did not fit in the token */
+static int read_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int util_lz_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t out_len)
+{
+    const uint8_t *ip   = in;
+    const uint8_t *iend = in + len;
+    uint8_t *op         = out;
+    uint8_t *oend       = out + out_len;
+    while (ip < iend) {
+        uint8_t token  = *ip++;
+        size_t lit_len = token >> 4;
+        size_t match_len, offset;
+        if (lit_len == 15 && read_length(&ip, iend, &lit_len) < 0) {
+            return -1;
+        }
+        if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend) { /* last sequence has no match */
+            break;
+        }
+        if (iend - ip < 2) {
+            return -1;
+        }
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        match_len = token & 15;
+        if (match_len == 15 && read_length(&ip, iend, &match_len) < 0) {
+            return -1;
+        }
+        match_len += MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || match_len > (size_t)(oend - op)) {
+            return -1;
+        }
+        if (offset == 1) { /* run */
+            memset(op, op[-1], match_len);
+        } else if (offset >= match_len) {
+            memcpy(op, op - offset, match_len);
+        } else { /* byte by byte, as the match overlaps the output */
+            for (size_t x = 0; x < match_len; ++x) {
+                op[x] = (op - offset)[x];
+            }
+        }
+        op += match_len;
+    }
+    return op == oend ? 0 : -1;
+}
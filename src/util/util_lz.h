@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+/* Fast LZ77 compressor, for save states. Byte-oriented, in the style of LZ4:
+ * every sequence is a token, literals, and a match of at least 4 bytes at an
+ * offset of at most 64 KiB. Long runs (such as the zeros in a delta) are
+ * matches at offset 1, so they cost a few bytes.
+ */
+#ifndef H_UTIL_LZ
+#define H_UTIL_LZ
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum compressed size of *len* bytes of input. */
+extern size_t util_lz_bound(size_t len);
+
+/** Compress *len* bytes from *in* to *out*, which must have room for
+ * util_lz_bound(len) bytes. Returns the compressed size.
+ */
+extern size_t util_lz_compress(const uint8_t *in, size_t len, uint8_t *out);
+
+/** Decompress *len* bytes from *in* to *out*, which must decompress to exactly
+ * *out_len* bytes. Returns 0 on success, -1 if the data is corrupt.
+ */
+extern int util_lz_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,8 +1,38 @@
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, nanosleep */
+#endif
+
 #include "util_time.h"
 
-#include <SDL.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 void util_msleep(unsigned int msec)
 {
-    SDL_Delay(msec);
+#ifdef _WIN32
+    Sleep(msec);
+#else
+    struct timespec ts;
+    ts.tv_sec  = msec / 1000;
+    ts.tv_nsec = (long)(msec % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) != 0) /* continue after signals */
+        ;
+#endif
+}
+
+uint32_t util_ticks_ms(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint32_t)(now.QuadPart / (freq.QuadPart / 1000));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
 }
@@ -1,6 +1,8 @@
 #ifndef H_UTIL_TIME
 #define H_UTIL_TIME
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,6 +10,11 @@ extern "C" {
 /* Sleep for a specified number of milliseconds */
 void util_msleep(unsigned int ms);
 
+/* Monotonic time in milliseconds from an unspecified starting point. This
+ * wraps around, so only differences are meaningful.
+ */
+uint32_t util_ticks_ms(void);
+
 #ifdef __cplusplus
 }
 #endif
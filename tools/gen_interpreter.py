@@ -3,7 +3,9 @@
 # Distributed under the MIT software license, see the accompanying
 # file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-# Generate interpreter skeleton
+# Generate opcode tables and interpreter dispatch table.
+# Must be run from the top-level source directory.
+import argparse
 import sys
 
 import opcodes, pme_defs
@@ -92,90 +94,280 @@ def handler_name(x):
     else:
         return 'do_'+op[0].lower().replace('-','_')
 
-ACCESSORS = [
-    'pc_big',  # varlen
-    'pc_byte', # byte
-    'pc_word', # LE word
-]
-
-def gen_dispatcher(out = sys.stdout):
-    out.write('/* Read byte from PC */\n')
-    out.write('static inline psys_byte pc_byte(struct psys_state *state)\n')
-    out.write('{\n')
-    out.write('    return psys_load_byte(state, state->ipc++);\n')
-    out.write('}\n')
+def gen_dispatch_table(out = sys.stdout):
+    out.write('/* auto-generated by gen_interpreter.py */\n')
+    out.write('/* Handler label for every opcode, for use by the threaded interpreter.\n')
+    out.write(' * Every label named here must be defined exactly once in psys_interpreter().\n')
+    out.write(' */\n')
+    out.write('#define PSYS_DISPATCH_LABELS(X) \\\n')
+    for i,op in enumerate(opcodes.OPCODES):
+        out.write('    X(%-12s) /* 0x%02x %-8s */' % (handler_name(i), i, op[0].lower()))
+        if i != 255:
+            out.write(' \\')
+        out.write('\n')
+
+# Superinstructions: sequences of simple instructions that are fused into one
+# handler by the predecode pass. Only instructions that cannot raise an
+# execution error or fault, call out or switch tasks can be fused, and a
+# control flow instruction can only appear at the end of a sequence, so that a
+# fused sequence always behaves as one uninterruptible unit.
+#
+# Handler code for each instruction, {a} is the operand of the instruction
+# (either encoded in the opcode or the first argument).
+FUSABLE = {
+    'do_sldc':  'PUSH({a});',
+    'do_sldl':  'PUSH(psys_ldw(s, local_addr(s, {a})));',
+    'do_sldo':  'PUSH(psys_ldw(s, global_addr(s, {a})));',
+    'do_slla':  'PUSH(local_addr(s, {a}));',
+    'do_sstl':  'tos0 = POP(); psys_stw(s, local_addr(s, {a}), tos0);',
+    'do_sind':  'tos0 = TOP(); SET_TOP(psys_ldw(s, W(tos0, {a})));',
+    'do_ldcb':  'PUSH({a});',
+    'do_ldci':  'PUSH({a});',
+    'do_ldcn':  'PUSH(PSYS_NIL);',
+    'do_lla':   'PUSH(local_addr(s, {a}));',
+    'do_ldo':   'PUSH(psys_ldw(s, global_addr(s, {a})));',
+    'do_lao':   'PUSH(global_addr(s, {a}));',
+    'do_ldl':   'PUSH(psys_ldw(s, local_addr(s, {a})));',
+    'do_stl':   'tos0 = POP(); psys_stw(s, local_addr(s, {a}), tos0);',
+    'do_sro':   'tos0 = POP(); psys_stw(s, global_addr(s, {a}), tos0);',
+    'do_ind':   'tos0 = TOP(); SET_TOP(psys_ldw(s, W(tos0, {a})));',
+    'do_inc':   'tos0 = TOP(); SET_TOP(W(tos0, {a}));',
+    'do_ixa':   'tos0 = POP(); tos1 = TOP(); SET_TOP(W(tos1, {a} * tos0));',
+    'do_sto':   'tos0 = POP(); tos1 = POP(); psys_stw(s, tos1, tos0);',
+    'do_ldb':   'tos0 = POP(); tos1 = TOP(); SET_TOP(psys_ldb(s, tos1, tos0));',
+    'do_adi':   'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 + tos0);',
+    'do_sbi':   'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 - tos0);',
+    'do_mpi':   'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 * tos0);',
+    'do_land':  'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 & tos0);',
+    'do_lor':   'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 | tos0);',
+    'do_equi':  'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 == tos0);',
+    'do_neqi':  'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 != tos0);',
+    'do_leqi':  'tos0 = SPOP(); tos1 = signext_word(TOP()); SET_TOP(tos1 <= tos0);',
+    'do_geqi':  'tos0 = SPOP(); tos1 = signext_word(TOP()); SET_TOP(tos1 >= tos0);',
+    'do_leusw': 'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 <= tos0);',
+    'do_geusw': 'tos0 = POP(); tos1 = TOP(); SET_TOP(tos1 >= tos0);',
+    'do_bnot':  'tos0 = TOP(); SET_TOP(!BOOL(tos0));',
+    'do_lnot':  'tos0 = TOP(); SET_TOP(~tos0);',
+    'do_inci':  'tos0 = TOP(); SET_TOP(tos0 + 1);',
+    'do_deci':  'tos0 = TOP(); SET_TOP(tos0 - 1);',
+    'do_dup1':  'tos0 = POP(); PUSH(tos0); PUSH(tos0);',
+    'do_swap':  'tos0 = POP(); tos1 = TOP(); SET_TOP(tos0); PUSH(tos1);',
+    # control flow, only allowed at the end of a sequence
+    'do_ujp':   'JUMP({a});',
+    'do_fjp':   'tos0 = POP(); if (!BOOL(tos0)) { JUMP({a}); }',
+    'do_tjp':   'tos0 = POP(); if (BOOL(tos0)) { JUMP({a}); }',
+}
+FUSABLE_CFLOW = {'do_ujp', 'do_fjp', 'do_tjp'}
+# Maximum number of instructions in a superinstruction (PSYS_SUPERINST_MAX_LEN
+# in psys_predecode.h), and of operands (limited by number of argument slots in
+# a predecoded instruction)
+SUPERINST_MAX_LEN = 4
+SUPERINST_MAX_OPERANDS = 3
+# Default number of superinstructions to select from a profile
+SUPERINST_DEFAULT_COUNT = 16
+# Profile that the checked-in tables are generated from
+SUPERINST_DEFAULT_PROFILE = 'tools/superinst_profile.txt'
+
+def handler_family(name):
+    '''Return (first opcode, last opcode) of the instructions sharing a handler.'''
+    ops = [i for i in range(256) if handler_name(i) == name]
+    assert ops == list(range(ops[0], ops[-1] + 1))
+    return (ops[0], ops[-1])
+
+def operand_source(name):
+    '''Return the operand source of an instruction family: base value for
+    operand encoded in opcode, 'arg' for first argument, or None.'''
+    (first, last) = handler_family(name)
+    if last != first: # operand encoded in opcode
+        if name in {'do_sldc', 'do_sind'}:
+            return 0
+        return 1
+    if opcodes.OPCODES[first][1]:
+        return 'arg'
+    return None
+
+def superinst_ok(seq):
+    '''Can this sequence be fused?'''
+    if not (2 <= len(seq) <= SUPERINST_MAX_LEN):
+        return False
+    if not all(name in FUSABLE for name in seq):
+        return False
+    if any(name in FUSABLE_CFLOW for name in seq[:-1]):
+        return False
+    return sum(operand_source(name) is not None for name in seq) <= SUPERINST_MAX_OPERANDS
+
+def read_profile(f, count):
+    '''Select superinstructions from an opcode n-gram profile, as produced by
+    opcode_ngrams.py. Sequences are ranked by the number of dispatches saved.'''
+    candidates = []
+    for line in f:
+        line = line.strip()
+        if not line or line.startswith('#'):
+            continue
+        fields = line.split()
+        seq = tuple('do_' + x.lower() for x in fields[1:])
+        if superinst_ok(seq):
+            candidates.append((int(fields[0]) * (len(seq) - 1), seq))
+    candidates.sort(key=lambda x: -x[0])
+    return [seq for (_, seq) in candidates[0:count]]
+
+def superinst_comment(seq):
+    return ' '.join(name[3:] for name in seq)
+
+def gen_superinst_table(superinsts, out = sys.stdout):
+    out.write('/* auto-generated by gen_interpreter.py */\n')
+    out.write('#define PSYS_SUPERINST_COUNT %d\n' % len(superinsts))
     out.write('\n')
-    out.write('/* Read LE word from PC */\n')
-    out.write('static inline psys_word pc_word(struct psys_state *state)\n')
-    out.write('{\n')
-    out.write('    psys_word a = psys_load_byte(state, state->ipc++);\n')
-    out.write('    psys_word b = psys_load_byte(state, state->ipc++);\n')
-    out.write('    return a | (b << 8);\n')
-    out.write('}\n')
+    out.write('enum psys_superinst {\n')
+    for i,seq in enumerate(superinsts):
+        out.write('    PSOP_SUPER_%d = 0x%03x, /* %s */\n' % (i, 0x100 + i, superinst_comment(seq)))
+    out.write('};\n')
     out.write('\n')
-    out.write('/* Read BIG (varlen) from PC */\n')
-    out.write('static inline psys_word pc_big(struct psys_state *state)\n')
-    out.write('{\n')
-    out.write('    psys_word a = psys_load_byte(state, state->ipc++);\n')
-    out.write('    if (a >= 0x80) {\n')
-    out.write('        a = (a << 8) | psys_load_byte(state, state->ipc++);')
-    out.write('    }\n')
-    out.write('    return a;\n')
-    out.write('}\n')
+    out.write('#define PSYS_SUPERINST_LABELS(X) \\\n')
+    for i,seq in enumerate(superinsts):
+        out.write('    X(do_super_%d)' % i)
+        if i != len(superinsts) - 1:
+            out.write(' \\')
+        out.write('\n')
     out.write('\n')
-    out.write('void psys_interpreter(struct psys_state *s)\n')
-    out.write('{\n')
-    out.write('    static void *dispatch_table[256] = {\n')
+    out.write('/* Instructions in superinstruction: opcode range, and base value for\n')
+    out.write(' * operand encoded in opcode, -1 if it is the first argument, -2 if none.\n')
+    out.write(' */\n')
+    out.write('static const struct psys_superinst_desc psys_superinst_descriptions[PSYS_SUPERINST_COUNT] = {\n')
+    for i,seq in enumerate(superinsts):
+        elems = []
+        for name in seq:
+            (first, last) = handler_family(name)
+            operand = operand_source(name)
+            if operand is None:
+                operand = -2
+            elif operand == 'arg':
+                operand = -1
+            elems.append('{0x%02x, 0x%02x, %2d}' % (first, last, operand))
+        out.write('    {%d, {%s}}, /* %s */\n' % (len(seq), ', '.join(elems), superinst_comment(seq)))
+    out.write('};\n')
+
+def gen_superinst_cases(superinsts, out = sys.stdout):
+    out.write('/* auto-generated by gen_interpreter.py */\n')
+    for i,seq in enumerate(superinsts):
+        out.write('HANDLER(do_super_%d)\n' % i)
+        out.write('case PSOP_SUPER_%d: /* %s */\n' % (i, superinst_comment(seq)))
+        out.write('    SUPERINST_ENTRY(%d);\n' % len(seq))
+        argn = 0
+        for name in seq:
+            operand = None
+            if operand_source(name) is not None:
+                operand = 'insn->args[%d]' % argn
+                argn += 1
+            out.write('    %s\n' % FUSABLE[name].replace('{a}', str(operand)))
+        out.write('    DISPATCH();\n')
+
+def gen_jit_templates(out = sys.stdout):
+    out.write('/* auto-generated by gen_interpreter.py */\n')
+    for name in FUSABLE:
+        code = FUSABLE[name].replace('JUMP({a})', 'taken = 1').replace('{a}', 'a')
+        out.write('static int jit_%s(struct psys_state *s, int a)\n' % name)
+        out.write('{\n')
+        out.write('    psys_word sp = s->sp;\n')
+        temps = [t for t in ['tos0', 'tos1'] if t in code]
+        if temps:
+            out.write('    int %s;\n' % ', '.join(temps))
+        if name in FUSABLE_CFLOW:
+            out.write('    int taken = 0;\n')
+        out.write('    %s\n' % code)
+        out.write('    s->sp = sp;\n')
+        out.write('    return %s;\n' % ('taken' if name in FUSABLE_CFLOW else '0'))
+        out.write('}\n')
+    out.write('\n')
+    out.write('/* Template for every opcode, and its operand: value for operand encoded in\n')
+    out.write(' * opcode, -1 if it is the first argument, -2 if none.\n')
+    out.write(' */\n')
+    out.write('static const struct psys_jit_template psys_jit_templates[256] = {\n')
     for i,op in enumerate(opcodes.OPCODES):
-        if (i & 7) == 0:
-            out.write('    ')
-        handler = handler_name(i)
-        comma = ',' if i<255 else ''
-        if (i & 7) == 7:
-            out.write('{:}\n'.format('&&'+handler+comma))
+        name = handler_name(i)
+        if name in FUSABLE:
+            (first, last) = handler_family(name)
+            operand = operand_source(name)
+            if operand is None:
+                operand = -2
+            elif operand == 'arg':
+                operand = -1
+            else:
+                operand = i - first + operand
+            if name == 'do_ujp':
+                flags = 'PSYS_JIT_JUMP'
+            elif name in FUSABLE_CFLOW:
+                flags = 'PSYS_JIT_JUMP | PSYS_JIT_COND'
+            else:
+                flags = '0'
+            out.write('    {&jit_%s, %d, %s},' % (name, operand, flags))
         else:
-            out.write('{:16}'.format('&&'+handler+comma))
-    out.write('    };\n')
-    out.write('    int op;\n')
-    out.write('    int arg0,arg1,arg2;\n')
-    out.write('    int tos0,tos1,tos2,tos3;\n')
-    out.write('#define DISPATCH() op = pc_byte(s); goto *dispatch_table[op]\n')
-    out.write('    DISPATCH();\n')
-    generated = set()
-    out.write('    while (s->running) {\n')
-    for i,op in enumerate(opcodes.OPCODES):
-        if op[2] & opcodes.UNDEF:
-            continue
-        handler = handler_name(i)
-        if handler in generated:
-            continue
-        generated.add(handler)
-        out.write('        {}:\n'.format(handler_name(i)))
-        for i,arg in enumerate(op[1]):
-            s = ACCESSORS[arg & opcodes.ARGTMASK]
-            out.write('            arg{:d} = {}(s);\n'.format(i,s))
-        if op[3] is not None:
-            for i in range(op[3]):
-                out.write('            tos{:d} = psys_pop(s);\n'.format(i))
-        if op[4] is not None:
-            for i in range(op[4]):
-                out.write('            psys_push(s, 0);\n'.format(i))
-        out.write('            DISPATCH();\n')
-    out.write('        do_invalid:\n')
-    out.write('            s->error = PSYS_ERR_INVALID_INSTRUCTION;\n')
-    out.write('    }\n')
-    out.write('    s->error = PSYS_OK;\n')
-    out.write('}\n')
+            out.write('    {NULL, 0, 0},')
+        out.write(' /* 0x%02x %s */\n' % (i, op[0].lower()))
+    out.write('};\n')
+
+COPYRIGHT = '''/*
+ * Copyright (c) 2017 Wladimir J. van der Laan
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+'''
 
 if __name__ == '__main__':
-    with open('src/psys_opcodes.h', 'w') as out:
-        gen_opcodes_enum(out)
-    with open('src/psys_opcodes.c', 'w') as out:
+    parser = argparse.ArgumentParser(description='Generate opcode tables and interpreter dispatch table.')
+    parser.add_argument('--profile', metavar='FILE', type=argparse.FileType('r'), default=SUPERINST_DEFAULT_PROFILE,
+            help='Opcode n-gram profile to select superinstructions from (see opcode_ngrams.py, default %s)' % SUPERINST_DEFAULT_PROFILE)
+    parser.add_argument('--superinsts', metavar='N', type=int, default=SUPERINST_DEFAULT_COUNT,
+            help='Maximum number of superinstructions to select from profile')
+    args = parser.parse_args()
+    superinsts = read_profile(args.profile, args.superinsts)
+
+    with open('src/psys/psys_opcodes.c', 'w') as out:
+        out.write(COPYRIGHT)
         out.write('#include "psys_opcodes.h"\n')
         out.write('\n')
+        out.write('// clang-format off')
         gen_opcodes_list(out)
-    #with open('src/psys_interpreter.c', 'w') as out:
-    #    out.write('#include "psys_interpreter.h"\n')
-    #    out.write('#include "psys_opcodes.h"\n')
-    #    out.write('\n')
-    #    gen_dispatcher(out)
+        out.write('// clang-format on\n')
+    with open('src/psys/psys_dispatch.h', 'w') as out:
+        out.write(COPYRIGHT)
+        out.write('#ifndef H_PSYS_DISPATCH\n')
+        out.write('#define H_PSYS_DISPATCH\n')
+        out.write('\n')
+        out.write('// clang-format off\n')
+        gen_dispatch_table(out)
+        out.write('// clang-format on\n')
+        out.write('\n')
+        out.write('#endif\n')
+    with open('src/psys/psys_superinst.h', 'w') as out:
+        out.write(COPYRIGHT)
+        out.write('#ifndef H_PSYS_SUPERINST\n')
+        out.write('#define H_PSYS_SUPERINST\n')
+        out.write('\n')
+        out.write('#include "psys_predecode.h"\n')
+        out.write('\n')
+        out.write('// clang-format off\n')
+        gen_superinst_table(superinsts, out)
+        out.write('// clang-format on\n')
+        out.write('\n')
+        out.write('#endif\n')
+    with open('src/psys/psys_jit_templates.h', 'w') as out:
+        out.write(COPYRIGHT)
+        out.write('/* Instruction templates for the JIT (see psys_jit.c). */\n')
+        out.write('#ifndef H_PSYS_JIT_TEMPLATES\n')
+        out.write('#define H_PSYS_JIT_TEMPLATES\n')
+        out.write('\n')
+        out.write('#include "psys_compiled.h"\n')
+        out.write('#include "psys_jit.h"\n')
+        out.write('\n')
+        out.write('// clang-format off\n')
+        gen_jit_templates(out)
+        out.write('// clang-format on\n')
+        out.write('\n')
+        out.write('#endif\n')
+    with open('src/psys/psys_superinst_cases.h', 'w') as out:
+        out.write(COPYRIGHT)
+        out.write('/* Superinstruction handlers, included into the interpreter loop. */\n')
+        out.write('// clang-format off\n')
+        gen_superinst_cases(superinsts, out)
+        out.write('// clang-format on\n')
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 Wladimir J. van der Laan
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+'''
+Generate the bootable disk image used by the replay test in inst_tests.
+
+The image has the layout of the game disk, but SYSTEM.PASCAL contains a
+single segment named GEMBIND, so that the native GEMBIND procedures can be
+called from it. Procedure 1 polls the mouse with VDI vq_mouse in a loop, and
+folds the result into a hash in global 14. Global 15 counts the polls.
+
+Usage:
+    make_test_disk.py <out.st>
+'''
+import sys
+import struct
+
+from opcodes import *
+
+BLOCK_SIZE = 512
+DISK_SIZE = 80 * 9 * BLOCK_SIZE
+# Boot volume starts at track 4, see GAME_DISK_FIRST_BLOCK and the bootstrap
+VOLUME_OFS = (3 * 9 + 9) * BLOCK_SIZE
+# Blocks relative to the boot volume. Block 6 is patched by game_setup_state
+# (SYSTEM.MISCINFO), so stay clear of it.
+GDIR_BLOCK = 2
+SYSTEM_PASCAL_BLOCK = 10
+
+# GEM address of memory address 0 (mem_fake_base in game_setup.c)
+MEM_FAKE_BASE = 0x000337ac - 0x10000
+
+# Globals: VDI context (contrl, intin, ptsin, intout, ptsout as GEM
+# addresses), then intout[0], ptsout[0..1], hash, count.
+G_CTX = 1
+G_INTOUT = 11
+G_PTSOUT = 12
+G_HASH = 14
+G_COUNT = 15
+NUM_GLOBALS = 16
+
+def gem_address(g_target, g_ctx):
+    '''Store GEM address of global g_target into the pair of globals at g_ctx.
+    The globals live in the first 64 kB, so the high word is fixed.'''
+    return [
+        LAO, g_target,
+        LDCI, MEM_FAKE_BASE & 0xff, (MEM_FAKE_BASE >> 8) & 0xff,
+        ADI,
+        SRO, g_ctx + 1,
+        SLDC0 + (MEM_FAKE_BASE >> 16),
+        SRO, g_ctx,
+    ]
+
+code = []
+code += gem_address(G_INTOUT, G_CTX + 6)
+code += gem_address(G_PTSOUT, G_CTX + 8)
+loop = len(code)
+code += [
+    LAO, G_CTX,
+    LDCB, 0x7c,                     # vq_mouse
+    SLDC0,                          # numptsin
+    SLDC0,                          # numintin
+    CGP, 0x02,                      # VDI
+    SLDO1 + G_HASH - 1,             # hash = hash * 33 + x + y * 7 + buttons
+    LDCB, 33,
+    MPI,
+    SLDO1 + G_PTSOUT - 1,
+    ADI,
+    SLDO1 + G_PTSOUT,
+    SLDC7,
+    MPI,
+    ADI,
+    SLDO1 + G_INTOUT - 1,
+    ADI,
+    SRO, G_HASH,
+    SLDO1 + G_COUNT - 1,            # count += 1
+    INCI,
+    SRO, G_COUNT,
+]
+code += [UJP, (loop - (len(code) + 2)) & 0xff]
+
+# Segment, big-endian like the game disk
+PROC1 = 0x1e     # header of procedure 1, code follows
+PROC2 = 0x100    # header of procedure 2, native
+PROCDICT = 0x110
+SEG_SIZE = 0x120
+assert PROC1 + 2 + len(code) <= PROC2
+seg = bytearray(SEG_SIZE)
+struct.pack_into('>H', seg, 0x00, PROCDICT // 2)
+seg[0x04:0x0c] = b'GEMBIND '
+struct.pack_into('>H', seg, 0x0c, 1) # endian: no byteswap needed
+struct.pack_into('>HH', seg, PROC1 - 2, (PROC1 + 2 + len(code)) // 2, 0)
+seg[PROC1 + 2:PROC1 + 2 + len(code)] = bytes(code)
+struct.pack_into('>H', seg, PROC2, 0xffff)
+struct.pack_into('>HHH', seg, PROCDICT - 4, PROC2 // 2, PROC1 // 2, 2)
+
+disk = bytearray(DISK_SIZE)
+def put(block, ofs, data):
+    ptr = VOLUME_OFS + block * BLOCK_SIZE + ofs
+    disk[ptr:ptr + len(data)] = data
+
+# Global directory with one entry, SYSTEM.PASCAL
+put(GDIR_BLOCK, 0x10, struct.pack('>H', 1))
+put(GDIR_BLOCK, 0x1a, struct.pack('>H', SYSTEM_PASCAL_BLOCK))
+put(GDIR_BLOCK, 0x1a + 0x06, b'\x0dSYSTEM.PASCAL\x00')
+# Segment dictionary: USERPROG in the next block
+put(SYSTEM_PASCAL_BLOCK, 0x3c, struct.pack('>HH', 1, SEG_SIZE // 2))
+put(SYSTEM_PASCAL_BLOCK, 0x120, struct.pack('>H', NUM_GLOBALS))
+put(SYSTEM_PASCAL_BLOCK + 1, 0, seg)
+
+with open(sys.argv[1], 'wb') as f:
+    f.write(disk)
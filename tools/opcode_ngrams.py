@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 Wladimir J. van der Laan
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+'''
+Build an opcode n-gram profile from an instruction trace, for selecting
+superinstructions with gen_interpreter.py --profile.
+
+The trace is the output of running the game with PSYS_DEBUG=8. Only runs of
+instructions that follow each other in memory, within the same segment and
+task, are counted. Output lines are "count FAMILY FAMILY ...", where a family
+is the interpreter handler that implements an opcode (so that e.g. all SLDL
+variants count as one).
+'''
+import argparse
+import collections
+import re
+import sys
+
+import opcodes
+from gen_interpreter import handler_name
+
+# SEGNAME_:0xPP:OOOO ipc=0xIIIII tib=TTTT sp=SSSS opname args (stack)
+TRACE_RE = re.compile(r'^(.{8}):0x([0-9a-f]+):([0-9a-f]+) ipc=0x([0-9a-f]+) tib=([0-9a-f]+) sp=[0-9a-f]+ (\S+)(.*?) \(')
+
+OPCODE_BY_NAME = {op[0].lower(): i for i,op in enumerate(opcodes.OPCODES)}
+
+def insn_length(op, args):
+    '''Compute length of instruction from opcode and printed arguments.'''
+    length = 1
+    for (argtype, val) in zip(opcodes.OPCODES[op][1], args):
+        argtype &= opcodes.ARGTMASK
+        if argtype == opcodes.VAR:
+            length += 2 if val >= 0x80 else 1
+        else:
+            length += argtype
+    return length
+
+def parse_trace(f):
+    '''Yield (segment, task, ipc, length, family) for every traced instruction.'''
+    for line in f:
+        m = TRACE_RE.match(line)
+        if not m:
+            continue
+        op = OPCODE_BY_NAME.get(m.group(6))
+        if op is None:
+            continue
+        args = [int(x, 0) for x in m.group(7).replace(',', ' ').split()]
+        yield (m.group(1), int(m.group(5), 16), int(m.group(4), 16),
+               insn_length(op, args), handler_name(op)[3:].upper())
+
+def count_ngrams(insns, maxlen):
+    counts = collections.Counter()
+    run = []
+    prev = None
+    for (seg, task, ipc, length, family) in insns:
+        if prev is None or (seg, task, ipc) != prev:
+            run = []
+        run.append(family)
+        run = run[-maxlen:]
+        for n in range(2, len(run) + 1):
+            counts[tuple(run[-n:])] += 1
+        prev = (seg, task, ipc + length)
+    return counts
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Build opcode n-gram profile from instruction trace.')
+    parser.add_argument('trace', type=argparse.FileType('r'), help='Trace log (PSYS_DEBUG=8 output)')
+    parser.add_argument('--max-length', type=int, default=4, help='Longest sequence to count')
+    parser.add_argument('--min-count', type=int, default=100, help='Omit sequences that occur less often')
+    args = parser.parse_args()
+
+    counts = count_ngrams(parse_trace(args.trace), args.max_length)
+    for (seq, count) in counts.most_common():
+        if count < args.min_count:
+            break
+        sys.stdout.write('%d %s\n' % (count, ' '.join(seq)))
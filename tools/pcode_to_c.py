@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 Wladimir J. van der Laan
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+'''
+Translate the p-code procedures of selected segments of a code file (e.g.
+SYSTEM.STARTUP) to C, for use by the interpreter as compiled procedures.
+
+Simple instructions are translated using the same handlers as the
+interpreter uses for superinstructions, as well as jumps and intermediate
+variable accesses. Compiled code leaves to the interpreter at any other
+instruction, and is entered again at the start of a procedure, after calls
+(when returning to the procedure) and at the targets of backward jumps. See
+src/psys/psys_compiled.h for the runtime side.
+'''
+import argparse
+import sys
+
+import opcodes
+from disass import disassemble_unit
+from gen_interpreter import FUSABLE, COPYRIGHT, handler_name, handler_family, operand_source
+from segdir import SegmentDirectory
+
+# Handlers for instructions in addition to the fusable ones. {a} is the first
+# operand, {b} the second.
+EXTRA = {
+    'do_ujpl':  'JUMP({a});',
+    'do_fjpl':  'tos0 = POP(); if (!BOOL(tos0)) { JUMP({a}); }',
+    'do_efj':   'tos0 = POP(); tos1 = POP(); if (tos1 != tos0) { JUMP({a}); }',
+    'do_nfj':   'tos0 = POP(); tos1 = POP(); if (tos1 == tos0) { JUMP({a}); }',
+    'do_lda':   'PUSH(intermd_addr(s, {a}, {b}));',
+    'do_lod':   'PUSH(psys_ldw(s, intermd_addr(s, {a}, {b})));',
+    'do_slod':  'PUSH(psys_ldw(s, intermd_addr(s, {a}, {b})));',
+    'do_str':   'tos0 = POP(); psys_stw(s, intermd_addr(s, {a}, {b}), tos0);',
+}
+HANDLERS = dict(FUSABLE, **EXTRA)
+# Jumps, with the target as first operand
+JUMPS = {'do_ujp', 'do_ujpl', 'do_fjp', 'do_fjpl', 'do_tjp', 'do_efj', 'do_nfj'}
+UNCONDITIONAL_JUMPS = {'do_ujp', 'do_ujpl'}
+TEMPS = ['tos0', 'tos1']
+# Offset of code in segment (PSYS_SEG_CODESTART)
+CODESTART = 0x16
+
+def code_hash(data):
+    '''FNV-1a hash of code, must match psys_compiled_code_hash.'''
+    h = 0x811c9dc5
+    for b in data:
+        h = ((h ^ b) * 0x01000193) & 0xffffffff
+    return h
+
+def operands(inst):
+    '''Return operands of an instruction, as used in handlers.'''
+    name = handler_name(inst.opcode)
+    (first, last) = handler_family(name)
+    if name == 'do_slod': # lex level encoded in opcode
+        return (inst.opcode - first + 1, inst.args[0])
+    src = operand_source(name)
+    if src is None:
+        return ()
+    if src == 'arg':
+        return tuple(inst.args)
+    return (inst.opcode - first + src,)
+
+def is_compiled(inst):
+    return handler_name(inst.opcode) in HANDLERS
+
+def entry_points(proc):
+    '''Offsets at which the interpreter can enter compiled code.'''
+    insts = proc.instructions
+    entries = {insts[0].addr}
+    for (i, inst) in enumerate(insts):
+        op = opcodes.OPCODES[inst.opcode]
+        name = handler_name(inst.opcode)
+        if (op[2] & opcodes.CALL) and inst.opcode != opcodes.RPU and i + 1 < len(insts): # return point
+            entries.add(insts[i + 1].addr)
+        if name in JUMPS and inst.args[0] < inst.addr + inst.size and inst.args[0] in proc.inst_by_addr: # backward jump
+            entries.add(inst.args[0])
+    return entries
+
+def block_length(insts, i, labels):
+    '''Number of compiled instructions in basic block starting at instruction i.'''
+    n = 0
+    while i < len(insts) and is_compiled(insts[i]) and (n == 0 or insts[i].addr not in labels):
+        n += 1
+        if handler_name(insts[i].opcode) in JUMPS:
+            break
+        i += 1
+    return n
+
+def compile_procedure(proc, funcname, out):
+    '''Generate C function for a procedure.'''
+    insts = proc.instructions
+    entries = entry_points(proc)
+    labels = set(entries)
+    for inst in insts:
+        if is_compiled(inst) and handler_name(inst.opcode) in JUMPS and inst.args[0] in proc.inst_by_addr:
+            labels.add(inst.args[0])
+
+    body = []
+    reachable = False
+    need_block = True
+    for (i, inst) in enumerate(insts):
+        name = handler_name(inst.opcode)
+        comment = '/* %04x %s */' % (inst.addr, ' '.join([opcodes.OPCODES[inst.opcode][0].lower()] + ['0x%x' % x for x in inst.args]))
+        if inst.addr in labels:
+            body.append('L_%04x:' % inst.addr)
+            reachable = True
+            need_block = True
+        if not reachable:
+            continue
+        if not is_compiled(inst):
+            body.append('    EXIT(0x%04x); %s' % (inst.addr, comment))
+            reachable = False
+            continue
+        if need_block:
+            body.append('    BLOCK(0x%04x, %d);' % (inst.addr, block_length(insts, i, labels)))
+            need_block = False
+        code = HANDLERS[name]
+        ops = operands(inst)
+        if name in JUMPS:
+            if ops[0] in proc.inst_by_addr:
+                code = code.replace('JUMP({a})', 'goto L_%04x' % ops[0])
+            else:
+                code = code.replace('JUMP({a})', 'EXIT(0x%04x)' % ops[0])
+            need_block = True
+            if name in UNCONDITIONAL_JUMPS:
+                reachable = False
+        else:
+            if len(ops) > 0:
+                code = code.replace('{a}', str(ops[0]))
+            if len(ops) > 1:
+                code = code.replace('{b}', str(ops[1]))
+        body.append('    %s %s' % (code, comment))
+    if reachable: # fell off the end
+        body.append('    EXIT(0x%04x);' % (insts[-1].addr + insts[-1].size))
+
+    temps = [t for t in TEMPS if any(t in line for line in body)]
+    out.write('static void %s(struct psys_state *s, psys_word ofs)\n' % funcname)
+    out.write('{\n')
+    out.write('    psys_word sp = s->sp;\n')
+    if temps:
+        out.write('    int %s;\n' % ', '.join(temps))
+    out.write('    switch (ofs) {\n')
+    for addr in sorted(entries):
+        out.write('    case 0x%04x: goto L_%04x;\n' % (addr, addr))
+    out.write('    default: return;\n')
+    out.write('    }\n')
+    for line in body:
+        out.write(line + '\n')
+    out.write('}\n')
+    out.write('\n')
+
+def c_identifier(name):
+    return ''.join(c if c.isalnum() else '_' for c in name)
+
+def compile_segment(dseg, out):
+    '''Generate compiled procedures for a segment. Returns name of segment
+    descriptor.'''
+    segname = c_identifier(dseg.name_str)
+    numproc = max(dseg.proc_by_num) + 1 if dseg.proc_by_num else 1
+    procs = {}
+    for proc in dseg.procedures:
+        if proc.is_native or not proc.instructions:
+            continue
+        funcname = 'compiled_%s_%02x' % (segname, proc.num)
+        out.write('/* %s:0x%02x */\n' % (dseg.name_str, proc.num))
+        compile_procedure(proc, funcname, out)
+        procs[proc.num] = funcname
+
+    code = dseg.data[CODESTART:dseg.datastart]
+    out.write('static psys_compiledfunc *const compiled_%s_procedures[] = {\n' % segname)
+    for num in range(numproc):
+        out.write('    %s,\n' % (('&' + procs[num]) if num in procs else 'NULL'))
+    out.write('};\n')
+    out.write('\n')
+    out.write('static const struct psys_compiled_segment compiled_%s = {\n' % segname)
+    out.write('    "%s",\n' % dseg.name.decode())
+    out.write('    0x%08x,\n' % code_hash(code))
+    out.write('    0x%04x,\n' % len(code))
+    out.write('    %d,\n' % numproc)
+    out.write('    compiled_%s_procedures,\n' % segname)
+    out.write('};\n')
+    out.write('\n')
+    return 'compiled_%s' % segname
+
+def main():
+    parser = argparse.ArgumentParser(description='Translate p-code procedures to C.')
+    parser.add_argument('input', help='Code file (e.g. SYSTEM.STARTUP)')
+    parser.add_argument('segments', nargs='+', help='Names of segments to translate')
+    parser.add_argument('-o', dest='output', required=True, help='Output C file')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    dir_ = SegmentDirectory.load(data)
+    dir_.load_imports(data)
+    by_name = {seg.name_str: seg for seg in dir_.segments}
+    for name in args.segments:
+        if name not in by_name:
+            sys.stderr.write('Segment %s not found in %s\n' % (name, args.input))
+            sys.exit(1)
+
+    with open(args.output, 'w') as out:
+        out.write(COPYRIGHT)
+        out.write('/* auto-generated by pcode_to_c.py */\n')
+        out.write('#include "game/game_compiled.h"\n')
+        out.write('\n')
+        out.write('#include "psys/psys_bindings.h"\n')
+        out.write('#include "psys/psys_compiled.h"\n')
+        out.write('\n')
+        out.write('// clang-format off\n')
+        descs = []
+        for name in args.segments:
+            seg = by_name[name]
+            dseg = disassemble_unit(data[seg.base:seg.base + seg.codesize], None, seg)
+            descs.append(compile_segment(dseg, out))
+        out.write('// clang-format on\n')
+        out.write('\n')
+        out.write('void game_register_compiled(struct psys_state *state)\n')
+        out.write('{\n')
+        for desc in descs:
+            out.write('    psys_register_compiled(state, &%s);\n' % desc)
+        out.write('}\n')
+
+if __name__ == '__main__':
+    main()